@@ -0,0 +1,253 @@
+/**
+* @file bench.h
+* @brief Shared harness for the benchmark programs
+*
+* Each case is warmed up, calibrated so one repetition runs for at least
+* min_rep_ms, then repeated. Results are reported as the median, min and
+* max ns per operation of the repetitions and, for cases with a byte count,
+* as MB/s (10^6 bytes) at the median. The calling thread is pinned to one
+* CPU when --cpu is given, so runs on the same host are comparable across
+* commits.
+*/
+
+#ifndef PNGCORE_BENCH_H
+#define PNGCORE_BENCH_H
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#define BENCH_MAX_REPS 100
+
+/* Runs iters operations of one case */
+typedef void (*bench_fn)(void *ctx, uint64_t iters);
+
+typedef struct {
+  int reps;
+  double warmup_ms;
+  double min_rep_ms;
+  int cpu;              /* pinned CPU, -1 to leave unpinned */
+  const char *filter;   /* run only cases whose name contains this */
+  const char *label;    /* recorded in the JSON, e.g. a commit id */
+  const char *suite;
+  const char *params;   /* extra JSON members describing the run, or NULL */
+  FILE *json;
+  int count;            /* results written so far */
+} bench_t;
+
+static inline double bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Pin the calling thread; threads of a contention case pass their index so
+* they spread over the online CPUs starting at the configured one */
+static inline void bench_pin(const bench_t *bench, int index) {
+  if (bench->cpu < 0) return;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpu < 1) ncpu = 1;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET((bench->cpu + index) % ncpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static inline void bench_usage(void) {
+  fprintf(stderr,
+          "Common options: [--reps N] [--warmup-ms MS] [--min-rep-ms MS] [--cpu N|-1]\n"
+          "                [--filter SUBSTR] [--label TEXT] [--json PATH|-]\n");
+}
+
+/* Parse and remove the common options from argv; returns the new argc, with
+* the program's own options left in place, or -1 on error. bench must be
+* zero-initialised; reps, warmup_ms and min_rep_ms set beforehand are kept
+* as the defaults */
+static inline int bench_init(bench_t *bench, const char *suite, int argc, char **argv) {
+  if (!bench->reps) bench->reps = 10;
+  if (!bench->warmup_ms) bench->warmup_ms = 200;
+  if (!bench->min_rep_ms) bench->min_rep_ms = 50;
+  bench->cpu = -1;
+  bench->suite = suite;
+  bench->label = "";
+
+  int out = 1;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    int known = strcmp(arg, "--reps") == 0 || strcmp(arg, "--warmup-ms") == 0 ||
+                strcmp(arg, "--min-rep-ms") == 0 || strcmp(arg, "--cpu") == 0 ||
+                strcmp(arg, "--filter") == 0 || strcmp(arg, "--label") == 0 ||
+                strcmp(arg, "--json") == 0;
+    if (!known) {
+      argv[out++] = argv[i];
+      continue;
+    }
+    if (!val) {
+      fprintf(stderr, "%s needs a value\n", arg);
+      return -1;
+    }
+    if (strcmp(arg, "--reps") == 0) {
+      bench->reps = atoi(val);
+    } else if (strcmp(arg, "--warmup-ms") == 0) {
+      bench->warmup_ms = atof(val);
+    } else if (strcmp(arg, "--min-rep-ms") == 0) {
+      bench->min_rep_ms = atof(val);
+    } else if (strcmp(arg, "--cpu") == 0) {
+      bench->cpu = atoi(val);
+    } else if (strcmp(arg, "--filter") == 0) {
+      bench->filter = val;
+    } else if (strcmp(arg, "--label") == 0) {
+      bench->label = val;
+    } else if (strcmp(val, "-") == 0) {
+      bench->json = stdout;
+    } else if (!(bench->json = fopen(val, "w"))) {
+      perror(val);
+      return -1;
+    }
+    i++;
+  }
+  argv[out] = NULL;
+  if (bench->reps < 1 || bench->reps > BENCH_MAX_REPS) {
+    fprintf(stderr, "--reps must be between 1 and %d\n", BENCH_MAX_REPS);
+    return -1;
+  }
+
+  bench_pin(bench, 0);
+  return out;
+}
+
+/* Body of a JSON string holding s: quotes, backslashes and control characters
+* are escaped. Truncated to fit cap without splitting a UTF-8 sequence */
+static inline const char* bench_json_escape(const char *s, char *out, size_t cap) {
+  size_t n = 0;
+  for (; s && *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    char esc[8] = {(char)c, 0};
+    if (c == '"' || c == '\\') {
+      esc[0] = '\\';
+      esc[1] = (char)c;
+      esc[2] = 0;
+    } else if (c < 0x20) {
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+    }
+    size_t len = strlen(esc);
+    if (n + len >= cap) {
+      while (n > 0 && ((unsigned char)out[n - 1] & 0xc0) == 0x80) n--;
+      if (n > 0 && ((unsigned char)out[n - 1] & 0x80)) n--;
+      break;
+    }
+    memcpy(out + n, esc, len);
+    n += len;
+  }
+  if (cap > 0) out[n] = 0;
+  return out;
+}
+
+/* Start the next JSON result object, writing the document header first */
+static inline void bench_json_next(bench_t *bench) {
+  if (bench->count++ == 0) {
+    char suite[256], label[1024];
+    fprintf(bench->json,
+            "{\n  \"suite\": \"%s\",\n  \"label\": \"%s\",\n  \"cpu\": %d,\n"
+            "  \"online_cpus\": %ld,\n  \"reps\": %d,\n",
+            bench_json_escape(bench->suite, suite, sizeof(suite)),
+            bench_json_escape(bench->label, label, sizeof(label)), bench->cpu,
+            sysconf(_SC_NPROCESSORS_ONLN), bench->reps);
+    if (bench->params) {
+      fprintf(bench->json, "  \"params\": {%s},\n", bench->params);
+    }
+    fprintf(bench->json, "  \"results\": [\n    ");
+  } else {
+    fprintf(bench->json, ",\n    ");
+  }
+}
+
+static inline int bench_cmp(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Percentile p (0-100) of n sorted samples, interpolating between ranks */
+static inline double bench_percentile(const double *sorted, size_t n, double p) {
+  if (n == 0) return 0;
+  double rank = p / 100 * (n - 1);
+  size_t lo = (size_t)rank;
+  if (lo + 1 >= n) return sorted[n - 1];
+  return sorted[lo] + (sorted[lo + 1] - sorted[lo]) * (rank - lo);
+}
+
+/* Warm up, calibrate and time one case */
+static inline void bench_run(bench_t *bench, const char *name, bench_fn fn, void *ctx,
+                             double bytes_per_op) {
+  if (bench->filter && !strstr(name, bench->filter)) return;
+
+  /* Double the batch until it fills a repetition, for at least the warm-up */
+  uint64_t iters = 1;
+  double start = bench_now_ns();
+  for (;;) {
+    double t0 = bench_now_ns();
+    fn(ctx, iters);
+    double t = bench_now_ns() - t0;
+    int long_enough = t >= bench->min_rep_ms * 1e6;
+    if (long_enough && bench_now_ns() - start >= bench->warmup_ms * 1e6) break;
+    if (!long_enough) {
+      iters *= 2;
+    }
+  }
+
+  double ns[BENCH_MAX_REPS];
+  double mean = 0;
+  for (int r = 0; r < bench->reps; r++) {
+    double t0 = bench_now_ns();
+    fn(ctx, iters);
+    ns[r] = (bench_now_ns() - t0) / iters;
+    mean += ns[r] / bench->reps;
+  }
+  double var = 0;
+  for (int r = 0; r < bench->reps; r++) {
+    var += (ns[r] - mean) * (ns[r] - mean) / bench->reps;
+  }
+  qsort(ns, bench->reps, sizeof(double), bench_cmp);
+  double median = bench_percentile(ns, bench->reps, 50);
+  double mbps = bytes_per_op > 0 ? bytes_per_op / median * 1e3 : 0;
+
+  fprintf(stderr, "%-28s %14.1f ns/op", name, median);
+  if (mbps > 0) {
+    fprintf(stderr, " %10.1f MB/s", mbps);
+  } else {
+    fprintf(stderr, " %15s", "");
+  }
+  fprintf(stderr, "   +-%.1f%%\n", median > 0 ? sqrt(var) / median * 100 : 0);
+
+  if (bench->json) {
+    char escaped[256];
+    bench_json_next(bench);
+    fprintf(bench->json,
+            "{\"name\": \"%s\", \"iters\": %llu, \"bytes_per_op\": %.0f, "
+            "\"ns_per_op\": {\"median\": %.2f, \"min\": %.2f, \"max\": %.2f, \"stddev\": %.2f}, "
+            "\"mb_per_s\": %.2f}",
+            bench_json_escape(name, escaped, sizeof(escaped)), (unsigned long long)iters, bytes_per_op,
+            median, ns[0], ns[bench->reps - 1], sqrt(var), mbps);
+  }
+}
+
+static inline void bench_finish(bench_t *bench) {
+  if (!bench->json) return;
+  if (bench->count == 0) {
+    bench_json_next(bench);
+  }
+  fprintf(bench->json, "\n  ]\n}\n");
+  if (bench->json != stdout) {
+    fclose(bench->json);
+  }
+}
+
+#endif /* PNGCORE_BENCH_H */
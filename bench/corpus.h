@@ -0,0 +1,355 @@
+/**
+* @file corpus.h
+* @brief Deterministic synthetic image corpus for the benchmarks
+*
+* An image is fully described by a corpus_spec_t: content class, size,
+* format, interlace, IDAT chunk size and seed. Every sample is a hash of the
+* seed and its coordinates, so the same spec gives the same bytes on any
+* host and in any iteration order. Filtering uses the library's adaptive
+* filter and the zlib stream comes from pngcore_create/pngcore_set_raw_data;
+* only the chunk layout (interlace flag, PLTE and IDAT splits, which the
+* public API does not write) is assembled here.
+*/
+
+#ifndef PNGCORE_BENCH_CORPUS_H
+#define PNGCORE_BENCH_CORPUS_H
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pngcore.h>
+#include <pngcore/pngcore_filter.h>
+
+typedef enum {
+  CORPUS_FLAT,      /* solid rectangles, like UI art */
+  CORPUS_GRADIENT,  /* smooth linear ramps */
+  CORPUS_NOISE,     /* uniform random samples */
+  CORPUS_TEXT,      /* dark glyphs on a light page */
+  CORPUS_PHOTO,     /* smooth value noise with fine grain */
+  CORPUS_CLASS_COUNT
+} corpus_class_t;
+
+typedef struct {
+  corpus_class_t cls;
+  U32 width;
+  U32 height;
+  U8 bit_depth;
+  U8 color_type;
+  U8 interlace;     /* 0 or 1 (Adam7) */
+  U32 idat_size;    /* data bytes per IDAT chunk, 0 for a single chunk */
+  U64 seed;
+} corpus_spec_t;
+
+static const char *const corpus_class_names[CORPUS_CLASS_COUNT] = {
+  "flat", "gradient", "noise", "text", "photo"
+};
+
+/* Every valid color type and bit depth combination */
+static const U8 corpus_formats[][2] = {
+  {PNGCORE_COLOR_GRAYSCALE, 1}, {PNGCORE_COLOR_GRAYSCALE, 2}, {PNGCORE_COLOR_GRAYSCALE, 4},
+  {PNGCORE_COLOR_GRAYSCALE, 8}, {PNGCORE_COLOR_GRAYSCALE, 16},
+  {PNGCORE_COLOR_RGB, 8}, {PNGCORE_COLOR_RGB, 16},
+  {PNGCORE_COLOR_INDEXED, 1}, {PNGCORE_COLOR_INDEXED, 2}, {PNGCORE_COLOR_INDEXED, 4},
+  {PNGCORE_COLOR_INDEXED, 8},
+  {PNGCORE_COLOR_GRAYSCALE_ALPHA, 8}, {PNGCORE_COLOR_GRAYSCALE_ALPHA, 16},
+  {PNGCORE_COLOR_RGBA, 8}, {PNGCORE_COLOR_RGBA, 16}
+};
+
+#define CORPUS_FORMAT_COUNT (sizeof(corpus_formats) / sizeof(corpus_formats[0]))
+#define CORPUS_SIZE         (CORPUS_CLASS_COUNT * CORPUS_FORMAT_COUNT)
+
+static const U32 corpus_sizes[][2] = {{37, 23}, {256, 256}, {1024, 768}};
+static const U32 corpus_idat_sizes[] = {0, 8192, 1024};
+
+/* Entry i of the standard corpus: every class in every format, with size,
+* interlace and IDAT split rotating so each class meets every value of each */
+static inline corpus_spec_t corpus_standard(size_t i, U64 seed) {
+  corpus_spec_t spec = {0};
+  size_t cls = i % CORPUS_CLASS_COUNT;
+  size_t fmt = i / CORPUS_CLASS_COUNT % CORPUS_FORMAT_COUNT;
+  spec.cls = (corpus_class_t)cls;
+  spec.color_type = corpus_formats[fmt][0];
+  spec.bit_depth = corpus_formats[fmt][1];
+  spec.width = corpus_sizes[(cls + fmt) % 3][0];
+  spec.height = corpus_sizes[(cls + fmt) % 3][1];
+  spec.interlace = fmt % 2;
+  spec.idat_size = corpus_idat_sizes[(cls + fmt / 3) % 3];
+  spec.seed = seed + i;
+  return spec;
+}
+
+/* File name without directory, e.g. photo-256x256-rgba8-i0-s8192.png */
+static inline void corpus_name(const corpus_spec_t *spec, char *buf, size_t len) {
+  static const char *ct_names[] = {"gray", "", "rgb", "pal", "graya", "", "rgba"};
+  snprintf(buf, len, "%s-%ux%u-%s%u-i%u-s%u.png", corpus_class_names[spec->cls],
+           spec->width, spec->height, ct_names[spec->color_type % 7], spec->bit_depth,
+           spec->interlace, spec->idat_size);
+}
+
+/******************************************************************************
+* CONTENT
+*****************************************************************************/
+
+static inline U64 corpus_hash(U64 seed, U64 a, U64 b, U64 c) {
+  U64 z = seed ^ (a * 0x9E3779B97F4A7C15ull) ^ (b * 0xC2B2AE3D27D4EB4Full) ^
+          (c * 0x165667B19E3779F9ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static inline double corpus_unit(U64 h) {
+  return (h >> 11) / 9007199254740992.0;
+}
+
+/* Smoothly interpolated lattice noise with the given cell size */
+static inline double corpus_value_noise(U64 seed, double x, double y, U32 cell, int c) {
+  double fx = x / cell, fy = y / cell;
+  U64 ix = (U64)fx, iy = (U64)fy;
+  double tx = fx - ix, ty = fy - iy;
+  tx = tx * tx * (3 - 2 * tx);
+  ty = ty * ty * (3 - 2 * ty);
+  double v00 = corpus_unit(corpus_hash(seed, ix, iy, c));
+  double v10 = corpus_unit(corpus_hash(seed, ix + 1, iy, c));
+  double v01 = corpus_unit(corpus_hash(seed, ix, iy + 1, c));
+  double v11 = corpus_unit(corpus_hash(seed, ix + 1, iy + 1, c));
+  return (v00 * (1 - tx) + v10 * tx) * (1 - ty) + (v01 * (1 - tx) + v11 * tx) * ty;
+}
+
+/* Channel c of pixel (x, y) in [0, 1]; channel 3 is alpha */
+static inline double corpus_sample(const corpus_spec_t *spec, U32 x, U32 y, int c) {
+  U64 seed = spec->seed;
+  switch (spec->cls) {
+    case CORPUS_FLAT: {
+      if (c == 3) return 1;
+      double v = corpus_unit(corpus_hash(seed, 0, 0, c));
+      for (U64 k = 1; k <= 12; k++) {
+        U32 x0 = (U32)(corpus_unit(corpus_hash(seed, k, 0, 4)) * spec->width);
+        U32 y0 = (U32)(corpus_unit(corpus_hash(seed, k, 0, 5)) * spec->height);
+        U32 x1 = x0 + 1 + (U32)(corpus_unit(corpus_hash(seed, k, 0, 6)) * spec->width / 2);
+        U32 y1 = y0 + 1 + (U32)(corpus_unit(corpus_hash(seed, k, 0, 7)) * spec->height / 2);
+        if (x >= x0 && x < x1 && y >= y0 && y < y1) {
+          v = corpus_unit(corpus_hash(seed, k, 1, c));
+        }
+      }
+      return v;
+    }
+    case CORPUS_GRADIENT: {
+      double a = corpus_unit(corpus_hash(seed, 0, 0, c)) * 2 * M_PI;
+      double span = fabs(cos(a)) * spec->width + fabs(sin(a)) * spec->height;
+      double t = (x * cos(a) + y * sin(a)) / (span > 0 ? span : 1);
+      return t < 0 ? t + 1 : t;
+    }
+    case CORPUS_NOISE:
+      return corpus_unit(corpus_hash(seed, x, y, c));
+    case CORPUS_TEXT: {
+      if (c == 3) return 1;
+      /* 6x10 character cells with a 4 pixel margin; glyphs are 5x7 bitmaps,
+      * one cell in six is a space */
+      if (x < 4 || y < 4) return 0.96;
+      U32 col = (x - 4) / 6, row = (y - 4) / 10, gx = (x - 4) % 6, gy = (y - 4) % 10;
+      if (gx >= 5 || gy >= 7) return 0.96;
+      U64 glyph = corpus_hash(seed, col, row, 0) % 64;
+      if (glyph < 11) return 0.96;
+      U64 bits = corpus_hash(seed, glyph, 0, 1);
+      int ink = (bits >> (gy * 5 + gx)) & 1;
+      return ink ? 0.08 + 0.04 * c : 0.96;
+    }
+    case CORPUS_PHOTO: {
+      if (c == 3) return 1;
+      double v = 0.55 * corpus_value_noise(seed, x, y, 97, c) +
+                 0.30 * corpus_value_noise(seed, x, y, 23, c + 4) +
+                 0.10 * corpus_value_noise(seed, x, y, 5, c + 8);
+      return v + 0.05 * (corpus_unit(corpus_hash(seed, x, y, c + 12)) - 0.5);
+    }
+    default:
+      return 0;
+  }
+}
+
+static inline void corpus_put_bits(U8 *row, U32 index, U32 bits, U32 value) {
+  U32 bit = index * bits;
+  row[bit / 8] |= (U8)(value << (8 - bits - bit % 8));
+}
+
+/* Unfiltered scanlines, pngcore_scanline_bytes(width) each, without filter
+* bytes. Free with free() */
+static inline U8* corpus_pixels(const corpus_spec_t *spec, size_t *size) {
+  size_t stride = pngcore_scanline_bytes(spec->width, spec->bit_depth, spec->color_type);
+  U8 *pixels = calloc(spec->height ? spec->height : 1, stride);
+  if (!pixels) return NULL;
+  int channels = pngcore_color_channels(spec->color_type);
+  int has_alpha = spec->color_type == PNGCORE_COLOR_GRAYSCALE_ALPHA ||
+                  spec->color_type == PNGCORE_COLOR_RGBA;
+  U32 max = (1u << spec->bit_depth) - 1;
+
+  for (U32 y = 0; y < spec->height; y++) {
+    U8 *row = pixels + (size_t)y * stride;
+    for (U32 x = 0; x < spec->width; x++) {
+      for (int c = 0; c < channels; c++) {
+        int src = has_alpha && c == channels - 1 ? 3 : c;
+        double v = corpus_sample(spec, x, y, src);
+        v = v < 0 ? 0 : v > 1 ? 1 : v;
+        U32 q = (U32)(v * max + 0.5);
+        if (spec->bit_depth == 16) {
+          row[(x * channels + c) * 2] = (U8)(q >> 8);
+          row[(x * channels + c) * 2 + 1] = (U8)q;
+        } else if (spec->bit_depth == 8) {
+          row[x * channels + c] = (U8)q;
+        } else {
+          corpus_put_bits(row, x, spec->bit_depth, q);
+        }
+      }
+    }
+  }
+  *size = stride * spec->height;
+  return pixels;
+}
+
+/******************************************************************************
+* ENCODING
+*****************************************************************************/
+
+/* Filter the rows of one (sub)image of pixels into out; returns bytes written */
+static inline size_t corpus_filter_image(U8 *out, const U8 *rows, U32 width, U32 height,
+                                         const corpus_spec_t *spec, U8 *scratch) {
+  size_t len = pngcore_scanline_bytes(width, spec->bit_depth, spec->color_type);
+  size_t bpp = pngcore_filter_bpp(spec->bit_depth, spec->color_type);
+  if (width == 0 || height == 0) return 0;
+  for (U32 y = 0; y < height; y++) {
+    pngcore_filter_row(out + y * (len + 1), scratch, rows + y * len,
+                       y ? rows + (y - 1) * len : NULL, len, bpp);
+  }
+  return height * (len + 1);
+}
+
+/* Filtered image data as it is compressed into IDAT, with the seven Adam7
+* passes one after another when interlaced */
+static inline U8* corpus_filtered(const corpus_spec_t *spec, const U8 *pixels, size_t *size) {
+  static const U32 sx[7] = {0, 4, 0, 2, 0, 1, 0}, sy[7] = {0, 0, 4, 0, 2, 0, 1};
+  static const U32 dx[7] = {8, 8, 4, 4, 2, 2, 1}, dy[7] = {8, 8, 8, 4, 4, 2, 2};
+  size_t stride = pngcore_scanline_bytes(spec->width, spec->bit_depth, spec->color_type);
+  size_t bits = pngcore_pixel_bits(spec->bit_depth, spec->color_type);
+  size_t total = spec->height * (stride + 1) + (spec->interlace ? 7 * (spec->height + 8) : 0);
+  U8 *out = malloc(total ? total : 1);
+  U8 *scratch = malloc(stride + 1);
+  U8 *pass = spec->interlace ? malloc(stride * spec->height + 1) : NULL;
+  if (!out || !scratch || (spec->interlace && !pass)) {
+    free(out);
+    free(scratch);
+    free(pass);
+    return NULL;
+  }
+
+  size_t n = 0;
+  if (!spec->interlace) {
+    n = corpus_filter_image(out, pixels, spec->width, spec->height, spec, scratch);
+  } else {
+    for (int p = 0; p < 7; p++) {
+      U32 pw = spec->width > sx[p] ? (spec->width - sx[p] + dx[p] - 1) / dx[p] : 0;
+      U32 ph = spec->height > sy[p] ? (spec->height - sy[p] + dy[p] - 1) / dy[p] : 0;
+      size_t plen = pngcore_scanline_bytes(pw, spec->bit_depth, spec->color_type);
+      memset(pass, 0, plen * ph + 1);
+      for (U32 y = 0; y < ph; y++) {
+        const U8 *src = pixels + (size_t)(sy[p] + y * dy[p]) * stride;
+        for (U32 x = 0; x < pw; x++) {
+          pngcore_copy_pixels(pass + y * plen, x, src, sx[p] + x * dx[p], 1, bits);
+        }
+      }
+      n += corpus_filter_image(out + n, pass, pw, ph, spec, scratch);
+    }
+  }
+  free(scratch);
+  free(pass);
+  *size = n;
+  return out;
+}
+
+static inline U8* corpus_put_chunk(U8 *p, const char type[4], const U8 *data, U32 len) {
+  U32 be = htonl(len);
+  memcpy(p, &be, 4);
+  memcpy(p + 4, type, 4);
+  if (len) memcpy(p + 8, data, len);
+  be = htonl(pngcore_crc32(p + 4, len + 4));
+  memcpy(p + 8 + len, &be, 4);
+  return p + 12 + len;
+}
+
+/* Complete PNG file for spec. Free with free() */
+static inline U8* corpus_encode(const corpus_spec_t *spec, size_t *size) {
+  size_t pixels_size = 0, filtered_size = 0, zlen = 0;
+  U8 *pixels = corpus_pixels(spec, &pixels_size);
+  U8 *filtered = pixels ? corpus_filtered(spec, pixels, &filtered_size) : NULL;
+  free(pixels);
+  if (!filtered) return NULL;
+
+  /* The library compresses; its IDAT view holds the zlib stream */
+  pngcore_png_t *png = pngcore_create(spec->width, spec->height, spec->bit_depth,
+                                      spec->color_type);
+  pngcore_chunk_t *idat = NULL;
+  const U8 *zdata = NULL;
+  if (png && filtered_size && pngcore_set_raw_data(png, filtered, filtered_size) == 0) {
+    idat = pngcore_get_chunk(png, "IDAT");
+    zdata = idat ? pngcore_chunk_get_data(idat, &zlen) : NULL;
+  }
+  free(filtered);
+  if (!zdata) {
+    pngcore_chunk_free(idat);
+    pngcore_free(png);
+    return NULL;
+  }
+
+  U32 palette = spec->color_type == PNGCORE_COLOR_INDEXED ? 1u << spec->bit_depth : 0;
+  U32 split = spec->idat_size ? spec->idat_size : (U32)zlen;
+  size_t chunks = (zlen + split - 1) / split;
+  size_t total = PNG_SIG_SIZE + 25 + (palette ? 12 + 3 * palette : 0) + zlen + 12 * chunks + 12;
+  U8 *file = malloc(total);
+  if (!file) {
+    pngcore_chunk_free(idat);
+    pngcore_free(png);
+    return NULL;
+  }
+
+  static const U8 sig[PNG_SIG_SIZE] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  U8 ihdr[13];
+  U32 be = htonl(spec->width);
+  memcpy(ihdr, &be, 4);
+  be = htonl(spec->height);
+  memcpy(ihdr + 4, &be, 4);
+  ihdr[8] = spec->bit_depth;
+  ihdr[9] = spec->color_type;
+  ihdr[10] = 0;
+  ihdr[11] = 0;
+  ihdr[12] = spec->interlace;
+
+  U8 *p = file;
+  memcpy(p, sig, PNG_SIG_SIZE);
+  p = corpus_put_chunk(p + PNG_SIG_SIZE, "IHDR", ihdr, 13);
+  if (palette) {
+    /* A ramp between two seeded colors, so index order follows brightness */
+    U8 plte[3 * 256];
+    for (U32 i = 0; i < palette; i++) {
+      double t = palette > 1 ? (double)i / (palette - 1) : 0;
+      for (int c = 0; c < 3; c++) {
+        double lo = 0.3 * corpus_unit(corpus_hash(spec->seed, c, 0, 99));
+        double hi = 0.7 + 0.3 * corpus_unit(corpus_hash(spec->seed, c, 1, 99));
+        plte[i * 3 + c] = (U8)((lo + (hi - lo) * t) * 255 + 0.5);
+      }
+    }
+    p = corpus_put_chunk(p, "PLTE", plte, 3 * palette);
+  }
+  for (size_t off = 0; off < zlen; off += split) {
+    U32 n = zlen - off < split ? (U32)(zlen - off) : split;
+    p = corpus_put_chunk(p, "IDAT", zdata + off, n);
+  }
+  p = corpus_put_chunk(p, "IEND", NULL, 0);
+
+  pngcore_chunk_free(idat);
+  pngcore_free(png);
+  *size = p - file;
+  return file;
+}
+
+#endif /* PNGCORE_BENCH_CORPUS_H */
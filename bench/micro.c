@@ -0,0 +1,296 @@
+/**
+* @file micro.c
+* @brief Micro-benchmarks for the library hot paths
+*
+* Usage: bench_micro [options]; see bench.h for the options and the JSON
+* layout. Every input is a 512x512 RGBA image of the synthetic corpus
+* (corpus.h) with a fixed seed, so two builds run the same work and their
+* JSON files can be compared case by case. The codec and load cases run once
+* per content class; the level sweep, raw data and save cases use the
+* photographic class.
+*/
+
+#include "bench.h"
+#include "corpus.h"
+#include <pngcore.h>
+#include <pngcore/pngcore_crc.h>
+#include <pngcore/pngcore_zutil.h>
+#include <pngcore/pngcore_concurrent.h>
+#include <zlib.h>
+
+#define IMG_WIDTH   512
+#define IMG_HEIGHT  512
+#define CORPUS_SEED 1
+#define CRC_SIZE    (1 << 20)
+#define CBUF_SLOTS  8
+
+/* Keeps results live so the work is not optimised away */
+static volatile U64 sink;
+
+/******************************************************************************
+* CRC AND ZLIB
+*****************************************************************************/
+
+typedef struct {
+  U8 *src;
+  U64 src_len;
+  U8 *dst;
+  U64 dst_cap;
+  int level;
+} buf_ctx_t;
+
+static void run_crc(void *ctx, uint64_t iters) {
+  buf_ctx_t *c = ctx;
+  for (uint64_t i = 0; i < iters; i++) {
+    sink += pngcore_crc(c->src, (int)c->src_len);
+  }
+}
+
+static void run_deflate(void *ctx, uint64_t iters) {
+  buf_ctx_t *c = ctx;
+  for (uint64_t i = 0; i < iters; i++) {
+    U64 len = 0;
+    pngcore_mem_deflate(c->dst, &len, c->src, c->src_len, c->level);
+    sink += len;
+  }
+}
+
+static void run_inflate(void *ctx, uint64_t iters) {
+  buf_ctx_t *c = ctx;
+  for (uint64_t i = 0; i < iters; i++) {
+    U64 len = 0;
+    pngcore_mem_inflate(c->dst, &len, c->src, c->src_len);
+    sink += len;
+  }
+}
+
+/******************************************************************************
+* PNG API
+*****************************************************************************/
+
+typedef struct {
+  U8 *file;
+  size_t file_size;
+  pngcore_png_t *png;
+  const char *path;
+} png_ctx_t;
+
+static void run_load_buffer(void *ctx, uint64_t iters) {
+  png_ctx_t *c = ctx;
+  for (uint64_t i = 0; i < iters; i++) {
+    pngcore_png_t *png = pngcore_load_buffer(c->file, c->file_size, NULL);
+    sink += pngcore_get_width(png);
+    pngcore_free(png);
+  }
+}
+
+static void run_get_raw_data(void *ctx, uint64_t iters) {
+  png_ctx_t *c = ctx;
+  for (uint64_t i = 0; i < iters; i++) {
+    uint8_t *data = NULL;
+    size_t size = 0;
+    pngcore_get_raw_data(c->png, &data, &size);
+    sink += size;
+    free(data);
+  }
+}
+
+static void run_save(void *ctx, uint64_t iters) {
+  png_ctx_t *c = ctx;
+  for (uint64_t i = 0; i < iters; i++) {
+    sink += pngcore_save_file(c->png, c->path, NULL);
+  }
+}
+
+/******************************************************************************
+* CIRCULAR BUFFER CONTENTION
+*****************************************************************************/
+
+/* Producers and consumers move entries through the shared buffer with the
+* same semaphore protocol as paster; one op is one entry handed over */
+typedef struct {
+  bench_t *bench;
+  int producers;
+  int consumers;
+  pngcore_cbuf_t cb;
+  sem_t sems[3];
+} cbuf_ctx_t;
+
+typedef struct {
+  cbuf_ctx_t *c;
+  int index;
+  uint64_t count;
+} cbuf_worker_t;
+
+static void* cbuf_producer(void *arg) {
+  cbuf_worker_t *w = arg;
+  pngcore_cbuf_entry_t *entry = malloc(sizeof(*entry));
+  if (!entry) return NULL;
+  memset(entry, 0, sizeof(*entry));
+  bench_pin(w->c->bench, w->index);
+  for (uint64_t i = 0; i < w->count; i++) {
+    entry->sequence_num = (int)i;
+    sem_wait(&w->c->sems[1]);
+    pngcore_cbuf_add(&w->c->cb, entry, w->c->sems);
+    sem_post(&w->c->sems[2]);
+  }
+  free(entry);
+  return NULL;
+}
+
+static void* cbuf_consumer(void *arg) {
+  cbuf_worker_t *w = arg;
+  pngcore_cbuf_entry_t *entry = malloc(sizeof(*entry));
+  if (!entry) return NULL;
+  bench_pin(w->c->bench, w->index);
+  for (uint64_t i = 0; i < w->count; i++) {
+    sem_wait(&w->c->sems[2]);
+    pngcore_cbuf_get(&w->c->cb, entry, w->c->sems);
+    sem_post(&w->c->sems[1]);
+    sink += entry->sequence_num;
+  }
+  free(entry);
+  return NULL;
+}
+
+/* Split iters as evenly as possible over n workers */
+static uint64_t share(uint64_t iters, int n, int i) {
+  return iters / n + ((uint64_t)i < iters % n);
+}
+
+static void run_cbuf(void *ctx, uint64_t iters) {
+  cbuf_ctx_t *c = ctx;
+  int n = c->producers + c->consumers;
+  pthread_t threads[n];
+  cbuf_worker_t workers[n];
+
+  for (int i = 0; i < n; i++) {
+    int producer = i < c->producers;
+    workers[i].c = c;
+    workers[i].index = i;
+    workers[i].count = producer ? share(iters, c->producers, i)
+                                : share(iters, c->consumers, i - c->producers);
+    pthread_create(&threads[i], NULL, producer ? cbuf_producer : cbuf_consumer, &workers[i]);
+  }
+  for (int i = 0; i < n; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+static void bench_cbuf(bench_t *bench, const char *name, int producers, int consumers) {
+  cbuf_ctx_t c = {.bench = bench, .producers = producers, .consumers = consumers};
+  c.cb.data = malloc(CBUF_SLOTS * sizeof(pngcore_cbuf_entry_t));
+  if (!c.cb.data) return;
+  pngcore_cbuf_init(&c.cb, CBUF_SLOTS);
+  sem_init(&c.sems[0], 0, 1);
+  sem_init(&c.sems[1], 0, CBUF_SLOTS);
+  sem_init(&c.sems[2], 0, 0);
+
+  bench_run(bench, name, run_cbuf, &c, sizeof(pngcore_cbuf_entry_t));
+
+  for (int i = 0; i < 3; i++) {
+    sem_destroy(&c.sems[i]);
+  }
+  free(c.cb.data);
+  bench_pin(bench, 0);
+}
+
+/******************************************************************************
+* MAIN
+*****************************************************************************/
+
+int main(int argc, char **argv) {
+  bench_t bench = {0};
+  argc = bench_init(&bench, "micro", argc, argv);
+  if (argc != 1) {
+    if (argc > 1) {
+      fprintf(stderr, "Unknown option: %s\n", argv[1]);
+    }
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    bench_usage();
+    return 1;
+  }
+
+  U8 *raw[CORPUS_CLASS_COUNT] = {0}, *file[CORPUS_CLASS_COUNT] = {0};
+  size_t raw_size[CORPUS_CLASS_COUNT], file_size[CORPUS_CLASS_COUNT];
+  for (int c = 0; c < CORPUS_CLASS_COUNT; c++) {
+    corpus_spec_t spec = {(corpus_class_t)c, IMG_WIDTH, IMG_HEIGHT, 8, PNGCORE_COLOR_RGBA,
+                          0, 0, CORPUS_SEED};
+    size_t n = 0;
+    U8 *pixels = corpus_pixels(&spec, &n);
+    raw[c] = pixels ? corpus_filtered(&spec, pixels, &raw_size[c]) : NULL;
+    file[c] = corpus_encode(&spec, &file_size[c]);
+    free(pixels);
+    if (!raw[c] || !file[c]) {
+      fprintf(stderr, "Failed to generate the %s image\n", corpus_class_names[c]);
+      return 1;
+    }
+  }
+  const U8 *photo = raw[CORPUS_PHOTO];
+  size_t photo_size = raw_size[CORPUS_PHOTO];
+  U64 zcap = compressBound(photo_size);
+  U8 *zbuf = malloc(zcap);
+  U8 *out = malloc(photo_size > zcap ? photo_size : zcap);
+  U8 *crc_buf = malloc(CRC_SIZE);
+  if (!zbuf || !out || !crc_buf) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  /* CRC over a MiB of image data, tiled if the image is smaller */
+  for (size_t i = 0; i < CRC_SIZE; i++) {
+    crc_buf[i] = photo[i % photo_size];
+  }
+  buf_ctx_t crc = {crc_buf, CRC_SIZE, NULL, 0, 0};
+  bench_run(&bench, "crc/1MiB", run_crc, &crc, CRC_SIZE);
+  free(crc_buf);
+
+  char name[64];
+  for (int c = 0; c < CORPUS_CLASS_COUNT; c++) {
+    for (int level = 1; level <= 9; level++) {
+      /* Level 6 for every class, the 1 and 9 extremes for the photo */
+      if (level != 6 && (c != CORPUS_PHOTO || (level != 1 && level != 9))) continue;
+      buf_ctx_t def = {raw[c], raw_size[c], out, zcap, level};
+      snprintf(name, sizeof(name), "deflate/%s/level%d", corpus_class_names[c], level);
+      bench_run(&bench, name, run_deflate, &def, raw_size[c]);
+
+      U64 zlen = 0;
+      pngcore_mem_deflate(zbuf, &zlen, raw[c], raw_size[c], level);
+      buf_ctx_t inf = {zbuf, zlen, out, raw_size[c], 0};
+      snprintf(name, sizeof(name), "inflate/%s/level%d", corpus_class_names[c], level);
+      bench_run(&bench, name, run_inflate, &inf, raw_size[c]);
+    }
+  }
+
+  for (int c = 0; c < CORPUS_CLASS_COUNT; c++) {
+    png_ctx_t p = {file[c], file_size[c], NULL, NULL};
+    snprintf(name, sizeof(name), "png/load_buffer/%s", corpus_class_names[c]);
+    bench_run(&bench, name, run_load_buffer, &p, file_size[c]);
+  }
+
+  char path[] = "/tmp/pngcore_bench_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd >= 0) {
+    close(fd);
+    png_ctx_t p = {file[CORPUS_PHOTO], file_size[CORPUS_PHOTO], NULL, path};
+    p.png = pngcore_load_buffer(p.file, p.file_size, NULL);
+    if (p.png) {
+      bench_run(&bench, "png/get_raw_data/photo", run_get_raw_data, &p, photo_size);
+      bench_run(&bench, "png/save_file/photo", run_save, &p, p.file_size);
+    }
+    pngcore_free(p.png);
+    unlink(path);
+  }
+
+  bench_cbuf(&bench, "cbuf/1p1c", 1, 1);
+  bench_cbuf(&bench, "cbuf/4p4c", 4, 4);
+
+  for (int c = 0; c < CORPUS_CLASS_COUNT; c++) {
+    free(raw[c]);
+    free(file[c]);
+  }
+  free(zbuf);
+  free(out);
+  bench_finish(&bench);
+  return 0;
+}
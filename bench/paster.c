@@ -0,0 +1,585 @@
+/**
+* @file paster.c
+* @brief End-to-end concurrent processor benchmark against a local fragment server
+*
+* A stub HTTP server is forked on 127.0.0.1 and serves the 50 strips of one
+* image the way the course server does: GET /image?img=N&part=M answers a
+* 400x6 RGBA PNG with an X-Ece252-Fragment header. Strips are cut from a
+* synthetic corpus image (corpus.h) of the chosen class, each response is
+* held back by a latency drawn from the chosen distribution and sent no
+* faster than the bandwidth cap. The concurrent processor then runs over
+* every buffer size x producers x consumers x delay combination; each cell
+* reports wall time, throughput, the server-side request latency
+* percentiles and whether the assembled image is correct.
+* With --trace DIR the last repetition of every cell is traced and written
+* as DIR/<cell>.json for chrome://tracing or Perfetto.
+*/
+
+#include "bench.h"
+#include "corpus.h"
+#include <pngcore.h>
+#include <pngcore/pngcore_types.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define STRIP_WIDTH   400
+#define STRIP_HEIGHT  6
+#define STRIP_RAW     (STRIP_HEIGHT * (STRIP_WIDTH * 4 + 1))
+#define MAX_SAMPLES   65536
+#define MAX_AXIS      16
+#define SEND_SLICE    1460
+
+typedef enum {
+  LAT_FIXED,
+  LAT_UNIFORM,
+  LAT_EXP,
+  LAT_LOGNORMAL
+} latency_kind_t;
+
+typedef struct {
+  latency_kind_t kind;
+  double a;   /* fixed, uniform low, exp mean, lognormal median (ms) */
+  double b;   /* uniform high (ms), lognormal sigma */
+} latency_t;
+
+/* Shared with the server process */
+typedef struct {
+  atomic_uint run;            /* seeds the latency draw with the fragment */
+  atomic_uint count;
+  double ms[MAX_SAMPLES];     /* request read to last byte written */
+} samples_t;
+
+typedef struct {
+  U8 *png[TOTAL_IMAGES];
+  size_t size[TOTAL_IMAGES];
+  U8 *raw;                    /* expected assembled rows */
+} strips_t;
+
+typedef struct {
+  int fd;
+  const strips_t *strips;
+  latency_t latency;
+  double bandwidth;           /* bytes per second per connection, 0 unlimited */
+  U64 seed;
+  samples_t *samples;
+} conn_t;
+
+static U64 splitmix(U64 *state) {
+  U64 z = (*state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+/* Uniform in (0, 1) */
+static double unit(U64 *state) {
+  return ((splitmix(state) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double draw_latency(const latency_t *lat, U64 *state) {
+  switch (lat->kind) {
+    case LAT_UNIFORM:
+      return lat->a + (lat->b - lat->a) * unit(state);
+    case LAT_EXP:
+      return -lat->a * log(unit(state));
+    case LAT_LOGNORMAL: {
+      double n = sqrt(-2 * log(unit(state))) * cos(2 * M_PI * unit(state));
+      return lat->a * exp(lat->b * n);
+    }
+    default:
+      return lat->a;
+  }
+}
+
+static int parse_latency(const char *spec, latency_t *lat) {
+  lat->b = 0;
+  if (sscanf(spec, "fixed:%lf", &lat->a) == 1) {
+    lat->kind = LAT_FIXED;
+  } else if (sscanf(spec, "uniform:%lf:%lf", &lat->a, &lat->b) == 2 && lat->b >= lat->a) {
+    lat->kind = LAT_UNIFORM;
+  } else if (sscanf(spec, "exp:%lf", &lat->a) == 1) {
+    lat->kind = LAT_EXP;
+  } else if (sscanf(spec, "lognormal:%lf:%lf", &lat->a, &lat->b) == 2) {
+    lat->kind = LAT_LOGNORMAL;
+  } else {
+    return -1;
+  }
+  return lat->a >= 0 ? 0 : -1;
+}
+
+static void sleep_ms(double ms) {
+  if (ms <= 0) return;
+  struct timespec ts = {(time_t)(ms / 1e3), (long)(fmod(ms, 1e3) * 1e6)};
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+/******************************************************************************
+* FRAGMENTS
+*****************************************************************************/
+
+/* Cut a corpus image of the class into strips, each filtered on its own as
+* the course server's strips are */
+static int make_strips(strips_t *strips, corpus_class_t cls, int image_num, U64 seed,
+                       const char *path) {
+  corpus_spec_t spec = {cls, STRIP_WIDTH, STRIP_HEIGHT * TOTAL_IMAGES, 8, PNGCORE_COLOR_RGBA,
+                        0, 0, seed + image_num};
+  corpus_spec_t strip = spec;
+  strip.height = STRIP_HEIGHT;
+  size_t n = 0;
+  U8 *pixels = corpus_pixels(&spec, &n);
+  strips->raw = malloc((size_t)STRIP_RAW * TOTAL_IMAGES);
+  if (!pixels || !strips->raw) {
+    free(pixels);
+    return -1;
+  }
+
+  for (int part = 0; part < TOTAL_IMAGES; part++) {
+    U8 *raw = strips->raw + (size_t)part * STRIP_RAW;
+    U8 *filtered = corpus_filtered(&strip, pixels + (size_t)part * STRIP_HEIGHT * STRIP_WIDTH * 4,
+                                   &n);
+    if (!filtered || n != STRIP_RAW) {
+      free(filtered);
+      free(pixels);
+      return -1;
+    }
+    memcpy(raw, filtered, n);
+    free(filtered);
+
+    pngcore_png_t *png = pngcore_create(STRIP_WIDTH, STRIP_HEIGHT, 8, PNGCORE_COLOR_RGBA);
+    if (!png || pngcore_set_raw_data(png, raw, STRIP_RAW) != 0 ||
+        pngcore_save_file(png, path, NULL) != 0) {
+      pngcore_free(png);
+      free(pixels);
+      return -1;
+    }
+    pngcore_free(png);
+
+    FILE *fp = fopen(path, "rb");
+    long len = -1;
+    if (fp && fseek(fp, 0, SEEK_END) == 0) {
+      len = ftell(fp);
+      rewind(fp);
+    }
+    strips->png[part] = len > 0 && len <= MAX_IMG_STRIP_SIZE ? malloc(len) : NULL;
+    int ok = strips->png[part] && fread(strips->png[part], 1, len, fp) == (size_t)len;
+    if (fp) fclose(fp);
+    if (!ok) {
+      free(pixels);
+      return -1;
+    }
+    strips->size[part] = len;
+  }
+  free(pixels);
+  return 0;
+}
+
+static void free_strips(strips_t *strips) {
+  for (int i = 0; i < TOTAL_IMAGES; i++) {
+    free(strips->png[i]);
+  }
+  free(strips->raw);
+}
+
+/******************************************************************************
+* STUB SERVER
+*****************************************************************************/
+
+/* Send buf, pacing slices so the connection stays under bandwidth bytes/s */
+static void send_paced(int fd, const U8 *buf, size_t len, double bandwidth) {
+  double start = bench_now_ns();
+  size_t sent = 0;
+  while (sent < len) {
+    size_t n = len - sent;
+    if (bandwidth > 0 && n > SEND_SLICE) n = SEND_SLICE;
+    ssize_t w = send(fd, buf + sent, n, MSG_NOSIGNAL);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    sent += w;
+    if (bandwidth > 0) {
+      sleep_ms(sent / bandwidth * 1e3 - (bench_now_ns() - start) / 1e6);
+    }
+  }
+}
+
+static void* serve_conn(void *arg) {
+  conn_t *conn = arg;
+  char req[4096];
+  size_t len = 0;
+  while (len < sizeof(req) - 1) {
+    ssize_t r = recv(conn->fd, req + len, sizeof(req) - 1 - len, 0);
+    if (r <= 0) break;
+    len += r;
+    req[len] = '\0';
+    if (strstr(req, "\r\n\r\n")) break;
+  }
+  req[len] = '\0';
+  double t0 = bench_now_ns();
+
+  int img = -1, part = -1;
+  const char *q = strstr(req, "img=");
+  const char *p = strstr(req, "part=");
+  if (q) img = atoi(q + 4);
+  if (p) part = atoi(p + 5);
+
+  if (strncmp(req, "GET ", 4) != 0 || img < 1 || part < 0 || part >= TOTAL_IMAGES) {
+    const char *bad = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    send_paced(conn->fd, (const U8 *)bad, strlen(bad), 0);
+  } else {
+    /* The same fragment waits the same time in the same run */
+    U64 state = conn->seed ^ ((U64)atomic_load(&conn->samples->run) << 40) ^ (U64)part << 8;
+    sleep_ms(draw_latency(&conn->latency, &state));
+
+    U8 resp[256 + MAX_IMG_STRIP_SIZE];
+    int n = snprintf((char *)resp, 256,
+                     "HTTP/1.1 200 OK\r\nContent-Type: image/png\r\nContent-Length: %zu\r\n"
+                     FRAGMENT_HEADER "%d\r\nConnection: close\r\n\r\n",
+                     conn->strips->size[part], part);
+    memcpy(resp + n, conn->strips->png[part], conn->strips->size[part]);
+    send_paced(conn->fd, resp, n + conn->strips->size[part], conn->bandwidth);
+
+    unsigned i = atomic_fetch_add(&conn->samples->count, 1);
+    if (i < MAX_SAMPLES) {
+      conn->samples->ms[i] = (bench_now_ns() - t0) / 1e6;
+    }
+  }
+
+  close(conn->fd);
+  free(conn);
+  return NULL;
+}
+
+static void serve(int listen_fd, const conn_t *proto) {
+  signal(SIGPIPE, SIG_IGN);
+  for (;;) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      _exit(1);
+    }
+    conn_t *conn = malloc(sizeof(*conn));
+    pthread_t thread;
+    if (!conn) {
+      close(fd);
+      continue;
+    }
+    *conn = *proto;
+    conn->fd = fd;
+    if (pthread_create(&thread, NULL, serve_conn, conn) != 0) {
+      close(fd);
+      free(conn);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+}
+
+/* Fork the server; returns its pid and stores the bound port */
+static pid_t start_server(const conn_t *proto, int *port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t addr_len = sizeof(addr);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0 ||
+      getsockname(fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+    close(fd);
+    return -1;
+  }
+  *port = ntohs(addr.sin_port);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    serve(fd, proto);
+    _exit(0);
+  }
+  close(fd);
+  return pid;
+}
+
+/******************************************************************************
+* MATRIX
+*****************************************************************************/
+
+typedef struct {
+  int values[MAX_AXIS];
+  int count;
+} axis_t;
+
+static int parse_axis(const char *list, axis_t *axis, int lo, int hi) {
+  axis->count = 0;
+  char *copy = strdup(list);
+  char *save = NULL;
+  int ok = copy != NULL;
+  for (char *tok = ok ? strtok_r(copy, ",", &save) : NULL; tok; tok = strtok_r(NULL, ",", &save)) {
+    int v = atoi(tok);
+    if (axis->count == MAX_AXIS || v < lo || v > hi) {
+      ok = 0;
+      break;
+    }
+    axis->values[axis->count++] = v;
+  }
+  free(copy);
+  return ok && axis->count > 0 ? 0 : -1;
+}
+
+/* Compare the assembled image against the strips that were served */
+static int check_result(pngcore_concurrent_t *proc, const strips_t *strips) {
+  pngcore_png_t *png = pngcore_concurrent_get_result(proc);
+  uint8_t *data = NULL;
+  size_t size = 0;
+  int ok = png && pngcore_get_raw_data(png, &data, &size) == 0 &&
+           size == (size_t)STRIP_RAW * TOTAL_IMAGES &&
+           memcmp(data, strips->raw, size) == 0;
+  free(data);
+  pngcore_free(png);
+  return ok;
+}
+
+/* Trace the run that is about to start, or dump the one that just ended */
+static void trace_cell(const char *dir, const char *name, int start) {
+  pngcore_error_t error;
+  if (start) {
+    if (pngcore_trace_enable(0, &error) != 0) {
+      fprintf(stderr, "%s: %s\n", name, error.message);
+    }
+    return;
+  }
+  char path[4096];
+  int len = snprintf(path, sizeof(path), "%s/", dir);
+  for (const char *c = name; *c && len < (int)sizeof(path) - 6; c++) {
+    path[len++] = *c == '/' ? '_' : *c;
+  }
+  snprintf(path + len, sizeof(path) - len, ".json");
+  pngcore_trace_disable();
+  if (pngcore_trace_write(path, &error) != 0) {
+    fprintf(stderr, "%s: %s\n", name, error.message);
+  }
+}
+
+static void run_cell(bench_t *bench, samples_t *samples, const strips_t *strips,
+                     const pngcore_concurrent_config_t *config, double total_bytes,
+                     const char *trace_dir) {
+  char name[64];
+  snprintf(name, sizeof(name), "b%d/p%d/c%d/x%d", config->buffer_size,
+           config->num_producers, config->num_consumers, config->consumer_delay);
+  if (bench->filter && !strstr(name, bench->filter)) return;
+
+  double wall[BENCH_MAX_REPS];
+  int ok = 1;
+  atomic_store(&samples->count, 0);
+  fflush(NULL);  /* the workers exit() and would flush our buffers again */
+  for (int r = 0; r < bench->reps; r++) {
+    atomic_store(&samples->run, r);
+    int traced = trace_dir && r == bench->reps - 1;
+    if (traced) trace_cell(trace_dir, name, 1);
+    pngcore_concurrent_t *proc = pngcore_concurrent_create(config);
+    if (!proc || pngcore_concurrent_run(proc) != 0) {
+      pngcore_concurrent_destroy(proc);
+      fprintf(stderr, "%s: run failed\n", name);
+      return;
+    }
+    wall[r] = pngcore_concurrent_get_time(proc);
+    ok &= check_result(proc, strips);
+    if (traced) trace_cell(trace_dir, name, 0);
+    pngcore_concurrent_destroy(proc);
+  }
+
+  size_t n = atomic_load(&samples->count);
+  if (n > MAX_SAMPLES) n = MAX_SAMPLES;
+  qsort(wall, bench->reps, sizeof(double), bench_cmp);
+  qsort(samples->ms, n, sizeof(double), bench_cmp);
+  double median = bench_percentile(wall, bench->reps, 50);
+  double p50 = bench_percentile(samples->ms, n, 50);
+  double p90 = bench_percentile(samples->ms, n, 90);
+  double p99 = bench_percentile(samples->ms, n, 99);
+  double lat_max = n ? samples->ms[n - 1] : 0;
+
+  fprintf(stderr, "%-18s %8.3f s %8.1f frag/s %7.2f MB/s   p50 %7.2f  p90 %7.2f  p99 %7.2f ms%s\n",
+          name, median, TOTAL_IMAGES / median, total_bytes / median / 1e6,
+          p50, p90, p99, ok ? "" : "   MISMATCH");
+
+  if (bench->json) {
+    char escaped[256];
+    bench_json_next(bench);
+    fprintf(bench->json,
+            "{\"name\": \"%s\", \"buffer_size\": %d, \"producers\": %d, \"consumers\": %d, "
+            "\"delay_ms\": %d, \"ok\": %s, "
+            "\"wall_s\": {\"median\": %.6f, \"min\": %.6f, \"max\": %.6f}, "
+            "\"fragments_per_s\": %.2f, \"mb_per_s\": %.4f, \"requests\": %zu, "
+            "\"latency_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}}",
+            bench_json_escape(name, escaped, sizeof(escaped)), config->buffer_size,
+            config->num_producers, config->num_consumers,
+            config->consumer_delay, ok ? "true" : "false",
+            median, wall[0], wall[bench->reps - 1],
+            TOTAL_IMAGES / median, total_bytes / median / 1e6, n, p50, p90, p99, lat_max);
+  }
+}
+
+/******************************************************************************
+* MAIN
+*****************************************************************************/
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [--buffers LIST] [--producers LIST] [--consumers LIST] [--delays LIST]\n"
+          "          [--latency fixed:MS|uniform:LO:HI|exp:MEAN|lognormal:MEDIAN:SIGMA]\n"
+          "          [--bandwidth BYTES_PER_S] [--class NAME] [--image N] [--seed N]\n"
+          "          [--trace DIR]\n"
+          "          [options]\n"
+          "LISTs are comma separated; the bandwidth cap applies per connection.\n",
+          prog);
+  bench_usage();
+}
+
+int main(int argc, char **argv) {
+  bench_t bench = {.reps = 3};  /* a repetition is a whole run */
+  argc = bench_init(&bench, "paster", argc, argv);
+  if (argc < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  axis_t buffers, producers, consumers, delays;
+  const char *buffers_arg = "1,5,10", *producers_arg = "1,5", *consumers_arg = "1,5";
+  const char *delays_arg = "0,10", *latency_arg = "exp:5";
+  conn_t proto = {.bandwidth = 0, .seed = 252};
+  int image_num = 1;
+  const char *class_arg = "photo";
+  const char *trace_dir = NULL;
+  corpus_class_t cls = CORPUS_CLASS_COUNT;
+
+  for (int i = 1; i < argc; i++) {
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      usage(argv[0]);
+      return 1;
+    }
+    if (strcmp(argv[i], "--buffers") == 0) {
+      buffers_arg = val;
+    } else if (strcmp(argv[i], "--producers") == 0) {
+      producers_arg = val;
+    } else if (strcmp(argv[i], "--consumers") == 0) {
+      consumers_arg = val;
+    } else if (strcmp(argv[i], "--delays") == 0) {
+      delays_arg = val;
+    } else if (strcmp(argv[i], "--latency") == 0) {
+      latency_arg = val;
+    } else if (strcmp(argv[i], "--bandwidth") == 0) {
+      proto.bandwidth = atof(val);
+    } else if (strcmp(argv[i], "--class") == 0) {
+      class_arg = val;
+    } else if (strcmp(argv[i], "--image") == 0) {
+      image_num = atoi(val);
+    } else if (strcmp(argv[i], "--seed") == 0) {
+      proto.seed = strtoull(val, NULL, 0);
+    } else if (strcmp(argv[i], "--trace") == 0) {
+      trace_dir = val;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+    i++;
+  }
+  for (int c = 0; c < CORPUS_CLASS_COUNT; c++) {
+    if (strcmp(class_arg, corpus_class_names[c]) == 0) cls = (corpus_class_t)c;
+  }
+  /* Same limits as paster2 */
+  if (parse_axis(buffers_arg, &buffers, 1, 100) || parse_axis(producers_arg, &producers, 1, 20) ||
+      parse_axis(consumers_arg, &consumers, 1, 20) || parse_axis(delays_arg, &delays, 0, 1000) ||
+      parse_latency(latency_arg, &proto.latency) || proto.bandwidth < 0 ||
+      image_num < 1 || image_num > 3 || cls == CORPUS_CLASS_COUNT) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (trace_dir && mkdir(trace_dir, 0755) != 0 && errno != EEXIST) {
+    perror(trace_dir);
+    return 1;
+  }
+
+  char path[] = "/tmp/pngcore_paster_XXXXXX";
+  int fd = mkstemp(path);
+  strips_t strips = {0};
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+  int made = make_strips(&strips, cls, image_num, proto.seed, path);
+  unlink(path);
+  if (made != 0) {
+    fprintf(stderr, "Failed to generate fragments\n");
+    free_strips(&strips);
+    return 1;
+  }
+  double total_bytes = 0;
+  for (int i = 0; i < TOTAL_IMAGES; i++) {
+    total_bytes += strips.size[i];
+  }
+
+  samples_t *samples = mmap(NULL, sizeof(samples_t), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (samples == MAP_FAILED) {
+    perror("mmap");
+    free_strips(&strips);
+    return 1;
+  }
+  proto.strips = &strips;
+  proto.samples = samples;
+
+  int port = 0;
+  pid_t server = start_server(&proto, &port);
+  if (server < 0) {
+    perror("server");
+    free_strips(&strips);
+    return 1;
+  }
+  char endpoint[64];
+  snprintf(endpoint, sizeof(endpoint), "http://127.0.0.1:%d/image", port);
+
+  char params[512], latency_json[64], class_json[64];
+  snprintf(params, sizeof(params),
+           "\"latency\": \"%s\", \"bandwidth\": %.0f, \"class\": \"%s\", \"image\": %d, "
+           "\"seed\": %llu, \"fragment_bytes\": %.0f",
+           bench_json_escape(latency_arg, latency_json, sizeof(latency_json)), proto.bandwidth,
+           bench_json_escape(class_arg, class_json, sizeof(class_json)), image_num, (unsigned long long)proto.seed,
+           total_bytes);
+  bench.params = params;
+  fprintf(stderr, "Serving %d fragments (%.0f bytes) on %s, latency %s\n",
+          TOTAL_IMAGES, total_bytes, endpoint, latency_arg);
+
+  for (int b = 0; b < buffers.count; b++) {
+    for (int p = 0; p < producers.count; p++) {
+      for (int c = 0; c < consumers.count; c++) {
+        for (int x = 0; x < delays.count; x++) {
+          pngcore_concurrent_config_t config = {
+            .buffer_size = buffers.values[b],
+            .num_producers = producers.values[p],
+            .num_consumers = consumers.values[c],
+            .consumer_delay = delays.values[x],
+            .image_num = image_num,
+            .endpoint = endpoint
+          };
+          run_cell(&bench, samples, &strips, &config, total_bytes, trace_dir);
+        }
+      }
+    }
+  }
+
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+  munmap(samples, sizeof(samples_t));
+  free_strips(&strips);
+  pngcore_trace_free();
+  bench_finish(&bench);
+  return 0;
+}
@@ -80,6 +80,14 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    /* PNGCORE_TRACE=path records a per-worker timeline of the run */
+    pngcore_error_t error;
+    const char *trace_path = getenv("PNGCORE_TRACE");
+    if (trace_path && pngcore_trace_enable(0, &error) != 0) {
+        fprintf(stderr, "Warning: %s\n", error.message);
+        trace_path = NULL;
+    }
+
     /* Run the concurrent processing */
     printf("Starting concurrent PNG fetching...\n");
     if (pngcore_concurrent_run(proc) != 0) {
@@ -97,9 +105,17 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if (trace_path) {
+        if (pngcore_trace_write(trace_path, &error) != 0) {
+            fprintf(stderr, "Warning: %s\n", error.message);
+        } else {
+            printf("Trace written to %s\n", trace_path);
+        }
+        pngcore_trace_free();
+    }
+
     /* Save the result */
     printf("Saving result to all.png...\n");
-    pngcore_error_t error;
     if (pngcore_save_file(result, "all.png", &error) != 0) {
         fprintf(stderr, "Error saving PNG: %s\n", error.message);
         pngcore_free(result);
@@ -111,6 +127,12 @@ int main(int argc, char **argv) {
     double exec_time = pngcore_concurrent_get_time(proc);
     printf("\npaster2 execution time: %.2f seconds\n", exec_time);
 
+    /* PNGCORE_STATS=path exports the library counters for Prometheus */
+    const char *stats_path = getenv("PNGCORE_STATS");
+    if (stats_path && pngcore_stats_write_prometheus(stats_path, &error) != 0) {
+        fprintf(stderr, "Warning: %s\n", error.message);
+    }
+
     /* Clean up */
     pngcore_free(result);
     pngcore_concurrent_destroy(proc);
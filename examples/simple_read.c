@@ -110,7 +110,7 @@ int main(int argc, char **argv) {
         const uint8_t *ihdr_data = pngcore_chunk_get_data(ihdr, &ihdr_size);
         uint32_t ihdr_crc = pngcore_chunk_get_crc(ihdr);
         printf("  IHDR: %zu bytes, CRC: 0x%08X\n", ihdr_size, ihdr_crc);
-        free(ihdr);
+        pngcore_chunk_free(ihdr);
     }
     
     pngcore_chunk_t *idat = pngcore_get_chunk(png, "IDAT");
@@ -119,7 +119,7 @@ int main(int argc, char **argv) {
         const uint8_t *idat_data = pngcore_chunk_get_data(idat, &idat_size);
         uint32_t idat_crc = pngcore_chunk_get_crc(idat);
         printf("  IDAT: %zu bytes, CRC: 0x%08X\n", idat_size, idat_crc);
-        free(idat);
+        pngcore_chunk_free(idat);
     }
     
     /* Save a copy of the PNG */
@@ -49,6 +49,12 @@ typedef struct pngcore_png pngcore_png_t;
 typedef struct pngcore_chunk pngcore_chunk_t;
 typedef struct pngcore_concurrent pngcore_concurrent_t;
 typedef struct pngcore_http_response pngcore_http_response_t;
+typedef struct pngcore_row_reader pngcore_row_reader_t;
+typedef struct pngcore_row_writer pngcore_row_writer_t;
+typedef struct pngcore_apng pngcore_apng_t;
+typedef struct pngcore_apng_writer pngcore_apng_writer_t;
+typedef struct pngcore_index pngcore_index_t;
+typedef struct pngcore_cache pngcore_cache_t;
 
 /* PNG color types */
 typedef enum {
@@ -59,6 +65,28 @@ typedef enum {
   PNGCORE_COLOR_RGBA = 6
 } pngcore_color_type_t;
 
+/* In-memory pixel formats. 16-bit samples are big-endian, as in PNG
+* scanlines. Premultiplied formats store color scaled by alpha */
+typedef enum {
+  PNGCORE_FMT_GRAY8 = 0,
+  PNGCORE_FMT_GRAY16,
+  PNGCORE_FMT_GRAY_ALPHA8,
+  PNGCORE_FMT_GRAY_ALPHA16,
+  PNGCORE_FMT_RGB8,
+  PNGCORE_FMT_RGB16,
+  PNGCORE_FMT_RGBA8,
+  PNGCORE_FMT_RGBA16,
+  PNGCORE_FMT_BGRA8,
+  PNGCORE_FMT_BGRA16,
+  PNGCORE_FMT_GRAY_ALPHA8_PREMUL,
+  PNGCORE_FMT_GRAY_ALPHA16_PREMUL,
+  PNGCORE_FMT_RGBA8_PREMUL,
+  PNGCORE_FMT_RGBA16_PREMUL,
+  PNGCORE_FMT_BGRA8_PREMUL,
+  PNGCORE_FMT_BGRA16_PREMUL,
+  PNGCORE_FMT_COUNT
+} pngcore_pixel_format_t;
+
 /******************************************************************************
 * Core PNG Functions
 *****************************************************************************/
@@ -71,6 +99,11 @@ int pngcore_save_file(const pngcore_png_t *png, const char *filename, pngcore_er
 /* Creation */
 pngcore_png_t* pngcore_create(uint32_t width, uint32_t height, uint8_t bit_depth, uint8_t color_type);
 
+/* Copy in O(1). The copy shares its image data and raw chunks with png by
+* reference count; either can be changed or freed independently, and
+* shared image data is only copied when one of them rewrites it in place */
+pngcore_png_t* pngcore_clone(const pngcore_png_t *png);
+
 /* Properties */
 uint32_t pngcore_get_width(const pngcore_png_t *png);
 uint32_t pngcore_get_height(const pngcore_png_t *png);
@@ -92,10 +125,71 @@ int pngcore_validate(const pngcore_png_t *png);
 * Chunk Operations
 *****************************************************************************/
 
+/* IDAT and raw ancillary chunks are views sharing bytes with png, valid
+* until pngcore_chunk_free even after png is freed */
 pngcore_chunk_t* pngcore_get_chunk(const pngcore_png_t *png, const char type[4]);
+void pngcore_chunk_free(pngcore_chunk_t *chunk);
 const uint8_t* pngcore_chunk_get_data(const pngcore_chunk_t *chunk, size_t *size);
 uint32_t pngcore_chunk_get_crc(const pngcore_chunk_t *chunk);
 
+/******************************************************************************
+* Metadata
+*****************************************************************************/
+
+/* PLTE and ancillary chunks (tEXt, zTXt, iCCP, gAMA, pHYs, eXIf and any
+* other) are kept as the bytes read at load time. Nothing in them is
+* checked or decoded until it is accessed here; save writes them back
+* unchanged, before or after the image data as in the source */
+
+/* Text of the first tEXt or zTXt chunk with keyword, NUL-terminated; free
+* with free(). zTXt is inflated on this call */
+int pngcore_get_text(const pngcore_png_t *png, const char *keyword, char **text,
+                     size_t *length, pngcore_error_t *error);
+
+/* Inflated ICC profile, free with free(); name receives the profile name */
+int pngcore_get_iccp(const pngcore_png_t *png, char name[80], uint8_t **profile,
+                     size_t *length, pngcore_error_t *error);
+
+/* Gamma times 100000 */
+int pngcore_get_gamma(const pngcore_png_t *png, uint32_t *gamma, pngcore_error_t *error);
+
+/* Pixels per unit; unit 1 is the meter, 0 means aspect ratio only */
+int pngcore_get_phys(const pngcore_png_t *png, uint32_t *ppu_x, uint32_t *ppu_y,
+                     uint8_t *unit, pngcore_error_t *error);
+
+/* Exif data inside the PNG; valid until the PNG is freed */
+const uint8_t* pngcore_get_exif(const pngcore_png_t *png, size_t *length, pngcore_error_t *error);
+
+/* One change to an ancillary chunk of a PNG file. Text chunks (tEXt, zTXt,
+* iTXt) share one keyword namespace and are matched by keyword, which is
+* taken from data when NULL; other types match the first chunk of the type.
+* data is the complete chunk data, NULL removes every matching chunk. A chunk
+* that is not found is inserted before the image data, or before IEND for
+* text chunks */
+typedef struct {
+  char type[4];
+  const char *keyword;
+  const uint8_t *data;
+  uint32_t length;
+} pngcore_chunk_edit_t;
+
+/* Apply edits to a PNG file without loading or rewriting its image data.
+* Only edited chunks get a new CRC; everything else is kept byte for byte.
+* When the chunks before the image data keep their total size the file is
+* patched in place, otherwise the new prefix is written to a temporary file,
+* the image data spliced in with copy_file_range and the result renamed
+* over the original */
+int pngcore_edit_chunks(const char *path, const pngcore_chunk_edit_t *edits, size_t count,
+                        pngcore_error_t *error);
+
+/* Set the text of keyword as a tEXt chunk, or remove it when text is NULL */
+int pngcore_edit_text(const char *path, const char *keyword, const char *text,
+                      pngcore_error_t *error);
+
+/* Set the pHYs chunk */
+int pngcore_edit_phys(const char *path, uint32_t ppu_x, uint32_t ppu_y, uint8_t unit,
+                      pngcore_error_t *error);
+
 /******************************************************************************
 * Compression
 *****************************************************************************/
@@ -103,6 +197,410 @@ uint32_t pngcore_chunk_get_crc(const pngcore_chunk_t *chunk);
 int pngcore_inflate(uint8_t *dest, uint64_t *dest_len, const uint8_t *src, uint64_t src_len);
 int pngcore_deflate(uint8_t *dest, uint64_t *dest_len, const uint8_t *src, uint64_t src_len, int level);
 
+/******************************************************************************
+* Streaming Row Codec
+*****************************************************************************/
+
+/* Rows are unfiltered scanlines without the filter byte. Interlaced images
+* are not supported by the streaming decoder */
+pngcore_row_reader_t* pngcore_row_reader_create(const pngcore_png_t *png, pngcore_error_t *error);
+int pngcore_row_reader_next(pngcore_row_reader_t *reader, const uint8_t **row); /* 1: row, 0: end, -1: error */
+size_t pngcore_row_reader_row_bytes(const pngcore_row_reader_t *reader);
+void pngcore_row_reader_destroy(pngcore_row_reader_t *reader);
+
+/* Deliver rows converted to fmt; call before the first row. Indexed images
+* cannot be converted */
+int pngcore_row_reader_set_format(pngcore_row_reader_t *reader, pngcore_pixel_format_t fmt);
+
+pngcore_row_writer_t* pngcore_row_writer_create(const char *filename,
+                                                uint32_t width, uint32_t height,
+                                                uint8_t bit_depth, uint8_t color_type,
+                                                pngcore_error_t *error);
+int pngcore_row_writer_write(pngcore_row_writer_t *writer, const uint8_t *row);
+int pngcore_row_writer_finish(pngcore_row_writer_t *writer, pngcore_error_t *error);
+void pngcore_row_writer_destroy(pngcore_row_writer_t *writer);
+
+/* Accept rows in fmt and convert them to the PNG's format; call before the
+* first row. Requires an 8 or 16-bit non-indexed output */
+int pngcore_row_writer_set_format(pngcore_row_writer_t *writer, pngcore_pixel_format_t fmt);
+
+/* Write PLTE (RGB triples) and optionally tRNS; call before the first row.
+* Indexed images need a palette before any row is accepted */
+int pngcore_row_writer_set_palette(pngcore_row_writer_t *writer,
+                                   const uint8_t *plte, size_t plte_len,
+                                   const uint8_t *trns, size_t trns_len);
+
+/******************************************************************************
+* Pixel Format Conversion
+*****************************************************************************/
+
+/* Gray conversion uses BT.601 luma. 16 to 8-bit keeps the high byte and
+* 8 to 16-bit replicates it. Source and destination must not overlap */
+size_t pngcore_format_pixel_bytes(pngcore_pixel_format_t fmt);
+int pngcore_format_from_png(uint8_t bit_depth, uint8_t color_type, pngcore_pixel_format_t *fmt);
+int pngcore_convert_row(const uint8_t *src, pngcore_pixel_format_t src_fmt,
+                        uint8_t *dst, pngcore_pixel_format_t dst_fmt, size_t width);
+int pngcore_convert_image(const uint8_t *src, pngcore_pixel_format_t src_fmt, size_t src_stride,
+                          uint8_t *dst, pngcore_pixel_format_t dst_fmt, size_t dst_stride,
+                          uint32_t width, uint32_t height);
+
+/******************************************************************************
+* Image Composition
+*****************************************************************************/
+
+/* Stack inputs top to bottom into one PNG written to filename. All inputs must
+* share width, bit depth, color type and any PLTE and tRNS. Inputs are decoded in parallel and
+* emitted in order through one streaming encoder */
+int pngcore_stitch_vertical(pngcore_png_t *const inputs[], size_t n,
+                            const char *filename, pngcore_error_t *error);
+
+/* Compose a rows x cols grid of tiles (row-major, NULL for empty cells) into
+* one PNG. Each cell is as wide as the widest tile in its column and as tall
+* as the tallest tile in its grid row; tiles sit at the top-left of their cell
+* and the remainder is filled with `background`, one pixel in the tiles'
+* format (the sample value in the first byte for sub-byte depths; NULL for
+* zero). Tiles must share any PLTE and tRNS. Tiles of one grid row are
+* decoded in parallel, so peak memory is one band of tiles */
+int pngcore_mosaic(pngcore_png_t *const tiles[], uint32_t rows, uint32_t cols,
+                   const uint8_t *background, const char *filename,
+                   pngcore_error_t *error);
+
+typedef enum {
+  PNGCORE_BLEND_OVER = 0,   /* Porter-Duff source over */
+  PNGCORE_BLEND_ADD,        /* Porter-Duff plus, clamped */
+  PNGCORE_BLEND_MULTIPLY,
+  PNGCORE_BLEND_SCREEN,
+  PNGCORE_BLEND_DARKEN,
+  PNGCORE_BLEND_LIGHTEN
+} pngcore_blend_mode_t;
+
+/* Blend in linear light: decode sRGB before blending, encode after */
+#define PNGCORE_COMPOSITE_LINEAR 0x1
+
+/* Blend overlay onto base with its top-left corner at (x, y), which may lie
+* outside the base, and write the result to filename in the base's format.
+* Rows that do not meet the overlay are passed from the decoder to the
+* encoder untouched */
+int pngcore_composite(const pngcore_png_t *base, const pngcore_png_t *overlay,
+                      int32_t x, int32_t y, pngcore_blend_mode_t mode,
+                      unsigned flags, const char *filename,
+                      pngcore_error_t *error);
+
+/* Tile grid for pngcore_split. Tiles are numbered row-major; tiles on the
+* right and bottom edges are cropped to the image */
+typedef struct {
+  uint32_t tile_width;      /* 0 for the full image width */
+  uint32_t tile_height;     /* 0 for the full image height */
+} pngcore_split_grid_t;
+
+/* Receives one encoded tile; return non-zero to stop the split */
+typedef int (*pngcore_split_fn)(void *ctx, uint32_t index, uint32_t col, uint32_t row,
+                                const uint8_t *data, size_t size);
+
+/* Split png into standalone PNGs of the same format. The source is decoded
+* once, streaming; tiles are encoded on a thread pool as their band of rows
+* is decoded and delivered to callback in index order on the calling thread */
+int pngcore_split(const pngcore_png_t *png, const pngcore_split_grid_t *grid,
+                  pngcore_split_fn callback, void *ctx, pngcore_error_t *error);
+
+/* pngcore_split writing each tile to dir/<index>.png */
+int pngcore_split_to_dir(const pngcore_png_t *png, const pngcore_split_grid_t *grid,
+                         const char *dir, pngcore_error_t *error);
+
+/******************************************************************************
+* Image Transforms
+*****************************************************************************/
+
+/* Write the w x h region at (x, y) to filename. Rows are decoded streaming
+* and inflation stops after the last cropped row, so memory is O(width) */
+int pngcore_crop(const pngcore_png_t *png, uint32_t x, uint32_t y,
+                 uint32_t w, uint32_t h, const char *filename,
+                 pngcore_error_t *error);
+
+typedef enum {
+  PNGCORE_RESIZE_BOX,       /* area average */
+  PNGCORE_RESIZE_BILINEAR,  /* triangle filter */
+  PNGCORE_RESIZE_LANCZOS3   /* windowed sinc, 3 lobes */
+} pngcore_resize_filter_t;
+
+/* Resample to out_w x out_h and write to filename. Alpha images are filtered
+* premultiplied; sub-byte grayscale is written as 8-bit, with a tRNS key
+* turned into an alpha channel. Other tRNS chunks are copied. Indexed images
+* are not supported. Memory is O(width x filter support) */
+int pngcore_resize(const pngcore_png_t *png, uint32_t out_w, uint32_t out_h,
+                   pngcore_resize_filter_t filter, const char *filename,
+                   pngcore_error_t *error);
+
+typedef enum {
+  PNGCORE_ORIENT_ROTATE_90 = 0,   /* clockwise */
+  PNGCORE_ORIENT_ROTATE_180,
+  PNGCORE_ORIENT_ROTATE_270,      /* clockwise, i.e. 90 counter-clockwise */
+  PNGCORE_ORIENT_FLIP_H,          /* mirror left to right */
+  PNGCORE_ORIENT_FLIP_V,          /* mirror top to bottom */
+  PNGCORE_ORIENT_TRANSPOSE,       /* swap x and y */
+  PNGCORE_ORIENT_TRANSVERSE       /* swap x and y across the other diagonal */
+} pngcore_orientation_t;
+
+/* Reorient a decoded width x height image of pixel_bytes-sized pixels into
+* row-major dst, ready for the encoder. Transposing orientations produce a
+* height x width image. Work is cache-blocked and split across threads for
+* large images. Source and destination must not overlap */
+int pngcore_reorient_pixels(const uint8_t *src, size_t src_stride,
+                            uint8_t *dst, size_t dst_stride,
+                            uint32_t width, uint32_t height, size_t pixel_bytes,
+                            pngcore_orientation_t op);
+
+/* Decode png, reorient it and write the result to filename */
+int pngcore_reorient(const pngcore_png_t *png, pngcore_orientation_t op,
+                     const char *filename, pngcore_error_t *error);
+
+/******************************************************************************
+* Image Statistics
+*****************************************************************************/
+
+/* Per-channel statistics in the image's own sample order and range (gray,
+* gray+alpha, RGB, RGBA or palette index). 16-bit samples are binned by
+* their high byte; min, max and mean are exact */
+typedef struct {
+  uint32_t channels;
+  uint64_t pixels;
+  uint64_t histogram[4][256];
+  uint16_t min[4];
+  uint16_t max[4];
+  double mean[4];
+  uint64_t opaque;          /* alpha at full scale; every pixel without alpha */
+  uint64_t transparent;     /* alpha zero */
+} pngcore_image_stats_t;
+
+/* Histogram and statistics in one streaming pass over the decoded rows */
+int pngcore_image_stats(const pngcore_png_t *png, pngcore_image_stats_t *stats,
+                        pngcore_error_t *error);
+
+/* Collect statistics on the rows the reader decodes. Must be called before
+* the first row; stats is filled in when the last row is returned */
+int pngcore_row_reader_collect_stats(pngcore_row_reader_t *reader, pngcore_image_stats_t *stats);
+
+/******************************************************************************
+* Pixel Hashing
+*****************************************************************************/
+
+/* 64-bit hash of width, height and pixels, computed while streaming the
+* decode. Pixels are normalized to RGBA8 (RGBA16 for 16-bit images), with
+* palettes expanded and tRNS colour-keyed pixels given zero alpha, so
+* encodings that differ only in color type, filtering or compression hash
+* equal. Interlaced images are not supported */
+int pngcore_pixel_hash(const pngcore_png_t *png, uint64_t *hash, pngcore_error_t *error);
+
+/* Hash n images on num_threads threads (<= 0 for one per CPU). Images with
+* byte-identical IHDR, PLTE, tRNS and image data are decoded once. Returns -1 with the
+* first error if any image fails; its hash is set to 0 */
+int pngcore_pixel_hash_batch(pngcore_png_t *const pngs[], size_t n, uint64_t hashes[],
+                             int num_threads, pngcore_error_t *error);
+
+/* 1 if both images have the same normalized pixels, 0 if not, -1 on error.
+* Identical IHDR, PLTE, tRNS and image data short-circuit without decoding; otherwise
+* rows are compared in lockstep and decoding stops at the first difference */
+int pngcore_pixel_equal(const pngcore_png_t *a, const pngcore_png_t *b,
+                        pngcore_error_t *error);
+
+/******************************************************************************
+* Image Diff
+*****************************************************************************/
+
+typedef struct {
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+} pngcore_rect_t;
+
+/* Changed regions between two images */
+typedef struct {
+  uint64_t changed_pixels;
+  pngcore_rect_t bounds;    /* all changes; zero size if the images match */
+  pngcore_rect_t *rects;    /* separate changed regions, top to bottom */
+  size_t num_rects;
+} pngcore_diff_t;
+
+/* Find what changed between two images of the same size. Rows are compared
+* with AVX2 as they are decoded and identical rows are skipped after one
+* compare; identical image data is detected without decoding. A rect can be
+* passed to pngcore_crop to encode only the changed part of b. Release with
+* pngcore_diff_free */
+int pngcore_diff(const pngcore_png_t *a, const pngcore_png_t *b, pngcore_diff_t *diff,
+                 pngcore_error_t *error);
+void pngcore_diff_free(pngcore_diff_t *diff);
+
+/******************************************************************************
+* Animated PNG
+*****************************************************************************/
+
+typedef enum {
+  PNGCORE_APNG_DISPOSE_NONE = 0,
+  PNGCORE_APNG_DISPOSE_BACKGROUND,
+  PNGCORE_APNG_DISPOSE_PREVIOUS
+} pngcore_apng_dispose_t;
+
+typedef enum {
+  PNGCORE_APNG_BLEND_SOURCE = 0,
+  PNGCORE_APNG_BLEND_OVER
+} pngcore_apng_blend_t;
+
+/* fcTL fields of one frame */
+typedef struct {
+  uint32_t width;
+  uint32_t height;
+  uint32_t x;
+  uint32_t y;
+  uint16_t delay_num;
+  uint16_t delay_den;       /* 0 means 1/100 s */
+  uint8_t dispose_op;
+  uint8_t blend_op;
+} pngcore_apng_frame_info_t;
+
+/* Open an APNG. A PNG without acTL opens as a single frame; the default
+* image is not a frame when its fcTL is missing. Indexed and interlaced
+* images are not supported */
+pngcore_apng_t* pngcore_apng_load_file(const char *filename, pngcore_error_t *error);
+pngcore_apng_t* pngcore_apng_load_buffer(const uint8_t *buffer, size_t size, pngcore_error_t *error);
+void pngcore_apng_free(pngcore_apng_t *apng);
+
+uint32_t pngcore_apng_get_width(const pngcore_apng_t *apng);
+uint32_t pngcore_apng_get_height(const pngcore_apng_t *apng);
+uint32_t pngcore_apng_num_frames(const pngcore_apng_t *apng);
+uint32_t pngcore_apng_num_plays(const pngcore_apng_t *apng);   /* 0: loop forever */
+int pngcore_apng_frame_info(const pngcore_apng_t *apng, uint32_t index,
+                            pngcore_apng_frame_info_t *info);
+
+/* Inflate every frame up front on num_threads threads (<= 0 for one per
+* CPU). Optional: rendering decodes the frames it needs */
+int pngcore_apng_decode(pngcore_apng_t *apng, int num_threads, pngcore_error_t *error);
+
+/* Composite the canvas as displayed for frame index and write it to dst in
+* fmt, stride bytes per row. Sequential rendering composites one frame per
+* call */
+int pngcore_apng_render(pngcore_apng_t *apng, uint32_t index, pngcore_pixel_format_t fmt,
+                        uint8_t *dst, size_t stride, pngcore_error_t *error);
+
+/* Encode an APNG from full frames in fmt. Each frame is diffed against the
+* previous one with AVX2 and only the changed rectangle is stored, with the
+* dispose and blend ops that keep it smallest. Identical frames extend the
+* previous frame's delay. Frames are compressed on a thread pool */
+pngcore_apng_writer_t* pngcore_apng_writer_create(const char *filename,
+                                                  uint32_t width, uint32_t height,
+                                                  pngcore_pixel_format_t fmt,
+                                                  uint32_t num_plays, pngcore_error_t *error);
+int pngcore_apng_writer_add_frame(pngcore_apng_writer_t *writer, const uint8_t *pixels,
+                                  size_t stride, uint16_t delay_num, uint16_t delay_den,
+                                  pngcore_error_t *error);
+int pngcore_apng_writer_finish(pngcore_apng_writer_t *writer, pngcore_error_t *error);
+void pngcore_apng_writer_destroy(pngcore_apng_writer_t *writer);
+
+/******************************************************************************
+* Random-Access Index
+*****************************************************************************/
+
+/* Suffix appended to a PNG path by pngcore_index_build_files */
+#define PNGCORE_INDEX_SUFFIX ".pngidx"
+
+/* Rows per band when band_rows is 0 */
+#define PNGCORE_INDEX_BAND_ROWS 64
+
+/* Build a sidecar index in one sequential read of a PNG: IHDR, chunk
+* offsets, an inflate checkpoint at the start of every band of band_rows
+* rows and a hash of each band's unfiltered rows. Interlaced images are not
+* supported. The index is written to a temporary file and renamed into place */
+int pngcore_index_build(const char *png_path, const char *index_path,
+                        uint32_t band_rows, pngcore_error_t *error);
+
+/* Index n files on num_threads threads (<= 0 for one per CPU), writing
+* <path>.pngidx next to each. Returns -1 with the first error if any fails */
+int pngcore_index_build_files(const char *const png_paths[], size_t n, uint32_t band_rows,
+                              int num_threads, pngcore_error_t *error);
+
+/* Map an index read-only; it is validated once here */
+pngcore_index_t* pngcore_index_open(const char *index_path, pngcore_error_t *error);
+void pngcore_index_close(pngcore_index_t *index);
+
+uint32_t pngcore_index_get_width(const pngcore_index_t *index);
+uint32_t pngcore_index_get_height(const pngcore_index_t *index);
+uint8_t pngcore_index_get_bit_depth(const pngcore_index_t *index);
+uint8_t pngcore_index_get_color_type(const pngcore_index_t *index);
+uint32_t pngcore_index_band_rows(const pngcore_index_t *index);
+uint32_t pngcore_index_num_bands(const pngcore_index_t *index);
+
+/* Hash of the unfiltered scanlines of one band, as pngcore_hash_* over the
+* concatenated rows. Equal hashes mean the band can be skipped */
+uint64_t pngcore_index_band_hash(const pngcore_index_t *index, uint32_t band);
+
+/* File offset and data length of the first chunk of a type; -1 if absent */
+int pngcore_index_find_chunk(const pngcore_index_t *index, const char type[4],
+                             uint64_t *offset, uint32_t *length);
+
+/* Decode rows [y0, y1) of the indexed PNG into dst in the image's own
+* scanline format. Inflate resumes from the nearest checkpoint, so rows
+* above y0 cost at most about one band and one deflate block. Thread-safe
+* on a shared index */
+int pngcore_index_read_rows(const pngcore_index_t *index, const char *png_path,
+                            uint32_t y0, uint32_t y1, uint8_t *dst, size_t stride,
+                            pngcore_error_t *error);
+
+/******************************************************************************
+* Decoded Pixel Cache
+*****************************************************************************/
+
+/* Row alignment of cached pixels in bytes */
+#define PNGCORE_CACHE_ALIGN 64
+
+/* Decoded pixels in memory, in the (pixels, fmt, stride) form the
+* conversion, transform and APNG functions take */
+typedef struct {
+  const uint8_t *pixels;
+  size_t stride;
+  uint32_t width;
+  uint32_t height;
+  pngcore_pixel_format_t format;
+  uint64_t source_hash;
+} pngcore_pixel_view_t;
+
+/* Decode png into a cache file with rows in fmt. The file is written to a
+* temporary name and renamed into place, so readers never map a partial file */
+int pngcore_cache_write(const pngcore_png_t *png, pngcore_pixel_format_t fmt,
+                        const char *path, pngcore_error_t *error);
+
+/* Map a cache file read-only. The pixels stay valid until the cache is closed */
+pngcore_cache_t* pngcore_cache_open(const char *path, pngcore_error_t *error);
+const pngcore_pixel_view_t* pngcore_cache_view(const pngcore_cache_t *cache);
+void pngcore_cache_close(pngcore_cache_t *cache);
+
+/* 1 if the cache was written from png's IHDR and image data, 0 if not,
+* -1 on error. Hashes the compressed data only; nothing is decoded */
+int pngcore_cache_matches(const pngcore_cache_t *cache, const pngcore_png_t *png);
+
+/******************************************************************************
+* Band Updates
+*****************************************************************************/
+
+/* Default rows per independently compressed band */
+#define PNGCORE_BAND_ROWS 64
+
+/* Re-encode png's image data as bands of band_rows rows (0 for the default),
+* each ending in a full flush and starting with a row filtered without the
+* row above, so any band can later be replaced without touching the others.
+* level is a zlib compression level. Interlaced images are not supported */
+int pngcore_encode_bands(pngcore_png_t *png, uint32_t band_rows, int level,
+                         pngcore_error_t *error);
+
+/* Replace rows [y0, y1) with pixels, unfiltered scanlines without filter
+* bytes packed at the scanline width. Only the bands holding those rows are
+* inflated, re-filtered and re-deflated; the zlib adler32 and IDAT CRC are
+* combined from per-band sums. png must have been encoded with
+* pngcore_encode_bands, or loaded from a file saved after that: the band
+* table is saved in a private chunk and dropped on load if the image data
+* no longer matches it */
+int pngcore_update_rows(pngcore_png_t *png, uint32_t y0, uint32_t y1, const uint8_t *pixels,
+                        pngcore_error_t *error);
+
 /******************************************************************************
 * Network Operations
 *****************************************************************************/
@@ -122,14 +620,63 @@ typedef struct {
   int num_consumers;    /* Number of consumer processes */
   int consumer_delay;   /* Consumer delay in milliseconds */
   int image_num;        /* Image number to fetch */
+  const char *endpoint; /* Fragment server URL, NULL for the default server */
 } pngcore_concurrent_config_t;
 
 pngcore_concurrent_t* pngcore_concurrent_create(const pngcore_concurrent_config_t *config);
+/* Fetch and place every fragment. A fragment is retried a few times; if it
+* still fails the run stops early and returns -1, leaving the image incomplete */
 int pngcore_concurrent_run(pngcore_concurrent_t *proc);
 pngcore_png_t* pngcore_concurrent_get_result(pngcore_concurrent_t *proc);
 void pngcore_concurrent_destroy(pngcore_concurrent_t *proc);
 double pngcore_concurrent_get_time(const pngcore_concurrent_t *proc);
 
+/******************************************************************************
+* Tracing
+*****************************************************************************/
+
+/* Record fetch, enqueue, dequeue, parse, CRC, inflate, place and deflate
+* spans per worker thread or process. Enable before pngcore_concurrent_run
+* so the forked workers share the buffers. events_per_worker is the ring
+* size (0 for 16384); the oldest events are overwritten when it fills.
+* Enabling again clears everything recorded so far */
+int pngcore_trace_enable(size_t events_per_worker, pngcore_error_t *error);
+void pngcore_trace_disable(void);
+
+/* Write everything recorded as Chrome trace event JSON, viewable in
+* chrome://tracing or Perfetto */
+int pngcore_trace_write(const char *path, pngcore_error_t *error);
+void pngcore_trace_free(void);
+
+/******************************************************************************
+* Statistics
+*****************************************************************************/
+
+/* Process-wide counters since the last reset, including the workers forked
+* by the concurrent processor. Phase times are inclusive: parse time covers
+* the CRC checks made while parsing */
+typedef struct {
+  uint64_t bytes_parsed;
+  uint64_t bytes_crc;
+  uint64_t bytes_inflated;      /* inflate output */
+  uint64_t bytes_deflated;      /* deflate input */
+  uint64_t parse_ns;
+  uint64_t crc_ns;
+  uint64_t inflate_ns;
+  uint64_t deflate_ns;
+  uint64_t allocations;
+  uint64_t bytes_allocated;
+  uint64_t http_requests;
+  uint64_t http_retries;
+} pngcore_stats_t;
+
+void pngcore_stats_get(pngcore_stats_t *stats);
+void pngcore_stats_reset(void);
+
+/* Write the counters in Prometheus text format, replacing path atomically
+* so it can be served by a textfile collector */
+int pngcore_stats_write_prometheus(const char *path, pngcore_error_t *error);
+
 /******************************************************************************
 * Utility Functions
 *****************************************************************************/
@@ -137,5 +684,6 @@ double pngcore_concurrent_get_time(const pngcore_concurrent_t *proc);
 uint32_t pngcore_crc32(const uint8_t *buf, size_t len);
 const char* pngcore_error_string(pngcore_error_code_t code);
 void pngcore_error_clear(pngcore_error_t *error);
+void pngcore_error_set(pngcore_error_t *error, pngcore_error_code_t code, const char *fmt, ...);
 
 #endif /* PNGCORE_H */
\ No newline at end of file
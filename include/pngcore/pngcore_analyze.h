@@ -0,0 +1,50 @@
+/**
+* @file pngcore_analyze.h
+* @brief Single-pass image statistics
+*
+* Samples are counted into four interleaved sub-histograms per channel so
+* that runs of equal pixels don't serialize on increments of one counter;
+* the copies are summed at the end. For 8-bit and smaller samples min, max,
+* mean and the alpha counts all follow from the histograms. 16-bit images
+* are binned by high byte and take exact sums in the same loop, with min,
+* max and the alpha counts from an AVX2 kernel over the row while it is in
+* cache. The accumulator can be attached to a row reader so statistics are
+* collected as rows are decoded.
+*/
+
+#ifndef PNGCORE_ANALYZE_H
+#define PNGCORE_ANALYZE_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+
+#define PNGCORE_ANALYZE_SUBHISTS 4
+
+/* Pixels binned before the 32-bit sub-histograms are folded into totals */
+#define PNGCORE_ANALYZE_FOLD_PIXELS (1u << 30)
+
+/* Running statistics over native scanlines */
+typedef struct {
+  U32 width;
+  int channels;
+  int bit_depth;
+  int alpha;                    /* alpha sample index, -1 if none */
+
+  U32 hist[PNGCORE_ANALYZE_SUBHISTS][4][256];
+  U64 totals[4][256];
+  U64 pending;                  /* pixels in hist since the last fold */
+  U64 pixels;
+
+  /* 16-bit samples only */
+  U64 sum[4];
+  uint16_t min[4];
+  uint16_t max[4];
+  U64 opaque;
+  U64 transparent;
+} pngcore_image_stats_acc_t;
+
+void pngcore_image_stats_acc_init(pngcore_image_stats_acc_t *acc, U32 width, U8 bit_depth, U8 color_type);
+void pngcore_image_stats_acc_row(pngcore_image_stats_acc_t *acc, const U8 *row);
+void pngcore_image_stats_acc_finish(pngcore_image_stats_acc_t *acc, pngcore_image_stats_t *stats);
+
+#endif /* PNGCORE_ANALYZE_H */
@@ -0,0 +1,120 @@
+/**
+* @file pngcore_apng.h
+* @brief Animated PNG decoding
+*
+* Opening an APNG only walks the chunk list. Every frame is recorded with its
+* fcTL fields and the location of its IDAT or fdAT payloads in the file
+* buffer, so no chunk is scanned twice. Each frame is an independent zlib
+* stream, so frames are CRC-checked, inflated and unfiltered on a thread
+* pool. Compositing replays dispose and blend ops over the decoded frames on
+* the calling thread, on a premultiplied RGBA8 canvas.
+*
+* Seeking starts from the nearest earlier frame that does not depend on the
+* canvas beneath it, or continues from the frame last rendered when that is
+* closer.
+*
+* The writer keeps the canvas as displayed and the canvas a frame was drawn
+* on. A new frame is diffed against what each dispose op of the previous
+* frame would leave, and the op with the smallest changed rectangle wins, so
+* only that rectangle is encoded. Unchanged pixels inside it become
+* transparent under source-over blending when every changed pixel is opaque.
+* Frames are filtered and deflated on the thread pool and written in order;
+* each is held back until its successor has chosen its dispose op.
+*/
+
+#ifndef PNGCORE_APNG_H
+#define PNGCORE_APNG_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+#include "pngcore_stream.h"
+#include "pngcore_convert.h"
+#include "pngcore_pool.h"
+#include <pthread.h>
+#include <stdio.h>
+
+/* Compressed payload of one IDAT or fdAT chunk inside the file buffer */
+typedef struct {
+  size_t chunk;         /* offset of the chunk type, for the CRC */
+  U32 length;           /* chunk data length */
+  U32 skip;             /* sequence number bytes before the zlib data */
+  U32 crc;
+} pngcore_apng_segment_t;
+
+typedef struct {
+  pngcore_apng_frame_info_t info;
+  size_t first_segment;
+  size_t num_segments;
+  size_t data_len;      /* zlib bytes over all segments */
+
+  U32 start;            /* first frame to replay onto a clear canvas */
+
+  U8 *pixels;           /* premultiplied RGBA8, NULL until decoded */
+  int rc;
+  pngcore_error_t error;
+} pngcore_apng_frame_t;
+
+struct pngcore_apng {
+  U8 *buf;              /* the whole file */
+  size_t size;
+
+  U32 width;
+  U32 height;
+  U8 bit_depth;
+  U8 color_type;
+  U32 num_plays;
+
+  pngcore_apng_frame_t *frames;
+  U32 num_frames;
+  pngcore_apng_segment_t *segments;
+  size_t num_segments;
+
+  U8 *canvas;           /* premultiplied RGBA8, width * height */
+  U8 *saved;            /* region under a frame disposed to previous */
+  long rendered;        /* frame on the canvas, -1 if none */
+};
+
+/* One frame between diffing and being written */
+typedef struct {
+  struct pngcore_apng_writer *writer;
+  pngcore_apng_frame_info_t info;
+  U8 *pixels;           /* sub-image, RGBA8 */
+  pngcore_mem_buffer_t z;
+  int level;
+  int sealed;           /* dispose op chosen */
+  int done;             /* compressed, under the writer lock */
+  int rc;
+} pngcore_apng_enc_frame_t;
+
+struct pngcore_apng_writer {
+  FILE *fp;
+  long actl_offset;     /* rewritten with the frame count on finish */
+  U32 width;
+  U32 height;
+  U32 num_plays;
+  int level;
+
+  int convert;
+  pngcore_convert_plan_t plan;
+
+  U8 *canvas;           /* last frame as displayed */
+  U8 *base;             /* canvas the last frame was drawn on */
+  U8 *next;             /* incoming frame */
+  U8 *zero_row;
+
+  pngcore_pool_t *pool;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pngcore_apng_enc_frame_t **ring;  /* frames not yet written, in order */
+  size_t window;
+  size_t head;
+  size_t count;
+
+  U32 num_frames;
+  U32 seq;
+  U8 *chunk;            /* fdAT staging: sequence number + payload */
+  int failed;
+  pngcore_error_t error;
+};
+
+#endif /* PNGCORE_APNG_H */
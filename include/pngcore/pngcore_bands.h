@@ -0,0 +1,54 @@
+/**
+* @file pngcore_bands.h
+* @brief Image data encoded as independently replaceable row bands
+*
+* The zlib stream is the 2-byte header, one raw deflate segment per band and
+* the adler32 trailer. Every band but the last ends in a full flush, which
+* byte-aligns the output and empties the window, and the first row of every
+* band is filtered with None or Sub only. A band therefore inflates and
+* unfilters on its own, and a re-encoded band can be spliced between its
+* neighbours. The stream adler32 and the IDAT CRC are rebuilt from the
+* per-band sums with adler32_combine and crc32_combine.
+*
+* Saving writes the band table in a private pcBD chunk after IDAT, tagged
+* with the IDAT CRC. Loading takes the table back only while that CRC still
+* matches, so a file re-encoded elsewhere just loses it.
+*/
+
+#ifndef PNGCORE_BANDS_H
+#define PNGCORE_BANDS_H
+
+#include "pngcore_types.h"
+#include <stdio.h>
+
+#define PNGCORE_ZLIB_HEADER_SIZE  2
+#define PNGCORE_ZLIB_TRAILER_SIZE 4
+
+/* Private, unsafe-to-copy chunk holding the band table */
+#define PNGCORE_BANDS_CHUNK "pcBD"
+
+typedef struct {
+  U64 offset;   /* of the band's deflate data within the IDAT data */
+  U64 length;
+  U32 crc;      /* crc32 of the compressed bytes */
+  U32 adler;    /* adler32 of the filtered rows */
+} pngcore_band_t;
+
+struct pngcore_idat_bands {
+  U32 band_rows;
+  U32 count;
+  int level;
+  pngcore_band_t *bands;
+};
+
+void pngcore_idat_bands_free(struct pngcore_idat_bands *bands);
+
+/* Write the table as a PNGCORE_BANDS_CHUNK chunk for image data with idat_crc */
+int pngcore_idat_bands_write(const struct pngcore_idat_bands *bands, U32 idat_crc, FILE *fp);
+
+/* Table from PNGCORE_BANDS_CHUNK data, or NULL unless it describes exactly
+* the image data with idat_crc and idat_length */
+struct pngcore_idat_bands* pngcore_idat_bands_read(const U8 *data, U32 length, U32 idat_crc,
+                                                   U32 idat_length, U32 height);
+
+#endif /* PNGCORE_BANDS_H */
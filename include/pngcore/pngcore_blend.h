@@ -0,0 +1,37 @@
+/**
+* @file pngcore_blend.h
+* @brief Alpha compositing kernels
+*
+* All kernels operate on premultiplied RGBA, where every mode reduces to
+* per-lane arithmetic on color and alpha alike. 8-bit source-over and plus
+* have SSE2/AVX2 integer kernels; the remaining modes and gamma-correct
+* blending run on floats.
+*/
+
+#ifndef PNGCORE_BLEND_H
+#define PNGCORE_BLEND_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+
+/* Pixels converted to float per step on the float path */
+#define PNGCORE_BLEND_CHUNK 256
+
+/* dst = src over dst, premultiplied RGBA8 */
+void pngcore_blend_over8(U8 *dst, const U8 *src, size_t width);
+
+/* dst = min(src + dst, 1), premultiplied RGBA8 */
+void pngcore_blend_add8(U8 *dst, const U8 *src, size_t width);
+
+/* dst = mode(src, dst), premultiplied RGBA floats in [0, 1] */
+void pngcore_blend_rowf(pngcore_blend_mode_t mode, float *dst, const float *src,
+                        size_t width);
+
+/* Straight RGBA8/RGBA16 samples to premultiplied floats, decoding sRGB to
+* linear light when `linear` is set, and back */
+void pngcore_blend_to_float(const U8 *src, float *dst, size_t width,
+                            int sample_bytes, int linear);
+void pngcore_blend_from_float(const float *src, U8 *dst, size_t width,
+                              int sample_bytes, int linear);
+
+#endif /* PNGCORE_BLEND_H */
@@ -0,0 +1,48 @@
+/**
+* @file pngcore_cache.h
+* @brief Decoded pixel cache files
+*
+* A cache file holds one decoded image: a 64-byte header followed, at the
+* next page boundary, by unfiltered rows in a pixel format of the caller's
+* choice. Rows are padded to PNGCORE_CACHE_ALIGN bytes so every row starts
+* on a cache line. Opening a cache maps it read-only, so processes serving
+* the same image share one copy through the page cache and no decoding
+* happens after the file is written.
+*
+* The source hash covers the IHDR fields and the compressed image data, so
+* a cache can be checked against a PNG without decoding it. Fields are in
+* host byte order, like the .pngidx index.
+*/
+
+#ifndef PNGCORE_CACHE_H
+#define PNGCORE_CACHE_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+
+#define PNGCORE_CACHE_MAGIC      "PNGCACHE"
+#define PNGCORE_CACHE_VERSION    1
+#define PNGCORE_CACHE_BYTE_ORDER 0x01020304
+#define PNGCORE_CACHE_DATA_ALIGN 4096
+
+typedef struct {
+  char magic[8];
+  U32 byte_order;
+  U32 version;
+  U32 width;
+  U32 height;
+  U32 format;
+  U32 reserved;
+  U64 stride;
+  U64 data_offset;
+  U64 source_hash;
+  U64 file_size;
+} pngcore_cache_header_t;
+
+struct pngcore_cache {
+  U8 *map;
+  size_t size;
+  pngcore_pixel_view_t view;
+};
+
+#endif /* PNGCORE_CACHE_H */
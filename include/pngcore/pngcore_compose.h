@@ -0,0 +1,58 @@
+/**
+* @file pngcore_compose.h
+* @brief Multi-image composition (stitching, mosaics)
+*/
+
+#ifndef PNGCORE_COMPOSE_H
+#define PNGCORE_COMPOSE_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+#include <pthread.h>
+
+/* Upper bound on decoded rows queued per input while stitching */
+#define PNGCORE_STITCH_RING_BYTES 1048576  /* 1MB */
+#define PNGCORE_STITCH_MIN_ROWS   4
+#define PNGCORE_STITCH_MAX_ROWS   256
+
+struct pngcore_stitch;
+
+/* Per-input decode queue. A worker fills the ring while the emitter drains
+* it; the ring exists only while its input is being decoded */
+typedef struct {
+  const pngcore_png_t *png;
+  struct pngcore_stitch *ctx;
+
+  U8 *ring;               /* ring_rows scanlines */
+  size_t head;            /* next write slot */
+  size_t tail;            /* next read slot */
+  size_t count;           /* rows queued */
+  U32 rows_total;
+
+  int done;               /* all rows decoded */
+  int failed;
+  pngcore_error_t error;
+} pngcore_stitch_slot_t;
+
+/* Shared stitch state */
+typedef struct pngcore_stitch {
+  pngcore_stitch_slot_t *slots;
+  size_t num_slots;
+  size_t row_bytes;
+  size_t ring_rows;
+  int abort;              /* set by the emitter to release blocked workers */
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} pngcore_stitch_t;
+
+/* One decoded mosaic tile; alive only while its grid row is emitted */
+typedef struct {
+  const pngcore_png_t *png;
+  U8 *pixels;             /* height unfiltered scanlines */
+  size_t row_bytes;
+  int failed;
+  pngcore_error_t error;
+} pngcore_mosaic_tile_t;
+
+#endif /* PNGCORE_COMPOSE_H */
@@ -10,6 +10,9 @@
 #include <semaphore.h>
 #include <sys/types.h>
 
+/* Attempts per fragment before a producer gives up on it and aborts the run */
+#define PNGCORE_FETCH_ATTEMPTS 3
+
 /* Circular buffer entry */
 typedef struct {
   U8 data[MAX_IMG_STRIP_SIZE];  /* image data */
@@ -34,6 +37,7 @@ typedef struct pngcore_concurrent {
   int num_consumers;
   int consumer_delay_ms;
   int image_num;
+  char endpoint[256];
   
   /* Shared memory IDs */
   int shmid_cbuf;
@@ -49,6 +53,7 @@ typedef struct pngcore_concurrent {
   int *entries_produced;
   int *entries_consumed;
   int *next_entry_to_produce;
+  int *aborted;                 /* set when a fragment could not be fetched */
   
   /* Process IDs */
   pid_t *producer_pids;
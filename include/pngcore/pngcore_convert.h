@@ -0,0 +1,72 @@
+/**
+* @file pngcore_convert.h
+* @brief Pixel format conversion
+*
+* Conversions are planned once per format pair. Anything that only moves,
+* duplicates or drops bytes (channel reordering, adding or dropping alpha,
+* gray to color, 8 <-> 16 bit) runs as a byte shuffle with SSSE3/AVX2 pshufb
+* kernels when available. Straight to premultiplied alpha is a shuffle
+* followed by an in-place multiply. Luma and unpremultiply go through a scalar
+* path over canonical 16-bit RGBA.
+*/
+
+#ifndef PNGCORE_CONVERT_H
+#define PNGCORE_CONVERT_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+
+/* Pixels per chunk on the scalar canonical path */
+#define PNGCORE_CONVERT_CHUNK 256
+
+/* Largest pixel (RGBA16) in bytes */
+#define PNGCORE_MAX_PIXEL_BYTES 8
+
+/* Layout of one pixel format */
+typedef struct {
+  U8 channels;          /* samples per pixel */
+  U8 sample_bytes;      /* 1 or 2; 16-bit samples are big-endian as in PNG */
+  signed char r, g, b;  /* sample index of each color; gray uses 0 for all */
+  signed char a;        /* sample index of alpha, -1 if absent */
+  U8 gray;
+  U8 premul;
+} pngcore_format_desc_t;
+
+typedef enum {
+  PNGCORE_CONVERT_COPY = 0,
+  PNGCORE_CONVERT_SHUFFLE,
+  PNGCORE_CONVERT_SHUFFLE_PREMUL,   /* shuffle, then premultiply in place */
+  PNGCORE_CONVERT_GENERIC           /* via canonical straight RGBA16 */
+} pngcore_convert_kind_t;
+
+/* Prepared conversion between two formats */
+typedef struct {
+  pngcore_pixel_format_t src;
+  pngcore_pixel_format_t dst;
+  pngcore_convert_kind_t kind;
+  size_t src_bytes;                   /* bytes per source pixel */
+  size_t dst_bytes;                   /* bytes per destination pixel */
+
+  /* Byte shuffle: dst byte i comes from src byte map[i], or 0xFF if < 0 */
+  signed char map[PNGCORE_MAX_PIXEL_BYTES];
+  size_t group;                       /* pixels per 16-byte shuffle */
+  U8 mask[16];                        /* pshufb control for one group */
+  U8 fill[16];                        /* constant bytes OR'd in after shuffle */
+} pngcore_convert_plan_t;
+
+const pngcore_format_desc_t* pngcore_format_desc(pngcore_pixel_format_t fmt);
+
+int pngcore_convert_plan_init(pngcore_convert_plan_t *plan,
+                              pngcore_pixel_format_t src,
+                              pngcore_pixel_format_t dst);
+void pngcore_convert_plan_run(const pngcore_convert_plan_t *plan,
+                              const U8 *src, U8 *dst, size_t width);
+
+/* Expand 1/2/4-bit gray samples to 8-bit gray */
+void pngcore_unpack_gray(const U8 *src, U8 *dst, size_t width, U8 bit_depth);
+
+/* Pack 8-bit gray into 1/2/4-bit samples, rounding to the nearest level.
+* Exact inverse of pngcore_unpack_gray */
+void pngcore_pack_gray(const U8 *src, U8 *dst, size_t width, U8 bit_depth);
+
+#endif /* PNGCORE_CONVERT_H */
@@ -8,9 +8,12 @@
 
 #include <stddef.h>
 
-/* CRC calculation functions */
+/* CRC calculation functions. pngcore_update_crc only counts bytes;
+* pngcore_crc and pngcore_chunk_crc also time the whole pass */
 void pngcore_make_crc_table(void);
 unsigned long pngcore_update_crc(unsigned long crc, unsigned char *buf, int len);
 unsigned long pngcore_crc(unsigned char *buf, int len);
+unsigned long pngcore_chunk_crc(const unsigned char *type, const unsigned char *data,
+                                size_t len);
 
 #endif /* PNGCORE_CRC_H */
\ No newline at end of file
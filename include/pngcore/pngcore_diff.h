@@ -0,0 +1,35 @@
+/**
+* @file pngcore_diff.h
+* @brief Changed-region detection between two images
+*
+* Both images are decoded in lockstep. A row identical in both costs one
+* memcmp; a differing row is compared again cell by cell with AVX2, and each
+* cell of the grid keeps the tight bounds of its changed pixels. Changed
+* cells that touch, diagonals included, form one region, whose rect is the
+* union of its cell bounds.
+*/
+
+#ifndef PNGCORE_DIFF_H
+#define PNGCORE_DIFF_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+
+/* Cell edge in pixels */
+#define PNGCORE_DIFF_CELL 32
+
+/* Tight bounds of the changed pixels in one cell, inclusive */
+typedef struct {
+  U32 x0;
+  U32 y0;
+  U32 x1;
+  U32 y1;
+  int state;            /* 0 unchanged, 1 changed, 2 assigned to a region */
+} pngcore_diff_cell_t;
+
+/* Number of differing pixels in a row of width pixels; *first and *last
+* receive the outermost differing pixels when the count is non-zero */
+size_t pngcore_diff_row(const U8 *a, const U8 *b, U32 width, size_t pixel_bytes,
+                        U32 *first, U32 *last);
+
+#endif /* PNGCORE_DIFF_H */
@@ -0,0 +1,41 @@
+/**
+* @file pngcore_filter.h
+* @brief Scanline geometry and PNG filter/unfilter operations
+*/
+
+#ifndef PNGCORE_FILTER_H
+#define PNGCORE_FILTER_H
+
+#include "pngcore_types.h"
+
+/* PNG filter types (filter method 0) */
+#define PNGCORE_FILTER_NONE    0
+#define PNGCORE_FILTER_SUB     1
+#define PNGCORE_FILTER_UP      2
+#define PNGCORE_FILTER_AVERAGE 3
+#define PNGCORE_FILTER_PAETH   4
+#define PNGCORE_NUM_FILTERS    5
+
+/* Scanline geometry */
+int pngcore_color_channels(U8 color_type);
+size_t pngcore_pixel_bits(U8 bit_depth, U8 color_type);
+size_t pngcore_filter_bpp(U8 bit_depth, U8 color_type);
+size_t pngcore_scanline_bytes(U32 width, U8 bit_depth, U8 color_type);
+int pngcore_valid_format(U8 bit_depth, U8 color_type);
+
+/* Copy `count` pixels between scanlines. Sub-byte pixels (1, 2 or 4 bits)
+* are packed MSB first as in PNG scanlines */
+void pngcore_copy_pixels(U8 *dst, size_t dst_x, const U8 *src, size_t src_x,
+                         size_t count, size_t pixel_bits);
+
+/* Reverse the filter on one scanline in place. `line` excludes the filter
+* byte, `prev` is the previous unfiltered scanline or NULL for the first row */
+int pngcore_unfilter_row(U8 filter, U8 *line, const U8 *prev, size_t len, size_t bpp);
+
+/* Filter one scanline. `out` receives len + 1 bytes: the filter byte followed
+* by the filtered data. The filter is chosen with the minimum sum of absolute
+* differences heuristic. `scratch` must hold len + 1 bytes */
+void pngcore_filter_row(U8 *out, U8 *scratch, const U8 *line, const U8 *prev,
+                        size_t len, size_t bpp);
+
+#endif /* PNGCORE_FILTER_H */
@@ -0,0 +1,39 @@
+/**
+* @file pngcore_hash.h
+* @brief Streaming 64-bit hash for pixel content
+*
+* The hash follows the XXH3 long-input design: 64-byte stripes feed eight
+* 64-bit accumulators with a 32x32->64 multiply per lane, and the
+* accumulators are scrambled after every block of stripes. It is not
+* bit-compatible with XXH3. Input is consumed incrementally, so rows can be
+* hashed as they leave the decoder.
+*/
+
+#ifndef PNGCORE_HASH_H
+#define PNGCORE_HASH_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+
+#define PNGCORE_HASH_STRIPE 64
+
+/* Stripes accumulated between scrambles */
+#define PNGCORE_HASH_BLOCK_STRIPES 16
+
+/* Incremental hash state */
+typedef struct {
+  U64 acc[8];
+  U8 buf[PNGCORE_HASH_STRIPE];  /* partial stripe */
+  size_t buf_len;
+  size_t stripes;               /* stripes accumulated in the current block */
+  U64 total;                    /* bytes consumed */
+} pngcore_hash_state_t;
+
+void pngcore_hash_init(pngcore_hash_state_t *state);
+void pngcore_hash_update(pngcore_hash_state_t *state, const void *data, size_t len);
+U64 pngcore_hash_final(const pngcore_hash_state_t *state);
+
+/* 1 if both images have byte-identical IHDR, PLTE, tRNS and image data */
+int pngcore_same_encoding(const pngcore_png_t *a, const pngcore_png_t *b);
+
+#endif /* PNGCORE_HASH_H */
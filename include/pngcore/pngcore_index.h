@@ -0,0 +1,84 @@
+/**
+* @file pngcore_index.h
+* @brief Random-access sidecar index (.pngidx)
+*
+* An index is built in one sequential read of a PNG. It records the IHDR
+* fields, the offset of every chunk, a hash of each band of rows and
+* inflate checkpoints, so rows can later be decoded from the middle of the
+* image without inflating everything above them.
+*
+* A checkpoint sits on the first deflate block boundary at or after the
+* start of each band. It holds the bit position in the zlib stream, the
+* last 32 KB of inflated data as a dictionary, the filtered bytes of the row
+* cut by the boundary and the unfiltered row above it.
+*
+* The file is laid out for mmap: a fixed header, then the chunk table,
+* checkpoint table and band hashes at 8-byte aligned offsets, then the
+* checkpoint data. Fields are in host byte order; byte_order rejects
+* indexes written on a machine of the other endianness.
+*/
+
+#ifndef PNGCORE_INDEX_H
+#define PNGCORE_INDEX_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+
+#define PNGCORE_INDEX_MAGIC      "PNGIDX\r\n"
+#define PNGCORE_INDEX_VERSION    1
+#define PNGCORE_INDEX_BYTE_ORDER 0x01020304
+#define PNGCORE_INDEX_WINDOW     32768
+
+typedef struct {
+  char magic[8];
+  U32 byte_order;
+  U32 version;
+  U64 source_size;      /* PNG bytes up to the end of IEND */
+  U32 width;
+  U32 height;
+  U8 bit_depth;
+  U8 color_type;
+  U8 interlace;
+  U8 reserved0;
+  U32 band_rows;
+  U32 num_chunks;
+  U32 num_checkpoints;
+  U32 num_bands;
+  U32 reserved1;
+  U64 chunks_offset;
+  U64 checkpoints_offset;
+  U64 hashes_offset;
+  U64 data_offset;
+  U64 file_size;        /* of the index itself */
+} pngcore_index_header_t;
+
+typedef struct {
+  U64 offset;           /* of the length field in the PNG */
+  U32 length;
+  U32 crc;
+  char type[4];
+  U32 reserved;
+} pngcore_index_chunk_t;
+
+typedef struct {
+  U64 in;               /* zlib stream bytes consumed, over all IDAT payloads */
+  U64 out;              /* filtered bytes inflated */
+  U64 data;             /* window, then prefix, then the row above */
+  U32 row;              /* row cut by the checkpoint */
+  U32 window_len;
+  U32 prefix_len;       /* filtered bytes of row before the checkpoint */
+  U8 bits;              /* unused bits of byte in - 1 */
+  U8 reserved[3];
+} pngcore_index_checkpoint_t;
+
+struct pngcore_index {
+  U8 *map;
+  size_t size;
+  const pngcore_index_header_t *header;
+  const pngcore_index_chunk_t *chunks;
+  const pngcore_index_checkpoint_t *checkpoints;
+  const U64 *hashes;
+  size_t row_bytes;
+};
+
+#endif /* PNGCORE_INDEX_H */
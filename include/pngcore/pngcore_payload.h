@@ -0,0 +1,29 @@
+/**
+* @file pngcore_payload.h
+* @brief Reference-counted chunk payloads
+*
+* Image data is held in a payload shared by every PNG object cloned from the
+* same source and by every chunk view handed out for it. A payload is
+* immutable while shared: a holder that wants to change the bytes asks for
+* a writable copy, which is only made when someone else still holds it.
+*/
+
+#ifndef PNGCORE_PAYLOAD_H
+#define PNGCORE_PAYLOAD_H
+
+#include "pngcore_types.h"
+#include <stdatomic.h>
+
+typedef struct {
+  atomic_uint refs;
+  size_t size;   /* allocated bytes */
+  U8 *data;
+} pngcore_payload_t;
+
+/* Wrap malloc'd data with one reference; NULL leaves data with the caller */
+pngcore_payload_t* pngcore_payload_adopt(U8 *data, size_t size);
+pngcore_payload_t* pngcore_payload_retain(pngcore_payload_t *payload);
+void pngcore_payload_release(pngcore_payload_t *payload);
+int pngcore_payload_shared(const pngcore_payload_t *payload);
+
+#endif /* PNGCORE_PAYLOAD_H */
@@ -7,6 +7,7 @@
 #define PNGCORE_PNG_H
 
 #include "pngcore_types.h"
+#include "pngcore_payload.h"
 #include <stdio.h>
 
 /******************************************************************************
@@ -20,8 +21,30 @@ typedef struct {
   U32 crc;     /* CRC field */
 } pngcore_raw_chunk_t;
 
+/* Chunks other than IHDR, IDAT and IEND, kept as the bytes read from the
+* file (length, type, data, CRC) and only CRC-checked or decoded on access */
+typedef struct {
+  U8  type[4];
+  U32 length;       /* data length */
+  size_t offset;    /* of the length field in the list's bytes */
+  U8  after_idat;   /* written after the image data on save */
+} pngcore_chunk_ref_t;
+
+/* Shared by reference count between cloned PNGs and chunk views; not
+* modified once loading is done */
+typedef struct {
+  U8 *bytes;
+  size_t size;
+  size_t cap;
+  pngcore_chunk_ref_t *refs;
+  size_t count;
+  size_t cap_refs;
+  atomic_uint holders;
+} pngcore_chunk_list_t;
+
 typedef struct {
   pngcore_raw_chunk_t *chunks[3]; /* 0: IHDR, 1: IDAT, 2: IEND */
+  pngcore_chunk_list_t *extra;    /* PLTE and ancillary chunks, NULL if none */
 } pngcore_raw_png_t;
 
 /******************************************************************************
@@ -48,12 +71,16 @@ typedef struct {
 /* IDAT data */
 typedef struct {
   U32 length;  /* length of data in the chunk */
-  U8  *data;   /* compressed image data */
+  U8  *data;   /* compressed image data, owned by payload */
+  pngcore_payload_t *payload;  /* shared with clones and chunk views */
 } pngcore_idat_data_t;
 
+struct pngcore_idat_bands;
+
 typedef struct {
   pngcore_idat_data_t *p_data;
-  U32 crc;
+  U32 crc;                           /* of the type and data, kept current */
+  struct pngcore_idat_bands *bands;  /* band layout, NULL unless band-encoded */
 } pngcore_idat_t;
 
 /* IEND */
@@ -66,6 +93,7 @@ typedef struct {
   pngcore_ihdr_t *ihdr;
   pngcore_idat_t *idat;  /* only handles one IDAT chunk */
   pngcore_iend_t *iend;
+  pngcore_chunk_list_t *extra;  /* PLTE and ancillary chunks, NULL if none */
 } pngcore_simple_png_t;
 
 /* Public PNG structure */
@@ -75,8 +103,12 @@ struct pngcore_png {
 };
 
 /* Public chunk structure */
+/* Public chunk structure. A view of image data or of a raw ancillary chunk
+* holds a reference instead of a copy */
 struct pngcore_chunk {
   pngcore_raw_chunk_t *internal;
+  pngcore_payload_t *payload;   /* owner of internal->p_data, or NULL */
+  pngcore_chunk_list_t *list;   /* owner of internal->p_data, or NULL */
 };
 
 /******************************************************************************
@@ -102,12 +134,29 @@ pngcore_raw_chunk_t* pngcore_load_raw_chunk(U8 *buf, size_t buf_size, size_t off
 void pngcore_free_raw_png(pngcore_raw_png_t *raw_png);
 void pngcore_free_raw_chunk(pngcore_raw_chunk_t *raw_chunk);
 
+/* Chunk list: append copies a whole chunk starting at its length field */
+int pngcore_chunk_list_add(pngcore_chunk_list_t **list, const U8 *chunk, U8 after_idat);
+pngcore_chunk_list_t* pngcore_chunk_list_retain(pngcore_chunk_list_t *list);
+const pngcore_chunk_ref_t* pngcore_chunk_list_find(const pngcore_chunk_list_t *list,
+                                                   const char type[4], size_t start, size_t *index);
+const U8* pngcore_chunk_ref_data(const pngcore_chunk_list_t *list, const pngcore_chunk_ref_t *ref);
+int pngcore_chunk_ref_crc_ok(const pngcore_chunk_list_t *list, const pngcore_chunk_ref_t *ref);
+/* Raw chunk whose p_data points into the list; free only the struct */
+pngcore_raw_chunk_t* pngcore_chunk_ref_view(const pngcore_chunk_list_t *list,
+                                            const pngcore_chunk_ref_t *ref);
+int pngcore_chunk_list_write(const pngcore_chunk_list_t *list, U8 after_idat, FILE *fp);
+/* Drop one chunk; only while loading, before the list is shared */
+void pngcore_chunk_list_remove(pngcore_chunk_list_t *list, size_t index);
+/* Drops one reference; the list is freed with the last */
+void pngcore_chunk_list_free(pngcore_chunk_list_t *list);
+
 /******************************************************************************
 * PARSED PNG FUNCTIONS
 *****************************************************************************/
 
 /* Creation and parsing */
 pngcore_simple_png_t* pngcore_new_simple_png(void);
+pngcore_simple_png_t* pngcore_clone_simple_png(const pngcore_simple_png_t *png);
 pngcore_simple_png_t* pngcore_parse_raw(pngcore_raw_png_t *raw_png, Error *error);
 
 /* Chunk parsing */
@@ -125,12 +174,22 @@ pngcore_raw_png_t* pngcore_png_to_raw(pngcore_simple_png_t *png, Error *error);
 void pngcore_write_png_file(const char *filename, pngcore_simple_png_t *png, Error *error);
 int pngcore_write_file(const char *path, const void *in, size_t len);
 
+/* Create a fresh temp file next to path with mode 0666 minus the umask.
+ * Returns the fd and stores the malloc'd name in *tmp_path, or -1 */
+int pngcore_open_temp(const char *path, char **tmp_path);
+
 /* Memory management */
 void pngcore_free_simple_png(pngcore_simple_png_t *png);
 void pngcore_free_ihdr(pngcore_ihdr_t *ihdr);
 void pngcore_free_idat(pngcore_idat_t *idat);
 void pngcore_free_iend(pngcore_iend_t *iend);
 
+/* IDAT payload: set_data takes ownership of malloc'd data; writable
+* returns at least size bytes this IDAT alone holds, copying the current
+* data first if it is shared */
+int pngcore_idat_set_data(pngcore_idat_t *idat, U8 *data, U32 length);
+U8* pngcore_idat_writable(pngcore_idat_t *idat, size_t size);
+
 /* IDAT operations */
 ssize_t pngcore_inflate_idat(U8 *dest_buf, pngcore_raw_png_t *src_png);
 ssize_t pngcore_deflate_idat(U8 *src_buf, U64 src_len, pngcore_simple_png_t *dest_png);
@@ -0,0 +1,44 @@
+/**
+* @file pngcore_pool.h
+* @brief Fixed-size worker thread pool with a FIFO task queue
+*/
+
+#ifndef PNGCORE_POOL_H
+#define PNGCORE_POOL_H
+
+#include <pthread.h>
+
+typedef void (*pngcore_task_fn)(void *arg);
+
+/* Queued task */
+typedef struct pngcore_task {
+  pngcore_task_fn fn;
+  void *arg;
+  struct pngcore_task *next;
+} pngcore_task_t;
+
+/* Thread pool structure */
+typedef struct pngcore_pool {
+  pthread_t *threads;
+  int num_threads;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;   /* signalled when a task is queued */
+  pthread_cond_t idle_cond;   /* signalled when the pool drains */
+
+  pngcore_task_t *head;       /* tasks run in submission order */
+  pngcore_task_t *tail;
+  int pending;                /* queued + running tasks */
+  int shutdown;
+} pngcore_pool_t;
+
+/* Number of online CPUs, at least 1 */
+int pngcore_pool_default_threads(void);
+
+/* num_threads <= 0 selects pngcore_pool_default_threads() */
+pngcore_pool_t* pngcore_pool_create(int num_threads);
+int pngcore_pool_submit(pngcore_pool_t *pool, pngcore_task_fn fn, void *arg);
+void pngcore_pool_wait(pngcore_pool_t *pool);
+void pngcore_pool_destroy(pngcore_pool_t *pool);
+
+#endif /* PNGCORE_POOL_H */
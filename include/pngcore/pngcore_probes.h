@@ -0,0 +1,44 @@
+/**
+* @file pngcore_probes.h
+* @brief USDT static probes for bpftrace and perf
+*
+* With <sys/sdt.h> (systemtap-sdt-dev) present each probe is a single nop
+* plus a note in the binary that a tracer can attach to; the arguments stay
+* where the compiler already has them and are only read by an attached
+* tracer. Without the header, or when built with -DPNGCORE_NO_PROBES, the
+* probes compile to nothing.
+*
+* Provider "pngcore", probes and arguments:
+*   chunk_parse     type (4 chars), length, offset
+*   crc_mismatch    type (4 chars), expected, computed
+*   inflate_start   input bytes
+*   inflate_done    input bytes, output bytes, zlib status
+*   cbuf_add        sequence, depth after the add
+*   cbuf_get        sequence, depth after the get
+*   http_start      url
+*   http_done       url, curl status, body bytes
+*   fragment_place  sequence, consumer, offset in the image buffer
+*/
+
+#ifndef PNGCORE_PROBES_H
+#define PNGCORE_PROBES_H
+
+#if !defined(PNGCORE_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PNGCORE_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef PNGCORE_HAVE_PROBES
+#define PNGCORE_PROBE1(name, a) DTRACE_PROBE1(pngcore, name, a)
+#define PNGCORE_PROBE2(name, a, b) DTRACE_PROBE2(pngcore, name, a, b)
+#define PNGCORE_PROBE3(name, a, b, c) DTRACE_PROBE3(pngcore, name, a, b, c)
+#else
+/* Arguments are still evaluated so values kept only for a probe stay used */
+#define PNGCORE_PROBE1(name, a) do { (void)(a); } while (0)
+#define PNGCORE_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define PNGCORE_PROBE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while (0)
+#endif
+
+#endif /* PNGCORE_PROBES_H */
@@ -0,0 +1,67 @@
+/**
+* @file pngcore_resize.h
+* @brief Streaming separable image resampling
+*
+* Source rows arrive from the streaming decoder in batches. Each batch is
+* resampled horizontally in parallel into a ring of float rows; every output
+* row whose vertical window is complete is then resampled vertically in
+* parallel and handed to the streaming encoder. Memory depends on the image
+* widths and filter support, not on the heights.
+*/
+
+#ifndef PNGCORE_RESIZE_H
+#define PNGCORE_RESIZE_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+#include "pngcore_pool.h"
+
+/* Source rows decoded and resampled horizontally per step */
+#define PNGCORE_RESIZE_BATCH_ROWS 32
+
+/* Output rows resampled vertically per step */
+#define PNGCORE_RESIZE_BAND_ROWS 32
+
+/* Precomputed filter taps along one axis */
+typedef struct {
+  U32 *start;           /* first source index per output index */
+  U32 *count;           /* taps used per output index */
+  float *weights;       /* `taps` normalized weights per output index */
+  U32 taps;             /* stride of weights */
+} pngcore_resize_coeffs_t;
+
+/* Shared resampler state */
+typedef struct {
+  U32 in_w, in_h;
+  U32 out_w, out_h;
+  int channels;
+  int sample_bytes;     /* 1 or 2; 16-bit samples are big-endian */
+
+  pngcore_resize_coeffs_t hc;
+  pngcore_resize_coeffs_t vc;
+
+  U8 *batch;            /* decoded source rows of the current step */
+  size_t in_row_bytes;
+  U32 batch_first;      /* source row index of batch[0] */
+
+  float *ring;          /* horizontally resampled rows, by source row % ring_rows */
+  U32 ring_rows;
+  size_t ring_stride;   /* floats per ring row */
+
+  U8 *band;             /* output rows of the current step */
+  size_t out_row_bytes;
+  U32 band_first;       /* output row index of band[0] */
+
+  float **scratch;      /* one float row per task */
+  pngcore_pool_t *pool;
+} pngcore_resize_t;
+
+/* Range of rows handled by one task */
+typedef struct {
+  pngcore_resize_t *ctx;
+  U32 begin;
+  U32 end;
+  int index;            /* selects the task's scratch row */
+} pngcore_resize_task_t;
+
+#endif /* PNGCORE_RESIZE_H */
@@ -0,0 +1,34 @@
+/**
+* @file pngcore_split.h
+* @brief Parallel split of one PNG into standalone tiles
+*
+* The source is decoded once, one band of tile rows at a time, into one of
+* two band buffers. Tiles of a band are encoded on the thread pool while the
+* next band is decoded into the other buffer, so peak memory is two bands
+* plus the encoded tiles of one band.
+*/
+
+#ifndef PNGCORE_SPLIT_H
+#define PNGCORE_SPLIT_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+#include "pngcore_stream.h"
+
+/* One output tile of the current band */
+typedef struct {
+  const pngcore_png_t *src; /* source of PLTE and tRNS */
+  const U8 *band;           /* first source row of the band */
+  size_t band_stride;       /* source row bytes */
+  U32 x;                    /* tile origin column in the source */
+  U32 width;
+  U32 height;
+  U8 bit_depth;
+  U8 color_type;
+
+  pngcore_mem_buffer_t out; /* encoded PNG */
+  int rc;
+  pngcore_error_t error;
+} pngcore_split_tile_t;
+
+#endif /* PNGCORE_SPLIT_H */
@@ -0,0 +1,76 @@
+/**
+* @file pngcore_stats.h
+* @brief Library-wide performance counters
+*
+* Every thread or process keeps its counters in a block of its own, claimed
+* on first use from one shared anonymous mapping, so a hot path pays a plain
+* increment and workers forked by the concurrent processor still count
+* towards the parent's totals. pngcore_stats_get sums the blocks on read.
+* Blocks of exited threads and processes are folded into a common total and
+* handed out again.
+*/
+
+#ifndef PNGCORE_STATS_H
+#define PNGCORE_STATS_H
+
+#include "pngcore_types.h"
+#include <stddef.h>
+#include <time.h>
+
+#define PNGCORE_STATS_MAX_BLOCKS 256
+
+/* Same order as the fields of pngcore_stats_t */
+typedef enum {
+  PNGCORE_STAT_BYTES_PARSED,
+  PNGCORE_STAT_BYTES_CRC,
+  PNGCORE_STAT_BYTES_INFLATED,
+  PNGCORE_STAT_BYTES_DEFLATED,
+  PNGCORE_STAT_PARSE_NS,
+  PNGCORE_STAT_CRC_NS,
+  PNGCORE_STAT_INFLATE_NS,
+  PNGCORE_STAT_DEFLATE_NS,
+  PNGCORE_STAT_ALLOCATIONS,
+  PNGCORE_STAT_BYTES_ALLOCATED,
+  PNGCORE_STAT_HTTP_REQUESTS,
+  PNGCORE_STAT_HTTP_RETRIES,
+  PNGCORE_STAT_COUNT
+} pngcore_stat_t;
+
+typedef struct {
+  U64 v[PNGCORE_STAT_COUNT];
+} __attribute__((aligned(64))) pngcore_stats_block_t;
+
+extern __thread pngcore_stats_block_t *pngcore_stats_local;
+
+/* Claims the calling thread's block, or counts atomically if none is left */
+void pngcore_stats_add_slow(pngcore_stat_t stat, U64 n);
+
+/* Map the counters before forking workers so their counts reach us */
+void pngcore_stats_init(void);
+
+static inline void pngcore_stats_add(pngcore_stat_t stat, U64 n) {
+  pngcore_stats_block_t *block = pngcore_stats_local;
+  if (block) {
+    block->v[stat] += n;
+  } else {
+    pngcore_stats_add_slow(stat, n);
+  }
+}
+
+static inline U64 pngcore_stats_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (U64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Charge the time since start to a phase counter */
+static inline void pngcore_stats_since(pngcore_stat_t stat, U64 start) {
+  pngcore_stats_add(stat, pngcore_stats_now() - start);
+}
+
+/* Counting allocators used throughout the library */
+void* pngcore_malloc(size_t size);
+void* pngcore_calloc(size_t count, size_t size);
+void* pngcore_realloc(void *ptr, size_t size);
+
+#endif /* PNGCORE_STATS_H */
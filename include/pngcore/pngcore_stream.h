@@ -0,0 +1,138 @@
+/**
+* @file pngcore_stream.h
+* @brief Streaming scanline decoder and encoder
+*
+* The reader inflates IDAT data incrementally and unfilters one scanline at a
+* time, so only two scanlines are resident. The writer filters and deflates
+* rows as they arrive and emits IDAT chunks through a sink as soon as they
+* fill, so the encoded image is never held in memory.
+*/
+
+#ifndef PNGCORE_STREAM_H
+#define PNGCORE_STREAM_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+#include "pngcore_convert.h"
+#include "pngcore_analyze.h"
+#include <stdio.h>
+#include <zlib.h>
+
+/* Payload size of IDAT chunks emitted by the writer */
+#define PNGCORE_STREAM_IDAT_SIZE 65536
+
+/* Output sink: returns 0 on success */
+typedef int (*pngcore_sink_fn)(void *ctx, const U8 *buf, size_t len);
+
+/* Streaming row decoder */
+struct pngcore_row_reader {
+  z_stream strm;
+  int strm_open;
+
+  U32 width;
+  U32 height;
+  U8  bit_depth;
+  U8  color_type;
+  size_t row_bytes;     /* scanline bytes, excluding the filter byte */
+  size_t bpp;           /* filter distance in bytes */
+
+  U8 *lines;            /* two scanlines of row_bytes + 1 */
+  U8 *cur;              /* filter byte + current scanline */
+  U8 *prev;             /* filter byte + previous scanline */
+
+  /* Optional output format conversion */
+  int convert;
+  pngcore_convert_plan_t plan;
+  U8 *unpacked;         /* sub-byte gray expanded to 8 bits, or indices to RGBA8 */
+  U8 *palette;          /* 256 RGBA8 entries built from PLTE and tRNS */
+  int has_key;          /* tRNS colour key of a gray or RGB source */
+  uint16_t key[3];
+  U8 *converted;        /* row in the requested format */
+  size_t out_row_bytes;
+
+  /* Optional statistics over native rows */
+  pngcore_image_stats_acc_t *stats_acc;
+  pngcore_image_stats_t *stats;
+
+  U32 y;                /* number of rows returned so far */
+  int failed;
+};
+
+/* Streaming row encoder */
+struct pngcore_row_writer {
+  pngcore_sink_fn sink;
+  void *sink_ctx;
+  FILE *fp;             /* owned when created from a filename */
+
+  z_stream strm;
+  int strm_open;
+
+  U32 width;
+  U32 height;
+  U8  bit_depth;
+  U8  color_type;
+  size_t row_bytes;
+  size_t bpp;
+
+  U8 *prev;             /* previous unfiltered scanline */
+  U8 *filtered;         /* filter byte + filtered scanline */
+  U8 *scratch;          /* candidate buffer for filter selection */
+  U8 *zbuf;             /* IDAT payload staged until full */
+
+  /* Optional input format conversion */
+  int convert;
+  pngcore_convert_plan_t plan;
+  U8 *converted;
+
+  int has_palette;      /* PLTE written; indexed images need one */
+
+  U32 y;                /* number of rows written so far */
+  int failed;
+  int finished;
+};
+
+/* Reader over an in-memory zlib stream with the given geometry */
+pngcore_row_reader_t* pngcore_row_reader_open(const U8 *zdata, size_t zlen,
+                                              U32 width, U32 height,
+                                              U8 bit_depth, U8 color_type,
+                                              pngcore_error_t *error);
+
+/* Load PLTE and tRNS of the source; call before set_format. Indexed rows
+* are then expanded through the palette, and gray or RGB pixels matching a
+* tRNS colour key get zero alpha when the output format has alpha */
+int pngcore_row_reader_load_palette(pngcore_row_reader_t *reader, const pngcore_png_t *src,
+                                    pngcore_error_t *error);
+
+/* Writer emitting a complete PNG file through a sink */
+pngcore_row_writer_t* pngcore_row_writer_open(pngcore_sink_fn sink, void *ctx,
+                                              U32 width, U32 height,
+                                              U8 bit_depth, U8 color_type,
+                                              int level, pngcore_error_t *error);
+
+/* Copy PLTE and tRNS of a source image; call before the first row. Fails
+* when an indexed writer gets no palette */
+int pngcore_row_writer_copy_palette(pngcore_row_writer_t *writer, const pngcore_png_t *src,
+                                    pngcore_error_t *error);
+
+/* 1 if both images carry byte-identical PLTE and tRNS chunks, or neither */
+int pngcore_same_palette(const pngcore_png_t *a, const pngcore_png_t *b);
+
+/* Sink writing to a stdio stream */
+int pngcore_file_sink(void *ctx, const U8 *buf, size_t len);
+
+/* Growable buffer filled by pngcore_mem_sink; zero-initialize before use
+* and free data when done */
+typedef struct {
+  U8 *data;
+  size_t len;
+  size_t cap;
+} pngcore_mem_buffer_t;
+
+/* Sink appending to a pngcore_mem_buffer_t */
+int pngcore_mem_sink(void *ctx, const U8 *buf, size_t len);
+
+/* Emit one chunk (length, type, data, CRC) through a sink */
+int pngcore_write_chunk(pngcore_sink_fn sink, void *ctx, const char type[4],
+                        const U8 *data, U32 len);
+
+#endif /* PNGCORE_STREAM_H */
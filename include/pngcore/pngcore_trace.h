@@ -0,0 +1,81 @@
+/**
+* @file pngcore_trace.h
+* @brief Pipeline stage tracing into per-worker ring buffers
+*
+* The buffers live in one shared anonymous mapping made by
+* pngcore_trace_enable, so producer and consumer processes forked afterwards
+* record into it and the parent can dump every worker's events. Each thread
+* or process claims its own ring on its first event and is the only writer
+* of it; a full ring overwrites its oldest events. While tracing is off a
+* trace point costs a load and a branch.
+*/
+
+#ifndef PNGCORE_TRACE_H
+#define PNGCORE_TRACE_H
+
+#include "pngcore_types.h"
+#include <stdatomic.h>
+
+#define PNGCORE_TRACE_MAX_WORKERS 64
+#define PNGCORE_TRACE_NAME_SIZE   32
+
+typedef enum {
+  PNGCORE_TRACE_FETCH,
+  PNGCORE_TRACE_ENQUEUE,
+  PNGCORE_TRACE_DEQUEUE,
+  PNGCORE_TRACE_PARSE,
+  PNGCORE_TRACE_CRC,
+  PNGCORE_TRACE_INFLATE,
+  PNGCORE_TRACE_PLACE,
+  PNGCORE_TRACE_DEFLATE,
+  PNGCORE_TRACE_STAGE_COUNT
+} pngcore_trace_stage_t;
+
+typedef struct {
+  U64 start;        /* ns since tracing was enabled */
+  U64 duration;     /* ns */
+  U64 bytes;
+  U32 stage;
+  int seq;          /* fragment sequence number, -1 if none */
+} pngcore_trace_event_t;
+
+typedef struct {
+  U64 head;         /* events written; the ring holds the last capacity */
+  int pid;
+  int tid;
+  char name[PNGCORE_TRACE_NAME_SIZE];
+} pngcore_trace_ring_t;
+
+typedef struct {
+  atomic_int on;
+  atomic_uint generation;     /* bumped by every enable */
+  atomic_uint workers;        /* rings claimed */
+  atomic_ulong dropped;       /* events from workers beyond the last ring */
+  U64 origin;                 /* CLOCK_MONOTONIC ns at enable */
+  U64 capacity;               /* events per ring */
+  size_t map_size;
+} pngcore_trace_shared_t;
+
+extern pngcore_trace_shared_t *pngcore_trace_shared;
+
+U64 pngcore_trace_now(void);
+void pngcore_trace_record(pngcore_trace_stage_t stage, U64 start, int seq, U64 bytes);
+
+/* Name the calling worker in the dump, e.g. "producer 3" */
+void pngcore_trace_name(const char *fmt, ...);
+
+/* Start of a stage, or 0 when tracing is off */
+static inline U64 pngcore_trace_begin(void) {
+  pngcore_trace_shared_t *shared = pngcore_trace_shared;
+  return shared && atomic_load_explicit(&shared->on, memory_order_relaxed)
+         ? pngcore_trace_now() : 0;
+}
+
+static inline void pngcore_trace_end(pngcore_trace_stage_t stage, U64 start, int seq,
+                                     U64 bytes) {
+  if (start) {
+    pngcore_trace_record(stage, start, seq, bytes);
+  }
+}
+
+#endif /* PNGCORE_TRACE_H */
@@ -0,0 +1,40 @@
+/**
+* @file pngcore_transform.h
+* @brief Geometric transforms
+*
+* Every orientation is expressed as a strided view of the source: output
+* pixel (x, y) is read from base + y * row_step + x * col_step, or from
+* base + x * row_step + y * col_step for the transposing orientations.
+* Transposes walk the output in cache-sized tiles of 8x8 blocks, and 32-bit
+* pixels are transposed in AVX2 registers one block at a time.
+*/
+
+#ifndef PNGCORE_TRANSFORM_H
+#define PNGCORE_TRANSFORM_H
+
+#include "pngcore.h"
+#include "pngcore_types.h"
+
+/* Output tile edge in pixels; a multiple of the 8x8 block */
+#define PNGCORE_TRANSFORM_TILE 64
+
+/* Images smaller than this many pixels are reoriented on the caller's thread */
+#define PNGCORE_TRANSFORM_MIN_PARALLEL (512 * 512)
+
+/* Source view and output rows of one task */
+typedef struct {
+  const U8 *base;       /* source pixel feeding output (0, 0) */
+  ptrdiff_t row_step;   /* signed source row stride */
+  ptrdiff_t col_step;   /* signed source pixel stride */
+  int transpose;
+
+  U8 *dst;
+  size_t dst_stride;
+  U32 out_w;
+  size_t pixel_bytes;
+
+  U32 y_begin;          /* output rows [y_begin, y_end) */
+  U32 y_end;
+} pngcore_orient_task_t;
+
+#endif /* PNGCORE_TRANSFORM_H */
@@ -0,0 +1,305 @@
+/**
+* @file pngcore_analyze.c
+* @brief Histograms and per-channel statistics
+*/
+
+#include "pngcore/pngcore_analyze.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_stream.h"
+#include "pngcore/pngcore_filter.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PNGCORE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/******************************************************************************
+* HISTOGRAM KERNELS
+*****************************************************************************/
+
+/* Consecutive pixels go to different sub-histograms; C is a constant after
+* inlining, so each channel count gets its own unrolled loop */
+static inline void hist8(pngcore_image_stats_acc_t *acc, const U8 *p, size_t width, const int C) {
+  U32 (*h)[4][256] = acc->hist;
+  size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    for (int c = 0; c < C; c++) {
+      h[0][c][p[c]]++;
+      h[1][c][p[C + c]]++;
+      h[2][c][p[2 * C + c]]++;
+      h[3][c][p[3 * C + c]]++;
+    }
+    p += 4 * C;
+  }
+  for (; x < width; x++) {
+    for (int c = 0; c < C; c++) {
+      h[0][c][p[c]]++;
+    }
+    p += C;
+  }
+}
+
+/* 16-bit samples are binned by high byte; exact sums ride along */
+static inline void hist16(pngcore_image_stats_acc_t *acc, const U8 *p, size_t width, const int C) {
+  U32 (*h)[4][256] = acc->hist;
+  for (size_t x = 0; x < width; x++) {
+    for (int c = 0; c < C; c++) {
+      h[x & 3][c][p[2 * c]]++;
+      acc->sum[c] += (U32)((p[2 * c] << 8) | p[2 * c + 1]);
+    }
+    p += 2 * C;
+  }
+}
+
+static void hist_subbyte(pngcore_image_stats_acc_t *acc, const U8 *row, size_t width) {
+  int bd = acc->bit_depth;
+  U8 mask = (U8)((1u << bd) - 1);
+  for (size_t x = 0; x < width; x++) {
+    size_t bit = x * bd;
+    acc->hist[x & 3][0][(row[bit >> 3] >> (8 - bd - (bit & 7))) & mask]++;
+  }
+}
+
+/******************************************************************************
+* 16-BIT RANGE KERNELS
+*****************************************************************************/
+
+static void range16_scalar(pngcore_image_stats_acc_t *acc, const U8 *p, size_t samples,
+                           size_t first) {
+  int C = acc->channels;
+  for (size_t i = 0; i < samples; i++) {
+    int c = (int)((first + i) % C);
+    uint16_t v = (uint16_t)((p[2 * i] << 8) | p[2 * i + 1]);
+    if (v < acc->min[c]) acc->min[c] = v;
+    if (v > acc->max[c]) acc->max[c] = v;
+    if (c == acc->alpha) {
+      acc->opaque += (v == 0xFFFF);
+      acc->transparent += (v == 0);
+    }
+  }
+}
+
+#ifdef PNGCORE_X86_SIMD
+
+static int has_avx2 = -1;
+
+static int detect_avx2(void) {
+  if (has_avx2 < 0) {
+    __builtin_cpu_init();
+    has_avx2 = __builtin_cpu_supports("avx2");
+  }
+  return has_avx2;
+}
+
+/* Each step covers C vectors of 16 samples, so lane l of vector k always
+* holds channel (16k + l) % C. Samples are byte-swapped to host order for
+* unsigned min/max. Returns samples consumed */
+__attribute__((target("avx2")))
+static size_t range16_avx2(pngcore_image_stats_acc_t *acc, const U8 *p, size_t samples) {
+  const int C = acc->channels;
+  const size_t step = 16 * (size_t)C;
+  if (samples < step) return 0;
+
+  const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  const __m256i ones = _mm256_set1_epi16(-1);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i vmin[4], vmax[4];
+  U32 alpha_bits[4] = {0};
+
+  for (int k = 0; k < C; k++) {
+    vmin[k] = ones;
+    vmax[k] = zero;
+    for (int l = 0; l < 16; l++) {
+      if ((16 * k + l) % C == acc->alpha) alpha_bits[k] |= 3u << (2 * l);
+    }
+  }
+
+  U64 opaque = 0, transparent = 0;
+  size_t i = 0;
+  for (; i + step <= samples; i += step) {
+    for (int k = 0; k < C; k++) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(p + 2 * (i + 16 * k)));
+      v = _mm256_shuffle_epi8(v, swap);
+      vmin[k] = _mm256_min_epu16(vmin[k], v);
+      vmax[k] = _mm256_max_epu16(vmax[k], v);
+      if (alpha_bits[k]) {
+        U32 full = (U32)_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, ones)) & alpha_bits[k];
+        U32 none = (U32)_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, zero)) & alpha_bits[k];
+        opaque += __builtin_popcount(full) / 2;
+        transparent += __builtin_popcount(none) / 2;
+      }
+    }
+  }
+
+  for (int k = 0; k < C; k++) {
+    uint16_t lo[16], hi[16];
+    _mm256_storeu_si256((__m256i *)lo, vmin[k]);
+    _mm256_storeu_si256((__m256i *)hi, vmax[k]);
+    for (int l = 0; l < 16; l++) {
+      int c = (16 * k + l) % C;
+      if (lo[l] < acc->min[c]) acc->min[c] = lo[l];
+      if (hi[l] > acc->max[c]) acc->max[c] = hi[l];
+    }
+  }
+  acc->opaque += opaque;
+  acc->transparent += transparent;
+  return i;
+}
+
+#endif /* PNGCORE_X86_SIMD */
+
+/******************************************************************************
+* ACCUMULATOR
+*****************************************************************************/
+
+void pngcore_image_stats_acc_init(pngcore_image_stats_acc_t *acc, U32 width,
+                                  U8 bit_depth, U8 color_type) {
+  memset(acc, 0, sizeof(*acc));
+  acc->width = width;
+  acc->bit_depth = bit_depth;
+  acc->channels = pngcore_color_channels(color_type);
+  acc->alpha = (color_type == PNGCORE_COLOR_RGBA) ? 3 :
+               (color_type == PNGCORE_COLOR_GRAYSCALE_ALPHA) ? 1 : -1;
+  for (int c = 0; c < 4; c++) {
+    acc->min[c] = 0xFFFF;
+  }
+}
+
+static void fold(pngcore_image_stats_acc_t *acc) {
+  for (int s = 0; s < PNGCORE_ANALYZE_SUBHISTS; s++) {
+    for (int c = 0; c < acc->channels; c++) {
+      for (int b = 0; b < 256; b++) {
+        acc->totals[c][b] += acc->hist[s][c][b];
+      }
+    }
+  }
+  memset(acc->hist, 0, sizeof(acc->hist));
+  acc->pending = 0;
+}
+
+void pngcore_image_stats_acc_row(pngcore_image_stats_acc_t *acc, const U8 *row) {
+  size_t w = acc->width;
+
+  if (acc->bit_depth < 8) {
+    hist_subbyte(acc, row, w);
+  } else if (acc->bit_depth == 8) {
+    switch (acc->channels) {
+      case 1: hist8(acc, row, w, 1); break;
+      case 2: hist8(acc, row, w, 2); break;
+      case 3: hist8(acc, row, w, 3); break;
+      default: hist8(acc, row, w, 4); break;
+    }
+  } else {
+    switch (acc->channels) {
+      case 1: hist16(acc, row, w, 1); break;
+      case 2: hist16(acc, row, w, 2); break;
+      case 3: hist16(acc, row, w, 3); break;
+      default: hist16(acc, row, w, 4); break;
+    }
+    size_t samples = w * acc->channels;
+    size_t done = 0;
+#ifdef PNGCORE_X86_SIMD
+    if (detect_avx2()) {
+      done = range16_avx2(acc, row, samples);
+    }
+#endif
+    range16_scalar(acc, row + 2 * done, samples - done, done);
+  }
+
+  acc->pixels += w;
+  acc->pending += w;
+  if (acc->pending >= PNGCORE_ANALYZE_FOLD_PIXELS) {
+    fold(acc);
+  }
+}
+
+void pngcore_image_stats_acc_finish(pngcore_image_stats_acc_t *acc, pngcore_image_stats_t *stats) {
+  fold(acc);
+  memset(stats, 0, sizeof(*stats));
+  stats->channels = acc->channels;
+  stats->pixels = acc->pixels;
+  memcpy(stats->histogram, acc->totals, sizeof(stats->histogram));
+
+  if (acc->bit_depth == 16) {
+    for (int c = 0; c < acc->channels; c++) {
+      stats->min[c] = acc->pixels ? acc->min[c] : 0;
+      stats->max[c] = acc->max[c];
+      stats->mean[c] = acc->pixels ? (double)acc->sum[c] / acc->pixels : 0.0;
+    }
+    stats->opaque = acc->alpha >= 0 ? acc->opaque : acc->pixels;
+    stats->transparent = acc->alpha >= 0 ? acc->transparent : 0;
+    return;
+  }
+
+  /* Everything else follows from the histograms */
+  int top = (1 << acc->bit_depth) - 1;
+  for (int c = 0; c < acc->channels; c++) {
+    U64 sum = 0;
+    int lo = -1, hi = 0;
+    for (int b = 0; b <= top; b++) {
+      U64 n = acc->totals[c][b];
+      if (n == 0) continue;
+      if (lo < 0) lo = b;
+      hi = b;
+      sum += n * b;
+    }
+    stats->min[c] = (uint16_t)(lo < 0 ? 0 : lo);
+    stats->max[c] = (uint16_t)hi;
+    stats->mean[c] = acc->pixels ? (double)sum / acc->pixels : 0.0;
+  }
+  if (acc->alpha >= 0) {
+    stats->opaque = acc->totals[acc->alpha][top];
+    stats->transparent = acc->totals[acc->alpha][0];
+  } else {
+    stats->opaque = acc->pixels;
+  }
+}
+
+/******************************************************************************
+* PUBLIC API
+*****************************************************************************/
+
+int pngcore_row_reader_collect_stats(pngcore_row_reader_t *reader, pngcore_image_stats_t *stats) {
+  if (!reader || !stats || reader->y > 0) return -1;
+
+  pngcore_image_stats_acc_t *acc = reader->stats_acc;
+  if (!acc) {
+    acc = pngcore_malloc(sizeof(*acc));
+    if (!acc) return -1;
+  }
+  pngcore_image_stats_acc_init(acc, reader->width, reader->bit_depth, reader->color_type);
+  reader->stats_acc = acc;
+  reader->stats = stats;
+  return 0;
+}
+
+int pngcore_image_stats(const pngcore_png_t *png, pngcore_image_stats_t *stats,
+                        pngcore_error_t *error) {
+  if (!stats) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid stats output");
+    return -1;
+  }
+
+  pngcore_row_reader_t *reader = pngcore_row_reader_create(png, error);
+  if (!reader) return -1;
+  if (pngcore_row_reader_collect_stats(reader, stats) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate statistics");
+    pngcore_row_reader_destroy(reader);
+    return -1;
+  }
+
+  int rc;
+  while ((rc = pngcore_row_reader_next(reader, NULL)) == 1) {
+  }
+  pngcore_row_reader_destroy(reader);
+
+  if (rc < 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Failed to decode image data");
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,556 @@
+/**
+* @file pngcore_apng.c
+* @brief Animated PNG frame index, parallel frame decoding and compositing
+*/
+
+#include "pngcore/pngcore_apng.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_stream.h"
+#include "pngcore/pngcore_filter.h"
+#include "pngcore/pngcore_convert.h"
+#include "pngcore/pngcore_blend.h"
+#include "pngcore/pngcore_pool.h"
+#include "pngcore/pngcore_crc.h"
+#include "pngcore/pngcore_stats.h"
+#include "pngcore/pngcore_probes.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define ACTL_SIZE 8
+#define FCTL_SIZE 26
+
+/******************************************************************************
+* CHUNK SCAN
+*****************************************************************************/
+
+/* Make room for one more element in a doubling array */
+static int reserve(void **items, size_t *cap, size_t count, size_t elem) {
+  if (count < *cap) return 0;
+  size_t new_cap = *cap ? *cap * 2 : 16;
+  void *grown = pngcore_realloc(*items, new_cap * elem);
+  if (!grown) return -1;
+  *items = grown;
+  *cap = new_cap;
+  return 0;
+}
+
+static U32 be16(const U8 *p) {
+  return ((U32)p[0] << 8) | p[1];
+}
+
+static int add_frame(pngcore_apng_t *apng, size_t *cap, const U8 *fctl,
+                     pngcore_error_t *error) {
+  if (reserve((void **)&apng->frames, cap, apng->num_frames, sizeof(*apng->frames)) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to grow frame index");
+    return -1;
+  }
+
+  pngcore_apng_frame_t *frame = &apng->frames[apng->num_frames];
+  memset(frame, 0, sizeof(*frame));
+  pngcore_apng_frame_info_t *info = &frame->info;
+  if (fctl) {
+    info->width = from_be_buffer((U8 *)fctl + 4);
+    info->height = from_be_buffer((U8 *)fctl + 8);
+    info->x = from_be_buffer((U8 *)fctl + 12);
+    info->y = from_be_buffer((U8 *)fctl + 16);
+    info->delay_num = (uint16_t)be16(fctl + 20);
+    info->delay_den = (uint16_t)be16(fctl + 22);
+    info->dispose_op = fctl[24];
+    info->blend_op = fctl[25];
+  } else {
+    info->width = apng->width;
+    info->height = apng->height;
+  }
+
+  if (info->width == 0 || info->height == 0 ||
+      (U64)info->x + info->width > apng->width ||
+      (U64)info->y + info->height > apng->height ||
+      info->dispose_op > PNGCORE_APNG_DISPOSE_PREVIOUS ||
+      info->blend_op > PNGCORE_APNG_BLEND_OVER) {
+    pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "Invalid fcTL for frame %u",
+    apng->num_frames);
+    return -1;
+  }
+  frame->first_segment = apng->num_segments;
+  apng->num_frames++;
+  return 0;
+}
+
+static int add_segment(pngcore_apng_t *apng, size_t *cap, size_t chunk, U32 length,
+                       U32 skip, pngcore_error_t *error) {
+  if (reserve((void **)&apng->segments, cap, apng->num_segments, sizeof(*apng->segments)) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to grow segment index");
+    return -1;
+  }
+  pngcore_apng_segment_t *seg = &apng->segments[apng->num_segments++];
+  seg->chunk = chunk;
+  seg->length = length;
+  seg->skip = skip;
+  seg->crc = from_be_buffer(apng->buf + chunk + CHUNK_TYPE_SIZE + length);
+
+  pngcore_apng_frame_t *frame = &apng->frames[apng->num_frames - 1];
+  frame->num_segments++;
+  frame->data_len += length - skip;
+  return 0;
+}
+
+/* Frame a canvas replay has to start from so that frame i comes out right.
+* A frame covering the canvas with source blending doesn't depend on what
+* is beneath it, and neither does one drawn after a full-canvas clear */
+static void assign_starts(pngcore_apng_t *apng) {
+  U32 before = 0;
+  for (U32 i = 0; i < apng->num_frames; i++) {
+    pngcore_apng_frame_info_t *info = &apng->frames[i].info;
+    int full = info->x == 0 && info->y == 0 &&
+               info->width == apng->width && info->height == apng->height;
+
+    /* There is nothing to restore under the first frame */
+    if (i == 0 && info->dispose_op == PNGCORE_APNG_DISPOSE_PREVIOUS) {
+      info->dispose_op = PNGCORE_APNG_DISPOSE_BACKGROUND;
+    }
+
+    U32 start = (full && info->blend_op == PNGCORE_APNG_BLEND_SOURCE &&
+                 info->dispose_op != PNGCORE_APNG_DISPOSE_PREVIOUS) ? i : before;
+    apng->frames[i].start = start;
+
+    if (info->dispose_op == PNGCORE_APNG_DISPOSE_NONE) {
+      before = start;
+    } else if (info->dispose_op == PNGCORE_APNG_DISPOSE_BACKGROUND) {
+      before = full ? i + 1 : start;
+    }
+  }
+}
+
+/* Walk the chunks once and index every frame */
+static int scan_chunks(pngcore_apng_t *apng, pngcore_error_t *error) {
+  const U8 *buf = apng->buf;
+  size_t size = apng->size;
+  if (!pngcore_is_png_buf(apng->buf, size, 0)) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_PNG, "Not a PNG file");
+    return -1;
+  }
+
+  size_t frame_cap = 0, seg_cap = 0;
+  size_t off = PNG_SIG_SIZE;
+  int animated = 0, seen_ihdr = 0, seen_idat = 0, seen_iend = 0;
+  U32 declared = 0, seq = 0;
+  long cur = -1;        /* frame receiving image data */
+
+  while (!seen_iend && off + CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE <= size) {
+    U32 len = from_be_buffer((U8 *)buf + off);
+    size_t type = off + CHUNK_LEN_SIZE;
+    if ((U64)len + CHUNK_CRC_SIZE > size - type - CHUNK_TYPE_SIZE) {
+      pngcore_error_set(error, PNGCORE_ERR, "Truncated %.4s chunk", buf + type);
+      return -1;
+    }
+    const U8 *data = buf + type + CHUNK_TYPE_SIZE;
+
+    if (!seen_ihdr) {
+      if (memcmp(buf + type, "IHDR", 4) != 0 || len != DATA_IHDR_SIZE) {
+        pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "Expected IHDR chunk, got %.4s",
+        buf + type);
+        return -1;
+      }
+      apng->width = from_be_buffer((U8 *)data);
+      apng->height = from_be_buffer((U8 *)data + 4);
+      apng->bit_depth = data[8];
+      apng->color_type = data[9];
+      if (apng->width == 0 || apng->height == 0 ||
+          !pngcore_valid_format(apng->bit_depth, apng->color_type) ||
+          apng->color_type == PNGCORE_COLOR_INDEXED || data[12] != 0) {
+        pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED,
+        "Unsupported APNG: %ux%u depth %u type %u interlace %u", apng->width,
+        apng->height, apng->bit_depth, apng->color_type, data[12]);
+        return -1;
+      }
+      seen_ihdr = 1;
+    } else if (memcmp(buf + type, "acTL", 4) == 0) {
+      if (len != ACTL_SIZE || seen_idat) {
+        pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "Misplaced or invalid acTL");
+        return -1;
+      }
+      animated = 1;
+      declared = from_be_buffer((U8 *)data);
+      apng->num_plays = from_be_buffer((U8 *)data + 4);
+    } else if (memcmp(buf + type, "fcTL", 4) == 0) {
+      if (!animated || len != FCTL_SIZE || from_be_buffer((U8 *)data) != seq++) {
+        pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "Out of order fcTL at offset %zu", off);
+        return -1;
+      }
+      if (cur >= 0 && apng->frames[cur].num_segments == 0) {
+        pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "Frame %ld has no image data", cur);
+        return -1;
+      }
+      if (add_frame(apng, &frame_cap, data, error) != 0) return -1;
+      cur = apng->num_frames - 1;
+    } else if (memcmp(buf + type, "IDAT", 4) == 0) {
+      if (!animated && cur < 0) {
+        if (add_frame(apng, &frame_cap, NULL, error) != 0) return -1;
+        cur = 0;
+      }
+      /* Without an fcTL first the default image is not part of the animation */
+      if (cur == 0 && add_segment(apng, &seg_cap, type, len, 0, error) != 0) {
+        return -1;
+      }
+      seen_idat = 1;
+    } else if (memcmp(buf + type, "fdAT", 4) == 0) {
+      if (!animated || !seen_idat || cur < 0 || len < 4 ||
+          from_be_buffer((U8 *)data) != seq++) {
+        pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "Out of order fdAT at offset %zu", off);
+        return -1;
+      }
+      if (add_segment(apng, &seg_cap, type, len, 4, error) != 0) return -1;
+    } else if (memcmp(buf + type, "IEND", 4) == 0) {
+      seen_iend = 1;
+    }
+
+    off = type + CHUNK_TYPE_SIZE + len + CHUNK_CRC_SIZE;
+  }
+
+  if (!seen_iend) {
+    pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "Missing IEND chunk");
+    return -1;
+  }
+  if (apng->num_frames == 0 || apng->frames[apng->num_frames - 1].num_segments == 0) {
+    pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "Frame %u has no image data",
+    apng->num_frames ? apng->num_frames - 1 : 0);
+    return -1;
+  }
+  if (animated && declared != apng->num_frames) {
+    pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "acTL declares %u frames, found %u",
+    declared, apng->num_frames);
+    return -1;
+  }
+
+  assign_starts(apng);
+  return 0;
+}
+
+/******************************************************************************
+* FRAME DECODING
+*****************************************************************************/
+
+typedef struct {
+  pngcore_apng_t *apng;
+  pngcore_apng_frame_t *frame;
+} decode_job_t;
+
+static void decode_task(void *arg) {
+  decode_job_t *job = (decode_job_t *)arg;
+  const pngcore_apng_t *apng = job->apng;
+  pngcore_apng_frame_t *frame = job->frame;
+  const pngcore_apng_segment_t *segs = apng->segments + frame->first_segment;
+  frame->rc = -1;
+
+  /* Chunks are CRC-checked here rather than during the scan, in parallel */
+  for (size_t s = 0; s < frame->num_segments; s++) {
+    U32 crc = (U32)pngcore_crc(apng->buf + segs[s].chunk, CHUNK_TYPE_SIZE + segs[s].length);
+    if (crc != segs[s].crc) {
+      PNGCORE_PROBE3(crc_mismatch, apng->buf + segs[s].chunk, segs[s].crc, crc);
+      pngcore_error_set(&frame->error, PNGCORE_ERR_CRC_MISMATCH,
+      "%.4s chunk CRC error: computed %X, expected %X", apng->buf + segs[s].chunk,
+      crc, segs[s].crc);
+      return;
+    }
+  }
+
+  /* fdAT payloads of one frame form a single zlib stream */
+  const U8 *zdata = apng->buf + segs[0].chunk + CHUNK_TYPE_SIZE + segs[0].skip;
+  U8 *joined = NULL;
+  if (frame->num_segments > 1) {
+    joined = pngcore_malloc(frame->data_len);
+    if (!joined) {
+      pngcore_error_set(&frame->error, PNGCORE_ERR_MEMORY, "Failed to join frame data");
+      return;
+    }
+    size_t pos = 0;
+    for (size_t s = 0; s < frame->num_segments; s++) {
+      memcpy(joined + pos, apng->buf + segs[s].chunk + CHUNK_TYPE_SIZE + segs[s].skip,
+             segs[s].length - segs[s].skip);
+      pos += segs[s].length - segs[s].skip;
+    }
+    zdata = joined;
+  }
+
+  const pngcore_apng_frame_info_t *info = &frame->info;
+  pngcore_row_reader_t *reader = pngcore_row_reader_open(zdata, frame->data_len,
+                                                         info->width, info->height,
+                                                         apng->bit_depth, apng->color_type,
+                                                         &frame->error);
+  size_t row_bytes = (size_t)info->width * 4;
+  U8 *pixels = reader ? pngcore_malloc(row_bytes * info->height) : NULL;
+  int rc = -1;
+
+  if (reader && !pixels) {
+    pngcore_error_set(&frame->error, PNGCORE_ERR_MEMORY, "Failed to allocate frame pixels");
+  } else if (reader && pngcore_row_reader_set_format(reader, PNGCORE_FMT_RGBA8_PREMUL) != 0) {
+    pngcore_error_set(&frame->error, PNGCORE_ERR_NOT_IMPLEMENTED, "Cannot convert frame pixels");
+  } else if (reader) {
+    rc = 0;
+    for (U32 y = 0; y < info->height; y++) {
+      const uint8_t *row;
+      if (pngcore_row_reader_next(reader, &row) != 1) {
+        pngcore_error_set(&frame->error, PNGCORE_ERR, "Failed to decode frame row %u", y);
+        rc = -1;
+        break;
+      }
+      memcpy(pixels + y * row_bytes, row, row_bytes);
+    }
+  }
+
+  pngcore_row_reader_destroy(reader);
+  free(joined);
+  if (rc != 0) {
+    free(pixels);
+    return;
+  }
+  frame->pixels = pixels;
+  frame->rc = 0;
+}
+
+/* Decode frames [first, last] that are not decoded yet */
+static int decode_range(pngcore_apng_t *apng, U32 first, U32 last, int num_threads,
+                        pngcore_error_t *error) {
+  decode_job_t *jobs = pngcore_malloc((size_t)(last - first + 1) * sizeof(*jobs));
+  if (!jobs) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate decode jobs");
+    return -1;
+  }
+
+  size_t n = 0;
+  for (U32 i = first; i <= last; i++) {
+    if (!apng->frames[i].pixels) {
+      jobs[n].apng = apng;
+      jobs[n].frame = &apng->frames[i];
+      n++;
+    }
+  }
+
+  /* A single frame, as in sequential playback, isn't worth a pool */
+  pngcore_pool_t *pool = NULL;
+  if (n > 1) {
+    int threads = num_threads > 0 ? num_threads : pngcore_pool_default_threads();
+    pool = pngcore_pool_create((size_t)threads < n ? threads : (int)n);
+  }
+  for (size_t j = 0; j < n; j++) {
+    if (!pool || pngcore_pool_submit(pool, decode_task, &jobs[j]) != 0) {
+      decode_task(&jobs[j]);
+    }
+  }
+  pngcore_pool_destroy(pool);
+
+  int rc = 0;
+  for (size_t j = 0; j < n && rc == 0; j++) {
+    if (jobs[j].frame->rc != 0) {
+      if (error) *error = jobs[j].frame->error;
+      rc = -1;
+    }
+  }
+  free(jobs);
+  return rc;
+}
+
+/******************************************************************************
+* COMPOSITING
+*****************************************************************************/
+
+static void dispose_frame(pngcore_apng_t *apng, const pngcore_apng_frame_t *frame) {
+  const pngcore_apng_frame_info_t *info = &frame->info;
+  size_t stride = (size_t)apng->width * 4;
+  size_t row_bytes = (size_t)info->width * 4;
+  U8 *dst = apng->canvas + info->y * stride + (size_t)info->x * 4;
+
+  for (U32 y = 0; y < info->height; y++, dst += stride) {
+    if (info->dispose_op == PNGCORE_APNG_DISPOSE_BACKGROUND) {
+      memset(dst, 0, row_bytes);
+    } else if (info->dispose_op == PNGCORE_APNG_DISPOSE_PREVIOUS) {
+      memcpy(dst, apng->saved + y * row_bytes, row_bytes);
+    }
+  }
+}
+
+static void draw_frame(pngcore_apng_t *apng, const pngcore_apng_frame_t *frame) {
+  const pngcore_apng_frame_info_t *info = &frame->info;
+  size_t stride = (size_t)apng->width * 4;
+  size_t row_bytes = (size_t)info->width * 4;
+  U8 *dst = apng->canvas + info->y * stride + (size_t)info->x * 4;
+  const U8 *src = frame->pixels;
+
+  for (U32 y = 0; y < info->height; y++, dst += stride, src += row_bytes) {
+    if (info->dispose_op == PNGCORE_APNG_DISPOSE_PREVIOUS) {
+      memcpy(apng->saved + y * row_bytes, dst, row_bytes);
+    }
+    if (info->blend_op == PNGCORE_APNG_BLEND_OVER) {
+      pngcore_blend_over8(dst, src, info->width);
+    } else {
+      memcpy(dst, src, row_bytes);
+    }
+  }
+}
+
+/******************************************************************************
+* PUBLIC API
+*****************************************************************************/
+
+/* Takes ownership of buf */
+static pngcore_apng_t* apng_open(U8 *buf, size_t size, pngcore_error_t *error) {
+  pngcore_apng_t *apng = pngcore_calloc(1, sizeof(pngcore_apng_t));
+  if (!apng) {
+    free(buf);
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate APNG");
+    return NULL;
+  }
+  apng->buf = buf;
+  apng->size = size;
+  apng->rendered = -1;
+
+  if (scan_chunks(apng, error) != 0) {
+    pngcore_apng_free(apng);
+    return NULL;
+  }
+  return apng;
+}
+
+pngcore_apng_t* pngcore_apng_load_buffer(const uint8_t *buffer, size_t size,
+                                         pngcore_error_t *error) {
+  if (!buffer || size == 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid buffer or size");
+    return NULL;
+  }
+  U8 *copy = pngcore_malloc(size);
+  if (!copy) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate %zu bytes", size);
+    return NULL;
+  }
+  memcpy(copy, buffer, size);
+  return apng_open(copy, size, error);
+}
+
+pngcore_apng_t* pngcore_apng_load_file(const char *filename, pngcore_error_t *error) {
+  if (!filename) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Filename is NULL");
+    return NULL;
+  }
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to open file: %s", filename);
+    return NULL;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  long file_size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  U8 *buf = file_size > 0 ? pngcore_malloc(file_size) : NULL;
+  if (!buf) {
+    fclose(fp);
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate %ld bytes", file_size);
+    return NULL;
+  }
+  size_t bytes_read = fread(buf, 1, file_size, fp);
+  fclose(fp);
+  if (bytes_read != (size_t)file_size) {
+    free(buf);
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to read complete file");
+    return NULL;
+  }
+  return apng_open(buf, bytes_read, error);
+}
+
+void pngcore_apng_free(pngcore_apng_t *apng) {
+  if (!apng) return;
+  for (U32 i = 0; i < apng->num_frames; i++) {
+    free(apng->frames[i].pixels);
+  }
+  free(apng->frames);
+  free(apng->segments);
+  free(apng->canvas);
+  free(apng->saved);
+  free(apng->buf);
+  free(apng);
+}
+
+uint32_t pngcore_apng_get_width(const pngcore_apng_t *apng) {
+  return apng ? apng->width : 0;
+}
+
+uint32_t pngcore_apng_get_height(const pngcore_apng_t *apng) {
+  return apng ? apng->height : 0;
+}
+
+uint32_t pngcore_apng_num_frames(const pngcore_apng_t *apng) {
+  return apng ? apng->num_frames : 0;
+}
+
+uint32_t pngcore_apng_num_plays(const pngcore_apng_t *apng) {
+  return apng ? apng->num_plays : 0;
+}
+
+int pngcore_apng_frame_info(const pngcore_apng_t *apng, uint32_t index,
+                            pngcore_apng_frame_info_t *info) {
+  if (!apng || !info || index >= apng->num_frames) return -1;
+  *info = apng->frames[index].info;
+  return 0;
+}
+
+int pngcore_apng_decode(pngcore_apng_t *apng, int num_threads, pngcore_error_t *error) {
+  if (!apng) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid APNG");
+    return -1;
+  }
+  return decode_range(apng, 0, apng->num_frames - 1, num_threads, error);
+}
+
+int pngcore_apng_render(pngcore_apng_t *apng, uint32_t index, pngcore_pixel_format_t fmt,
+                        uint8_t *dst, size_t stride, pngcore_error_t *error) {
+  if (!apng || !dst || index >= apng->num_frames) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid APNG, frame index or output");
+    return -1;
+  }
+  pngcore_convert_plan_t plan;
+  if (pngcore_convert_plan_init(&plan, PNGCORE_FMT_RGBA8_PREMUL, fmt) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED, "Unsupported output format %d", fmt);
+    return -1;
+  }
+
+  size_t canvas_bytes = (size_t)apng->width * apng->height * 4;
+  if (!apng->canvas) {
+    apng->canvas = pngcore_calloc(1, canvas_bytes);
+    apng->saved = pngcore_malloc(canvas_bytes);
+    if (!apng->canvas || !apng->saved) {
+      free(apng->canvas);
+      free(apng->saved);
+      apng->canvas = apng->saved = NULL;
+      pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate APNG canvas");
+      return -1;
+    }
+  }
+
+  /* Continue from the frame on the canvas unless a replay is shorter */
+  U32 start = apng->frames[index].start;
+  U32 from = start;
+  if (apng->rendered >= 0 && (U32)apng->rendered <= index && (U32)apng->rendered >= start) {
+    from = (U32)apng->rendered + 1;
+  }
+
+  if (from <= index) {
+    if (decode_range(apng, from, index, 0, error) != 0) return -1;
+    if (from == start) {
+      memset(apng->canvas, 0, canvas_bytes);
+      apng->rendered = -1;
+    }
+    for (U32 i = from; i <= index; i++) {
+      if (apng->rendered >= 0) {
+        dispose_frame(apng, &apng->frames[apng->rendered]);
+      }
+      draw_frame(apng, &apng->frames[i]);
+      apng->rendered = i;
+    }
+  }
+
+  for (U32 y = 0; y < apng->height; y++) {
+    pngcore_convert_plan_run(&plan, apng->canvas + (size_t)y * apng->width * 4,
+                             dst + y * stride, apng->width);
+  }
+  return 0;
+}
@@ -0,0 +1,512 @@
+/**
+* @file pngcore_apng_write.c
+* @brief APNG encoder with changed-rectangle frames
+*/
+
+#include "pngcore/pngcore_apng.h"
+#include "pngcore/pngcore_diff.h"
+#include "pngcore/pngcore_filter.h"
+#include "pngcore/pngcore_zutil.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <arpa/inet.h>
+
+#define ACTL_SIZE 8
+#define FCTL_SIZE 26
+
+/******************************************************************************
+* FRAME COMPRESSION
+*****************************************************************************/
+
+static void compress_task(void *arg) {
+  pngcore_apng_enc_frame_t *frame = (pngcore_apng_enc_frame_t *)arg;
+  size_t row_bytes = (size_t)frame->info.width * 4;
+  size_t filtered_len = (row_bytes + 1) * frame->info.height;
+  U8 *filtered = pngcore_malloc(filtered_len);
+  U8 *scratch = pngcore_malloc(row_bytes + 1);
+  U64 zlen = compressBound(filtered_len);
+  U8 *zdata = pngcore_malloc(zlen);
+  int rc = -1;
+
+  if (filtered && scratch && zdata) {
+    for (U32 y = 0; y < frame->info.height; y++) {
+      const U8 *row = frame->pixels + y * row_bytes;
+      pngcore_filter_row(filtered + y * (row_bytes + 1), scratch, row,
+                         y > 0 ? row - row_bytes : NULL, row_bytes, 4);
+    }
+    rc = pngcore_mem_deflate(zdata, &zlen, filtered, filtered_len, frame->level) == 0 ? 0 : -1;
+  }
+  free(filtered);
+  free(scratch);
+
+  pthread_mutex_lock(&frame->writer->lock);
+  if (rc == 0) {
+    frame->z.data = zdata;
+    frame->z.len = zlen;
+  } else {
+    free(zdata);
+  }
+  frame->rc = rc;
+  frame->done = 1;
+  pthread_cond_broadcast(&frame->writer->cond);
+  pthread_mutex_unlock(&frame->writer->lock);
+}
+
+static void free_frame(pngcore_apng_enc_frame_t *frame) {
+  if (!frame) return;
+  free(frame->pixels);
+  free(frame->z.data);
+  free(frame);
+}
+
+/******************************************************************************
+* OUTPUT
+*****************************************************************************/
+
+static int write_frame(pngcore_apng_writer_t *writer, const pngcore_apng_enc_frame_t *frame) {
+  const pngcore_apng_frame_info_t *info = &frame->info;
+  int first = (writer->seq == 0);
+
+  U32 fields[5] = { htonl(writer->seq++), htonl(info->width), htonl(info->height),
+                    htonl(info->x), htonl(info->y) };
+  U8 fctl[FCTL_SIZE];
+  memcpy(fctl, fields, sizeof(fields));
+  fctl[20] = (U8)(info->delay_num >> 8);
+  fctl[21] = (U8)info->delay_num;
+  fctl[22] = (U8)(info->delay_den >> 8);
+  fctl[23] = (U8)info->delay_den;
+  fctl[24] = info->dispose_op;
+  fctl[25] = info->blend_op;
+  if (pngcore_write_chunk(pngcore_file_sink, writer->fp, "fcTL", fctl, FCTL_SIZE) != 0) {
+    return -1;
+  }
+
+  /* The first frame doubles as the default image */
+  for (size_t pos = 0; pos < frame->z.len; pos += PNGCORE_STREAM_IDAT_SIZE) {
+    size_t n = frame->z.len - pos < PNGCORE_STREAM_IDAT_SIZE ?
+               frame->z.len - pos : PNGCORE_STREAM_IDAT_SIZE;
+    int rc;
+    if (first) {
+      rc = pngcore_write_chunk(pngcore_file_sink, writer->fp, "IDAT", frame->z.data + pos, n);
+    } else {
+      U32 seq = htonl(writer->seq++);
+      memcpy(writer->chunk, &seq, 4);
+      memcpy(writer->chunk + 4, frame->z.data + pos, n);
+      rc = pngcore_write_chunk(pngcore_file_sink, writer->fp, "fdAT", writer->chunk, n + 4);
+    }
+    if (rc != 0) return -1;
+  }
+  return 0;
+}
+
+/* Write finished frames in order. Blocks on the oldest frame when the
+* window is full, or on every frame when `all` is set */
+static int drain(pngcore_apng_writer_t *writer, int all) {
+  while (writer->count > 0) {
+    pngcore_apng_enc_frame_t *frame = writer->ring[writer->head];
+    if (!frame->sealed) break;
+
+    int block = all || writer->count >= writer->window;
+    pthread_mutex_lock(&writer->lock);
+    while (block && !frame->done) {
+      pthread_cond_wait(&writer->cond, &writer->lock);
+    }
+    int done = frame->done;
+    pthread_mutex_unlock(&writer->lock);
+    if (!done) break;
+
+    if (frame->rc != 0) {
+      pngcore_error_set(&writer->error, PNGCORE_ERR, "Failed to compress frame");
+      return -1;
+    }
+    if (write_frame(writer, frame) != 0) {
+      pngcore_error_set(&writer->error, PNGCORE_ERR_IO, "Failed to write frame");
+      return -1;
+    }
+    free_frame(frame);
+    writer->ring[writer->head] = NULL;
+    writer->head = (writer->head + 1) % writer->window;
+    writer->count--;
+  }
+  return 0;
+}
+
+/******************************************************************************
+* CHANGE DETECTION
+*****************************************************************************/
+
+/* Widen [*x0, *x1] by the differing pixels of an n pixel span at x */
+static void diff_span(const U8 *a, const U8 *b, U32 x, U32 n, U32 *x0, U32 *x1, int *hit) {
+  U32 first, last;
+  if (n == 0 || pngcore_diff_row(a, b, n, 4, &first, &last) == 0) return;
+  if (!*hit || x + first < *x0) *x0 = x + first;
+  if (!*hit || x + last > *x1) *x1 = x + last;
+  *hit = 1;
+}
+
+/* Bounding rect of the pixels of img that differ from the canvas, where the
+* canvas inside region (if any) is replaced by ref rows of ref_stride bytes.
+* Returns the rect area, 0 if nothing differs */
+static U64 dirty_rect(const pngcore_apng_writer_t *writer, const U8 *img,
+                      const pngcore_apng_frame_info_t *region, const U8 *ref,
+                      size_t ref_stride, pngcore_rect_t *rect) {
+  size_t stride = (size_t)writer->width * 4;
+  U32 x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+  int any = 0;
+
+  for (U32 y = 0; y < writer->height; y++) {
+    const U8 *row = img + y * stride;
+    const U8 *cv = writer->canvas + y * stride;
+    U32 r0 = 0, r1 = 0;
+    int hit = 0;
+
+    if (!region || y < region->y || y >= region->y + region->height) {
+      if (memcmp(row, cv, stride) == 0) continue;
+      diff_span(row, cv, 0, writer->width, &r0, &r1, &hit);
+    } else {
+      U32 rx = region->x, tail = region->x + region->width;
+      diff_span(row, cv, 0, rx, &r0, &r1, &hit);
+      diff_span(row + (size_t)rx * 4, ref + (y - region->y) * ref_stride, rx, region->width,
+                &r0, &r1, &hit);
+      diff_span(row + (size_t)tail * 4, cv + (size_t)tail * 4, tail, writer->width - tail,
+                &r0, &r1, &hit);
+    }
+    if (!hit) continue;
+
+    if (!any || r0 < x0) x0 = r0;
+    if (!any || r1 > x1) x1 = r1;
+    if (!any) y0 = y;
+    y1 = y;
+    any = 1;
+  }
+
+  if (!any) {
+    memset(rect, 0, sizeof(*rect));
+    return 0;
+  }
+  rect->x = x0;
+  rect->y = y0;
+  rect->width = x1 - x0 + 1;
+  rect->height = y1 - y0 + 1;
+  return (U64)rect->width * rect->height;
+}
+
+/* Delays of an identical frame are folded into the previous one */
+static int merge_delay(pngcore_apng_frame_info_t *info, U32 num, U32 den) {
+  U32 d1 = info->delay_den ? info->delay_den : 100;
+  U32 d2 = den ? den : 100;
+  U64 n, d;
+  if (d1 == d2) {
+    n = (U64)info->delay_num + num;
+    d = d1;
+  } else {
+    n = (U64)info->delay_num * d2 + (U64)num * d1;
+    d = (U64)d1 * d2;
+  }
+  if (n > 0xFFFF || d > 0xFFFF) return 0;
+  info->delay_num = (uint16_t)n;
+  info->delay_den = (uint16_t)d;
+  return 1;
+}
+
+/* Sub-image of the canvas over rect, against the canvas it is drawn on.
+* Unchanged pixels are cleared for source-over when all changed ones are
+* opaque, which leaves long zero runs for deflate */
+static U8* build_subimage(const pngcore_apng_writer_t *writer, pngcore_apng_frame_info_t *info) {
+  size_t stride = (size_t)writer->width * 4;
+  size_t row_bytes = (size_t)info->width * 4;
+  U8 *pixels = pngcore_malloc(row_bytes * info->height);
+  if (!pixels) return NULL;
+
+  int over = 1, unchanged = 0;
+  for (U32 y = 0; y < info->height; y++) {
+    const U8 *cur = writer->canvas + (info->y + y) * stride + (size_t)info->x * 4;
+    const U8 *old = writer->base + (info->y + y) * stride + (size_t)info->x * 4;
+    memcpy(pixels + y * row_bytes, cur, row_bytes);
+    for (U32 x = 0; x < info->width && over; x++) {
+      if (memcmp(cur + 4 * x, old + 4 * x, 4) == 0) {
+        unchanged = 1;
+      } else if (cur[4 * x + 3] != 255) {
+        over = 0;
+      }
+    }
+  }
+
+  info->blend_op = PNGCORE_APNG_BLEND_SOURCE;
+  if (over && unchanged) {
+    info->blend_op = PNGCORE_APNG_BLEND_OVER;
+    for (U32 y = 0; y < info->height; y++) {
+      const U8 *old = writer->base + (info->y + y) * stride + (size_t)info->x * 4;
+      U8 *p = pixels + y * row_bytes;
+      for (U32 x = 0; x < info->width; x++) {
+        if (memcmp(p + 4 * x, old + 4 * x, 4) == 0) {
+          memset(p + 4 * x, 0, 4);
+        }
+      }
+    }
+  }
+  return pixels;
+}
+
+/******************************************************************************
+* PUBLIC API
+*****************************************************************************/
+
+pngcore_apng_writer_t* pngcore_apng_writer_create(const char *filename,
+                                                  uint32_t width, uint32_t height,
+                                                  pngcore_pixel_format_t fmt,
+                                                  uint32_t num_plays, pngcore_error_t *error) {
+  if (!filename || width == 0 || height == 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid filename or dimensions");
+    return NULL;
+  }
+
+  pngcore_apng_writer_t *writer = pngcore_calloc(1, sizeof(pngcore_apng_writer_t));
+  if (!writer) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate APNG writer");
+    return NULL;
+  }
+  pthread_mutex_init(&writer->lock, NULL);
+  pthread_cond_init(&writer->cond, NULL);
+  writer->width = width;
+  writer->height = height;
+  writer->num_plays = num_plays;
+  writer->level = Z_DEFAULT_COMPRESSION;
+
+  if (fmt != PNGCORE_FMT_RGBA8) {
+    if (pngcore_convert_plan_init(&writer->plan, fmt, PNGCORE_FMT_RGBA8) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED, "Unsupported frame format %d", fmt);
+      pngcore_apng_writer_destroy(writer);
+      return NULL;
+    }
+    writer->convert = 1;
+  }
+
+  size_t canvas_bytes = (size_t)width * height * 4;
+  writer->canvas = pngcore_calloc(1, canvas_bytes);
+  writer->base = pngcore_calloc(1, canvas_bytes);
+  writer->next = pngcore_malloc(canvas_bytes);
+  writer->zero_row = pngcore_calloc(width, 4);
+  writer->chunk = pngcore_malloc(PNGCORE_STREAM_IDAT_SIZE + 4);
+  writer->pool = pngcore_pool_create(0);
+  if (writer->pool) {
+    writer->window = 2 * (size_t)writer->pool->num_threads + 2;
+    writer->ring = pngcore_calloc(writer->window, sizeof(*writer->ring));
+  }
+  if (!writer->canvas || !writer->base || !writer->next || !writer->zero_row ||
+      !writer->chunk || !writer->ring) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate APNG canvases");
+    pngcore_apng_writer_destroy(writer);
+    return NULL;
+  }
+
+  writer->fp = fopen(filename, "wb");
+  if (!writer->fp) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to open file %s", filename);
+    pngcore_apng_writer_destroy(writer);
+    return NULL;
+  }
+
+  static const U8 signature[PNG_SIG_SIZE] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+  U32 dims[2] = { htonl(width), htonl(height) };
+  U8 ihdr[DATA_IHDR_SIZE] = {0};
+  memcpy(ihdr, dims, sizeof(dims));
+  ihdr[8] = 8;
+  ihdr[9] = PNGCORE_COLOR_RGBA;
+  U32 actl[2] = { 0, htonl(num_plays) };
+
+  if (pngcore_file_sink(writer->fp, signature, PNG_SIG_SIZE) != 0 ||
+      pngcore_write_chunk(pngcore_file_sink, writer->fp, "IHDR", ihdr, DATA_IHDR_SIZE) != 0 ||
+      (writer->actl_offset = ftell(writer->fp)) < 0 ||
+      pngcore_write_chunk(pngcore_file_sink, writer->fp, "acTL", (U8 *)actl, ACTL_SIZE) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to write APNG header");
+    pngcore_apng_writer_destroy(writer);
+    return NULL;
+  }
+  return writer;
+}
+
+int pngcore_apng_writer_add_frame(pngcore_apng_writer_t *writer, const uint8_t *pixels,
+                                  size_t stride, uint16_t delay_num, uint16_t delay_den,
+                                  pngcore_error_t *error) {
+  if (!writer || !pixels || !writer->fp) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid or finished writer");
+    return -1;
+  }
+  if (writer->failed) {
+    if (error) *error = writer->error;
+    return -1;
+  }
+
+  size_t canvas_stride = (size_t)writer->width * 4;
+  for (U32 y = 0; y < writer->height; y++) {
+    if (writer->convert) {
+      pngcore_convert_plan_run(&writer->plan, pixels + y * stride,
+                               writer->next + y * canvas_stride, writer->width);
+    } else {
+      memcpy(writer->next + y * canvas_stride, pixels + y * stride, canvas_stride);
+    }
+  }
+
+  pngcore_apng_frame_info_t info = {0};
+  info.delay_num = delay_num;
+  info.delay_den = delay_den;
+
+  if (writer->num_frames == 0) {
+    info.width = writer->width;
+    info.height = writer->height;
+  } else {
+    pngcore_apng_enc_frame_t *prev = writer->ring[(writer->head + writer->count - 1) % writer->window];
+    pngcore_apng_frame_info_t *pi = &prev->info;
+
+    pngcore_rect_t best;
+    U64 best_area = dirty_rect(writer, writer->next, NULL, NULL, 0, &best);
+    if (best_area == 0 && merge_delay(pi, delay_num, delay_den)) {
+      return 0;
+    }
+
+    /* Pick the dispose op of the previous frame that leaves the least to redraw.
+    * The first frame cannot be disposed to previous */
+    U8 dispose = PNGCORE_APNG_DISPOSE_NONE;
+    pngcore_rect_t rect;
+    U64 area = dirty_rect(writer, writer->next, pi, writer->zero_row, 0, &rect);
+    if (area < best_area) {
+      best_area = area;
+      best = rect;
+      dispose = PNGCORE_APNG_DISPOSE_BACKGROUND;
+    }
+    if (writer->num_frames > 1) {
+      area = dirty_rect(writer, writer->next, pi,
+                        writer->base + pi->y * canvas_stride + (size_t)pi->x * 4,
+                        canvas_stride, &rect);
+      if (area < best_area) {
+        best_area = area;
+        best = rect;
+        dispose = PNGCORE_APNG_DISPOSE_PREVIOUS;
+      }
+    }
+    pi->dispose_op = dispose;
+    prev->sealed = 1;
+
+    /* Apply the dispose op; the result is what the new frame is drawn on */
+    for (U32 y = pi->y; y < pi->y + pi->height; y++) {
+      U8 *dst = writer->canvas + y * canvas_stride + (size_t)pi->x * 4;
+      if (dispose == PNGCORE_APNG_DISPOSE_BACKGROUND) {
+        memset(dst, 0, (size_t)pi->width * 4);
+      } else if (dispose == PNGCORE_APNG_DISPOSE_PREVIOUS) {
+        memcpy(dst, writer->base + y * canvas_stride + (size_t)pi->x * 4, (size_t)pi->width * 4);
+      }
+    }
+
+    /* An unchanged canvas still needs a frame: one transparent pixel */
+    if (best_area == 0) {
+      best.x = best.y = 0;
+      best.width = best.height = 1;
+    }
+    info.x = best.x;
+    info.y = best.y;
+    info.width = best.width;
+    info.height = best.height;
+  }
+
+  U8 *tmp = writer->base;
+  writer->base = writer->canvas;
+  writer->canvas = writer->next;
+  writer->next = tmp;
+
+  if (drain(writer, 0) != 0) {
+    writer->failed = 1;
+    if (error) *error = writer->error;
+    return -1;
+  }
+
+  pngcore_apng_enc_frame_t *frame = pngcore_calloc(1, sizeof(pngcore_apng_enc_frame_t));
+  if (frame) {
+    frame->writer = writer;
+    frame->info = info;
+    frame->level = writer->level;
+    frame->pixels = build_subimage(writer, &frame->info);
+  }
+  if (!frame || !frame->pixels) {
+    free_frame(frame);
+    pngcore_error_set(&writer->error, PNGCORE_ERR_MEMORY, "Failed to allocate frame");
+    writer->failed = 1;
+    if (error) *error = writer->error;
+    return -1;
+  }
+  if (writer->num_frames == 0) {
+    frame->info.blend_op = PNGCORE_APNG_BLEND_SOURCE;
+  }
+
+  writer->ring[(writer->head + writer->count) % writer->window] = frame;
+  writer->count++;
+  writer->num_frames++;
+  if (pngcore_pool_submit(writer->pool, compress_task, frame) != 0) {
+    compress_task(frame);
+  }
+  return 0;
+}
+
+int pngcore_apng_writer_finish(pngcore_apng_writer_t *writer, pngcore_error_t *error) {
+  if (!writer || !writer->fp) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid or finished writer");
+    return -1;
+  }
+  if (!writer->failed && writer->num_frames == 0) {
+    pngcore_error_set(&writer->error, PNGCORE_ERR, "APNG has no frames");
+    writer->failed = 1;
+  }
+
+  if (!writer->failed) {
+    writer->ring[(writer->head + writer->count - 1) % writer->window]->sealed = 1;
+    if (drain(writer, 1) != 0) writer->failed = 1;
+  }
+
+  /* The frame count is only known now */
+  U32 actl[2] = { htonl(writer->num_frames), htonl(writer->num_plays) };
+  if (!writer->failed &&
+      (pngcore_write_chunk(pngcore_file_sink, writer->fp, "IEND", NULL, 0) != 0 ||
+       fseek(writer->fp, writer->actl_offset, SEEK_SET) != 0 ||
+       pngcore_write_chunk(pngcore_file_sink, writer->fp, "acTL", (U8 *)actl, ACTL_SIZE) != 0)) {
+    pngcore_error_set(&writer->error, PNGCORE_ERR_IO, "Failed to finish APNG");
+    writer->failed = 1;
+  }
+
+  int close_rc = fclose(writer->fp);
+  writer->fp = NULL;
+  if (!writer->failed && close_rc != 0) {
+    pngcore_error_set(&writer->error, PNGCORE_ERR_IO, "Failed to close APNG");
+    writer->failed = 1;
+  }
+  if (writer->failed) {
+    if (error) *error = writer->error;
+    return -1;
+  }
+  return 0;
+}
+
+void pngcore_apng_writer_destroy(pngcore_apng_writer_t *writer) {
+  if (!writer) return;
+
+  /* Running compressions finish before their frames are freed */
+  pngcore_pool_destroy(writer->pool);
+  if (writer->ring) {
+    for (size_t i = 0; i < writer->window; i++) {
+      free_frame(writer->ring[i]);
+    }
+  }
+  if (writer->fp) {
+    fclose(writer->fp);
+  }
+  free(writer->ring);
+  free(writer->canvas);
+  free(writer->base);
+  free(writer->next);
+  free(writer->zero_row);
+  free(writer->chunk);
+  pthread_cond_destroy(&writer->cond);
+  pthread_mutex_destroy(&writer->lock);
+  free(writer);
+}
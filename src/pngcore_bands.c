@@ -0,0 +1,442 @@
+/**
+* @file pngcore_bands.c
+* @brief Band-encoded image data and incremental row updates
+*/
+
+#include "pngcore.h"
+#include "pngcore/pngcore_bands.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_filter.h"
+#include "pngcore/pngcore_stream.h"
+#include "pngcore/pngcore_stats.h"
+#include "pngcore/pngcore_probes.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+/* Room for the flush marker or final block beyond deflateBound */
+#define FLUSH_SLACK 16
+
+/* Table chunk: IDAT CRC, band rows, band count, level, then per band
+* offset, length, crc and adler, all big-endian */
+#define TABLE_HEADER_SIZE 13
+#define TABLE_BAND_SIZE 16
+
+void pngcore_idat_bands_free(struct pngcore_idat_bands *bands) {
+  if (!bands) return;
+  free(bands->bands);
+  free(bands);
+}
+
+static void put_u32(U8 *p, U32 v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+int pngcore_idat_bands_write(const struct pngcore_idat_bands *bands, U32 idat_crc, FILE *fp) {
+  U64 length = TABLE_HEADER_SIZE + (U64)bands->count * TABLE_BAND_SIZE;
+  if (length > 0x7fffffffu) return -1;
+  U8 *data = pngcore_malloc(length);
+  if (!data) return -1;
+
+  put_u32(data, idat_crc);
+  put_u32(data + 4, bands->band_rows);
+  put_u32(data + 8, bands->count);
+  data[12] = (U8)(bands->level + 1);
+  for (U32 b = 0; b < bands->count; b++) {
+    const pngcore_band_t *band = &bands->bands[b];
+    U8 *p = data + TABLE_HEADER_SIZE + (size_t)b * TABLE_BAND_SIZE;
+    put_u32(p, (U32)band->offset);
+    put_u32(p + 4, (U32)band->length);
+    put_u32(p + 8, band->crc);
+    put_u32(p + 12, band->adler);
+  }
+  int rc = pngcore_write_chunk(pngcore_file_sink, fp, PNGCORE_BANDS_CHUNK, data, (U32)length);
+  free(data);
+  return rc;
+}
+
+struct pngcore_idat_bands* pngcore_idat_bands_read(const U8 *data, U32 length, U32 idat_crc,
+                                                   U32 idat_length, U32 height) {
+  if (length < TABLE_HEADER_SIZE || from_be_buffer((U8 *)data) != idat_crc) return NULL;
+  U32 band_rows = from_be_buffer((U8 *)data + 4);
+  U32 count = from_be_buffer((U8 *)data + 8);
+  int level = (int)data[12] - 1;
+  if (band_rows == 0 || count != (height + (U64)band_rows - 1) / band_rows ||
+      length != TABLE_HEADER_SIZE + (U64)count * TABLE_BAND_SIZE ||
+      level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+    return NULL;
+  }
+
+  struct pngcore_idat_bands *bands = pngcore_calloc(1, sizeof(*bands));
+  if (!bands) return NULL;
+  bands->band_rows = band_rows;
+  bands->count = count;
+  bands->level = level;
+  bands->bands = pngcore_calloc(count, sizeof(pngcore_band_t));
+  if (!bands->bands) {
+    pngcore_idat_bands_free(bands);
+    return NULL;
+  }
+
+  /* Bands must tile the stream between the zlib header and trailer */
+  U64 offset = PNGCORE_ZLIB_HEADER_SIZE;
+  int ok = 1;
+  for (U32 b = 0; b < count && ok; b++) {
+    const U8 *p = data + TABLE_HEADER_SIZE + (size_t)b * TABLE_BAND_SIZE;
+    pngcore_band_t *band = &bands->bands[b];
+    band->offset = from_be_buffer((U8 *)p);
+    band->length = from_be_buffer((U8 *)p + 4);
+    band->crc = from_be_buffer((U8 *)p + 8);
+    band->adler = from_be_buffer((U8 *)p + 12);
+    ok = band->offset == offset;
+    offset += band->length;
+  }
+  if (!ok || offset + PNGCORE_ZLIB_TRAILER_SIZE != idat_length) {
+    pngcore_idat_bands_free(bands);
+    return NULL;
+  }
+  return bands;
+}
+
+static U64 band_raw_len(const struct pngcore_idat_bands *bands, U32 b, U32 height,
+                        size_t row_bytes) {
+  U32 first = b * bands->band_rows;
+  U32 rows = height - first < bands->band_rows ? height - first : bands->band_rows;
+  return (U64)rows * (row_bytes + 1);
+}
+
+/* IDAT CRC and stream adler32 from the per-band sums */
+static void fix_sums(pngcore_idat_t *idat, U32 height, size_t row_bytes) {
+  struct pngcore_idat_bands *bands = idat->bands;
+  U8 *data = idat->p_data->data;
+  U32 length = idat->p_data->length;
+
+  uLong adler = adler32(0, NULL, 0);
+  uLong crc = crc32(crc32(0, (const U8 *)"IDAT", CHUNK_TYPE_SIZE), data, PNGCORE_ZLIB_HEADER_SIZE);
+  for (U32 b = 0; b < bands->count; b++) {
+    const pngcore_band_t *band = &bands->bands[b];
+    adler = adler32_combine(adler, band->adler, band_raw_len(bands, b, height, row_bytes));
+    crc = crc32_combine(crc, band->crc, band->length);
+  }
+
+  U8 *trailer = data + length - PNGCORE_ZLIB_TRAILER_SIZE;
+  trailer[0] = adler >> 24;
+  trailer[1] = adler >> 16;
+  trailer[2] = adler >> 8;
+  trailer[3] = adler;
+  idat->crc = crc32(crc, trailer, PNGCORE_ZLIB_TRAILER_SIZE);
+}
+
+/******************************************************************************
+* ENCODING
+*****************************************************************************/
+
+/* Run deflate over in until it has taken all of it and flushed */
+static int feed(z_stream *strm, pngcore_mem_buffer_t *out, const U8 *in, size_t len, int flush) {
+  U64 start = pngcore_stats_now();
+  strm->next_in = (U8 *)in;
+  strm->avail_in = len;
+  do {
+    if (out->cap - out->len < PNGCORE_STREAM_IDAT_SIZE) {
+      size_t cap = out->cap * 2 + PNGCORE_STREAM_IDAT_SIZE;
+      U8 *grown = pngcore_realloc(out->data, cap);
+      if (!grown) return -1;
+      out->data = grown;
+      out->cap = cap;
+    }
+    strm->next_out = out->data + out->len;
+    strm->avail_out = out->cap - out->len;
+    if (deflate(strm, flush) == Z_STREAM_ERROR) return -1;
+    out->len = out->cap - strm->avail_out;
+  } while (strm->avail_out == 0);
+  pngcore_stats_add(PNGCORE_STAT_BYTES_DEFLATED, len);
+  pngcore_stats_since(PNGCORE_STAT_DEFLATE_NS, start);
+  return 0;
+}
+
+int pngcore_encode_bands(pngcore_png_t *png, uint32_t band_rows, int level,
+                         pngcore_error_t *error) {
+  if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid compression level %d", level);
+    return -1;
+  }
+  pngcore_row_reader_t *reader = pngcore_row_reader_create(png, error);
+  if (!reader) return -1;
+
+  pngcore_ihdr_data_t *ihdr = png->internal->ihdr->p_data;
+  size_t row_bytes = pngcore_scanline_bytes(ihdr->width, ihdr->bit_depth, ihdr->color_type);
+  size_t bpp = pngcore_filter_bpp(ihdr->bit_depth, ihdr->color_type);
+  if (band_rows == 0) band_rows = PNGCORE_BAND_ROWS;
+
+  struct pngcore_idat_bands *bands = pngcore_calloc(1, sizeof(*bands));
+  U8 *prev = pngcore_malloc(row_bytes);
+  U8 *filtered = pngcore_malloc(row_bytes + 1);
+  U8 *scratch = pngcore_malloc(row_bytes + 1);
+  pngcore_mem_buffer_t out = { NULL, 0, 0 };
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  int rc = -1;
+  int z_ok = 0;
+
+  if (bands) {
+    bands->band_rows = band_rows;
+    bands->count = (ihdr->height + band_rows - 1) / band_rows;
+    bands->level = level;
+    bands->bands = pngcore_calloc(bands->count, sizeof(pngcore_band_t));
+  }
+  if (!bands || !bands->bands || !prev || !filtered || !scratch) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate band buffers");
+    goto cleanup;
+  }
+  if (deflateInit(&strm, level) != Z_OK) {
+    pngcore_error_set(error, PNGCORE_ERR, "Failed to initialize deflate");
+    goto cleanup;
+  }
+  z_ok = 1;
+
+  const uint8_t *row;
+  for (U32 y = 0; y < ihdr->height; y++) {
+    if (pngcore_row_reader_next(reader, &row) != 1) {
+      pngcore_error_set(error, PNGCORE_ERR, "Failed to decode row %u", y);
+      goto cleanup;
+    }
+    U32 b = y / band_rows;
+    pngcore_band_t *band = &bands->bands[b];
+    int first = y % band_rows == 0;
+    int last = y + 1 == ihdr->height || (y + 1) % band_rows == 0;
+    if (first) {
+      band->offset = b == 0 ? PNGCORE_ZLIB_HEADER_SIZE : out.len;
+      band->adler = adler32(0, NULL, 0);
+    }
+
+    /* The first row of a band must not depend on the band above */
+    pngcore_filter_row(filtered, scratch, row, first ? NULL : prev, row_bytes, bpp);
+    memcpy(prev, row, row_bytes);
+    band->adler = adler32(band->adler, filtered, row_bytes + 1);
+
+    int flush = !last ? Z_NO_FLUSH : y + 1 == ihdr->height ? Z_FINISH : Z_FULL_FLUSH;
+    if (feed(&strm, &out, filtered, row_bytes + 1, flush) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR, "Failed to deflate row %u", y);
+      goto cleanup;
+    }
+    if (last) {
+      band->length = out.len - band->offset - (flush == Z_FINISH ? PNGCORE_ZLIB_TRAILER_SIZE : 0);
+    }
+  }
+  if (out.len > 0xffffffffu) {
+    pngcore_error_set(error, PNGCORE_ERR, "Image data too large for one IDAT");
+    goto cleanup;
+  }
+
+  U64 start = pngcore_stats_now();
+  for (U32 b = 0; b < bands->count; b++) {
+    pngcore_band_t *band = &bands->bands[b];
+    band->crc = crc32(0, out.data + band->offset, band->length);
+    pngcore_stats_add(PNGCORE_STAT_BYTES_CRC, band->length);
+  }
+  pngcore_stats_since(PNGCORE_STAT_CRC_NS, start);
+
+  pngcore_idat_t *idat = png->internal->idat;
+  if (pngcore_idat_set_data(idat, out.data, out.len) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate image data");
+    goto cleanup;
+  }
+  idat->bands = bands;
+  out.data = NULL;
+  bands = NULL;
+  rc = 0;
+
+cleanup:
+  if (z_ok) deflateEnd(&strm);
+  pngcore_row_reader_destroy(reader);
+  pngcore_idat_bands_free(bands);
+  free(out.data);
+  free(prev);
+  free(filtered);
+  free(scratch);
+  return rc;
+}
+
+/******************************************************************************
+* UPDATES
+*****************************************************************************/
+
+/* Inflate one band on its own; the full flush before it emptied the window */
+static int inflate_band(const U8 *src, U64 src_len, U8 *dst, U64 dst_len) {
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) return -1;
+  U64 start = pngcore_stats_now();
+  strm.next_in = (U8 *)src;
+  strm.avail_in = src_len;
+  strm.next_out = dst;
+  strm.avail_out = dst_len;
+  PNGCORE_PROBE1(inflate_start, src_len);
+  int ret = inflate(&strm, Z_SYNC_FLUSH);
+  PNGCORE_PROBE3(inflate_done, strm.total_in, strm.total_out, ret);
+  int ok = (ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR) && strm.total_out == dst_len;
+  pngcore_stats_add(PNGCORE_STAT_BYTES_INFLATED, strm.total_out);
+  pngcore_stats_since(PNGCORE_STAT_INFLATE_NS, start);
+  inflateEnd(&strm);
+  return ok ? 0 : -1;
+}
+
+/* Raw deflate of one band's filtered rows into a new buffer */
+static U8* deflate_band(const U8 *src, U64 src_len, int level, int last, U64 *out_len) {
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return NULL;
+  }
+  U64 cap = deflateBound(&strm, src_len) + FLUSH_SLACK;
+  U8 *out = pngcore_malloc(cap);
+  if (out) {
+    U64 start = pngcore_stats_now();
+    strm.next_in = (U8 *)src;
+    strm.avail_in = src_len;
+    strm.next_out = out;
+    strm.avail_out = cap;
+    int ret = deflate(&strm, last ? Z_FINISH : Z_FULL_FLUSH);
+    pngcore_stats_add(PNGCORE_STAT_BYTES_DEFLATED, src_len - strm.avail_in);
+    pngcore_stats_since(PNGCORE_STAT_DEFLATE_NS, start);
+    if (ret != (last ? Z_STREAM_END : Z_OK) || strm.avail_in != 0) {
+      free(out);
+      out = NULL;
+    } else {
+      *out_len = strm.total_out;
+    }
+  }
+  deflateEnd(&strm);
+  return out;
+}
+
+int pngcore_update_rows(pngcore_png_t *png, uint32_t y0, uint32_t y1, const uint8_t *pixels,
+                        pngcore_error_t *error) {
+  if (!png || !png->internal || !png->internal->ihdr || !png->internal->idat || !pixels) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid PNG or pixels");
+    return -1;
+  }
+  pngcore_ihdr_data_t *ihdr = png->internal->ihdr->p_data;
+  pngcore_idat_t *idat = png->internal->idat;
+  struct pngcore_idat_bands *bands = idat->bands;
+  if (!bands) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED,
+                      "Image data is not band-encoded; call pngcore_encode_bands first");
+    return -1;
+  }
+  if (y0 >= y1 || y1 > ihdr->height) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid row range %u-%u", y0, y1);
+    return -1;
+  }
+
+  size_t row_bytes = pngcore_scanline_bytes(ihdr->width, ihdr->bit_depth, ihdr->color_type);
+  size_t bpp = pngcore_filter_bpp(ihdr->bit_depth, ihdr->color_type);
+  U32 R = bands->band_rows;
+  U32 b0 = y0 / R, b1 = (y1 - 1) / R;
+  U32 n = b1 - b0 + 1;
+
+  U8 *rows = pngcore_malloc((size_t)R * row_bytes);
+  U8 *filtered = pngcore_malloc((size_t)R * (row_bytes + 1));
+  U8 *scratch = pngcore_malloc(row_bytes + 1);
+  U8 **pieces = pngcore_calloc(n, sizeof(U8 *));
+  pngcore_band_t *fresh = pngcore_calloc(n, sizeof(pngcore_band_t));
+  int rc = -1;
+  if (!rows || !filtered || !scratch || !pieces || !fresh) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate band buffers");
+    goto cleanup;
+  }
+
+  /* Re-encode each touched band from its old rows and the new ones */
+  U64 new_total = 0;
+  for (U32 i = 0; i < n; i++) {
+    U32 b = b0 + i;
+    U32 first = b * R;
+    U32 count = ihdr->height - first < R ? ihdr->height - first : R;
+    U64 raw_len = (U64)count * (row_bytes + 1);
+    const pngcore_band_t *old = &bands->bands[b];
+
+    if (y0 > first || y1 < first + count) {
+      if (inflate_band(idat->p_data->data + old->offset, old->length, filtered, raw_len) != 0) {
+        pngcore_error_set(error, PNGCORE_ERR, "Corrupt image data in band %u", b);
+        goto cleanup;
+      }
+      for (U32 r = 0; r < count; r++) {
+        U8 *line = filtered + (size_t)r * (row_bytes + 1);
+        U8 *dst = rows + (size_t)r * row_bytes;
+        memcpy(dst, line + 1, row_bytes);
+        if (pngcore_unfilter_row(line[0], dst, r ? dst - row_bytes : NULL, row_bytes, bpp) != 0) {
+          pngcore_error_set(error, PNGCORE_ERR, "Invalid filter in band %u", b);
+          goto cleanup;
+        }
+      }
+    }
+
+    U32 lo = y0 > first ? y0 : first;
+    U32 hi = y1 < first + count ? y1 : first + count;
+    memcpy(rows + (size_t)(lo - first) * row_bytes, pixels + (size_t)(lo - y0) * row_bytes,
+           (size_t)(hi - lo) * row_bytes);
+
+    for (U32 r = 0; r < count; r++) {
+      U8 *src = rows + (size_t)r * row_bytes;
+      pngcore_filter_row(filtered + (size_t)r * (row_bytes + 1), scratch, src,
+                         r ? src - row_bytes : NULL, row_bytes, bpp);
+    }
+    pieces[i] = deflate_band(filtered, raw_len, bands->level, b + 1 == bands->count,
+                             &fresh[i].length);
+    if (!pieces[i]) {
+      pngcore_error_set(error, PNGCORE_ERR, "Failed to deflate band %u", b);
+      goto cleanup;
+    }
+    fresh[i].adler = adler32(adler32(0, NULL, 0), filtered, raw_len);
+    U64 start = pngcore_stats_now();
+    fresh[i].crc = crc32(0, pieces[i], fresh[i].length);
+    pngcore_stats_add(PNGCORE_STAT_BYTES_CRC, fresh[i].length);
+    pngcore_stats_since(PNGCORE_STAT_CRC_NS, start);
+    new_total += fresh[i].length;
+  }
+
+  /* Splice the new bands between the untouched ones */
+  U64 old_start = bands->bands[b0].offset;
+  U64 old_end = bands->bands[b1].offset + bands->bands[b1].length;
+  U64 old_len = idat->p_data->length;
+  U64 new_len = old_len - (old_end - old_start) + new_total;
+  if (new_len > 0xffffffffu) {
+    pngcore_error_set(error, PNGCORE_ERR, "Image data too large for one IDAT");
+    goto cleanup;
+  }
+  /* Clones sharing the image data keep the old bytes */
+  U8 *data = pngcore_idat_writable(idat, new_len > old_len ? new_len : old_len);
+  if (!data) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to grow image data");
+    goto cleanup;
+  }
+  memmove(data + old_start + new_total, data + old_end, old_len - old_end);
+  idat->p_data->length = new_len;
+
+  U64 offset = old_start;
+  for (U32 i = 0; i < n; i++) {
+    memcpy(data + offset, pieces[i], fresh[i].length);
+    fresh[i].offset = offset;
+    bands->bands[b0 + i] = fresh[i];
+    offset += fresh[i].length;
+  }
+  for (U32 b = b1 + 1; b < bands->count; b++) {
+    bands->bands[b].offset = bands->bands[b].offset + new_len - old_len;
+  }
+  fix_sums(idat, ihdr->height, row_bytes);
+  rc = 0;
+
+cleanup:
+  for (U32 i = 0; pieces && i < n; i++) {
+    free(pieces[i]);
+  }
+  free(pieces);
+  free(fresh);
+  free(rows);
+  free(filtered);
+  free(scratch);
+  return rc;
+}
@@ -0,0 +1,531 @@
+/**
+* @file pngcore_blend.c
+* @brief Alpha compositing of one PNG over another
+*/
+
+#include "pngcore/pngcore_blend.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_stream.h"
+#include "pngcore/pngcore_convert.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PNGCORE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* Entries in the linear to sRGB table; values in between are interpolated */
+#define SRGB_ENCODE_STEPS 4096
+
+/******************************************************************************
+* SRGB TRANSFER
+*****************************************************************************/
+
+static float srgb_decode8[256];
+static float srgb_encode[SRGB_ENCODE_STEPS + 1];
+static pthread_once_t srgb_once = PTHREAD_ONCE_INIT;
+
+static float srgb_to_linear(float c) {
+  return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linear_to_srgb(float c) {
+  return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+static void srgb_init(void) {
+  for (int i = 0; i < 256; i++) {
+    srgb_decode8[i] = srgb_to_linear(i / 255.0f);
+  }
+  for (int i = 0; i <= SRGB_ENCODE_STEPS; i++) {
+    srgb_encode[i] = linear_to_srgb((float)i / SRGB_ENCODE_STEPS);
+  }
+}
+
+static float srgb_encode_lut(float c) {
+  float pos = c * SRGB_ENCODE_STEPS;
+  int i = (int)pos;
+  if (i >= SRGB_ENCODE_STEPS) return srgb_encode[SRGB_ENCODE_STEPS];
+  float t = pos - i;
+  return srgb_encode[i] + t * (srgb_encode[i + 1] - srgb_encode[i]);
+}
+
+void pngcore_blend_to_float(const U8 *src, float *dst, size_t width,
+                            int sample_bytes, int linear) {
+  if (linear) pthread_once(&srgb_once, srgb_init);
+
+  for (size_t x = 0; x < width; x++) {
+    float v[4];
+    if (sample_bytes == 1) {
+      const U8 *p = src + x * 4;
+      for (int c = 0; c < 3; c++) {
+        v[c] = linear ? srgb_decode8[p[c]] : p[c] / 255.0f;
+      }
+      v[3] = p[3] / 255.0f;
+    } else {
+      const U8 *p = src + x * 8;
+      for (int c = 0; c < 4; c++) {
+        v[c] = ((p[2 * c] << 8) | p[2 * c + 1]) / 65535.0f;
+      }
+      if (linear) {
+        for (int c = 0; c < 3; c++) v[c] = srgb_to_linear(v[c]);
+      }
+    }
+    float *d = dst + x * 4;
+    d[0] = v[0] * v[3];
+    d[1] = v[1] * v[3];
+    d[2] = v[2] * v[3];
+    d[3] = v[3];
+  }
+}
+
+void pngcore_blend_from_float(const float *src, U8 *dst, size_t width,
+                              int sample_bytes, int linear) {
+  if (linear) pthread_once(&srgb_once, srgb_init);
+  float max = (sample_bytes == 1) ? 255.0f : 65535.0f;
+
+  for (size_t x = 0; x < width; x++) {
+    const float *s = src + x * 4;
+    float a = s[3] < 0.0f ? 0.0f : (s[3] > 1.0f ? 1.0f : s[3]);
+    float v[4] = { 0.0f, 0.0f, 0.0f, a };
+    if (a > 0.0f) {
+      for (int c = 0; c < 3; c++) {
+        float u = s[c] / a;
+        u = u < 0.0f ? 0.0f : (u > 1.0f ? 1.0f : u);
+        v[c] = linear ? srgb_encode_lut(u) : u;
+      }
+    }
+    for (int c = 0; c < 4; c++) {
+      U32 q = (U32)(v[c] * max + 0.5f);
+      if (sample_bytes == 1) {
+        dst[x * 4 + c] = (U8)q;
+      } else {
+        dst[x * 8 + 2 * c] = (U8)(q >> 8);
+        dst[x * 8 + 2 * c + 1] = (U8)q;
+      }
+    }
+  }
+}
+
+/******************************************************************************
+* SCALAR KERNELS
+*****************************************************************************/
+
+static inline U8 div255(U32 v) {
+  v += 128;
+  return (U8)((v + (v >> 8)) >> 8);
+}
+
+static void over8_scalar(U8 *dst, const U8 *src, size_t width) {
+  for (size_t x = 0; x < width; x++) {
+    U32 inv = 255 - src[x * 4 + 3];
+    for (int c = 0; c < 4; c++) {
+      U32 v = src[x * 4 + c] + div255(dst[x * 4 + c] * inv);
+      dst[x * 4 + c] = (U8)(v > 255 ? 255 : v);
+    }
+  }
+}
+
+static void add8_scalar(U8 *dst, const U8 *src, size_t width) {
+  for (size_t i = 0; i < width * 4; i++) {
+    U32 v = dst[i] + src[i];
+    dst[i] = (U8)(v > 255 ? 255 : v);
+  }
+}
+
+/* With premultiplied inputs every mode applies to alpha as to color:
+* result = S(1 - Da) + D(1 - Sa) + Sa Da B(s, d), B being the blend function
+* on straight colors, which reduces to the expressions below */
+static void blendf_scalar(pngcore_blend_mode_t mode, float *dst, const float *src,
+                          size_t width) {
+  for (size_t x = 0; x < width; x++) {
+    const float *s = src + x * 4;
+    float *d = dst + x * 4;
+    float sa = s[3];
+    float da = d[3];
+    for (int c = 0; c < 4; c++) {
+      float sc = s[c];
+      float dc = d[c];
+      float r;
+      switch (mode) {
+        case PNGCORE_BLEND_ADD:
+        r = sc + dc > 1.0f ? 1.0f : sc + dc;
+        break;
+        case PNGCORE_BLEND_MULTIPLY:
+        r = sc * (1.0f - da) + dc * (1.0f - sa) + sc * dc;
+        break;
+        case PNGCORE_BLEND_SCREEN:
+        r = sc + dc - sc * dc;
+        break;
+        case PNGCORE_BLEND_DARKEN:
+        r = sc + dc - fmaxf(sc * da, dc * sa);
+        break;
+        case PNGCORE_BLEND_LIGHTEN:
+        r = sc + dc - fminf(sc * da, dc * sa);
+        break;
+        default:
+        r = sc + dc * (1.0f - sa);
+        break;
+      }
+      d[c] = r;
+    }
+  }
+}
+
+/******************************************************************************
+* SIMD KERNELS
+*****************************************************************************/
+
+#ifdef PNGCORE_X86_SIMD
+
+/* 0: scalar, 1: SSE2, 2: AVX2 */
+static int simd_level = -1;
+
+static int detect_simd(void) {
+  if (simd_level < 0) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      simd_level = 2;
+    } else if (__builtin_cpu_supports("sse2")) {
+      simd_level = 1;
+    } else {
+      simd_level = 0;
+    }
+  }
+  return simd_level;
+}
+
+/* Widen to 16-bit lanes, broadcast each pixel's inverse alpha across its
+* four lanes, multiply and divide by 255 with rounding */
+__attribute__((target("sse2")))
+static size_t over8_sse2(U8 *dst, const U8 *src, size_t width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi16(128);
+  const __m128i ones = _mm_set1_epi16(255);
+  size_t x = 0;
+
+  for (; x + 4 <= width; x += 4) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + x * 4));
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + x * 4));
+    __m128i slo = _mm_unpacklo_epi8(s, zero);
+    __m128i shi = _mm_unpackhi_epi8(s, zero);
+    __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xFF), 0xFF);
+    __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xFF), 0xFF);
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(ones, alo));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(ones, ahi));
+    lo = _mm_add_epi16(lo, round);
+    hi = _mm_add_epi16(hi, round);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    d = _mm_adds_epu8(s, _mm_packus_epi16(lo, hi));
+    _mm_storeu_si128((__m128i *)(dst + x * 4), d);
+  }
+  return x;
+}
+
+/* Same as over8_sse2, eight pixels per step; unpacks stay within lanes */
+__attribute__((target("avx2")))
+static size_t over8_avx2(U8 *dst, const U8 *src, size_t width) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i round = _mm256_set1_epi16(128);
+  const __m256i ones = _mm256_set1_epi16(255);
+  size_t x = 0;
+
+  for (; x + 8 <= width; x += 8) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + x * 4));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + x * 4));
+    __m256i slo = _mm256_unpacklo_epi8(s, zero);
+    __m256i shi = _mm256_unpackhi_epi8(s, zero);
+    __m256i alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(slo, 0xFF), 0xFF);
+    __m256i ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(shi, 0xFF), 0xFF);
+    __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(ones, alo));
+    __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(ones, ahi));
+    lo = _mm256_add_epi16(lo, round);
+    hi = _mm256_add_epi16(hi, round);
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+    d = _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi));
+    _mm256_storeu_si256((__m256i *)(dst + x * 4), d);
+  }
+  return x;
+}
+
+__attribute__((target("avx2")))
+static size_t add8_avx2(U8 *dst, const U8 *src, size_t width) {
+  size_t n = width * 4;
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_adds_epu8(s, d));
+  }
+  return i / 4;
+}
+
+__attribute__((target("sse2")))
+static size_t add8_sse2(U8 *dst, const U8 *src, size_t width) {
+  size_t n = width * 4;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epu8(s, d));
+  }
+  return i / 4;
+}
+
+/* One pixel per register; alpha is broadcast with a shuffle */
+__attribute__((target("sse2")))
+static void blendf_sse2(pngcore_blend_mode_t mode, float *dst, const float *src,
+                        size_t width) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  for (size_t x = 0; x < width; x++) {
+    __m128 s = _mm_loadu_ps(src + x * 4);
+    __m128 d = _mm_loadu_ps(dst + x * 4);
+    __m128 sa = _mm_shuffle_ps(s, s, 0xFF);
+    __m128 da = _mm_shuffle_ps(d, d, 0xFF);
+    __m128 sum = _mm_add_ps(s, d);
+    __m128 r;
+    switch (mode) {
+      case PNGCORE_BLEND_ADD:
+      r = _mm_min_ps(sum, one);
+      break;
+      case PNGCORE_BLEND_MULTIPLY:
+      r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s, _mm_sub_ps(one, da)),
+                                _mm_mul_ps(d, _mm_sub_ps(one, sa))),
+                     _mm_mul_ps(s, d));
+      break;
+      case PNGCORE_BLEND_SCREEN:
+      r = _mm_sub_ps(sum, _mm_mul_ps(s, d));
+      break;
+      case PNGCORE_BLEND_DARKEN:
+      r = _mm_sub_ps(sum, _mm_max_ps(_mm_mul_ps(s, da), _mm_mul_ps(d, sa)));
+      break;
+      case PNGCORE_BLEND_LIGHTEN:
+      r = _mm_sub_ps(sum, _mm_min_ps(_mm_mul_ps(s, da), _mm_mul_ps(d, sa)));
+      break;
+      default:
+      r = _mm_add_ps(s, _mm_mul_ps(d, _mm_sub_ps(one, sa)));
+      break;
+    }
+    _mm_storeu_ps(dst + x * 4, r);
+  }
+}
+
+#endif /* PNGCORE_X86_SIMD */
+
+/******************************************************************************
+* DISPATCH
+*****************************************************************************/
+
+void pngcore_blend_over8(U8 *dst, const U8 *src, size_t width) {
+  size_t x = 0;
+#ifdef PNGCORE_X86_SIMD
+  int level = detect_simd();
+  if (level >= 2) {
+    x = over8_avx2(dst, src, width);
+  }
+  if (level >= 1) {
+    x += over8_sse2(dst + x * 4, src + x * 4, width - x);
+  }
+#endif
+  over8_scalar(dst + x * 4, src + x * 4, width - x);
+}
+
+void pngcore_blend_add8(U8 *dst, const U8 *src, size_t width) {
+  size_t x = 0;
+#ifdef PNGCORE_X86_SIMD
+  int level = detect_simd();
+  if (level >= 2) {
+    x = add8_avx2(dst, src, width);
+  }
+  if (level >= 1) {
+    x += add8_sse2(dst + x * 4, src + x * 4, width - x);
+  }
+#endif
+  add8_scalar(dst + x * 4, src + x * 4, width - x);
+}
+
+void pngcore_blend_rowf(pngcore_blend_mode_t mode, float *dst, const float *src,
+                        size_t width) {
+#ifdef PNGCORE_X86_SIMD
+  if (detect_simd() >= 1) {
+    blendf_sse2(mode, dst, src, width);
+    return;
+  }
+#endif
+  blendf_scalar(mode, dst, src, width);
+}
+
+/******************************************************************************
+* COMPOSITE
+*****************************************************************************/
+
+int pngcore_composite(const pngcore_png_t *base, const pngcore_png_t *overlay,
+                      int32_t x, int32_t y, pngcore_blend_mode_t mode,
+                      unsigned flags, const char *filename,
+                      pngcore_error_t *error) {
+  if (!base || !base->internal || !base->internal->ihdr ||
+      !overlay || !overlay->internal || !overlay->internal->ihdr || !filename) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid PNG or filename");
+    return -1;
+  }
+  if (mode < PNGCORE_BLEND_OVER || mode > PNGCORE_BLEND_LIGHTEN) {
+    pngcore_error_set(error, PNGCORE_ERR, "Unknown blend mode %d", (int)mode);
+    return -1;
+  }
+
+  pngcore_ihdr_data_t *bh = base->internal->ihdr->p_data;
+  pngcore_ihdr_data_t *oh = overlay->internal->ihdr->p_data;
+
+  /* Sub-byte gray is blended as 8-bit and packed back */
+  pngcore_pixel_format_t native;
+  if (pngcore_format_from_png(bh->bit_depth < 8 ? 8 : bh->bit_depth,
+                              bh->color_type, &native) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED,
+    "Compositing onto depth %u type %u is not supported", bh->bit_depth, bh->color_type);
+    return -1;
+  }
+
+  /* 8-bit over and plus onto an opaque base stay in premultiplied integers.
+  * A base with alpha would not survive an 8-bit premultiply round trip, so
+  * it is blended as floats from straight samples like the other modes */
+  int wide = (bh->bit_depth == 16);
+  int linear = (flags & PNGCORE_COMPOSITE_LINEAR) != 0;
+  int opaque = (pngcore_format_desc(native)->a < 0);
+  int integer = !wide && !linear && opaque &&
+                (mode == PNGCORE_BLEND_OVER || mode == PNGCORE_BLEND_ADD);
+  pngcore_pixel_format_t work = integer ? PNGCORE_FMT_RGBA8_PREMUL :
+                                wide ? PNGCORE_FMT_RGBA16 : PNGCORE_FMT_RGBA8;
+  int sample_bytes = wide ? 2 : 1;
+  size_t work_bytes = pngcore_format_pixel_bytes(work);
+  size_t native_bytes = pngcore_format_pixel_bytes(native);
+
+  /* Overlap of the overlay with the base, in base coordinates */
+  int64_t x0 = x > 0 ? x : 0;
+  int64_t y0 = y > 0 ? y : 0;
+  int64_t x1 = (int64_t)x + oh->width < bh->width ? (int64_t)x + oh->width : bh->width;
+  int64_t y1 = (int64_t)y + oh->height < bh->height ? (int64_t)y + oh->height : bh->height;
+  if (x1 <= x0 || y1 <= y0) {
+    y0 = y1 = bh->height;
+  }
+  size_t seg = (size_t)(x1 - x0);
+
+  pngcore_row_reader_t *reader = NULL;
+  pngcore_row_reader_t *over = NULL;
+  pngcore_row_writer_t *writer = NULL;
+  pngcore_convert_plan_t to_work, from_work;
+  U8 *row = NULL, *gray = NULL, *bwork = NULL;
+  float *fdst = NULL, *fsrc = NULL;
+  int rc = -1;
+
+  reader = pngcore_row_reader_create(base, error);
+  if (!reader) goto cleanup;
+  writer = pngcore_row_writer_create(filename, bh->width, bh->height,
+                                     bh->bit_depth, bh->color_type, error);
+  if (!writer || pngcore_row_writer_copy_palette(writer, base, error) != 0) goto cleanup;
+
+  if (y0 < y1) {
+    over = pngcore_row_reader_create(overlay, error);
+    if (!over) goto cleanup;
+    if (pngcore_row_reader_set_format(over, work) != 0 ||
+        pngcore_convert_plan_init(&to_work, native, work) != 0 ||
+        pngcore_convert_plan_init(&from_work, work, native) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED,
+      "Overlay depth %u type %u is not supported", oh->bit_depth, oh->color_type);
+      goto cleanup;
+    }
+
+    row = pngcore_malloc(writer->row_bytes);
+    gray = pngcore_malloc(bh->width);
+    bwork = pngcore_malloc(seg * work_bytes);
+    fdst = pngcore_malloc(PNGCORE_BLEND_CHUNK * 4 * sizeof(float));
+    fsrc = pngcore_malloc(PNGCORE_BLEND_CHUNK * 4 * sizeof(float));
+    if (!row || !gray || !bwork || !fdst || !fsrc) {
+      pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate composite buffers");
+      goto cleanup;
+    }
+
+    /* Overlay rows above the base are never used */
+    for (int64_t skip = y < 0 ? -(int64_t)y : 0; skip > 0; skip--) {
+      const uint8_t *unused;
+      if (pngcore_row_reader_next(over, &unused) != 1) {
+        pngcore_error_set(error, PNGCORE_ERR, "Failed to decode overlay");
+        goto cleanup;
+      }
+    }
+  }
+
+  for (U32 r = 0; r < bh->height; r++) {
+    const uint8_t *src = NULL;
+    if (pngcore_row_reader_next(reader, &src) != 1) {
+      pngcore_error_set(error, PNGCORE_ERR, "Failed to decode base row %u", r);
+      goto cleanup;
+    }
+
+    /* Rows outside the overlay go back to the encoder untouched */
+    if (r < y0 || r >= y1) {
+      if (pngcore_row_writer_write(writer, src) != 0) {
+        pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to encode row %u", r);
+        goto cleanup;
+      }
+      continue;
+    }
+
+    const uint8_t *top = NULL;
+    if (pngcore_row_reader_next(over, &top) != 1) {
+      pngcore_error_set(error, PNGCORE_ERR, "Failed to decode overlay row %u", (U32)(r - y));
+      goto cleanup;
+    }
+    top += (size_t)(x0 - x) * work_bytes;
+
+    U8 *pixels = row;
+    memcpy(row, src, writer->row_bytes);
+    if (bh->bit_depth < 8) {
+      pngcore_unpack_gray(row, gray, bh->width, bh->bit_depth);
+      pixels = gray;
+    }
+    U8 *span = pixels + (size_t)x0 * native_bytes;
+    pngcore_convert_plan_run(&to_work, span, bwork, seg);
+
+    if (integer && mode == PNGCORE_BLEND_OVER) {
+      pngcore_blend_over8(bwork, top, seg);
+    } else if (integer) {
+      pngcore_blend_add8(bwork, top, seg);
+    } else {
+      for (size_t i = 0; i < seg; i += PNGCORE_BLEND_CHUNK) {
+        size_t n = seg - i < PNGCORE_BLEND_CHUNK ? seg - i : PNGCORE_BLEND_CHUNK;
+        pngcore_blend_to_float(bwork + i * work_bytes, fdst, n, sample_bytes, linear);
+        pngcore_blend_to_float(top + i * work_bytes, fsrc, n, sample_bytes, linear);
+        pngcore_blend_rowf(mode, fdst, fsrc, n);
+        pngcore_blend_from_float(fdst, bwork + i * work_bytes, n, sample_bytes, linear);
+      }
+    }
+
+    pngcore_convert_plan_run(&from_work, bwork, span, seg);
+    if (bh->bit_depth < 8) {
+      pngcore_pack_gray(gray, row, bh->width, bh->bit_depth);
+    }
+    if (pngcore_row_writer_write(writer, row) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to encode row %u", r);
+      goto cleanup;
+    }
+  }
+
+  rc = pngcore_row_writer_finish(writer, error);
+
+cleanup:
+  free(row);
+  free(gray);
+  free(bwork);
+  free(fdst);
+  free(fsrc);
+  pngcore_row_writer_destroy(writer);
+  pngcore_row_reader_destroy(over);
+  pngcore_row_reader_destroy(reader);
+  return rc;
+}
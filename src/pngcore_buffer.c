@@ -4,6 +4,7 @@
 */
 
 #include "pngcore/pngcore_concurrent.h"
+#include "pngcore/pngcore_probes.h"
 #include <string.h>
 #include <stdbool.h>
 
@@ -24,6 +25,7 @@ int pngcore_cbuf_add(pngcore_cbuf_t *cb, pngcore_cbuf_entry_t *src_data, sem_t *
   memcpy(&cb->data[cb->head], src_data, sizeof(pngcore_cbuf_entry_t));
   cb->head = (cb->head + 1) % cb->capacity;
   cb->count++;
+  PNGCORE_PROBE2(cbuf_add, src_data->sequence_num, cb->count);
   
   sem_post(&sems[0]);  /* Unlock mutex */
   
@@ -44,6 +46,7 @@ int pngcore_cbuf_get(pngcore_cbuf_t *cb, pngcore_cbuf_entry_t *dest_data, sem_t
   memcpy(dest_data, &cb->data[cb->tail], sizeof(pngcore_cbuf_entry_t));
   cb->tail = (cb->tail + 1) % cb->capacity;
   cb->count--;
+  PNGCORE_PROBE2(cbuf_get, dest_data->sequence_num, cb->count);
   
   sem_post(&sems[0]);  /* Unlock mutex */
   
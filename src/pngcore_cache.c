@@ -0,0 +1,225 @@
+/**
+* @file pngcore_cache.c
+* @brief Decoded pixel cache files
+*/
+
+#include "pngcore/pngcore_cache.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_hash.h"
+#include "pngcore/pngcore_stream.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+static U64 align_up(U64 n, U64 align) {
+  return (n + align - 1) / align * align;
+}
+
+/* Hash of the IHDR fields, compressed image data and the PLTE and tRNS
+* chunks, which also change the decoded pixels */
+static int source_hash(const pngcore_png_t *png, U64 *hash) {
+  if (!png || !png->internal || !png->internal->ihdr || !png->internal->idat) return -1;
+
+  pngcore_ihdr_data_t *ihdr = png->internal->ihdr->p_data;
+  U32 header[3] = { htonl(ihdr->width), htonl(ihdr->height),
+                    htonl((U32)ihdr->bit_depth << 24 | (U32)ihdr->color_type << 16 |
+                          (U32)ihdr->interlace) };
+
+  pngcore_hash_state_t state;
+  pngcore_hash_init(&state);
+  pngcore_hash_update(&state, header, sizeof(header));
+  pngcore_hash_update(&state, png->internal->idat->p_data->data,
+                      png->internal->idat->p_data->length);
+  const pngcore_chunk_list_t *extra = png->internal->extra;
+  static const char *const palette_types[] = { "PLTE", "tRNS" };
+  for (int i = 0; i < 2; i++) {
+    const pngcore_chunk_ref_t *ref = pngcore_chunk_list_find(extra, palette_types[i], 0, NULL);
+    if (ref) {
+      U32 length = htonl(ref->length);
+      pngcore_hash_update(&state, palette_types[i], CHUNK_TYPE_SIZE);
+      pngcore_hash_update(&state, &length, sizeof(length));
+      pngcore_hash_update(&state, pngcore_chunk_ref_data(extra, ref), ref->length);
+    }
+  }
+  *hash = pngcore_hash_final(&state);
+  return 0;
+}
+
+int pngcore_cache_write(const pngcore_png_t *png, pngcore_pixel_format_t fmt,
+                        const char *path, pngcore_error_t *error) {
+  if (!path) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Filename is NULL");
+    return -1;
+  }
+
+  U64 hash;
+  if (source_hash(png, &hash) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid PNG");
+    return -1;
+  }
+  pngcore_row_reader_t *reader = pngcore_row_reader_create(png, error);
+  if (!reader) return -1;
+  if (pngcore_row_reader_set_format(reader, fmt) != 0) {
+    pngcore_row_reader_destroy(reader);
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED, "Cannot decode to format %d", fmt);
+    return -1;
+  }
+
+  size_t row_bytes = pngcore_row_reader_row_bytes(reader);
+  pngcore_cache_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PNGCORE_CACHE_MAGIC, sizeof(header.magic));
+  header.byte_order = PNGCORE_CACHE_BYTE_ORDER;
+  header.version = PNGCORE_CACHE_VERSION;
+  header.width = reader->width;
+  header.height = reader->height;
+  header.format = fmt;
+  header.stride = align_up(row_bytes, PNGCORE_CACHE_ALIGN);
+  header.data_offset = PNGCORE_CACHE_DATA_ALIGN;
+  header.source_hash = hash;
+  header.file_size = header.data_offset + header.stride * header.height;
+
+  char *tmp_path = NULL;
+  U8 *pad = pngcore_calloc(1, PNGCORE_CACHE_DATA_ALIGN);
+  int fd = -1;
+  FILE *fp = NULL;
+  if (pad) {
+    fd = pngcore_open_temp(path, &tmp_path);
+    fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+  }
+  if (!fp) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to create cache file for %s", path);
+    if (fd >= 0) {
+      close(fd);
+      unlink(tmp_path);
+    }
+    free(tmp_path);
+    free(pad);
+    pngcore_row_reader_destroy(reader);
+    return -1;
+  }
+
+  /* Rows are padded with zeros up to the stride */
+  int rc = pngcore_file_sink(fp, (const U8 *)&header, sizeof(header));
+  if (rc == 0) {
+    rc = pngcore_file_sink(fp, pad, header.data_offset - sizeof(header));
+  }
+  size_t row_pad = header.stride - row_bytes;
+  const uint8_t *row;
+  int next = 0;
+  while (rc == 0 && (next = pngcore_row_reader_next(reader, &row)) == 1) {
+    rc = pngcore_file_sink(fp, row, row_bytes);
+    if (rc == 0 && row_pad > 0) {
+      rc = pngcore_file_sink(fp, pad, row_pad);
+    }
+  }
+  pngcore_row_reader_destroy(reader);
+  free(pad);
+
+  if (fclose(fp) != 0) rc = -1;
+  if (next < 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Failed to decode image data");
+    rc = -1;
+  } else if (rc == 0 && rename(tmp_path, path) != 0) {
+    rc = -1;
+  }
+  if (rc != 0) {
+    if (next >= 0) {
+      pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to write cache file %s", path);
+    }
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+  return rc;
+}
+
+static int cache_validate(const pngcore_cache_t *cache) {
+  const pngcore_cache_header_t *h = (const pngcore_cache_header_t *)cache->map;
+  if (memcmp(h->magic, PNGCORE_CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+      h->byte_order != PNGCORE_CACHE_BYTE_ORDER || h->version != PNGCORE_CACHE_VERSION ||
+      h->file_size != cache->size) {
+    return -1;
+  }
+  if (h->format >= PNGCORE_FMT_COUNT || h->width == 0 || h->height == 0 ||
+      h->data_offset % PNGCORE_CACHE_DATA_ALIGN != 0 || h->stride % PNGCORE_CACHE_ALIGN != 0) {
+    return -1;
+  }
+  size_t pixel_bytes = pngcore_format_pixel_bytes((pngcore_pixel_format_t)h->format);
+  if (h->stride / pixel_bytes < h->width || h->data_offset > cache->size ||
+      (cache->size - h->data_offset) / h->stride < h->height) {
+    return -1;
+  }
+  return 0;
+}
+
+pngcore_cache_t* pngcore_cache_open(const char *path, pngcore_error_t *error) {
+  if (!path) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Filename is NULL");
+    return NULL;
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to open file: %s", path);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(pngcore_cache_header_t)) {
+    close(fd);
+    pngcore_error_set(error, PNGCORE_ERR, "Not a pngcore cache: %s", path);
+    return NULL;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to map %s", path);
+    return NULL;
+  }
+
+  pngcore_cache_t *cache = pngcore_calloc(1, sizeof(pngcore_cache_t));
+  if (!cache) {
+    munmap(map, st.st_size);
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate cache");
+    return NULL;
+  }
+  cache->map = map;
+  cache->size = st.st_size;
+
+  if (cache_validate(cache) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid or incompatible cache: %s", path);
+    pngcore_cache_close(cache);
+    return NULL;
+  }
+
+  const pngcore_cache_header_t *h = (const pngcore_cache_header_t *)cache->map;
+  cache->view.pixels = cache->map + h->data_offset;
+  cache->view.stride = h->stride;
+  cache->view.width = h->width;
+  cache->view.height = h->height;
+  cache->view.format = (pngcore_pixel_format_t)h->format;
+  cache->view.source_hash = h->source_hash;
+  return cache;
+}
+
+const pngcore_pixel_view_t* pngcore_cache_view(const pngcore_cache_t *cache) {
+  return cache ? &cache->view : NULL;
+}
+
+void pngcore_cache_close(pngcore_cache_t *cache) {
+  if (!cache) return;
+  munmap(cache->map, cache->size);
+  free(cache);
+}
+
+int pngcore_cache_matches(const pngcore_cache_t *cache, const pngcore_png_t *png) {
+  U64 hash;
+  if (!cache || source_hash(png, &hash) != 0) return -1;
+  return hash == cache->view.source_hash;
+}
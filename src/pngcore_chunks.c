@@ -0,0 +1,319 @@
+/**
+* @file pngcore_chunks.c
+* @brief PLTE and ancillary chunks kept raw for passthrough
+*/
+
+#include "pngcore.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_crc.h"
+#include "pngcore/pngcore_stats.h"
+#include "pngcore/pngcore_probes.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+/* Largest inflated zTXt or iCCP payload accepted */
+#define INFLATE_LIMIT (64u << 20)
+
+#define CHUNK_OVERHEAD (CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + CHUNK_CRC_SIZE)
+
+/******************************************************************************
+* CHUNK LIST
+*****************************************************************************/
+
+static int grow(void **items, size_t *cap, size_t need, size_t size) {
+  if (need <= *cap) return 0;
+  size_t n = *cap ? *cap * 2 : 16;
+  while (n < need) {
+    n *= 2;
+  }
+  void *p = pngcore_realloc(*items, n * size);
+  if (!p) return -1;
+  *items = p;
+  *cap = n;
+  return 0;
+}
+
+int pngcore_chunk_list_add(pngcore_chunk_list_t **list, const U8 *chunk, U8 after_idat) {
+  if (!*list) {
+    *list = pngcore_calloc(1, sizeof(pngcore_chunk_list_t));
+    if (!*list) return -1;
+    atomic_init(&(*list)->holders, 1);
+  }
+  pngcore_chunk_list_t *l = *list;
+  U32 length = from_be_buffer((U8 *)chunk);
+  size_t total = (size_t)length + CHUNK_OVERHEAD;
+  if (grow((void **)&l->bytes, &l->cap, l->size + total, 1) != 0 ||
+      grow((void **)&l->refs, &l->cap_refs, l->count + 1, sizeof(*l->refs)) != 0) {
+    return -1;
+  }
+
+  pngcore_chunk_ref_t *ref = &l->refs[l->count++];
+  memcpy(ref->type, chunk + CHUNK_LEN_SIZE, CHUNK_TYPE_SIZE);
+  ref->length = length;
+  ref->offset = l->size;
+  ref->after_idat = after_idat;
+  memcpy(l->bytes + l->size, chunk, total);
+  l->size += total;
+  PNGCORE_PROBE3(chunk_parse, (const char *)ref->type, length, ref->offset);
+  return 0;
+}
+
+const pngcore_chunk_ref_t* pngcore_chunk_list_find(const pngcore_chunk_list_t *list,
+                                                   const char type[4], size_t start, size_t *index) {
+  if (!list) return NULL;
+  for (size_t i = start; i < list->count; i++) {
+    if (memcmp(list->refs[i].type, type, CHUNK_TYPE_SIZE) == 0) {
+      if (index) *index = i;
+      return &list->refs[i];
+    }
+  }
+  return NULL;
+}
+
+const U8* pngcore_chunk_ref_data(const pngcore_chunk_list_t *list, const pngcore_chunk_ref_t *ref) {
+  return list->bytes + ref->offset + CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE;
+}
+
+int pngcore_chunk_ref_crc_ok(const pngcore_chunk_list_t *list, const pngcore_chunk_ref_t *ref) {
+  const U8 *type = list->bytes + ref->offset + CHUNK_LEN_SIZE;
+  U32 crc = pngcore_crc((unsigned char *)type, CHUNK_TYPE_SIZE + ref->length);
+  U32 expected = from_be_buffer((U8 *)type + CHUNK_TYPE_SIZE + ref->length);
+  if (crc != expected) {
+    PNGCORE_PROBE3(crc_mismatch, type, expected, crc);
+    return 0;
+  }
+  return 1;
+}
+
+pngcore_raw_chunk_t* pngcore_chunk_ref_view(const pngcore_chunk_list_t *list,
+                                            const pngcore_chunk_ref_t *ref) {
+  pngcore_raw_chunk_t *raw = pngcore_malloc(sizeof(pngcore_raw_chunk_t));
+  if (!raw) return NULL;
+  memcpy(raw->type, ref->type, CHUNK_TYPE_SIZE);
+  raw->length = ref->length;
+  raw->p_data = (U8 *)pngcore_chunk_ref_data(list, ref);
+  raw->crc = from_be_buffer(raw->p_data + ref->length);
+  return raw;
+}
+
+int pngcore_chunk_list_write(const pngcore_chunk_list_t *list, U8 after_idat, FILE *fp) {
+  if (!list) return 0;
+  for (size_t i = 0; i < list->count; i++) {
+    const pngcore_chunk_ref_t *ref = &list->refs[i];
+    size_t total = (size_t)ref->length + CHUNK_OVERHEAD;
+    if (ref->after_idat == after_idat &&
+        fwrite(list->bytes + ref->offset, 1, total, fp) != total) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void pngcore_chunk_list_remove(pngcore_chunk_list_t *list, size_t index) {
+  pngcore_chunk_ref_t *ref = &list->refs[index];
+  size_t start = ref->offset;
+  size_t total = (size_t)ref->length + CHUNK_OVERHEAD;
+  memmove(list->bytes + start, list->bytes + start + total, list->size - start - total);
+  list->size -= total;
+  memmove(ref, ref + 1, (list->count - index - 1) * sizeof(*ref));
+  list->count--;
+  for (size_t i = index; i < list->count; i++) {
+    list->refs[i].offset -= total;
+  }
+}
+
+pngcore_chunk_list_t* pngcore_chunk_list_retain(pngcore_chunk_list_t *list) {
+  if (list) {
+    atomic_fetch_add_explicit(&list->holders, 1, memory_order_relaxed);
+  }
+  return list;
+}
+
+void pngcore_chunk_list_free(pngcore_chunk_list_t *list) {
+  if (!list) return;
+  if (atomic_fetch_sub_explicit(&list->holders, 1, memory_order_acq_rel) != 1) return;
+  free(list->bytes);
+  free(list->refs);
+  free(list);
+}
+
+/******************************************************************************
+* METADATA ACCESS
+*****************************************************************************/
+
+static const pngcore_chunk_list_t* png_chunks(const pngcore_png_t *png) {
+  return (png && png->internal) ? png->internal->extra : NULL;
+}
+
+/* First chunk of a type, CRC-checked now that it is needed */
+static const pngcore_chunk_ref_t* find_checked(const pngcore_png_t *png, const char type[4],
+                                               pngcore_error_t *error) {
+  const pngcore_chunk_list_t *list = png_chunks(png);
+  const pngcore_chunk_ref_t *ref = pngcore_chunk_list_find(list, type, 0, NULL);
+  if (!ref) {
+    pngcore_error_set(error, PNGCORE_ERR, "No %.4s chunk", type);
+    return NULL;
+  }
+  if (!pngcore_chunk_ref_crc_ok(list, ref)) {
+    pngcore_error_set(error, PNGCORE_ERR_CRC_MISMATCH, "CRC mismatch in %.4s chunk", type);
+    return NULL;
+  }
+  return ref;
+}
+
+/* Length of a NUL-terminated keyword at the start of data, 0 if invalid */
+static size_t keyword_len(const U8 *data, size_t len) {
+  const U8 *end = memchr(data, 0, len < 80 ? len : 80);
+  return (end && end > data) ? (size_t)(end - data) : 0;
+}
+
+/* Inflate a zlib stream into a new NUL-terminated buffer */
+static int inflate_alloc(const U8 *src, size_t src_len, U8 **out, size_t *out_len) {
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit(&strm) != Z_OK) return -1;
+
+  size_t cap = src_len * 4 + 64;
+  U8 *buf = pngcore_malloc(cap + 1);
+  size_t len = 0;
+  int ret = Z_OK;
+  U64 start = pngcore_stats_now();
+  strm.next_in = (U8 *)src;
+  strm.avail_in = src_len;
+  PNGCORE_PROBE1(inflate_start, src_len);
+  while (buf && ret == Z_OK) {
+    if (len == cap) {
+      if (cap >= INFLATE_LIMIT) break;
+      cap = cap * 2 < INFLATE_LIMIT ? cap * 2 : INFLATE_LIMIT;
+      U8 *grown = pngcore_realloc(buf, cap + 1);
+      if (!grown) break;
+      buf = grown;
+    }
+    strm.next_out = buf + len;
+    strm.avail_out = cap - len;
+    ret = inflate(&strm, Z_NO_FLUSH);
+    len = cap - strm.avail_out;
+  }
+  PNGCORE_PROBE3(inflate_done, strm.total_in, len, ret);
+  inflateEnd(&strm);
+  pngcore_stats_add(PNGCORE_STAT_BYTES_INFLATED, len);
+  pngcore_stats_since(PNGCORE_STAT_INFLATE_NS, start);
+
+  if (!buf || ret != Z_STREAM_END) {
+    free(buf);
+    return -1;
+  }
+  buf[len] = 0;
+  *out = buf;
+  *out_len = len;
+  return 0;
+}
+
+int pngcore_get_text(const pngcore_png_t *png, const char *keyword, char **text,
+                     size_t *length, pngcore_error_t *error) {
+  const pngcore_chunk_list_t *list = png_chunks(png);
+  if (!keyword || !text) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid keyword or output");
+    return -1;
+  }
+
+  size_t key_len = strlen(keyword);
+  for (size_t i = 0; list && i < list->count; i++) {
+    const pngcore_chunk_ref_t *ref = &list->refs[i];
+    int compressed = memcmp(ref->type, "zTXt", 4) == 0;
+    if (!compressed && memcmp(ref->type, "tEXt", 4) != 0) continue;
+
+    const U8 *data = pngcore_chunk_ref_data(list, ref);
+    if (keyword_len(data, ref->length) != key_len || memcmp(data, keyword, key_len) != 0) {
+      continue;
+    }
+    if (!pngcore_chunk_ref_crc_ok(list, ref)) {
+      pngcore_error_set(error, PNGCORE_ERR_CRC_MISMATCH, "CRC mismatch in %.4s chunk", ref->type);
+      return -1;
+    }
+
+    const U8 *body = data + key_len + 1;
+    size_t body_len = ref->length - key_len - 1;
+    U8 *out;
+    size_t out_len;
+    if (compressed) {
+      /* Only zTXt pays for inflate, and only here */
+      if (body_len < 1 || body[0] != 0 ||
+          inflate_alloc(body + 1, body_len - 1, &out, &out_len) != 0) {
+        pngcore_error_set(error, PNGCORE_ERR, "Corrupt zTXt chunk for %s", keyword);
+        return -1;
+      }
+    } else {
+      out = pngcore_malloc(body_len + 1);
+      if (!out) {
+        pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate text");
+        return -1;
+      }
+      memcpy(out, body, body_len);
+      out[body_len] = 0;
+      out_len = body_len;
+    }
+    *text = (char *)out;
+    if (length) *length = out_len;
+    return 0;
+  }
+
+  pngcore_error_set(error, PNGCORE_ERR, "No text chunk with keyword %s", keyword);
+  return -1;
+}
+
+int pngcore_get_iccp(const pngcore_png_t *png, char name[80], uint8_t **profile,
+                     size_t *length, pngcore_error_t *error) {
+  if (!profile || !length) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid output");
+    return -1;
+  }
+  const pngcore_chunk_ref_t *ref = find_checked(png, "iCCP", error);
+  if (!ref) return -1;
+
+  const U8 *data = pngcore_chunk_ref_data(png_chunks(png), ref);
+  size_t name_len = keyword_len(data, ref->length);
+  if (name_len == 0 || ref->length < name_len + 2 || data[name_len + 1] != 0 ||
+      inflate_alloc(data + name_len + 2, ref->length - name_len - 2, profile, length) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Corrupt iCCP chunk");
+    return -1;
+  }
+  if (name) {
+    memcpy(name, data, name_len + 1);
+  }
+  return 0;
+}
+
+int pngcore_get_gamma(const pngcore_png_t *png, uint32_t *gamma, pngcore_error_t *error) {
+  const pngcore_chunk_ref_t *ref = find_checked(png, "gAMA", error);
+  if (!ref) return -1;
+  if (ref->length != 4 || !gamma) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid gAMA chunk");
+    return -1;
+  }
+  *gamma = from_be_buffer((U8 *)pngcore_chunk_ref_data(png_chunks(png), ref));
+  return 0;
+}
+
+int pngcore_get_phys(const pngcore_png_t *png, uint32_t *ppu_x, uint32_t *ppu_y,
+                     uint8_t *unit, pngcore_error_t *error) {
+  const pngcore_chunk_ref_t *ref = find_checked(png, "pHYs", error);
+  if (!ref) return -1;
+  if (ref->length != 9) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid pHYs chunk");
+    return -1;
+  }
+  U8 *data = (U8 *)pngcore_chunk_ref_data(png_chunks(png), ref);
+  if (ppu_x) *ppu_x = from_be_buffer(data);
+  if (ppu_y) *ppu_y = from_be_buffer(data + 4);
+  if (unit) *unit = data[8];
+  return 0;
+}
+
+const uint8_t* pngcore_get_exif(const pngcore_png_t *png, size_t *length, pngcore_error_t *error) {
+  const pngcore_chunk_ref_t *ref = find_checked(png, "eXIf", error);
+  if (!ref) return NULL;
+  if (length) *length = ref->length;
+  return pngcore_chunk_ref_data(png_chunks(png), ref);
+}
@@ -0,0 +1,451 @@
+/**
+* @file pngcore_compose.c
+* @brief Multi-image composition (stitching, mosaics)
+*/
+
+#include "pngcore/pngcore_compose.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_pool.h"
+#include "pngcore/pngcore_stream.h"
+#include "pngcore/pngcore_filter.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+
+/******************************************************************************
+* VERTICAL STITCH
+*****************************************************************************/
+
+/* Worker: decode one input into its ring, blocking while the ring is full */
+static void stitch_decode_task(void *arg) {
+  pngcore_stitch_slot_t *slot = (pngcore_stitch_slot_t *)arg;
+  pngcore_stitch_t *ctx = slot->ctx;
+  pngcore_row_reader_t *reader = NULL;
+  U8 *ring = NULL;
+  int failed = 0;
+
+  reader = pngcore_row_reader_create(slot->png, &slot->error);
+  ring = pngcore_malloc(ctx->ring_rows * ctx->row_bytes);
+  if (!reader || !ring) {
+    if (reader) {
+      pngcore_error_set(&slot->error, PNGCORE_ERR_MEMORY, "Failed to allocate stitch queue");
+    }
+    failed = 1;
+  }
+
+  pthread_mutex_lock(&ctx->lock);
+  slot->ring = ring;
+  pthread_mutex_unlock(&ctx->lock);
+
+  for (U32 y = 0; !failed && y < slot->rows_total; y++) {
+    const uint8_t *row = NULL;
+    if (pngcore_row_reader_next(reader, &row) != 1) {
+      pngcore_error_set(&slot->error, PNGCORE_ERR, "Failed to decode row %u", y);
+      failed = 1;
+      break;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    while (slot->count == ctx->ring_rows && !ctx->abort) {
+      pthread_cond_wait(&ctx->cond, &ctx->lock);
+    }
+    int abort = ctx->abort;
+    pthread_mutex_unlock(&ctx->lock);
+    if (abort) break;
+
+    /* The head slot is not visible to the emitter until count is bumped */
+    memcpy(ring + slot->head * ctx->row_bytes, row, ctx->row_bytes);
+
+    pthread_mutex_lock(&ctx->lock);
+    slot->head = (slot->head + 1) % ctx->ring_rows;
+    slot->count++;
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+  }
+
+  /* Publish the outcome and keep the ring alive until it is drained */
+  pthread_mutex_lock(&ctx->lock);
+  if (failed) {
+    slot->failed = 1;
+  } else {
+    slot->done = 1;
+  }
+  pthread_cond_broadcast(&ctx->cond);
+  while (slot->count > 0 && !ctx->abort) {
+    pthread_cond_wait(&ctx->cond, &ctx->lock);
+  }
+  slot->ring = NULL;
+  pthread_mutex_unlock(&ctx->lock);
+
+  free(ring);
+  pngcore_row_reader_destroy(reader);
+}
+
+/* Emitter: drain slots strictly in input order into the writer */
+static int stitch_emit(pngcore_stitch_t *ctx, pngcore_row_writer_t *writer,
+                       pngcore_error_t *error) {
+  for (size_t i = 0; i < ctx->num_slots; i++) {
+    pngcore_stitch_slot_t *slot = &ctx->slots[i];
+
+    for (U32 y = 0; y < slot->rows_total; y++) {
+      pthread_mutex_lock(&ctx->lock);
+      while (slot->count == 0 && !slot->failed) {
+        pthread_cond_wait(&ctx->cond, &ctx->lock);
+      }
+      if (slot->count == 0) {
+        pthread_mutex_unlock(&ctx->lock);
+        pngcore_error_set(error, slot->error.code, "Input %zu: %s", i, slot->error.message);
+        return -1;
+      }
+      const U8 *row = slot->ring + slot->tail * ctx->row_bytes;
+      pthread_mutex_unlock(&ctx->lock);
+
+      if (pngcore_row_writer_write(writer, row) != 0) {
+        pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to encode row %u of input %zu", y, i);
+        return -1;
+      }
+
+      pthread_mutex_lock(&ctx->lock);
+      slot->tail = (slot->tail + 1) % ctx->ring_rows;
+      slot->count--;
+      pthread_cond_broadcast(&ctx->cond);
+      pthread_mutex_unlock(&ctx->lock);
+    }
+  }
+
+  return 0;
+}
+
+int pngcore_stitch_vertical(pngcore_png_t *const inputs[], size_t n,
+                            const char *filename, pngcore_error_t *error) {
+  if (!inputs || n == 0 || !filename) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid inputs or filename");
+    return -1;
+  }
+
+  /* All inputs must agree on the scanline format */
+  U64 total_height = 0;
+  pngcore_ihdr_data_t *first = NULL;
+  for (size_t i = 0; i < n; i++) {
+    if (!inputs[i] || !inputs[i]->internal || !inputs[i]->internal->ihdr ||
+        !inputs[i]->internal->idat) {
+      pngcore_error_set(error, PNGCORE_ERR, "Input %zu is not a loaded PNG", i);
+      return -1;
+    }
+    pngcore_ihdr_data_t *ihdr = inputs[i]->internal->ihdr->p_data;
+    if (ihdr->interlace != 0) {
+      pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED, "Input %zu is interlaced", i);
+      return -1;
+    }
+    if (!first) {
+      first = ihdr;
+    } else if (ihdr->width != first->width || ihdr->bit_depth != first->bit_depth ||
+               ihdr->color_type != first->color_type) {
+      pngcore_error_set(error, PNGCORE_ERR,
+      "Input %zu is %ux%u depth %u type %u, expected width %u depth %u type %u",
+      i, ihdr->width, ihdr->height, ihdr->bit_depth, ihdr->color_type,
+      first->width, first->bit_depth, first->color_type);
+      return -1;
+    } else if (!pngcore_same_palette(inputs[0], inputs[i])) {
+      pngcore_error_set(error, PNGCORE_ERR, "Input %zu has a different PLTE or tRNS", i);
+      return -1;
+    }
+    total_height += ihdr->height;
+  }
+  if (total_height > 0x7fffffffUL) {
+    pngcore_error_set(error, PNGCORE_ERR, "Stitched height %lu exceeds the PNG limit", total_height);
+    return -1;
+  }
+
+  pngcore_stitch_t ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.num_slots = n;
+  ctx.slots = pngcore_calloc(n, sizeof(pngcore_stitch_slot_t));
+  if (!ctx.slots) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate stitch state");
+    return -1;
+  }
+
+  pngcore_row_writer_t *writer = pngcore_row_writer_create(filename, first->width,
+                                                           (U32)total_height,
+                                                           first->bit_depth,
+                                                           first->color_type, error);
+  if (!writer || pngcore_row_writer_copy_palette(writer, inputs[0], error) != 0) {
+    pngcore_row_writer_destroy(writer);
+    free(ctx.slots);
+    return -1;
+  }
+  ctx.row_bytes = writer->row_bytes;
+  ctx.ring_rows = PNGCORE_STITCH_RING_BYTES / ctx.row_bytes;
+  if (ctx.ring_rows < PNGCORE_STITCH_MIN_ROWS) ctx.ring_rows = PNGCORE_STITCH_MIN_ROWS;
+  if (ctx.ring_rows > PNGCORE_STITCH_MAX_ROWS) ctx.ring_rows = PNGCORE_STITCH_MAX_ROWS;
+
+  for (size_t i = 0; i < n; i++) {
+    ctx.slots[i].png = inputs[i];
+    ctx.slots[i].ctx = &ctx;
+    ctx.slots[i].rows_total = inputs[i]->internal->ihdr->p_data->height;
+  }
+
+  pthread_mutex_init(&ctx.lock, NULL);
+  pthread_cond_init(&ctx.cond, NULL);
+
+  int threads = pngcore_pool_default_threads();
+  if ((size_t)threads > n) threads = (int)n;
+
+  int rc = 0;
+  pngcore_pool_t *pool = pngcore_pool_create(threads);
+  if (!pool) {
+    pngcore_error_set(error, PNGCORE_ERR, "Failed to start decode threads");
+    rc = -1;
+    goto cleanup;
+  }
+
+  /* FIFO dispatch guarantees the input being emitted always has a worker */
+  for (size_t i = 0; i < n; i++) {
+    if (pngcore_pool_submit(pool, stitch_decode_task, &ctx.slots[i]) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to queue input %zu", i);
+      rc = -1;
+      break;
+    }
+  }
+
+  if (rc == 0) {
+    rc = stitch_emit(&ctx, writer, error);
+  }
+
+  if (rc != 0) {
+    pthread_mutex_lock(&ctx.lock);
+    ctx.abort = 1;
+    pthread_cond_broadcast(&ctx.cond);
+    pthread_mutex_unlock(&ctx.lock);
+  }
+  pngcore_pool_wait(pool);
+  pngcore_pool_destroy(pool);
+
+  if (rc == 0) {
+    rc = pngcore_row_writer_finish(writer, error);
+  }
+
+cleanup:
+  pngcore_row_writer_destroy(writer);
+  pthread_mutex_destroy(&ctx.lock);
+  pthread_cond_destroy(&ctx.cond);
+  free(ctx.slots);
+  return rc;
+}
+
+/******************************************************************************
+* GRID MOSAIC
+*****************************************************************************/
+
+/* Worker: decode a whole tile into its own buffer */
+static void mosaic_decode_task(void *arg) {
+  pngcore_mosaic_tile_t *tile = (pngcore_mosaic_tile_t *)arg;
+  U32 height = tile->png->internal->ihdr->p_data->height;
+
+  pngcore_row_reader_t *reader = pngcore_row_reader_create(tile->png, &tile->error);
+  if (!reader) {
+    tile->failed = 1;
+    return;
+  }
+
+  tile->row_bytes = pngcore_row_reader_row_bytes(reader);
+  tile->pixels = pngcore_malloc(tile->row_bytes * height);
+  if (!tile->pixels) {
+    pngcore_error_set(&tile->error, PNGCORE_ERR_MEMORY, "Failed to allocate tile buffer");
+    tile->failed = 1;
+    pngcore_row_reader_destroy(reader);
+    return;
+  }
+
+  for (U32 y = 0; y < height; y++) {
+    const uint8_t *row = NULL;
+    if (pngcore_row_reader_next(reader, &row) != 1) {
+      pngcore_error_set(&tile->error, PNGCORE_ERR, "Failed to decode row %u", y);
+      tile->failed = 1;
+      break;
+    }
+    memcpy(tile->pixels + y * tile->row_bytes, row, tile->row_bytes);
+  }
+
+  pngcore_row_reader_destroy(reader);
+}
+
+/* Replicate one background pixel across a scanline */
+static void fill_background_row(U8 *row, U32 width, size_t pixel_bits,
+                                const uint8_t *background) {
+  if (!background) {
+    memset(row, 0, (width * pixel_bits + 7) / 8);
+    return;
+  }
+
+  if (pixel_bits % 8 == 0) {
+    size_t bpp = pixel_bits / 8;
+    for (U32 x = 0; x < width; x++) {
+      memcpy(row + x * bpp, background, bpp);
+    }
+    return;
+  }
+
+  /* Sub-byte formats take the sample value from the first byte */
+  U8 pixel = (U8)(background[0] << (8 - pixel_bits));
+  for (U32 x = 0; x < width; x++) {
+    pngcore_copy_pixels(row, x, &pixel, 0, 1, pixel_bits);
+  }
+}
+
+int pngcore_mosaic(pngcore_png_t *const tiles[], uint32_t rows, uint32_t cols,
+                   const uint8_t *background, const char *filename,
+                   pngcore_error_t *error) {
+  if (!tiles || rows == 0 || cols == 0 || !filename) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid tiles, grid or filename");
+    return -1;
+  }
+
+  /* Cells size to the largest tile in their grid row and column */
+  U32 *col_w = pngcore_calloc(cols, sizeof(U32));
+  U32 *col_x = pngcore_calloc(cols, sizeof(U32));
+  U32 *row_h = pngcore_calloc(rows, sizeof(U32));
+  pngcore_mosaic_tile_t *band = pngcore_calloc(cols, sizeof(pngcore_mosaic_tile_t));
+  pngcore_row_writer_t *writer = NULL;
+  pngcore_pool_t *pool = NULL;
+  U8 *bg_row = NULL;
+  U8 *out_row = NULL;
+  int rc = -1;
+
+  if (!col_w || !col_x || !row_h || !band) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate mosaic layout");
+    goto cleanup;
+  }
+
+  pngcore_ihdr_data_t *first = NULL;
+  const pngcore_png_t *first_tile = NULL;
+  for (U32 r = 0; r < rows; r++) {
+    for (U32 c = 0; c < cols; c++) {
+      pngcore_png_t *tile = tiles[(size_t)r * cols + c];
+      if (!tile) continue;
+      if (!tile->internal || !tile->internal->ihdr || !tile->internal->idat) {
+        pngcore_error_set(error, PNGCORE_ERR, "Tile (%u, %u) is not a loaded PNG", r, c);
+        goto cleanup;
+      }
+      pngcore_ihdr_data_t *ihdr = tile->internal->ihdr->p_data;
+      if (ihdr->interlace != 0) {
+        pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED, "Tile (%u, %u) is interlaced", r, c);
+        goto cleanup;
+      }
+      if (!first) {
+        first = ihdr;
+        first_tile = tile;
+      } else if (ihdr->bit_depth != first->bit_depth || ihdr->color_type != first->color_type) {
+        pngcore_error_set(error, PNGCORE_ERR,
+        "Tile (%u, %u) has depth %u type %u, expected depth %u type %u",
+        r, c, ihdr->bit_depth, ihdr->color_type, first->bit_depth, first->color_type);
+        goto cleanup;
+      } else if (!pngcore_same_palette(first_tile, tile)) {
+        pngcore_error_set(error, PNGCORE_ERR, "Tile (%u, %u) has a different PLTE or tRNS", r, c);
+        goto cleanup;
+      }
+      if (ihdr->width > col_w[c]) col_w[c] = ihdr->width;
+      if (ihdr->height > row_h[r]) row_h[r] = ihdr->height;
+    }
+  }
+  if (!first) {
+    pngcore_error_set(error, PNGCORE_ERR, "Mosaic has no tiles");
+    goto cleanup;
+  }
+
+  U64 total_w = 0;
+  U64 total_h = 0;
+  for (U32 c = 0; c < cols; c++) {
+    col_x[c] = (U32)total_w;
+    total_w += col_w[c];
+  }
+  for (U32 r = 0; r < rows; r++) {
+    total_h += row_h[r];
+  }
+  if (total_w == 0 || total_h == 0 || total_w > 0x7fffffffUL || total_h > 0x7fffffffUL) {
+    pngcore_error_set(error, PNGCORE_ERR, "Mosaic size %lux%lu is invalid", total_w, total_h);
+    goto cleanup;
+  }
+
+  writer = pngcore_row_writer_create(filename, (U32)total_w, (U32)total_h,
+                                     first->bit_depth, first->color_type, error);
+  if (!writer || pngcore_row_writer_copy_palette(writer, first_tile, error) != 0) goto cleanup;
+
+  size_t pixel_bits = pngcore_pixel_bits(first->bit_depth, first->color_type);
+  bg_row = pngcore_malloc(writer->row_bytes);
+  out_row = pngcore_malloc(writer->row_bytes);
+  if (!bg_row || !out_row) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate mosaic scanlines");
+    goto cleanup;
+  }
+  fill_background_row(bg_row, (U32)total_w, pixel_bits, background);
+
+  int threads = pngcore_pool_default_threads();
+  if ((U32)threads > cols) threads = (int)cols;
+  pool = pngcore_pool_create(threads);
+  if (!pool) {
+    pngcore_error_set(error, PNGCORE_ERR, "Failed to start decode threads");
+    goto cleanup;
+  }
+
+  for (U32 r = 0; r < rows; r++) {
+    /* Decode the tiles of this grid row in parallel */
+    memset(band, 0, cols * sizeof(pngcore_mosaic_tile_t));
+    for (U32 c = 0; c < cols; c++) {
+      band[c].png = tiles[(size_t)r * cols + c];
+      if (band[c].png && pngcore_pool_submit(pool, mosaic_decode_task, &band[c]) != 0) {
+        band[c].failed = 1;
+        pngcore_error_set(&band[c].error, PNGCORE_ERR_MEMORY, "Failed to queue tile");
+      }
+    }
+    pngcore_pool_wait(pool);
+
+    int band_ok = 1;
+    for (U32 c = 0; c < cols; c++) {
+      if (band[c].failed) {
+        pngcore_error_set(error, band[c].error.code, "Tile (%u, %u): %s",
+        r, c, band[c].error.message);
+        band_ok = 0;
+        break;
+      }
+    }
+
+    /* Assemble and emit the band's scanlines */
+    for (U32 y = 0; band_ok && y < row_h[r]; y++) {
+      memcpy(out_row, bg_row, writer->row_bytes);
+      for (U32 c = 0; c < cols; c++) {
+        if (!band[c].png) continue;
+        pngcore_ihdr_data_t *ihdr = band[c].png->internal->ihdr->p_data;
+        if (y >= ihdr->height) continue;
+        pngcore_copy_pixels(out_row, col_x[c], band[c].pixels + y * band[c].row_bytes,
+                            0, ihdr->width, pixel_bits);
+      }
+      if (pngcore_row_writer_write(writer, out_row) != 0) {
+        pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to encode mosaic row");
+        band_ok = 0;
+      }
+    }
+
+    for (U32 c = 0; c < cols; c++) {
+      free(band[c].pixels);
+      band[c].pixels = NULL;
+    }
+    if (!band_ok) goto cleanup;
+  }
+
+  rc = pngcore_row_writer_finish(writer, error);
+
+cleanup:
+  pngcore_pool_destroy(pool);
+  pngcore_row_writer_destroy(writer);
+  free(bg_row);
+  free(out_row);
+  free(band);
+  free(col_w);
+  free(col_x);
+  free(row_h);
+  return rc;
+}
@@ -8,6 +8,10 @@
 #include "pngcore/pngcore_network.h"
 #include "pngcore/pngcore_png.h"
 #include "pngcore/pngcore_zutil.h"
+#include "pngcore/pngcore_crc.h"
+#include "pngcore/pngcore_trace.h"
+#include "pngcore/pngcore_stats.h"
+#include "pngcore/pngcore_probes.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -23,12 +27,34 @@
  * PRODUCER/CONSUMER FUNCTIONS
  *****************************************************************************/
 
+static int run_aborted(pngcore_concurrent_t *proc) {
+  sem_wait(&proc->sems[0]); /* Acquire mutex */
+  int aborted = *proc->aborted;
+  sem_post(&proc->sems[0]); /* Release mutex */
+  return aborted;
+}
+
+/* A fragment that cannot be fetched leaves the image incomplete, so the
+ * whole run stops; every blocked worker is woken to see it */
+static void abort_run(pngcore_concurrent_t *proc) {
+  sem_wait(&proc->sems[0]); /* Acquire mutex */
+  *proc->aborted = 1;
+  sem_post(&proc->sems[0]); /* Release mutex */
+  for (int i = 0; i < proc->num_producers; i++) {
+    sem_post(&proc->sems[1]);
+  }
+  for (int i = 0; i < proc->num_consumers; i++) {
+    sem_post(&proc->sems[2]);
+  }
+}
+
 int pngcore_producer(int producer_id, pngcore_concurrent_t *proc) {
+  pngcore_trace_name("producer %d", producer_id);
   while (1) {
     /* Get next entry number to produce */
     sem_wait(&proc->sems[0]); /* Acquire mutex */
     
-    if (*proc->entries_produced >= TOTAL_IMAGES) {
+    if (*proc->entries_produced >= TOTAL_IMAGES || *proc->aborted) {
       sem_post(&proc->sems[0]); /* Release mutex */
       break; /* All entries produced */
     }
@@ -43,17 +69,36 @@ int pngcore_producer(int producer_id, pngcore_concurrent_t *proc) {
     pngcore_cbuf_entry_t entry;
     char url[512];
     snprintf(url, sizeof(url), "%s?img=%d&part=%d", 
-              URL_ENDPOINT, proc->image_num, entry_num);
+              proc->endpoint, proc->image_num, entry_num);
 
+    U64 trace = pngcore_trace_begin();
     sem_wait(&proc->sems[1]); /* Wait for empty slot */
+    pngcore_trace_end(PNGCORE_TRACE_ENQUEUE, trace, entry_num, 0);
+    if (run_aborted(proc)) {
+      sem_post(&proc->sems[1]); /* Pass the wakeup on */
+      break;
+    }
 
-    pngcore_http_response_t* response = pngcore_http_get(url);
-    if (!response || response->data->seq != entry_num) {
-      fprintf(stderr, "Producer %d: Failed to get entry %d\n", 
-              producer_id, entry_num);
+    pngcore_http_response_t* response = NULL;
+    for (int attempt = 0; attempt < PNGCORE_FETCH_ATTEMPTS; attempt++) {
+      if (attempt > 0) {
+        pngcore_stats_add(PNGCORE_STAT_HTTP_RETRIES, 1);
+        usleep(attempt * 10000); /* back off before asking again */
+      }
+      trace = pngcore_trace_begin();
+      response = pngcore_http_get(url);
+      pngcore_trace_end(PNGCORE_TRACE_FETCH, trace, entry_num,
+                        response ? response->data->size : 0);
+      if (response && response->data->seq == entry_num) break;
       if (response) pngcore_free_http_response(response);
+      response = NULL;
+    }
+    if (!response) {
+      fprintf(stderr, "Producer %d: Failed to get entry %d after %d attempts\n",
+              producer_id, entry_num, PNGCORE_FETCH_ATTEMPTS);
       sem_post(&proc->sems[1]); /* Return empty slot */
-      continue;
+      abort_run(proc);
+      return -1;
     }
 
     /* Copy to entry */
@@ -65,19 +110,22 @@ int pngcore_producer(int producer_id, pngcore_concurrent_t *proc) {
     pngcore_free_http_response(response);
     
     /* Add to circular buffer */
+    trace = pngcore_trace_begin();
     pngcore_cbuf_add(proc->circ_buf, &entry, proc->sems);
 
     sem_post(&proc->sems[2]); /* Signal filled slot */
+    pngcore_trace_end(PNGCORE_TRACE_ENQUEUE, trace, entry_num, entry.length);
   }
   
   return 0;
 }
 
 int pngcore_consumer(int consumer_id, pngcore_concurrent_t *proc) {
+  pngcore_trace_name("consumer %d", consumer_id);
   while (1) {
     /* Check if all work is done */
     sem_wait(&proc->sems[0]); /* Acquire mutex */
-    if (*proc->entries_consumed >= TOTAL_IMAGES) {
+    if (*proc->entries_consumed >= TOTAL_IMAGES || *proc->aborted) {
       sem_post(&proc->sems[0]); /* Release mutex */
       sem_post(&proc->sems[2]); /* Signal to wake other consumers */
       break;
@@ -85,6 +133,7 @@ int pngcore_consumer(int consumer_id, pngcore_concurrent_t *proc) {
     sem_post(&proc->sems[0]); /* Release mutex */
     
     /* Get entry from buffer */
+    U64 trace = pngcore_trace_begin();
     sem_wait(&proc->sems[2]); /* Wait for filled slot */
 
     pngcore_cbuf_entry_t entry;
@@ -93,6 +142,7 @@ int pngcore_consumer(int consumer_id, pngcore_concurrent_t *proc) {
     }
     
     sem_post(&proc->sems[1]); /* Signal empty slot */
+    pngcore_trace_end(PNGCORE_TRACE_DEQUEUE, trace, entry.sequence_num, entry.length);
     
     /* Sleep if configured */
     if (proc->consumer_delay_ms > 0) {
@@ -101,23 +151,42 @@ int pngcore_consumer(int consumer_id, pngcore_concurrent_t *proc) {
 
     /* Parse buffer to raw PNG */
     Error error = {SUCCESS, ""};
+    trace = pngcore_trace_begin();
     pngcore_raw_png_t* png = pngcore_load_raw_png((U8*)entry.data, 
                                                   entry.length, 0, &error);
+    pngcore_trace_end(PNGCORE_TRACE_PARSE, trace, entry.sequence_num, entry.length);
     if (!png) {
       fprintf(stderr, "Consumer %d: Failed to parse PNG for entry %d\n",
               consumer_id, entry.sequence_num);
       continue;
     }
     
-    /* Inflate IDAT data into buffer at correct position */
+    /* Check the image data CRC; a bad fragment is reported but still placed */
+    pngcore_raw_chunk_t *idat = png->chunks[1];
+    trace = pngcore_trace_begin();
+    unsigned long crc = pngcore_chunk_crc(idat->type, idat->p_data, idat->length);
+    pngcore_trace_end(PNGCORE_TRACE_CRC, trace, entry.sequence_num, idat->length);
+    if ((U32)crc != idat->crc) {
+      PNGCORE_PROBE3(crc_mismatch, (const char *)idat->type, idat->crc, (U32)crc);
+      fprintf(stderr, "Consumer %d: IDAT CRC mismatch for entry %d\n",
+              consumer_id, entry.sequence_num);
+    }
+
+    /* Inflate IDAT data into buffer at correct position; the place span
+    * covers the inflate and the count that publishes it. Fragments out of
+    * range are counted but neither placed nor traced */
     int offset = entry.sequence_num * INF_SIZE;
+    int placed = offset + INF_SIZE < BUF_SIZE;
+    U64 place = placed ? pngcore_trace_begin() : 0;
     
-    if (offset + INF_SIZE < BUF_SIZE) {
+    if (placed) {
       U64 temp_dest_len = 0;
 
       /* Inflate IDAT data into buffer */
+      trace = pngcore_trace_begin();
       int ret = pngcore_mem_inflate(proc->idat_buf + offset, &temp_dest_len, 
-                                    png->chunks[1]->p_data, png->chunks[1]->length);
+                                    idat->p_data, idat->length);
+      pngcore_trace_end(PNGCORE_TRACE_INFLATE, trace, entry.sequence_num, temp_dest_len);
       if (ret != 0) {
         fprintf(stderr, "mem_inf failed for img %d. ret = %d.\n", 
                 entry.sequence_num, ret);
@@ -128,6 +197,10 @@ int pngcore_consumer(int consumer_id, pngcore_concurrent_t *proc) {
     sem_wait(&proc->sems[0]); /* Acquire mutex */
     (*proc->entries_consumed)++;
     sem_post(&proc->sems[0]); /* Release mutex */
+    if (placed) {
+      PNGCORE_PROBE3(fragment_place, entry.sequence_num, consumer_id, offset);
+      pngcore_trace_end(PNGCORE_TRACE_PLACE, place, entry.sequence_num, INF_SIZE);
+    }
 
     pngcore_free_raw_png(png);
   }
@@ -142,7 +215,7 @@ int pngcore_consumer(int consumer_id, pngcore_concurrent_t *proc) {
 pngcore_concurrent_t* pngcore_concurrent_create(const pngcore_concurrent_config_t *config) {
   if (!config) return NULL;
   
-  pngcore_concurrent_t *proc = calloc(1, sizeof(pngcore_concurrent_t));
+  pngcore_concurrent_t *proc = pngcore_calloc(1, sizeof(pngcore_concurrent_t));
   if (!proc) return NULL;
   
   /* Copy configuration */
@@ -151,11 +224,13 @@ pngcore_concurrent_t* pngcore_concurrent_create(const pngcore_concurrent_config_
   proc->num_consumers = config->num_consumers;
   proc->consumer_delay_ms = config->consumer_delay;
   proc->image_num = config->image_num;
+  snprintf(proc->endpoint, sizeof(proc->endpoint), "%s",
+           config->endpoint ? config->endpoint : URL_ENDPOINT);
   
   /* Calculate shared memory sizes */
   size_t cbuf_struct_size = sizeof(pngcore_cbuf_t);
   size_t cbuf_data_array_size = sizeof(pngcore_cbuf_entry_t) * proc->buffer_size;
-  size_t coordination_vars_size = 3 * sizeof(int);
+  size_t coordination_vars_size = 4 * sizeof(int);
   size_t total_cbuf_size = cbuf_struct_size + cbuf_data_array_size + coordination_vars_size;
   
   /* Create shared memory segments */
@@ -198,6 +273,7 @@ pngcore_concurrent_t* pngcore_concurrent_create(const pngcore_concurrent_config_
   proc->entries_produced = (int*)coord_mem;
   proc->entries_consumed = (int*)(coord_mem + sizeof(int));
   proc->next_entry_to_produce = (int*)(coord_mem + 2 * sizeof(int));
+  proc->aborted = (int*)(coord_mem + 3 * sizeof(int));
 
   /* Initialize shared memory */
   pngcore_cbuf_init(proc->circ_buf, proc->buffer_size);
@@ -206,6 +282,7 @@ pngcore_concurrent_t* pngcore_concurrent_create(const pngcore_concurrent_config_
   *proc->entries_produced = 0;
   *proc->entries_consumed = 0;
   *proc->next_entry_to_produce = 0;
+  *proc->aborted = 0;
   
   /* Initialize semaphores */
   if (sem_init(&proc->sems[0], SEM_PROC, 1) != 0) {    /* mutex */
@@ -222,8 +299,8 @@ pngcore_concurrent_t* pngcore_concurrent_create(const pngcore_concurrent_config_
   }
   
   /* Allocate PID arrays */
-  proc->producer_pids = calloc(proc->num_producers, sizeof(pid_t));
-  proc->consumer_pids = calloc(proc->num_consumers, sizeof(pid_t));
+  proc->producer_pids = pngcore_calloc(proc->num_producers, sizeof(pid_t));
+  proc->consumer_pids = pngcore_calloc(proc->num_consumers, sizeof(pid_t));
   if (!proc->producer_pids || !proc->consumer_pids) {
     goto cleanup;
   }
@@ -256,6 +333,7 @@ int pngcore_concurrent_run(pngcore_concurrent_t *proc) {
     return -1;
   }
   proc->start_time = (tv.tv_sec) + tv.tv_usec/1000000.;
+  pngcore_stats_init(); /* so the workers count into our totals */
 
   /* Create producer processes */
   for (int i = 0; i < proc->num_producers; i++) {
@@ -264,8 +342,7 @@ int pngcore_concurrent_run(pngcore_concurrent_t *proc) {
       proc->producer_pids[i] = pid;
     } else if (pid == 0) {
       /* Child process */
-      pngcore_producer(i, proc);
-      exit(0);
+      exit(pngcore_producer(i, proc) == 0 ? 0 : 1);
     } else {
       perror("fork");
       return -1;
@@ -304,6 +381,10 @@ int pngcore_concurrent_run(pngcore_concurrent_t *proc) {
   }
   proc->end_time = (tv.tv_sec) + tv.tv_usec/1000000.;
   
+  if (*proc->aborted) {
+    fprintf(stderr, "Concurrent run aborted: a fragment could not be fetched\n");
+    return -1;
+  }
   return 0;
 }
 
@@ -315,9 +396,11 @@ pngcore_png_t* pngcore_concurrent_get_result(pngcore_concurrent_t *proc) {
   if (!result) return NULL;
   
   /* Deflate the assembled data */
+  U64 trace = pngcore_trace_begin();
   ssize_t deflate_res = pngcore_deflate_idat(proc->idat_buf, 
                                               INF_SIZE * TOTAL_IMAGES, 
                                               result->internal);
+  pngcore_trace_end(PNGCORE_TRACE_DEFLATE, trace, -1, INF_SIZE * TOTAL_IMAGES);
   if (deflate_res == -1) {
     pngcore_free(result);
     return NULL;
@@ -0,0 +1,463 @@
+/**
+* @file pngcore_convert.c
+* @brief Pixel format conversion with SSSE3/AVX2 shuffle kernels
+*/
+
+#include "pngcore/pngcore_convert.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PNGCORE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/******************************************************************************
+* FORMAT TABLE
+*****************************************************************************/
+
+static const pngcore_format_desc_t format_table[PNGCORE_FMT_COUNT] = {
+  /*                                  ch  sb   r   g   b   a  gray premul */
+  [PNGCORE_FMT_GRAY8]               = {1, 1,  0,  0,  0, -1, 1, 0},
+  [PNGCORE_FMT_GRAY16]              = {1, 2,  0,  0,  0, -1, 1, 0},
+  [PNGCORE_FMT_GRAY_ALPHA8]         = {2, 1,  0,  0,  0,  1, 1, 0},
+  [PNGCORE_FMT_GRAY_ALPHA16]        = {2, 2,  0,  0,  0,  1, 1, 0},
+  [PNGCORE_FMT_RGB8]                = {3, 1,  0,  1,  2, -1, 0, 0},
+  [PNGCORE_FMT_RGB16]               = {3, 2,  0,  1,  2, -1, 0, 0},
+  [PNGCORE_FMT_RGBA8]               = {4, 1,  0,  1,  2,  3, 0, 0},
+  [PNGCORE_FMT_RGBA16]              = {4, 2,  0,  1,  2,  3, 0, 0},
+  [PNGCORE_FMT_BGRA8]               = {4, 1,  2,  1,  0,  3, 0, 0},
+  [PNGCORE_FMT_BGRA16]              = {4, 2,  2,  1,  0,  3, 0, 0},
+  [PNGCORE_FMT_GRAY_ALPHA8_PREMUL]  = {2, 1,  0,  0,  0,  1, 1, 1},
+  [PNGCORE_FMT_GRAY_ALPHA16_PREMUL] = {2, 2,  0,  0,  0,  1, 1, 1},
+  [PNGCORE_FMT_RGBA8_PREMUL]        = {4, 1,  0,  1,  2,  3, 0, 1},
+  [PNGCORE_FMT_RGBA16_PREMUL]       = {4, 2,  0,  1,  2,  3, 0, 1},
+  [PNGCORE_FMT_BGRA8_PREMUL]        = {4, 1,  2,  1,  0,  3, 0, 1},
+  [PNGCORE_FMT_BGRA16_PREMUL]       = {4, 2,  2,  1,  0,  3, 0, 1},
+};
+
+const pngcore_format_desc_t* pngcore_format_desc(pngcore_pixel_format_t fmt) {
+  if ((int)fmt < 0 || fmt >= PNGCORE_FMT_COUNT) return NULL;
+  return &format_table[fmt];
+}
+
+size_t pngcore_format_pixel_bytes(pngcore_pixel_format_t fmt) {
+  const pngcore_format_desc_t *desc = pngcore_format_desc(fmt);
+  return desc ? (size_t)desc->channels * desc->sample_bytes : 0;
+}
+
+int pngcore_format_from_png(uint8_t bit_depth, uint8_t color_type, pngcore_pixel_format_t *fmt) {
+  if (!fmt || (bit_depth != 8 && bit_depth != 16)) return -1;
+  int wide = (bit_depth == 16);
+  switch (color_type) {
+    case PNGCORE_COLOR_GRAYSCALE:
+    *fmt = wide ? PNGCORE_FMT_GRAY16 : PNGCORE_FMT_GRAY8;
+    return 0;
+    case PNGCORE_COLOR_GRAYSCALE_ALPHA:
+    *fmt = wide ? PNGCORE_FMT_GRAY_ALPHA16 : PNGCORE_FMT_GRAY_ALPHA8;
+    return 0;
+    case PNGCORE_COLOR_RGB:
+    *fmt = wide ? PNGCORE_FMT_RGB16 : PNGCORE_FMT_RGB8;
+    return 0;
+    case PNGCORE_COLOR_RGBA:
+    *fmt = wide ? PNGCORE_FMT_RGBA16 : PNGCORE_FMT_RGBA8;
+    return 0;
+    default:
+    return -1;
+  }
+}
+
+/******************************************************************************
+* SCALAR KERNELS
+*****************************************************************************/
+
+/* round(c * a / 255) without a division */
+static inline U8 premul8(U32 c, U32 a) {
+  U32 t = c * a + 128;
+  return (U8)((t + (t >> 8)) >> 8);
+}
+
+/* round(c * a / 65535) */
+static inline U32 premul16(U32 c, U32 a) {
+  return (U32)(((U64)c * a + 32767) / 65535);
+}
+
+static inline U32 read_sample(const U8 *p, U8 sample_bytes) {
+  return (sample_bytes == 2) ? ((U32)p[0] << 8) | p[1] : (U32)p[0] * 257;
+}
+
+static inline void write_sample(U8 *p, U8 sample_bytes, U32 v) {
+  if (sample_bytes == 2) {
+    p[0] = (U8)(v >> 8);
+    p[1] = (U8)v;
+  } else {
+    p[0] = (U8)(v >> 8);
+  }
+}
+
+static void shuffle_scalar(const pngcore_convert_plan_t *plan, const U8 *src,
+                           U8 *dst, size_t width) {
+  for (size_t x = 0; x < width; x++) {
+    const U8 *s = src + x * plan->src_bytes;
+    U8 *d = dst + x * plan->dst_bytes;
+    for (size_t i = 0; i < plan->dst_bytes; i++) {
+      d[i] = (plan->map[i] >= 0) ? s[(int)plan->map[i]] : 0xFF;
+    }
+  }
+}
+
+static void premultiply_scalar(const pngcore_format_desc_t *desc, U8 *px, size_t width) {
+  size_t pixel_bytes = (size_t)desc->channels * desc->sample_bytes;
+  U8 sb = desc->sample_bytes;
+
+  for (size_t x = 0; x < width; x++, px += pixel_bytes) {
+    if (sb == 1) {
+      U32 a = px[(int)desc->a];
+      for (int c = 0; c < desc->channels; c++) {
+        if (c != desc->a) px[c] = premul8(px[c], a);
+      }
+    } else {
+      U32 a = read_sample(px + desc->a * 2, 2);
+      for (int c = 0; c < desc->channels; c++) {
+        if (c != desc->a) write_sample(px + c * 2, 2, premul16(read_sample(px + c * 2, 2), a));
+      }
+    }
+  }
+}
+
+/* Source pixels to straight, host-order RGBA16 */
+static void unpack_canonical(const pngcore_format_desc_t *desc, const U8 *src,
+                             U32 *canon, size_t width) {
+  size_t pixel_bytes = (size_t)desc->channels * desc->sample_bytes;
+  U8 sb = desc->sample_bytes;
+
+  for (size_t x = 0; x < width; x++, src += pixel_bytes, canon += 4) {
+    U32 r = read_sample(src + desc->r * sb, sb);
+    U32 g = read_sample(src + desc->g * sb, sb);
+    U32 b = read_sample(src + desc->b * sb, sb);
+    U32 a = (desc->a >= 0) ? read_sample(src + desc->a * sb, sb) : 65535;
+
+    if (desc->premul && a < 65535) {
+      if (a == 0) {
+        r = g = b = 0;
+      } else {
+        r = (r * 65535 + a / 2) / a;
+        g = (g * 65535 + a / 2) / a;
+        b = (b * 65535 + a / 2) / a;
+        if (r > 65535) r = 65535;
+        if (g > 65535) g = 65535;
+        if (b > 65535) b = 65535;
+      }
+    }
+    canon[0] = r;
+    canon[1] = g;
+    canon[2] = b;
+    canon[3] = a;
+  }
+}
+
+/* Straight RGBA16 to destination pixels */
+static void pack_canonical(const pngcore_format_desc_t *desc, const U32 *canon,
+                           U8 *dst, size_t width) {
+  size_t pixel_bytes = (size_t)desc->channels * desc->sample_bytes;
+  U8 sb = desc->sample_bytes;
+
+  for (size_t x = 0; x < width; x++, dst += pixel_bytes, canon += 4) {
+    U32 r = canon[0];
+    U32 g = canon[1];
+    U32 b = canon[2];
+    U32 a = canon[3];
+
+    if (desc->premul) {
+      r = premul16(r, a);
+      g = premul16(g, a);
+      b = premul16(b, a);
+    }
+    if (desc->gray) {
+      /* BT.601 luma with weights summing to 65536 */
+      U32 y = (U32)((19595ULL * r + 38470ULL * g + 7471ULL * b + 32768) >> 16);
+      write_sample(dst, sb, y);
+    } else {
+      write_sample(dst + desc->r * sb, sb, r);
+      write_sample(dst + desc->g * sb, sb, g);
+      write_sample(dst + desc->b * sb, sb, b);
+    }
+    if (desc->a >= 0) {
+      write_sample(dst + desc->a * sb, sb, a);
+    }
+  }
+}
+
+void pngcore_unpack_gray(const U8 *src, U8 *dst, size_t width, U8 bit_depth) {
+  U8 mask = (U8)((1u << bit_depth) - 1);
+  U8 scale = (U8)(255 / mask);
+  for (size_t x = 0; x < width; x++) {
+    size_t bit = x * bit_depth;
+    U8 v = (src[bit >> 3] >> (8 - bit_depth - (bit & 7))) & mask;
+    dst[x] = (U8)(v * scale);
+  }
+}
+
+void pngcore_pack_gray(const U8 *src, U8 *dst, size_t width, U8 bit_depth) {
+  U32 mask = (1u << bit_depth) - 1;
+  memset(dst, 0, (width * bit_depth + 7) / 8);
+  for (size_t x = 0; x < width; x++) {
+    size_t bit = x * bit_depth;
+    U32 v = (src[x] * mask + 127) / 255;
+    dst[bit >> 3] |= (U8)(v << (8 - bit_depth - (bit & 7)));
+  }
+}
+
+/******************************************************************************
+* SIMD KERNELS
+*****************************************************************************/
+
+#ifdef PNGCORE_X86_SIMD
+
+/* 0: scalar, 1: SSSE3, 2: AVX2 */
+static int simd_level = -1;
+
+static int detect_simd(void) {
+  if (simd_level < 0) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      simd_level = 2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+      simd_level = 1;
+    } else {
+      simd_level = 0;
+    }
+  }
+  return simd_level;
+}
+
+/* Each step loads and stores a full 16-byte vector of which only
+* group * bytes are meaningful, so the loops stop while a full vector of
+* source and destination remains; the caller finishes the tail */
+__attribute__((target("ssse3")))
+static size_t shuffle_ssse3(const pngcore_convert_plan_t *plan, const U8 *src,
+                            U8 *dst, size_t width) {
+  __m128i mask = _mm_loadu_si128((const __m128i *)plan->mask);
+  __m128i fill = _mm_loadu_si128((const __m128i *)plan->fill);
+  size_t k = plan->group;
+  size_t x = 0;
+
+  while ((width - x) * plan->src_bytes >= 16 && (width - x) * plan->dst_bytes >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + x * plan->src_bytes));
+    v = _mm_or_si128(_mm_shuffle_epi8(v, mask), fill);
+    _mm_storeu_si128((__m128i *)(dst + x * plan->dst_bytes), v);
+    x += k;
+  }
+  return x;
+}
+
+/* AVX2 shuffles two groups per instruction, one per 128-bit lane */
+__attribute__((target("avx2")))
+static size_t shuffle_avx2(const pngcore_convert_plan_t *plan, const U8 *src,
+                           U8 *dst, size_t width) {
+  __m128i mask128 = _mm_loadu_si128((const __m128i *)plan->mask);
+  __m128i fill128 = _mm_loadu_si128((const __m128i *)plan->fill);
+  __m256i mask = _mm256_broadcastsi128_si256(mask128);
+  __m256i fill = _mm256_broadcastsi128_si256(fill128);
+  size_t k = plan->group;
+  size_t sstep = k * plan->src_bytes;
+  size_t dstep = k * plan->dst_bytes;
+  size_t x = 0;
+
+  while ((width - x) * plan->src_bytes >= sstep + 16 &&
+         (width - x) * plan->dst_bytes >= dstep + 16) {
+    const U8 *s = src + x * plan->src_bytes;
+    U8 *d = dst + x * plan->dst_bytes;
+    __m256i v = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)s)),
+      _mm_loadu_si128((const __m128i *)(s + sstep)), 1);
+    v = _mm256_or_si256(_mm256_shuffle_epi8(v, mask), fill);
+    /* Low group first so the high group overwrites its unused tail */
+    _mm_storeu_si128((__m128i *)d, _mm256_castsi256_si128(v));
+    _mm_storeu_si128((__m128i *)(d + dstep), _mm256_extracti128_si256(v, 1));
+    x += 2 * k;
+  }
+  return x + shuffle_ssse3(plan, src + x * plan->src_bytes,
+                           dst + x * plan->dst_bytes, width - x);
+}
+
+/* Premultiply four 8-bit 4-channel pixels (alpha last) per step */
+__attribute__((target("ssse3")))
+static size_t premultiply4_ssse3(U8 *px, size_t width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi16(128);
+  const __m128i alpha_bytes = _mm_set1_epi32((int)0xFF000000);
+  const __m128i alpha_lo = _mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1,
+                                         7, -1, 7, -1, 7, -1, 7, -1);
+  const __m128i alpha_hi = _mm_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1,
+                                         15, -1, 15, -1, 15, -1, 15, -1);
+  size_t x = 0;
+
+  for (; x + 4 <= width; x += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(px + x * 4));
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), _mm_shuffle_epi8(v, alpha_lo));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), _mm_shuffle_epi8(v, alpha_hi));
+    lo = _mm_add_epi16(lo, round);
+    hi = _mm_add_epi16(hi, round);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    __m128i out = _mm_packus_epi16(lo, hi);
+    out = _mm_or_si128(_mm_andnot_si128(alpha_bytes, out), _mm_and_si128(alpha_bytes, v));
+    _mm_storeu_si128((__m128i *)(px + x * 4), out);
+  }
+  return x;
+}
+
+#endif /* PNGCORE_X86_SIMD */
+
+/******************************************************************************
+* PLANNING AND DISPATCH
+*****************************************************************************/
+
+/* Sample of `src` feeding sample `j` of `dst`, or -1 for opaque alpha */
+static int source_sample(const pngcore_format_desc_t *s, const pngcore_format_desc_t *d, int j) {
+  if (j == d->a) {
+    return s->a;
+  }
+  if (s->gray) {
+    return 0;
+  }
+  if (j == d->r) return s->r;
+  if (j == d->g) return s->g;
+  return s->b;
+}
+
+int pngcore_convert_plan_init(pngcore_convert_plan_t *plan,
+                              pngcore_pixel_format_t src,
+                              pngcore_pixel_format_t dst) {
+  const pngcore_format_desc_t *s = pngcore_format_desc(src);
+  const pngcore_format_desc_t *d = pngcore_format_desc(dst);
+  if (!plan || !s || !d) return -1;
+
+  memset(plan, 0, sizeof(*plan));
+  plan->src = src;
+  plan->dst = dst;
+  plan->src_bytes = (size_t)s->channels * s->sample_bytes;
+  plan->dst_bytes = (size_t)d->channels * d->sample_bytes;
+
+  if (src == dst) {
+    plan->kind = PNGCORE_CONVERT_COPY;
+    return 0;
+  }
+
+  int has_alpha = (s->a >= 0);
+  int needs_luma = d->gray && !s->gray;
+  int unpremultiply = s->premul && (!d->premul || d->a < 0);
+  if (needs_luma || unpremultiply) {
+    plan->kind = PNGCORE_CONVERT_GENERIC;
+    return 0;
+  }
+
+  /* Everything else is byte movement, plus a multiply for straight alpha
+  * going premultiplied (no source alpha means opaque, which is a no-op) */
+  for (int j = 0; j < d->channels; j++) {
+    int sample = source_sample(s, d, j);
+    for (int k = 0; k < d->sample_bytes; k++) {
+      int byte;
+      if (sample < 0) {
+        byte = -1;
+      } else if (s->sample_bytes == d->sample_bytes) {
+        byte = sample * s->sample_bytes + k;
+      } else if (s->sample_bytes == 1) {
+        byte = sample;                 /* v * 257: both bytes are v */
+      } else {
+        byte = sample * 2;             /* keep the high byte */
+      }
+      plan->map[j * d->sample_bytes + k] = (signed char)byte;
+    }
+  }
+  plan->kind = (d->premul && !s->premul && has_alpha) ?
+  PNGCORE_CONVERT_SHUFFLE_PREMUL : PNGCORE_CONVERT_SHUFFLE;
+
+  size_t by_src = 16 / plan->src_bytes;
+  size_t by_dst = 16 / plan->dst_bytes;
+  plan->group = by_src < by_dst ? by_src : by_dst;
+  memset(plan->mask, 0x80, sizeof(plan->mask));
+  for (size_t p = 0; p < plan->group; p++) {
+    for (size_t i = 0; i < plan->dst_bytes; i++) {
+      size_t out = p * plan->dst_bytes + i;
+      if (plan->map[i] >= 0) {
+        plan->mask[out] = (U8)(p * plan->src_bytes + plan->map[i]);
+      } else {
+        plan->fill[out] = 0xFF;
+      }
+    }
+  }
+
+  return 0;
+}
+
+void pngcore_convert_plan_run(const pngcore_convert_plan_t *plan,
+                              const U8 *src, U8 *dst, size_t width) {
+  switch (plan->kind) {
+    case PNGCORE_CONVERT_COPY:
+    memcpy(dst, src, width * plan->src_bytes);
+    return;
+
+    case PNGCORE_CONVERT_SHUFFLE:
+    case PNGCORE_CONVERT_SHUFFLE_PREMUL: {
+      size_t x = 0;
+#ifdef PNGCORE_X86_SIMD
+      int level = detect_simd();
+      if (level == 2) {
+        x = shuffle_avx2(plan, src, dst, width);
+      } else if (level == 1) {
+        x = shuffle_ssse3(plan, src, dst, width);
+      }
+#endif
+      shuffle_scalar(plan, src + x * plan->src_bytes, dst + x * plan->dst_bytes, width - x);
+
+      if (plan->kind == PNGCORE_CONVERT_SHUFFLE_PREMUL) {
+        const pngcore_format_desc_t *d = pngcore_format_desc(plan->dst);
+        x = 0;
+#ifdef PNGCORE_X86_SIMD
+        if (level >= 1 && d->channels == 4 && d->sample_bytes == 1) {
+          x = premultiply4_ssse3(dst, width);
+        }
+#endif
+        premultiply_scalar(d, dst + x * plan->dst_bytes, width - x);
+      }
+      return;
+    }
+
+    case PNGCORE_CONVERT_GENERIC: {
+      const pngcore_format_desc_t *s = pngcore_format_desc(plan->src);
+      const pngcore_format_desc_t *d = pngcore_format_desc(plan->dst);
+      U32 canon[PNGCORE_CONVERT_CHUNK * 4];
+      for (size_t x = 0; x < width; x += PNGCORE_CONVERT_CHUNK) {
+        size_t n = width - x;
+        if (n > PNGCORE_CONVERT_CHUNK) n = PNGCORE_CONVERT_CHUNK;
+        unpack_canonical(s, src + x * plan->src_bytes, canon, n);
+        pack_canonical(d, canon, dst + x * plan->dst_bytes, n);
+      }
+      return;
+    }
+  }
+}
+
+int pngcore_convert_row(const uint8_t *src, pngcore_pixel_format_t src_fmt,
+                        uint8_t *dst, pngcore_pixel_format_t dst_fmt, size_t width) {
+  pngcore_convert_plan_t plan;
+  if (!src || !dst || pngcore_convert_plan_init(&plan, src_fmt, dst_fmt) != 0) {
+    return -1;
+  }
+  pngcore_convert_plan_run(&plan, src, dst, width);
+  return 0;
+}
+
+int pngcore_convert_image(const uint8_t *src, pngcore_pixel_format_t src_fmt, size_t src_stride,
+                          uint8_t *dst, pngcore_pixel_format_t dst_fmt, size_t dst_stride,
+                          uint32_t width, uint32_t height) {
+  pngcore_convert_plan_t plan;
+  if (!src || !dst || pngcore_convert_plan_init(&plan, src_fmt, dst_fmt) != 0) {
+    return -1;
+  }
+  for (uint32_t y = 0; y < height; y++) {
+    pngcore_convert_plan_run(&plan, src + y * src_stride, dst + y * dst_stride, width);
+  }
+  return 0;
+}
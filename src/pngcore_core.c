@@ -8,9 +8,11 @@
 #include "pngcore/pngcore_png.h"
 #include "pngcore/pngcore_zutil.h"
 #include "pngcore/pngcore_crc.h"
+#include "pngcore/pngcore_stats.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
 
 /* Error string table */
 static const char* error_strings[] = {
@@ -67,7 +69,7 @@ pngcore_png_t* pngcore_load_file(const char *filename, pngcore_error_t *error) {
   fseek(fp, 0, SEEK_SET);
   
   /* Allocate buffer */
-  uint8_t *buffer = malloc(file_size);
+  uint8_t *buffer = pngcore_malloc(file_size);
   if (!buffer) {
     fclose(fp);
     if (error) {
@@ -122,7 +124,9 @@ pngcore_png_t* pngcore_load_buffer(const uint8_t *buffer, size_t size, pngcore_e
   }
   
   /* Parse to structured PNG */
+  U64 start = pngcore_stats_now();
   pngcore_simple_png_t *simple = pngcore_parse_raw(raw, &internal_error);
+  pngcore_stats_since(PNGCORE_STAT_PARSE_NS, start);
   pngcore_free_raw_png(raw);
   
   if (!simple) {
@@ -134,7 +138,7 @@ pngcore_png_t* pngcore_load_buffer(const uint8_t *buffer, size_t size, pngcore_e
   }
   
   /* Create wrapper */
-  pngcore_png_t *png = calloc(1, sizeof(pngcore_png_t));
+  pngcore_png_t *png = pngcore_calloc(1, sizeof(pngcore_png_t));
   if (!png) {
     pngcore_free_simple_png(simple);
     if (error) {
@@ -178,7 +182,7 @@ int pngcore_save_file(const pngcore_png_t *png, const char *filename, pngcore_er
 *****************************************************************************/
 
 pngcore_png_t* pngcore_create(uint32_t width, uint32_t height, uint8_t bit_depth, uint8_t color_type) {
-  pngcore_png_t *png = calloc(1, sizeof(pngcore_png_t));
+  pngcore_png_t *png = pngcore_calloc(1, sizeof(pngcore_png_t));
   if (!png) return NULL;
   
   /* Create internal PNG structure */
@@ -201,6 +205,19 @@ pngcore_png_t* pngcore_create(uint32_t width, uint32_t height, uint8_t bit_depth
   return png;
 }
 
+pngcore_png_t* pngcore_clone(const pngcore_png_t *png) {
+  if (!png || !png->internal) return NULL;
+  pngcore_png_t *copy = pngcore_calloc(1, sizeof(pngcore_png_t));
+  if (!copy) return NULL;
+  copy->internal = pngcore_clone_simple_png(png->internal);
+  if (!copy->internal) {
+    free(copy);
+    return NULL;
+  }
+  copy->user_data = png->user_data;
+  return copy;
+}
+
 /******************************************************************************
 * PNG PROPERTIES
 *****************************************************************************/
@@ -253,7 +270,7 @@ int pngcore_get_raw_data(const pngcore_png_t *png, uint8_t **data, size_t *size)
   size_t expected_size = height * (row_bytes + 1); /* +1 for filter byte */
   
   /* Allocate buffer */
-  *data = malloc(expected_size);
+  *data = pngcore_malloc(expected_size);
   if (!*data) {
     return -1;
   }
@@ -352,28 +369,54 @@ pngcore_chunk_t* pngcore_get_chunk(const pngcore_png_t *png, const char type[4])
     return NULL;
   }
   
-  /* For now, only support the three basic chunks */
+  pngcore_chunk_t *chunk = pngcore_calloc(1, sizeof(pngcore_chunk_t));
+  if (!chunk) return NULL;
+  
   if (memcmp(type, "IHDR", 4) == 0) {
-    pngcore_chunk_t *chunk = malloc(sizeof(pngcore_chunk_t));
-    if (chunk) {
-      chunk->internal = pngcore_ihdr_to_raw(png->internal->ihdr);
-    }
-    return chunk;
+    chunk->internal = pngcore_ihdr_to_raw(png->internal->ihdr);
   } else if (memcmp(type, "IDAT", 4) == 0) {
-    pngcore_chunk_t *chunk = malloc(sizeof(pngcore_chunk_t));
-    if (chunk) {
-      chunk->internal = pngcore_idat_to_raw(png->internal->idat);
+    /* Image data is shared with the PNG, not copied */
+    pngcore_idat_t *idat = png->internal->idat;
+    chunk->internal = pngcore_malloc(sizeof(pngcore_raw_chunk_t));
+    if (chunk->internal) {
+      memcpy(chunk->internal->type, "IDAT", 4);
+      chunk->internal->length = idat->p_data->length;
+      chunk->internal->p_data = idat->p_data->data;
+      chunk->internal->crc = idat->crc;
+      chunk->payload = pngcore_payload_retain(idat->p_data->payload);
     }
-    return chunk;
   } else if (memcmp(type, "IEND", 4) == 0) {
-    pngcore_chunk_t *chunk = malloc(sizeof(pngcore_chunk_t));
-    if (chunk) {
-      chunk->internal = pngcore_iend_to_raw(png->internal->iend);
+    chunk->internal = pngcore_iend_to_raw(png->internal->iend);
+  } else {
+    /* Anything else comes from the chunks kept raw at load */
+    pngcore_chunk_list_t *extra = png->internal->extra;
+    const pngcore_chunk_ref_t *ref = pngcore_chunk_list_find(extra, type, 0, NULL);
+    if (ref) {
+      chunk->internal = pngcore_chunk_ref_view(extra, ref);
+      if (chunk->internal) {
+        chunk->list = pngcore_chunk_list_retain(extra);
+      }
     }
-    return chunk;
   }
   
-  return NULL;
+  if (!chunk->internal) {
+    free(chunk);
+    return NULL;
+  }
+  return chunk;
+}
+
+void pngcore_chunk_free(pngcore_chunk_t *chunk) {
+  if (!chunk) return;
+  if (chunk->payload || chunk->list) {
+    /* A view: the bytes belong to the shared owner */
+    free(chunk->internal);
+    pngcore_payload_release(chunk->payload);
+    pngcore_chunk_list_free(chunk->list);
+  } else {
+    pngcore_free_raw_chunk(chunk->internal);
+  }
+  free(chunk);
 }
 
 const uint8_t* pngcore_chunk_get_data(const pngcore_chunk_t *chunk, size_t *size) {
@@ -421,4 +464,14 @@ void pngcore_error_clear(pngcore_error_t *error) {
     error->code = PNGCORE_SUCCESS;
     error->message[0] = '\0';
   }
+}
+
+void pngcore_error_set(pngcore_error_t *error, pngcore_error_code_t code, const char *fmt, ...) {
+  if (error) {
+    va_list args;
+    error->code = code;
+    va_start(args, fmt);
+    vsnprintf(error->message, sizeof(error->message), fmt, args);
+    va_end(args);
+  }
 }
\ No newline at end of file
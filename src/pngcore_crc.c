@@ -5,6 +5,7 @@
 */
 
 #include "pngcore/pngcore_crc.h"
+#include "pngcore/pngcore_stats.h"
 
 /* Table of CRCs of all 8-bit messages */
 static unsigned long crc_table[256];
@@ -32,7 +33,8 @@ void pngcore_make_crc_table(void) {
 
 /* Update a running CRC with the bytes buf[0..len-1]--the CRC
 should be initialized to all 1's, and the transmitted value
-is the 1's complement of the final running CRC */
+is the 1's complement of the final running CRC. Only bytes are
+counted here; callers time whole chunks */
 unsigned long pngcore_update_crc(unsigned long crc, unsigned char *buf, int len) {
   unsigned long c = crc;
   int n;
@@ -42,10 +44,26 @@ unsigned long pngcore_update_crc(unsigned long crc, unsigned char *buf, int len)
   for (n = 0; n < len; n++) {
     c = crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
   }
+  pngcore_stats_add(PNGCORE_STAT_BYTES_CRC, len);
   return c;
 }
 
 /* Return the CRC of the bytes buf[0..len-1] */
 unsigned long pngcore_crc(unsigned char *buf, int len) {
-  return pngcore_update_crc(0xffffffffL, buf, len) ^ 0xffffffffL;
+  U64 start = pngcore_stats_now();
+  unsigned long c = pngcore_update_crc(0xffffffffL, buf, len) ^ 0xffffffffL;
+  pngcore_stats_since(PNGCORE_STAT_CRC_NS, start);
+  return c;
+}
+
+/* Return the CRC of a chunk whose type and data are not contiguous */
+unsigned long pngcore_chunk_crc(const unsigned char *type, const unsigned char *data,
+                                size_t len) {
+  U64 start = pngcore_stats_now();
+  unsigned long c = pngcore_update_crc(0xffffffffL, (unsigned char *)type, 4);
+  if (len > 0) {
+    c = pngcore_update_crc(c, (unsigned char *)data, len);
+  }
+  pngcore_stats_since(PNGCORE_STAT_CRC_NS, start);
+  return c ^ 0xffffffffL;
 }
\ No newline at end of file
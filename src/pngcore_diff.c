@@ -0,0 +1,323 @@
+/**
+* @file pngcore_diff.c
+* @brief Dirty-rectangle diff of two images
+*/
+
+#include "pngcore/pngcore_diff.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_stream.h"
+#include "pngcore/pngcore_filter.h"
+#include "pngcore/pngcore_hash.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PNGCORE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/******************************************************************************
+* ROW COMPARISON
+*****************************************************************************/
+
+/* Running result of one row comparison */
+typedef struct {
+  size_t changed;
+  size_t first;
+  size_t last;
+} row_diff_t;
+
+static void diff_pixels(const U8 *a, const U8 *b, size_t begin, size_t end,
+                        size_t pixel_bytes, row_diff_t *rd) {
+  for (size_t x = begin; x < end; x++) {
+    if (memcmp(a + x * pixel_bytes, b + x * pixel_bytes, pixel_bytes) != 0) {
+      if (rd->changed == 0) rd->first = x;
+      rd->last = x;
+      rd->changed++;
+    }
+  }
+}
+
+#ifdef PNGCORE_X86_SIMD
+
+static int has_avx2 = -1;
+
+static int detect_avx2(void) {
+  if (has_avx2 < 0) {
+    __builtin_cpu_init();
+    has_avx2 = __builtin_cpu_supports("avx2");
+  }
+  return has_avx2;
+}
+
+/* Power-of-two pixels are compared a whole lane at a time, so every pixel
+* contributes pixel_bytes bits to the inequality mask. 3- and 6-byte pixels
+* are compared in 96-byte blocks and only differing blocks are resolved per
+* pixel. Returns pixels consumed */
+__attribute__((target("avx2")))
+static size_t diff_avx2(const U8 *a, const U8 *b, size_t width, size_t pixel_bytes,
+                        row_diff_t *rd) {
+  size_t bytes = width * pixel_bytes;
+  size_t i = 0;
+
+  if (pixel_bytes == 3 || pixel_bytes == 6) {
+    for (; i + 96 <= bytes; i += 96) {
+      __m256i e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                     _mm256_loadu_si256((const __m256i *)(b + i)));
+      __m256i e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i + 32)),
+                                     _mm256_loadu_si256((const __m256i *)(b + i + 32)));
+      __m256i e2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i + 64)),
+                                     _mm256_loadu_si256((const __m256i *)(b + i + 64)));
+      __m256i eq = _mm256_and_si256(_mm256_and_si256(e0, e1), e2);
+      if ((U32)_mm256_movemask_epi8(eq) != 0xFFFFFFFFu) {
+        diff_pixels(a, b, i / pixel_bytes, (i + 96) / pixel_bytes, pixel_bytes, rd);
+      }
+    }
+    return i / pixel_bytes;
+  }
+
+  for (; i + 32 <= bytes; i += 32) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+    __m256i eq;
+    switch (pixel_bytes) {
+      case 1: eq = _mm256_cmpeq_epi8(va, vb); break;
+      case 2: eq = _mm256_cmpeq_epi16(va, vb); break;
+      case 4: eq = _mm256_cmpeq_epi32(va, vb); break;
+      default: eq = _mm256_cmpeq_epi64(va, vb); break;
+    }
+    U32 ne = ~(U32)_mm256_movemask_epi8(eq);
+    if (ne == 0) continue;
+    if (rd->changed == 0) rd->first = (i + __builtin_ctz(ne)) / pixel_bytes;
+    rd->last = (i + 31 - __builtin_clz(ne)) / pixel_bytes;
+    rd->changed += __builtin_popcount(ne) / pixel_bytes;
+  }
+  return i / pixel_bytes;
+}
+
+#endif /* PNGCORE_X86_SIMD */
+
+size_t pngcore_diff_row(const U8 *a, const U8 *b, U32 width, size_t pixel_bytes,
+                        U32 *first, U32 *last) {
+  row_diff_t rd = {0, 0, 0};
+  size_t x = 0;
+#ifdef PNGCORE_X86_SIMD
+  if (pixel_bytes <= 8 && pixel_bytes != 5 && pixel_bytes != 7 && detect_avx2()) {
+    x = diff_avx2(a, b, width, pixel_bytes, &rd);
+  }
+#endif
+  diff_pixels(a, b, x, width, pixel_bytes, &rd);
+  if (rd.changed > 0) {
+    *first = (U32)rd.first;
+    *last = (U32)rd.last;
+  }
+  return rd.changed;
+}
+
+/******************************************************************************
+* REGIONS
+*****************************************************************************/
+
+static void mark_cell(pngcore_diff_cell_t *cell, U32 x0, U32 x1, U32 y) {
+  if (cell->state == 0) {
+    cell->state = 1;
+    cell->x0 = x0;
+    cell->x1 = x1;
+    cell->y0 = y;
+  } else {
+    if (x0 < cell->x0) cell->x0 = x0;
+    if (x1 > cell->x1) cell->x1 = x1;
+  }
+  cell->y1 = y;
+}
+
+/* Group 8-connected changed cells into regions, in row-major seed order */
+static size_t collect_regions(pngcore_diff_cell_t *cells, U32 cols, U32 rows,
+                              size_t *stack, pngcore_rect_t *rects) {
+  size_t n = 0;
+  for (size_t seed = 0; seed < (size_t)cols * rows; seed++) {
+    if (cells[seed].state != 1) continue;
+
+    U32 x0 = cells[seed].x0, y0 = cells[seed].y0;
+    U32 x1 = cells[seed].x1, y1 = cells[seed].y1;
+    size_t top = 0;
+    stack[top++] = seed;
+    cells[seed].state = 2;
+
+    while (top > 0) {
+      size_t i = stack[--top];
+      pngcore_diff_cell_t *cell = &cells[i];
+      if (cell->x0 < x0) x0 = cell->x0;
+      if (cell->y0 < y0) y0 = cell->y0;
+      if (cell->x1 > x1) x1 = cell->x1;
+      if (cell->y1 > y1) y1 = cell->y1;
+
+      U32 cx = (U32)(i % cols), cy = (U32)(i / cols);
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          if ((dx < 0 && cx == 0) || (dx > 0 && cx + 1 == cols) ||
+              (dy < 0 && cy == 0) || (dy > 0 && cy + 1 == rows)) {
+            continue;
+          }
+          size_t j = (size_t)(cy + dy) * cols + (cx + dx);
+          if (cells[j].state == 1) {
+            cells[j].state = 2;
+            stack[top++] = j;
+          }
+        }
+      }
+    }
+
+    rects[n].x = x0;
+    rects[n].y = y0;
+    rects[n].width = x1 - x0 + 1;
+    rects[n].height = y1 - y0 + 1;
+    n++;
+  }
+  return n;
+}
+
+/******************************************************************************
+* PUBLIC API
+*****************************************************************************/
+
+/* Same-format images are compared natively; anything else is normalized
+* to RGBA8, or RGBA16 if either image is 16-bit */
+static int open_pair(const pngcore_png_t *a, const pngcore_png_t *b,
+                     pngcore_row_reader_t **ra, pngcore_row_reader_t **rb,
+                     size_t *pixel_bytes, pngcore_error_t *error) {
+  pngcore_ihdr_data_t *ha = a->internal->ihdr->p_data;
+  pngcore_ihdr_data_t *hb = b->internal->ihdr->p_data;
+
+  *ra = pngcore_row_reader_create(a, error);
+  if (!*ra) return -1;
+  *rb = pngcore_row_reader_create(b, error);
+  if (!*rb) {
+    pngcore_row_reader_destroy(*ra);
+    return -1;
+  }
+
+  if (ha->bit_depth == hb->bit_depth && ha->color_type == hb->color_type &&
+      ha->bit_depth >= 8 && ha->color_type != PNGCORE_COLOR_INDEXED) {
+    *pixel_bytes = pngcore_pixel_bits(ha->bit_depth, ha->color_type) / 8;
+    return 0;
+  }
+
+  pngcore_pixel_format_t fmt = (ha->bit_depth == 16 || hb->bit_depth == 16) ?
+                               PNGCORE_FMT_RGBA16 : PNGCORE_FMT_RGBA8;
+  if (pngcore_row_reader_set_format(*ra, fmt) != 0 ||
+      pngcore_row_reader_set_format(*rb, fmt) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED,
+    "Cannot compare depth %u type %u with depth %u type %u",
+    ha->bit_depth, ha->color_type, hb->bit_depth, hb->color_type);
+    pngcore_row_reader_destroy(*rb);
+    pngcore_row_reader_destroy(*ra);
+    return -1;
+  }
+  *pixel_bytes = pngcore_format_desc(fmt)->channels * pngcore_format_desc(fmt)->sample_bytes;
+  return 0;
+}
+
+int pngcore_diff(const pngcore_png_t *a, const pngcore_png_t *b, pngcore_diff_t *diff,
+                 pngcore_error_t *error) {
+  if (!a || !a->internal || !a->internal->ihdr ||
+      !b || !b->internal || !b->internal->ihdr || !diff) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid PNG or diff output");
+    return -1;
+  }
+  memset(diff, 0, sizeof(*diff));
+
+  pngcore_ihdr_data_t *ihdr = a->internal->ihdr->p_data;
+  pngcore_ihdr_data_t *hb = b->internal->ihdr->p_data;
+  if (ihdr->width != hb->width || ihdr->height != hb->height) {
+    pngcore_error_set(error, PNGCORE_ERR, "Image sizes differ: %ux%u and %ux%u",
+    ihdr->width, ihdr->height, hb->width, hb->height);
+    return -1;
+  }
+  if (pngcore_same_encoding(a, b)) return 0;
+
+  pngcore_row_reader_t *ra, *rb;
+  size_t pixel_bytes;
+  if (open_pair(a, b, &ra, &rb, &pixel_bytes, error) != 0) return -1;
+
+  U32 cols = (ihdr->width + PNGCORE_DIFF_CELL - 1) / PNGCORE_DIFF_CELL;
+  U32 rows = (ihdr->height + PNGCORE_DIFF_CELL - 1) / PNGCORE_DIFF_CELL;
+  size_t row_bytes = (size_t)ihdr->width * pixel_bytes;
+  pngcore_diff_cell_t *cells = pngcore_calloc((size_t)cols * rows, sizeof(*cells));
+  size_t num_changed = 0;
+  int rc = 0;
+
+  if (!cells) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate diff grid");
+    rc = -1;
+  }
+
+  for (U32 y = 0; rc == 0 && y < ihdr->height; y++) {
+    const uint8_t *row_a, *row_b;
+    if (pngcore_row_reader_next(ra, &row_a) != 1 ||
+        pngcore_row_reader_next(rb, &row_b) != 1) {
+      pngcore_error_set(error, PNGCORE_ERR, "Failed to decode row %u", y);
+      rc = -1;
+      break;
+    }
+    if (memcmp(row_a, row_b, row_bytes) == 0) continue;
+
+    pngcore_diff_cell_t *cell_row = cells + (size_t)(y / PNGCORE_DIFF_CELL) * cols;
+    for (U32 c = 0; c < cols; c++) {
+      U32 x = c * PNGCORE_DIFF_CELL;
+      U32 w = ihdr->width - x < PNGCORE_DIFF_CELL ? ihdr->width - x : PNGCORE_DIFF_CELL;
+      U32 first, last;
+      size_t n = pngcore_diff_row(row_a + (size_t)x * pixel_bytes, row_b + (size_t)x * pixel_bytes,
+                                  w, pixel_bytes, &first, &last);
+      if (n == 0) continue;
+      num_changed += (cell_row[c].state == 0);
+      mark_cell(&cell_row[c], x + first, x + last, y);
+      diff->changed_pixels += n;
+    }
+  }
+  pngcore_row_reader_destroy(rb);
+  pngcore_row_reader_destroy(ra);
+
+  if (rc == 0 && num_changed > 0) {
+    size_t *stack = pngcore_malloc(num_changed * sizeof(*stack));
+    diff->rects = pngcore_malloc(num_changed * sizeof(*diff->rects));
+    if (!stack || !diff->rects) {
+      pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate diff regions");
+      rc = -1;
+    } else {
+      diff->num_rects = collect_regions(cells, cols, rows, stack, diff->rects);
+    }
+    free(stack);
+  }
+  free(cells);
+
+  if (rc != 0) {
+    pngcore_diff_free(diff);
+    return -1;
+  }
+
+  /* Overall bounds */
+  for (size_t i = 0; i < diff->num_rects; i++) {
+    const pngcore_rect_t *r = &diff->rects[i];
+    if (i == 0) {
+      diff->bounds = *r;
+      continue;
+    }
+    U32 x1 = diff->bounds.x + diff->bounds.width;
+    U32 y1 = diff->bounds.y + diff->bounds.height;
+    if (r->x + r->width > x1) x1 = r->x + r->width;
+    if (r->y + r->height > y1) y1 = r->y + r->height;
+    if (r->x < diff->bounds.x) diff->bounds.x = r->x;
+    if (r->y < diff->bounds.y) diff->bounds.y = r->y;
+    diff->bounds.width = x1 - diff->bounds.x;
+    diff->bounds.height = y1 - diff->bounds.y;
+  }
+  return 0;
+}
+
+void pngcore_diff_free(pngcore_diff_t *diff) {
+  if (!diff) return;
+  free(diff->rects);
+  memset(diff, 0, sizeof(*diff));
+}
@@ -0,0 +1,536 @@
+/**
+* @file pngcore_edit.c
+* @brief In-place ancillary chunk edits that never touch the image data
+*/
+
+#define _GNU_SOURCE
+#include "pngcore.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_crc.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#define CHUNK_OVERHEAD (CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + CHUNK_CRC_SIZE)
+#define MAX_CHUNK_LEN  0x7fffffffu
+#define NO_SOURCE      ((U64)-1)
+#define COPY_BUF_SIZE  (1 << 20)
+
+/* One chunk outside the image data, either still in the file or rewritten */
+typedef struct {
+  U64 offset;        /* in the source file, NO_SOURCE once edited */
+  U32 length;
+  char type[4];
+  char keyword[80];  /* text chunks only */
+  U8 *bytes;         /* complete chunk when edited */
+} item_t;
+
+typedef struct {
+  item_t *items;
+  size_t count;
+  size_t cap;
+} item_list_t;
+
+/* The file as head chunks, an untouched run of image data, and tail chunks.
+* For APNG the run spans from the first IDAT to the last fdAT, so fcTL and
+* anything else between frames stays where it is */
+typedef struct {
+  item_list_t head;   /* signature excluded, IHDR first */
+  item_list_t tail;   /* IEND last */
+  U64 data_start;
+  U64 data_end;
+  U64 iend_end;
+  U64 file_size;
+} layout_t;
+
+static int is_type(const char *type, const char *name) {
+  return memcmp(type, name, CHUNK_TYPE_SIZE) == 0;
+}
+
+static int is_text(const char *type) {
+  return is_type(type, "tEXt") || is_type(type, "zTXt") || is_type(type, "iTXt");
+}
+
+static int read_full(int fd, void *buf, size_t len, U64 offset) {
+  U8 *p = buf;
+  while (len > 0) {
+    ssize_t n = pread(fd, p, len, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len, U64 offset) {
+  const U8 *p = buf;
+  while (len > 0) {
+    ssize_t n = pwrite(fd, p, len, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+/* Copy a byte range between files in the kernel, sharing extents where the
+* filesystem can; falls back to a buffered copy where it cannot */
+static int copy_range(int in, U64 in_off, int out, U64 out_off, U64 len) {
+  loff_t src = in_off, dst = out_off;
+  while (len > 0) {
+    ssize_t n = copy_file_range(in, &src, out, &dst, len, 0);
+    if (n > 0) {
+      len -= n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n == 0) return -1;
+    if (errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP && errno != EINVAL) return -1;
+    break;
+  }
+  if (len == 0) return 0;
+
+  U8 *buf = pngcore_malloc(COPY_BUF_SIZE);
+  if (!buf) return -1;
+  int rc = 0;
+  while (rc == 0 && len > 0) {
+    size_t n = len < COPY_BUF_SIZE ? len : COPY_BUF_SIZE;
+    rc = read_full(in, buf, n, src);
+    if (rc == 0) rc = write_full(out, buf, n, dst);
+    src += n;
+    dst += n;
+    len -= n;
+  }
+  free(buf);
+  return rc;
+}
+
+/******************************************************************************
+* CHUNK LAYOUT
+*****************************************************************************/
+
+static item_t* list_insert(item_list_t *list, size_t index) {
+  if (list->count == list->cap) {
+    size_t cap = list->cap ? list->cap * 2 : 16;
+    item_t *items = pngcore_realloc(list->items, cap * sizeof(item_t));
+    if (!items) return NULL;
+    list->items = items;
+    list->cap = cap;
+  }
+  memmove(&list->items[index + 1], &list->items[index], (list->count - index) * sizeof(item_t));
+  list->count++;
+  memset(&list->items[index], 0, sizeof(item_t));
+  return &list->items[index];
+}
+
+static void list_remove(item_list_t *list, size_t index) {
+  free(list->items[index].bytes);
+  memmove(&list->items[index], &list->items[index + 1], (list->count - index - 1) * sizeof(item_t));
+  list->count--;
+}
+
+static void list_clear(item_list_t *list) {
+  for (size_t i = 0; i < list->count; i++) {
+    free(list->items[i].bytes);
+  }
+  list->count = 0;
+}
+
+static void layout_free(layout_t *layout) {
+  list_clear(&layout->head);
+  list_clear(&layout->tail);
+  free(layout->head.items);
+  free(layout->tail.items);
+}
+
+/* Walk chunk headers only; the image data is never read */
+static int scan(int fd, U64 size, layout_t *layout, pngcore_error_t *error) {
+  U8 sig[PNG_SIG_SIZE];
+  if (read_full(fd, sig, PNG_SIG_SIZE, 0) != 0 || !is_png(sig, PNG_SIG_SIZE)) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_PNG, "Not a PNG file");
+    return -1;
+  }
+
+  enum { HEAD, DATA, TAIL } phase = HEAD;
+  U64 offset = PNG_SIG_SIZE;
+  int seen_iend = 0;
+  while (!seen_iend && offset + CHUNK_OVERHEAD <= size) {
+    U8 header[CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE];
+    if (read_full(fd, header, sizeof(header), offset) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to read chunk header");
+      return -1;
+    }
+    U32 length = from_be_buffer(header);
+    const char *type = (const char *)header + CHUNK_LEN_SIZE;
+    if (length > MAX_CHUNK_LEN || offset + CHUNK_OVERHEAD + length > size) {
+      pngcore_error_set(error, PNGCORE_ERR, "Truncated %.4s chunk", type);
+      return -1;
+    }
+    U64 end = offset + CHUNK_OVERHEAD + length;
+
+    if (is_type(type, "IDAT") || is_type(type, "fdAT")) {
+      if (phase == HEAD) layout->data_start = offset;
+      /* Chunks between frames belong to the untouched run */
+      list_clear(&layout->tail);
+      layout->data_end = end;
+      phase = DATA;
+    } else {
+      if (phase == DATA) phase = TAIL;
+      item_list_t *list = phase == HEAD ? &layout->head : &layout->tail;
+      item_t *item = list_insert(list, list->count);
+      if (!item) {
+        pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate chunk list");
+        return -1;
+      }
+      item->offset = offset;
+      item->length = length;
+      memcpy(item->type, type, CHUNK_TYPE_SIZE);
+      if (is_text(type)) {
+        size_t n = length < sizeof(item->keyword) ? length : sizeof(item->keyword);
+        char key[sizeof(item->keyword)];
+        if (read_full(fd, key, n, offset + CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE) != 0) {
+          pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to read text keyword");
+          return -1;
+        }
+        if (memchr(key, 0, n)) {
+          strcpy(item->keyword, key);
+        }
+      }
+      seen_iend = is_type(type, "IEND");
+    }
+    offset = end;
+  }
+
+  if (!seen_iend || phase != TAIL || layout->head.count == 0 ||
+      !is_type(layout->head.items[0].type, "IHDR")) {
+    pngcore_error_set(error, PNGCORE_ERR, "Missing IHDR, image data or IEND");
+    return -1;
+  }
+  layout->iend_end = offset;
+  layout->file_size = size;
+  return 0;
+}
+
+/******************************************************************************
+* EDITS
+*****************************************************************************/
+
+/* Chunks that must precede PLTE go right after IHDR */
+static int before_plte(const char *type) {
+  return is_type(type, "gAMA") || is_type(type, "cHRM") || is_type(type, "iCCP") ||
+         is_type(type, "sRGB") || is_type(type, "sBIT") || is_type(type, "cICP");
+}
+
+static int item_matches(const item_t *item, const char *type, const char *keyword) {
+  if (keyword) return is_text(item->type) && strcmp(item->keyword, keyword) == 0;
+  return is_type(item->type, type);
+}
+
+static int set_item(item_t *item, const pngcore_chunk_edit_t *edit, const char *keyword) {
+  U8 *bytes = pngcore_malloc((size_t)edit->length + CHUNK_OVERHEAD);
+  if (!bytes) return -1;
+  U32 length = htonl(edit->length);
+  memcpy(bytes, &length, CHUNK_LEN_SIZE);
+  memcpy(bytes + CHUNK_LEN_SIZE, edit->type, CHUNK_TYPE_SIZE);
+  if (edit->length > 0) {
+    memcpy(bytes + CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE, edit->data, edit->length);
+  }
+  U32 crc = htonl((U32)pngcore_crc(bytes + CHUNK_LEN_SIZE, CHUNK_TYPE_SIZE + edit->length));
+  memcpy(bytes + CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + edit->length, &crc, CHUNK_CRC_SIZE);
+
+  free(item->bytes);
+  item->bytes = bytes;
+  item->offset = NO_SOURCE;
+  item->length = edit->length;
+  memcpy(item->type, edit->type, CHUNK_TYPE_SIZE);
+  if (keyword) {
+    strcpy(item->keyword, keyword);
+  }
+  return 0;
+}
+
+static int apply_edit(layout_t *layout, const pngcore_chunk_edit_t *edit, pngcore_error_t *error) {
+  for (int i = 0; i < CHUNK_TYPE_SIZE; i++) {
+    char c = edit->type[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+      pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "Invalid chunk type");
+      return -1;
+    }
+  }
+  if (!(edit->type[0] & 0x20)) {
+    pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "Cannot edit critical chunk %.4s", edit->type);
+    return -1;
+  }
+  if (is_type(edit->type, "acTL") || is_type(edit->type, "fcTL")) {
+    pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "Cannot edit animation chunk %.4s", edit->type);
+    return -1;
+  }
+  if (edit->length > MAX_CHUNK_LEN || (edit->length > 0 && !edit->data)) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid %.4s data", edit->type);
+    return -1;
+  }
+
+  /* Text chunks are addressed by keyword, which must lead the data */
+  char keyword[80] = "";
+  if (is_text(edit->type)) {
+    if (edit->keyword) {
+      size_t n = strlen(edit->keyword);
+      if (n > 0 && n < sizeof(keyword)) memcpy(keyword, edit->keyword, n + 1);
+    } else if (edit->data) {
+      const U8 *end = memchr(edit->data, 0, edit->length < 80 ? edit->length : 80);
+      if (end) memcpy(keyword, edit->data, end - edit->data + 1);
+    }
+    size_t n = strlen(keyword);
+    if (n == 0 || (edit->data && (edit->length <= n || memcmp(edit->data, keyword, n + 1) != 0))) {
+      pngcore_error_set(error, PNGCORE_ERR, "Text data must start with its keyword");
+      return -1;
+    }
+  }
+  const char *key = keyword[0] ? keyword : NULL;
+
+  int found = 0;
+  item_list_t *lists[2] = { &layout->head, &layout->tail };
+  for (int l = 0; l < 2; l++) {
+    item_list_t *list = lists[l];
+    for (size_t i = 0; i < list->count; ) {
+      if (!item_matches(&list->items[i], edit->type, key)) {
+        i++;
+      } else if (!edit->data) {
+        list_remove(list, i);
+        found = 1;
+      } else {
+        if (set_item(&list->items[i], edit, key) != 0) {
+          pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate chunk");
+          return -1;
+        }
+        return 0;
+      }
+    }
+  }
+  if (found || !edit->data) return 0;
+
+  /* Text may follow the image data, where adding it leaves the data in place */
+  item_list_t *list = &layout->head;
+  size_t index = layout->head.count;
+  if (is_text(edit->type)) {
+    list = &layout->tail;
+    index = layout->tail.count - 1;
+  } else if (before_plte(edit->type)) {
+    index = 1;
+  } else {
+    /* Keep the first frame's fcTL next to its IDAT */
+    for (size_t i = 1; i < layout->head.count; i++) {
+      if (is_type(layout->head.items[i].type, "fcTL")) {
+        index = i;
+        break;
+      }
+    }
+  }
+  item_t *item = list_insert(list, index);
+  if (!item || set_item(item, edit, key) != 0) {
+    if (item) list_remove(list, index);
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate chunk");
+    return -1;
+  }
+  return 0;
+}
+
+/******************************************************************************
+* WRITING
+*****************************************************************************/
+
+/* Concatenate lead, the chunks and trail. Unedited chunks are copied from
+* old, the source bytes starting at file offset base */
+static U8* serialize(const item_list_t *list, const U8 *old, U64 base,
+                     const U8 *lead, size_t lead_len,
+                     const U8 *trail, size_t trail_len, size_t *out_len) {
+  size_t len = lead_len + trail_len;
+  for (size_t i = 0; i < list->count; i++) {
+    len += (size_t)list->items[i].length + CHUNK_OVERHEAD;
+  }
+  U8 *out = pngcore_malloc(len ? len : 1);
+  if (!out) return NULL;
+
+  U8 *p = out;
+  if (lead_len > 0) {
+    memcpy(p, lead, lead_len);
+    p += lead_len;
+  }
+  for (size_t i = 0; i < list->count; i++) {
+    const item_t *item = &list->items[i];
+    size_t n = (size_t)item->length + CHUNK_OVERHEAD;
+    memcpy(p, item->bytes ? item->bytes : old + (item->offset - base), n);
+    p += n;
+  }
+  if (trail_len > 0) {
+    memcpy(p, trail, trail_len);
+  }
+  *out_len = len;
+  return out;
+}
+
+/* Rewrite only the bytes of old that differ from new, which may differ in
+* length when nothing follows */
+static int patch(int fd, U64 offset, const U8 *old, size_t old_len,
+                 const U8 *new, size_t new_len, int truncate) {
+  size_t common = old_len < new_len ? old_len : new_len;
+  size_t first = 0;
+  while (first < common && old[first] == new[first]) {
+    first++;
+  }
+  size_t last = new_len;
+  if (old_len == new_len) {
+    while (last > first && old[last - 1] == new[last - 1]) {
+      last--;
+    }
+  }
+  if (last > first && write_full(fd, new + first, last - first, offset + first) != 0) return -1;
+  if (truncate && new_len != old_len && ftruncate(fd, offset + new_len) != 0) return -1;
+  return 0;
+}
+
+static int rewrite_file(const char *path, int fd, const struct stat *st, const layout_t *layout,
+                  const U8 *head, size_t head_len, const U8 *tail, size_t tail_len) {
+  size_t path_len = strlen(path);
+  char *tmp_path = pngcore_malloc(path_len + 8);
+  if (!tmp_path) return -1;
+  snprintf(tmp_path, path_len + 8, "%s.XXXXXX", path);
+  int out = mkstemp(tmp_path);
+  if (out < 0) {
+    free(tmp_path);
+    return -1;
+  }
+
+  U64 data_len = layout->data_end - layout->data_start;
+  int rc = write_full(out, head, head_len, 0);
+  if (rc == 0) rc = copy_range(fd, layout->data_start, out, head_len, data_len);
+  if (rc == 0) rc = write_full(out, tail, tail_len, head_len + data_len);
+  if (rc == 0) rc = fchmod(out, st->st_mode & 07777);
+  if (close(out) != 0) rc = -1;
+  if (rc == 0) rc = rename(tmp_path, path);
+  if (rc != 0) unlink(tmp_path);
+  free(tmp_path);
+  return rc;
+}
+
+int pngcore_edit_chunks(const char *path, const pngcore_chunk_edit_t *edits, size_t count,
+                        pngcore_error_t *error) {
+  if (!path || (count > 0 && !edits)) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Filename or edits are NULL");
+    return -1;
+  }
+
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to open file: %s", path);
+    return -1;
+  }
+
+  int rc = -1;
+  layout_t layout;
+  memset(&layout, 0, sizeof(layout));
+  U8 *old_head = NULL, *old_tail = NULL, *head = NULL, *tail = NULL;
+  size_t head_len = 0, tail_len = 0;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to stat %s", path);
+    goto cleanup;
+  }
+  if (scan(fd, st.st_size, &layout, error) != 0) goto cleanup;
+  for (size_t i = 0; i < count; i++) {
+    if (apply_edit(&layout, &edits[i], error) != 0) goto cleanup;
+  }
+
+  /* Only the chunks around the image data are read */
+  size_t old_head_len = layout.data_start;
+  size_t old_tail_len = layout.file_size - layout.data_end;
+  old_head = pngcore_malloc(old_head_len);
+  old_tail = pngcore_malloc(old_tail_len);
+  if (!old_head || !old_tail) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate chunk buffers");
+    goto cleanup;
+  }
+  if (read_full(fd, old_head, old_head_len, 0) != 0 ||
+      read_full(fd, old_tail, old_tail_len, layout.data_end) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to read %s", path);
+    goto cleanup;
+  }
+
+  /* Bytes after IEND are kept */
+  size_t extra = layout.file_size - layout.iend_end;
+  head = serialize(&layout.head, old_head, 0, old_head, PNG_SIG_SIZE, NULL, 0, &head_len);
+  tail = serialize(&layout.tail, old_tail, layout.data_end, NULL, 0,
+                   old_tail + old_tail_len - extra, extra, &tail_len);
+  if (!head || !tail) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate chunk buffers");
+    goto cleanup;
+  }
+
+  if (head_len == old_head_len) {
+    /* The image data stays where it is */
+    if (patch(fd, 0, old_head, old_head_len, head, head_len, 0) != 0 ||
+        patch(fd, layout.data_end, old_tail, old_tail_len, tail, tail_len, 1) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to patch %s", path);
+      goto cleanup;
+    }
+  } else if (rewrite_file(path, fd, &st, &layout, head, head_len, tail, tail_len) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to rewrite %s", path);
+    goto cleanup;
+  }
+  rc = 0;
+
+cleanup:
+  close(fd);
+  layout_free(&layout);
+  free(old_head);
+  free(old_tail);
+  free(head);
+  free(tail);
+  return rc;
+}
+
+int pngcore_edit_text(const char *path, const char *keyword, const char *text,
+                      pngcore_error_t *error) {
+  if (!keyword) {
+    pngcore_error_set(error, PNGCORE_ERR, "Keyword is NULL");
+    return -1;
+  }
+  pngcore_chunk_edit_t edit = { .type = { 't', 'E', 'X', 't' }, .keyword = keyword };
+  if (!text) return pngcore_edit_chunks(path, &edit, 1, error);
+
+  size_t key_len = strlen(keyword);
+  size_t text_len = strlen(text);
+  U8 *data = pngcore_malloc(key_len + 1 + text_len);
+  if (!data) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate text chunk");
+    return -1;
+  }
+  memcpy(data, keyword, key_len + 1);
+  memcpy(data + key_len + 1, text, text_len);
+  edit.data = data;
+  edit.length = key_len + 1 + text_len;
+  int rc = pngcore_edit_chunks(path, &edit, 1, error);
+  free(data);
+  return rc;
+}
+
+int pngcore_edit_phys(const char *path, uint32_t ppu_x, uint32_t ppu_y, uint8_t unit,
+                      pngcore_error_t *error) {
+  U8 data[9];
+  U32 x = htonl(ppu_x), y = htonl(ppu_y);
+  memcpy(data, &x, 4);
+  memcpy(data + 4, &y, 4);
+  data[8] = unit;
+  pngcore_chunk_edit_t edit = { .type = { 'p', 'H', 'Y', 's' }, .data = data, .length = sizeof(data) };
+  return pngcore_edit_chunks(path, &edit, 1, error);
+}
@@ -0,0 +1,192 @@
+/**
+* @file pngcore_filter.c
+* @brief Scanline geometry and PNG filter/unfilter operations
+* Reference: https://www.w3.org/TR/PNG-Filters.html
+*/
+
+#include "pngcore/pngcore_filter.h"
+#include <stdlib.h>
+#include <string.h>
+
+/******************************************************************************
+* SCANLINE GEOMETRY
+*****************************************************************************/
+
+int pngcore_color_channels(U8 color_type) {
+  switch (color_type) {
+    case 0: return 1;  /* Grayscale */
+    case 2: return 3;  /* Truecolor */
+    case 3: return 1;  /* Indexed-color */
+    case 4: return 2;  /* Greyscale with alpha */
+    case 6: return 4;  /* Truecolor with alpha */
+    default: return 0;
+  }
+}
+
+size_t pngcore_pixel_bits(U8 bit_depth, U8 color_type) {
+  return (size_t)pngcore_color_channels(color_type) * bit_depth;
+}
+
+size_t pngcore_filter_bpp(U8 bit_depth, U8 color_type) {
+  /* Filters operate on whole bytes; sub-byte pixels use a distance of 1 */
+  size_t bpp = pngcore_pixel_bits(bit_depth, color_type) / 8;
+  return bpp ? bpp : 1;
+}
+
+size_t pngcore_scanline_bytes(U32 width, U8 bit_depth, U8 color_type) {
+  return ((size_t)width * pngcore_pixel_bits(bit_depth, color_type) + 7) / 8;
+}
+
+int pngcore_valid_format(U8 bit_depth, U8 color_type) {
+  switch (color_type) {
+    case 0:
+    return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 ||
+    bit_depth == 8 || bit_depth == 16;
+    case 3:
+    return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8;
+    case 2: case 4: case 6:
+    return bit_depth == 8 || bit_depth == 16;
+    default:
+    return 0;
+  }
+}
+
+void pngcore_copy_pixels(U8 *dst, size_t dst_x, const U8 *src, size_t src_x,
+                         size_t count, size_t pixel_bits) {
+  if (pixel_bits % 8 == 0) {
+    size_t bpp = pixel_bits / 8;
+    memmove(dst + dst_x * bpp, src + src_x * bpp, count * bpp);
+    return;
+  }
+
+  U8 mask = (U8)((1u << pixel_bits) - 1);
+  for (size_t i = 0; i < count; i++) {
+    size_t sbit = (src_x + i) * pixel_bits;
+    size_t dbit = (dst_x + i) * pixel_bits;
+    U8 v = (src[sbit >> 3] >> (8 - pixel_bits - (sbit & 7))) & mask;
+    int shift = (int)(8 - pixel_bits - (dbit & 7));
+    dst[dbit >> 3] = (U8)((dst[dbit >> 3] & ~(mask << shift)) | (v << shift));
+  }
+}
+
+/******************************************************************************
+* UNFILTERING
+*****************************************************************************/
+
+static inline U8 paeth_predictor(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return (U8)a;
+  if (pb <= pc) return (U8)b;
+  return (U8)c;
+}
+
+int pngcore_unfilter_row(U8 filter, U8 *line, const U8 *prev, size_t len, size_t bpp) {
+  size_t i;
+
+  switch (filter) {
+    case PNGCORE_FILTER_NONE:
+    break;
+
+    case PNGCORE_FILTER_SUB:
+    for (i = bpp; i < len; i++) {
+      line[i] += line[i - bpp];
+    }
+    break;
+
+    case PNGCORE_FILTER_UP:
+    if (prev) {
+      for (i = 0; i < len; i++) {
+        line[i] += prev[i];
+      }
+    }
+    break;
+
+    case PNGCORE_FILTER_AVERAGE:
+    if (prev) {
+      for (i = 0; i < bpp && i < len; i++) {
+        line[i] += prev[i] >> 1;
+      }
+      for (; i < len; i++) {
+        line[i] += (line[i - bpp] + prev[i]) >> 1;
+      }
+    } else {
+      for (i = bpp; i < len; i++) {
+        line[i] += line[i - bpp] >> 1;
+      }
+    }
+    break;
+
+    case PNGCORE_FILTER_PAETH:
+    if (prev) {
+      for (i = 0; i < bpp && i < len; i++) {
+        line[i] += prev[i];
+      }
+      for (; i < len; i++) {
+        line[i] += paeth_predictor(line[i - bpp], prev[i], prev[i - bpp]);
+      }
+    } else {
+      /* Paeth degenerates to Sub on the first row */
+      for (i = bpp; i < len; i++) {
+        line[i] += line[i - bpp];
+      }
+    }
+    break;
+
+    default:
+    return -1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************
+* FILTERING
+*****************************************************************************/
+
+/* Apply one filter type to a scanline and return the heuristic cost */
+static U64 apply_filter(U8 filter, U8 *out, const U8 *line, const U8 *prev,
+                        size_t len, size_t bpp) {
+  U64 cost = 0;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    int a = (i >= bpp) ? line[i - bpp] : 0;
+    int b = prev ? prev[i] : 0;
+    int c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+    U8 v;
+
+    switch (filter) {
+      case PNGCORE_FILTER_SUB:     v = (U8)(line[i] - a); break;
+      case PNGCORE_FILTER_UP:      v = (U8)(line[i] - b); break;
+      case PNGCORE_FILTER_AVERAGE: v = (U8)(line[i] - ((a + b) >> 1)); break;
+      case PNGCORE_FILTER_PAETH:   v = (U8)(line[i] - paeth_predictor(a, b, c)); break;
+      default:                     v = line[i]; break;
+    }
+    out[i] = v;
+    cost += (v < 128) ? v : 256 - v;
+  }
+
+  return cost;
+}
+
+void pngcore_filter_row(U8 *out, U8 *scratch, const U8 *line, const U8 *prev,
+                        size_t len, size_t bpp) {
+  out[0] = PNGCORE_FILTER_NONE;
+  U64 best = apply_filter(PNGCORE_FILTER_NONE, out + 1, line, prev, len, bpp);
+
+  for (U8 f = PNGCORE_FILTER_SUB; f < PNGCORE_NUM_FILTERS; f++) {
+    /* Up, Average and Paeth gain nothing over None/Sub on the first row */
+    if (!prev && f != PNGCORE_FILTER_SUB) {
+      continue;
+    }
+    U64 cost = apply_filter(f, scratch + 1, line, prev, len, bpp);
+    if (cost < best) {
+      best = cost;
+      scratch[0] = f;
+      memcpy(out, scratch, len + 1);
+    }
+  }
+}
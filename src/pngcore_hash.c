@@ -0,0 +1,442 @@
+/**
+* @file pngcore_hash.c
+* @brief Pixel content hashing and comparison
+*/
+
+#include "pngcore/pngcore_hash.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_stream.h"
+#include "pngcore/pngcore_pool.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PNGCORE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+/* 192 bytes of splitmix64 output. Stripe n of a block is keyed by words
+* n..n+7; the scramble uses the last eight words */
+static const U64 secret[24] = {
+  0x2CB0F69F4ABEA221ULL, 0x9417034723148989ULL, 0xDD555950609DFE03ULL,
+  0xDBAFB150DEB12800ULL, 0x7E789B2E6C442CB6ULL, 0xF41E5636C7E4F8C4ULL,
+  0x0959D150F8FBA7E4ULL, 0xA97316F13CDB9EEAULL, 0x74CD8258F9520068ULL,
+  0x55C74A62E116868BULL, 0xD2F4C799A2023CBDULL, 0xDF98CB79A37B51B9ULL,
+  0x396F5885524F3905ULL, 0xAF1D56386CA3B276ULL, 0xA9FFBE6B5104E85AULL,
+  0x6BD0C51B9FD533B3ULL, 0x980CE91C50AB4B56ULL, 0x28AC395780FE62C5ULL,
+  0x768912E3A6BCEDC7ULL, 0x50B3E8C9332C7C88ULL, 0xCE3BBFE520BD47DAULL,
+  0xCBA6C8E8E0BB7C4FULL, 0xBF194DB8434A346DULL, 0x7D8F2A7B60416D7FULL,
+};
+
+#define SCRAMBLE_KEY (secret + 16)
+
+/******************************************************************************
+* SCALAR KERNELS
+*****************************************************************************/
+
+/* Input words are little-endian regardless of the host */
+static inline U64 read_le64(const U8 *p) {
+  U64 v;
+  memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+static void accumulate_scalar(U64 *acc, const U8 *p, size_t stripes, size_t first) {
+  for (size_t s = 0; s < stripes; s++) {
+    const U64 *key = secret + first + s;
+    for (int i = 0; i < 8; i++) {
+      U64 data = read_le64(p + s * PNGCORE_HASH_STRIPE + i * 8);
+      U64 mixed = data ^ key[i];
+      acc[i ^ 1] += data;
+      acc[i] += (mixed & 0xFFFFFFFFULL) * (mixed >> 32);
+    }
+  }
+}
+
+static void scramble_scalar(U64 *acc) {
+  for (int i = 0; i < 8; i++) {
+    U64 v = acc[i];
+    v ^= v >> 47;
+    v ^= SCRAMBLE_KEY[i];
+    acc[i] = v * PRIME32_1;
+  }
+}
+
+/******************************************************************************
+* SIMD KERNELS
+*****************************************************************************/
+
+#ifdef PNGCORE_X86_SIMD
+
+static int has_avx2 = -1;
+
+static int detect_avx2(void) {
+  if (has_avx2 < 0) {
+    __builtin_cpu_init();
+    has_avx2 = __builtin_cpu_supports("avx2");
+  }
+  return has_avx2;
+}
+
+/* Four accumulators per register; the data swap feeds acc[i ^ 1] */
+__attribute__((target("avx2")))
+static void accumulate_avx2(U64 *acc, const U8 *p, size_t stripes, size_t first) {
+  __m256i a0 = _mm256_loadu_si256((const __m256i *)acc);
+  __m256i a1 = _mm256_loadu_si256((const __m256i *)(acc + 4));
+
+  for (size_t s = 0; s < stripes; s++) {
+    const U64 *key = secret + first + s;
+    const U8 *in = p + s * PNGCORE_HASH_STRIPE;
+    __m256i d0 = _mm256_loadu_si256((const __m256i *)in);
+    __m256i d1 = _mm256_loadu_si256((const __m256i *)(in + 32));
+    __m256i k0 = _mm256_xor_si256(d0, _mm256_loadu_si256((const __m256i *)key));
+    __m256i k1 = _mm256_xor_si256(d1, _mm256_loadu_si256((const __m256i *)(key + 4)));
+    __m256i p0 = _mm256_mul_epu32(k0, _mm256_srli_epi64(k0, 32));
+    __m256i p1 = _mm256_mul_epu32(k1, _mm256_srli_epi64(k1, 32));
+    a0 = _mm256_add_epi64(a0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+    a1 = _mm256_add_epi64(a1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+    a0 = _mm256_add_epi64(a0, p0);
+    a1 = _mm256_add_epi64(a1, p1);
+  }
+
+  _mm256_storeu_si256((__m256i *)acc, a0);
+  _mm256_storeu_si256((__m256i *)(acc + 4), a1);
+}
+
+#endif /* PNGCORE_X86_SIMD */
+
+/******************************************************************************
+* STREAMING HASH
+*****************************************************************************/
+
+static void accumulate(U64 *acc, const U8 *p, size_t stripes, size_t first) {
+#ifdef PNGCORE_X86_SIMD
+  if (detect_avx2()) {
+    accumulate_avx2(acc, p, stripes, first);
+    return;
+  }
+#endif
+  accumulate_scalar(acc, p, stripes, first);
+}
+
+/* Feed whole stripes, scrambling at each block boundary */
+static void consume(pngcore_hash_state_t *state, const U8 *p, size_t stripes) {
+  while (stripes > 0) {
+    size_t room = PNGCORE_HASH_BLOCK_STRIPES - state->stripes;
+    size_t n = stripes < room ? stripes : room;
+    accumulate(state->acc, p, n, state->stripes);
+    state->stripes += n;
+    if (state->stripes == PNGCORE_HASH_BLOCK_STRIPES) {
+      scramble_scalar(state->acc);
+      state->stripes = 0;
+    }
+    p += n * PNGCORE_HASH_STRIPE;
+    stripes -= n;
+  }
+}
+
+void pngcore_hash_init(pngcore_hash_state_t *state) {
+  static const U64 init[8] = {
+    PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+    PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1
+  };
+  memset(state, 0, sizeof(*state));
+  memcpy(state->acc, init, sizeof(init));
+}
+
+void pngcore_hash_update(pngcore_hash_state_t *state, const void *data, size_t len) {
+  const U8 *p = (const U8 *)data;
+  state->total += len;
+
+  if (state->buf_len > 0) {
+    size_t n = PNGCORE_HASH_STRIPE - state->buf_len;
+    if (n > len) n = len;
+    memcpy(state->buf + state->buf_len, p, n);
+    state->buf_len += n;
+    p += n;
+    len -= n;
+    if (state->buf_len < PNGCORE_HASH_STRIPE) return;
+    consume(state, state->buf, 1);
+    state->buf_len = 0;
+  }
+
+  size_t stripes = len / PNGCORE_HASH_STRIPE;
+  consume(state, p, stripes);
+  p += stripes * PNGCORE_HASH_STRIPE;
+  len -= stripes * PNGCORE_HASH_STRIPE;
+
+  memcpy(state->buf, p, len);
+  state->buf_len = len;
+}
+
+static U64 mul_fold(U64 a, U64 b) {
+  __uint128_t product = (__uint128_t)a * b;
+  return (U64)product ^ (U64)(product >> 64);
+}
+
+static U64 avalanche(U64 h) {
+  h ^= h >> 37;
+  h *= 0x165667919E3779F9ULL;
+  return h ^ (h >> 32);
+}
+
+/* The partial stripe is zero-padded; the length folded into the result
+* keeps padded inputs distinct */
+U64 pngcore_hash_final(const pngcore_hash_state_t *state) {
+  U64 acc[8];
+  memcpy(acc, state->acc, sizeof(acc));
+
+  if (state->buf_len > 0) {
+    U8 last[PNGCORE_HASH_STRIPE] = {0};
+    memcpy(last, state->buf, state->buf_len);
+    accumulate(acc, last, 1, state->stripes);
+  }
+
+  U64 h = state->total * PRIME64_1;
+  for (int i = 0; i < 4; i++) {
+    h += mul_fold(acc[2 * i] ^ secret[3 + 2 * i], acc[2 * i + 1] ^ secret[4 + 2 * i]);
+  }
+  return avalanche(h);
+}
+
+/******************************************************************************
+* PIXEL HASHING
+*****************************************************************************/
+
+/* Pixels are hashed as RGBA8, or RGBA16 for 16-bit images, so images that
+* differ only in color type, filtering or compression hash equal. Palettes
+* are expanded and a tRNS colour key becomes zero alpha */
+static pngcore_row_reader_t* open_canonical(const pngcore_png_t *png,
+                                            pngcore_pixel_format_t *fmt,
+                                            pngcore_error_t *error) {
+  if (!png || !png->internal || !png->internal->ihdr) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid PNG");
+    return NULL;
+  }
+
+  pngcore_ihdr_data_t *ihdr = png->internal->ihdr->p_data;
+  *fmt = ihdr->bit_depth == 16 ? PNGCORE_FMT_RGBA16 : PNGCORE_FMT_RGBA8;
+
+  pngcore_row_reader_t *reader = pngcore_row_reader_create(png, error);
+  if (!reader) return NULL;
+  if (pngcore_row_reader_load_palette(reader, png, error) != 0) {
+    pngcore_row_reader_destroy(reader);
+    return NULL;
+  }
+  if (pngcore_row_reader_set_format(reader, *fmt) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED,
+    "Hashing depth %u type %u is not supported", ihdr->bit_depth, ihdr->color_type);
+    pngcore_row_reader_destroy(reader);
+    return NULL;
+  }
+  return reader;
+}
+
+int pngcore_pixel_hash(const pngcore_png_t *png, uint64_t *hash, pngcore_error_t *error) {
+  if (!hash) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid hash output");
+    return -1;
+  }
+
+  pngcore_pixel_format_t fmt;
+  pngcore_row_reader_t *reader = open_canonical(png, &fmt, error);
+  if (!reader) return -1;
+
+  pngcore_ihdr_data_t *ihdr = png->internal->ihdr->p_data;
+  U32 header[3] = { htonl(ihdr->width), htonl(ihdr->height), htonl((U32)fmt) };
+
+  pngcore_hash_state_t state;
+  pngcore_hash_init(&state);
+  pngcore_hash_update(&state, header, sizeof(header));
+
+  size_t row_bytes = pngcore_row_reader_row_bytes(reader);
+  const uint8_t *row;
+  int rc;
+  while ((rc = pngcore_row_reader_next(reader, &row)) == 1) {
+    pngcore_hash_update(&state, row, row_bytes);
+  }
+  pngcore_row_reader_destroy(reader);
+
+  if (rc < 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Failed to decode image data");
+    return -1;
+  }
+  *hash = pngcore_hash_final(&state);
+  return 0;
+}
+
+/* Byte-identical header, palette and image data imply identical pixels */
+int pngcore_same_encoding(const pngcore_png_t *a, const pngcore_png_t *b) {
+  pngcore_ihdr_data_t *ha = a->internal->ihdr->p_data;
+  pngcore_ihdr_data_t *hb = b->internal->ihdr->p_data;
+  if (ha->width != hb->width || ha->height != hb->height ||
+      ha->bit_depth != hb->bit_depth || ha->color_type != hb->color_type ||
+      ha->interlace != hb->interlace || !pngcore_same_palette(a, b)) {
+    return 0;
+  }
+  pngcore_idat_t *ia = a->internal->idat;
+  pngcore_idat_t *ib = b->internal->idat;
+  if (!ia || !ib || ia->p_data->length != ib->p_data->length || ia->crc != ib->crc) {
+    return 0;
+  }
+  return memcmp(ia->p_data->data, ib->p_data->data, ia->p_data->length) == 0;
+}
+
+int pngcore_pixel_equal(const pngcore_png_t *a, const pngcore_png_t *b,
+                        pngcore_error_t *error) {
+  if (!a || !a->internal || !a->internal->ihdr ||
+      !b || !b->internal || !b->internal->ihdr) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid PNG");
+    return -1;
+  }
+  if (pngcore_same_encoding(a, b)) return 1;
+
+  pngcore_ihdr_data_t *ha = a->internal->ihdr->p_data;
+  pngcore_ihdr_data_t *hb = b->internal->ihdr->p_data;
+  if (ha->width != hb->width || ha->height != hb->height ||
+      (ha->bit_depth == 16) != (hb->bit_depth == 16)) {
+    return 0;
+  }
+
+  /* Decode both in lockstep and stop at the first differing row */
+  pngcore_pixel_format_t fa, fb;
+  pngcore_row_reader_t *ra = open_canonical(a, &fa, error);
+  if (!ra) return -1;
+  pngcore_row_reader_t *rb = open_canonical(b, &fb, error);
+  if (!rb) {
+    pngcore_row_reader_destroy(ra);
+    return -1;
+  }
+
+  size_t row_bytes = pngcore_row_reader_row_bytes(ra);
+  int equal = 1;
+  for (U32 y = 0; y < ha->height && equal == 1; y++) {
+    const uint8_t *row_a, *row_b;
+    if (pngcore_row_reader_next(ra, &row_a) != 1 ||
+        pngcore_row_reader_next(rb, &row_b) != 1) {
+      pngcore_error_set(error, PNGCORE_ERR, "Failed to decode row %u", y);
+      equal = -1;
+    } else if (memcmp(row_a, row_b, row_bytes) != 0) {
+      equal = 0;
+    }
+  }
+
+  pngcore_row_reader_destroy(rb);
+  pngcore_row_reader_destroy(ra);
+  return equal;
+}
+
+/******************************************************************************
+* BATCH HASHING
+*****************************************************************************/
+
+typedef struct {
+  const pngcore_png_t *png;
+  uint64_t hash;
+  int rc;
+  pngcore_error_t error;
+} hash_job_t;
+
+/* Batch input with its position in the caller's array */
+typedef struct {
+  const pngcore_png_t *png;
+  size_t index;
+  size_t job;
+} batch_entry_t;
+
+static void hash_task(void *arg) {
+  hash_job_t *job = (hash_job_t *)arg;
+  job->rc = pngcore_pixel_hash(job->png, &job->hash, &job->error);
+}
+
+/* Orders inputs so byte-identical encodings are adjacent */
+static int entry_cmp(const void *pa, const void *pb) {
+  const batch_entry_t *a = (const batch_entry_t *)pa;
+  const batch_entry_t *b = (const batch_entry_t *)pb;
+  const pngcore_idat_t *ia = a->png->internal->idat;
+  const pngcore_idat_t *ib = b->png->internal->idat;
+  U32 la = ia ? ia->p_data->length : 0;
+  U32 lb = ib ? ib->p_data->length : 0;
+  if (la != lb) return la < lb ? -1 : 1;
+  U32 ca = ia ? ia->crc : 0;
+  U32 cb = ib ? ib->crc : 0;
+  if (ca != cb) return ca < cb ? -1 : 1;
+  return a->index < b->index ? -1 : (a->index > b->index);
+}
+
+int pngcore_pixel_hash_batch(pngcore_png_t *const pngs[], size_t n, uint64_t hashes[],
+                             int num_threads, pngcore_error_t *error) {
+  if (!pngs || !hashes) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid batch");
+    return -1;
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (!pngs[i] || !pngs[i]->internal || !pngs[i]->internal->ihdr) {
+      pngcore_error_set(error, PNGCORE_ERR, "Invalid PNG at index %zu", i);
+      return -1;
+    }
+  }
+  if (n == 0) return 0;
+
+  batch_entry_t *entries = pngcore_malloc(n * sizeof(*entries));
+  hash_job_t *jobs = pngcore_calloc(n, sizeof(*jobs));
+  pngcore_pool_t *pool = pngcore_pool_create(num_threads);
+  if (!entries || !jobs || !pool) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to start batch hashing");
+    free(entries);
+    free(jobs);
+    pngcore_pool_destroy(pool);
+    return -1;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    entries[i].png = pngs[i];
+    entries[i].index = i;
+  }
+  qsort(entries, n, sizeof(*entries), entry_cmp);
+
+  /* Repeats of the previous encoding share its job instead of decoding */
+  size_t num_jobs = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (i > 0 && pngcore_same_encoding(entries[i - 1].png, entries[i].png)) {
+      entries[i].job = entries[i - 1].job;
+      continue;
+    }
+    entries[i].job = num_jobs;
+    jobs[num_jobs].png = entries[i].png;
+    if (pngcore_pool_submit(pool, hash_task, &jobs[num_jobs]) != 0) {
+      hash_task(&jobs[num_jobs]);
+    }
+    num_jobs++;
+  }
+  pngcore_pool_wait(pool);
+  pngcore_pool_destroy(pool);
+
+  int rc = 0;
+  for (size_t i = 0; i < n; i++) {
+    hash_job_t *job = &jobs[entries[i].job];
+    hashes[entries[i].index] = job->rc == 0 ? job->hash : 0;
+    if (job->rc != 0 && rc == 0) {
+      if (error) *error = job->error;
+      rc = -1;
+    }
+  }
+
+  free(entries);
+  free(jobs);
+  return rc;
+}
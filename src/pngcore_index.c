@@ -0,0 +1,862 @@
+/**
+* @file pngcore_index.c
+* @brief Random-access sidecar index (.pngidx)
+*/
+
+#include "pngcore/pngcore_index.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_filter.h"
+#include "pngcore/pngcore_hash.h"
+#include "pngcore/pngcore_crc.h"
+#include "pngcore/pngcore_stream.h"
+#include "pngcore/pngcore_pool.h"
+#include "pngcore/pngcore_stats.h"
+#include "pngcore/pngcore_probes.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define READ_SIZE 65536
+
+/******************************************************************************
+* BUILDER
+*****************************************************************************/
+
+typedef struct {
+  U32 width;
+  U32 height;
+  U8 bit_depth;
+  U8 color_type;
+  U32 band_rows;
+  size_t row_bytes;
+  size_t bpp;
+
+  pngcore_index_chunk_t *chunks;
+  size_t num_chunks;
+  size_t cap_chunks;
+  pngcore_index_checkpoint_t *points;
+  size_t num_points;
+  size_t cap_points;
+  U64 *hashes;
+  pngcore_mem_buffer_t data;    /* checkpoint windows and rows */
+
+  /* Raw inflate; the zlib header and trailer are handled here */
+  z_stream strm;
+  int strm_open;
+  U8 zhead[2];
+  size_t zhead_len;
+  U8 trailer[4];
+  size_t trailer_len;
+  int ended;
+  uLong adler;
+  U64 in;
+  U64 out;
+  U8 *window;                   /* last PNGCORE_INDEX_WINDOW bytes inflated */
+
+  U8 *lines;
+  U8 *cur;                      /* filter byte + scanline being filled */
+  U8 *prev;
+  size_t fill;
+  U32 row;
+  U32 next_point;               /* first row a new checkpoint may cut */
+  pngcore_hash_state_t hash;
+} builder_t;
+
+static int grow(void **items, size_t *cap, size_t need, size_t size) {
+  if (need <= *cap) return 0;
+  size_t n = *cap ? *cap * 2 : 16;
+  while (n < need) {
+    n *= 2;
+  }
+  void *p = pngcore_realloc(*items, n * size);
+  if (!p) return -1;
+  *items = p;
+  *cap = n;
+  return 0;
+}
+
+static void builder_free(builder_t *b) {
+  if (b->strm_open) {
+    (void) inflateEnd(&b->strm);
+  }
+  free(b->chunks);
+  free(b->points);
+  free(b->hashes);
+  free(b->data.data);
+  free(b->window);
+  free(b->lines);
+}
+
+static int append(builder_t *b, const U8 *data, size_t len) {
+  return len > 0 ? pngcore_mem_sink(&b->data, data, len) : 0;
+}
+
+static int builder_checkpoint(builder_t *b) {
+  if (grow((void **)&b->points, &b->cap_points, b->num_points + 1, sizeof(*b->points)) != 0) {
+    return -1;
+  }
+  pngcore_index_checkpoint_t *p = &b->points[b->num_points];
+  memset(p, 0, sizeof(*p));
+  p->in = b->in;
+  p->out = b->out;
+  p->data = b->data.len;
+  p->row = b->row;
+  p->prefix_len = b->fill;
+  p->bits = b->strm_open && b->out > 0 ? (U8)(b->strm.data_type & 7) : 0;
+
+  /* The window is circular; store it oldest byte first */
+  size_t pos = b->out % PNGCORE_INDEX_WINDOW;
+  int rc = 0;
+  if (b->out >= PNGCORE_INDEX_WINDOW) {
+    p->window_len = PNGCORE_INDEX_WINDOW;
+    rc |= append(b, b->window + pos, PNGCORE_INDEX_WINDOW - pos);
+    rc |= append(b, b->window, pos);
+  } else {
+    p->window_len = (U32)b->out;
+    rc |= append(b, b->window, pos);
+  }
+  rc |= append(b, b->cur, b->fill);
+  if (b->row > 0) {
+    rc |= append(b, b->prev + 1, b->row_bytes);
+  }
+  if (rc != 0) return -1;
+
+  b->num_points++;
+  b->next_point = (b->row / b->band_rows + 1) * b->band_rows;
+  return 0;
+}
+
+static int builder_setup(builder_t *b, const U8 *ihdr, pngcore_error_t *error) {
+  b->width = from_be_buffer((U8 *)ihdr);
+  b->height = from_be_buffer((U8 *)ihdr + 4);
+  b->bit_depth = ihdr[8];
+  b->color_type = ihdr[9];
+  if (b->width == 0 || b->height == 0 || !pngcore_valid_format(b->bit_depth, b->color_type)) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED, "Unsupported IHDR");
+    return -1;
+  }
+  if (ihdr[12] != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED,
+    "Indexing interlaced images is not supported");
+    return -1;
+  }
+
+  b->row_bytes = pngcore_scanline_bytes(b->width, b->bit_depth, b->color_type);
+  b->bpp = pngcore_filter_bpp(b->bit_depth, b->color_type);
+  b->lines = pngcore_malloc(2 * (b->row_bytes + 1));
+  b->window = pngcore_malloc(PNGCORE_INDEX_WINDOW);
+  b->hashes = pngcore_calloc((b->height + b->band_rows - 1) / b->band_rows, sizeof(U64));
+  if (!b->lines || !b->window || !b->hashes) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate index buffers");
+    return -1;
+  }
+  b->cur = b->lines;
+  b->prev = b->lines + b->row_bytes + 1;
+  pngcore_hash_init(&b->hash);
+  b->adler = adler32(0L, Z_NULL, 0);
+
+  if (inflateInit2(&b->strm, -MAX_WBITS) != Z_OK) {
+    pngcore_error_set(error, PNGCORE_ERR, "inflateInit failed");
+    return -1;
+  }
+  b->strm_open = 1;
+
+  /* Decoding can always start right after the zlib header */
+  b->in = 2;
+  if (builder_checkpoint(b) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to record checkpoint");
+    return -1;
+  }
+  b->in = 0;
+  return 0;
+}
+
+/* Unfilter and hash completed scanlines */
+static int builder_rows(builder_t *b, const U8 *data, size_t len) {
+  size_t line_len = b->row_bytes + 1;
+  while (len > 0 && b->row < b->height) {
+    size_t n = line_len - b->fill < len ? line_len - b->fill : len;
+    memcpy(b->cur + b->fill, data, n);
+    b->fill += n;
+    data += n;
+    len -= n;
+    if (b->fill < line_len) break;
+
+    if (pngcore_unfilter_row(b->cur[0], b->cur + 1, b->row > 0 ? b->prev + 1 : NULL,
+                             b->row_bytes, b->bpp) != 0) {
+      return -1;
+    }
+    pngcore_hash_update(&b->hash, b->cur + 1, b->row_bytes);
+    if ((b->row + 1) % b->band_rows == 0 || b->row + 1 == b->height) {
+      b->hashes[b->row / b->band_rows] = pngcore_hash_final(&b->hash);
+      pngcore_hash_init(&b->hash);
+    }
+
+    U8 *tmp = b->prev;
+    b->prev = b->cur;
+    b->cur = tmp;
+    b->fill = 0;
+    b->row++;
+  }
+  return 0;
+}
+
+static int builder_inflate(builder_t *b, const U8 *data, size_t len, pngcore_error_t *error) {
+  while (len > 0) {
+    if (b->zhead_len < 2) {
+      b->zhead[b->zhead_len++] = *data++;
+      len--;
+      b->in++;
+      if (b->zhead_len == 2 &&
+          ((b->zhead[0] & 0x0f) != Z_DEFLATED || (b->zhead[1] & 0x20) ||
+           ((b->zhead[0] << 8) | b->zhead[1]) % 31 != 0)) {
+        pngcore_error_set(error, PNGCORE_ERR, "Invalid zlib header");
+        return -1;
+      }
+      continue;
+    }
+    if (b->ended) {
+      /* Adler-32 trailer; anything after it is ignored like the decoder does */
+      while (len > 0 && b->trailer_len < 4) {
+        b->trailer[b->trailer_len++] = *data++;
+        len--;
+      }
+      return 0;
+    }
+
+    size_t pos = b->out % PNGCORE_INDEX_WINDOW;
+    size_t room = PNGCORE_INDEX_WINDOW - pos;
+    b->strm.next_in = (U8 *)data;
+    b->strm.avail_in = len;
+    b->strm.next_out = b->window + pos;
+    b->strm.avail_out = room;
+
+    /* Z_BLOCK stops at every deflate block boundary */
+    U64 start = pngcore_stats_now();
+    PNGCORE_PROBE1(inflate_start, len);
+    int ret = inflate(&b->strm, Z_BLOCK);
+    size_t used = len - b->strm.avail_in;
+    size_t have = room - b->strm.avail_out;
+    PNGCORE_PROBE3(inflate_done, used, have, ret);
+    pngcore_stats_add(PNGCORE_STAT_BYTES_INFLATED, have);
+    pngcore_stats_since(PNGCORE_STAT_INFLATE_NS, start);
+    if (ret != Z_OK && ret != Z_STREAM_END && !(ret == Z_BUF_ERROR && (used || have))) {
+      pngcore_error_set(error, PNGCORE_ERR, "Corrupt image data");
+      return -1;
+    }
+    data += used;
+    len -= used;
+    b->in += used;
+    b->adler = adler32(b->adler, b->window + pos, have);
+    if (builder_rows(b, b->window + pos, have) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR, "Invalid filter type in row %u", b->row);
+      return -1;
+    }
+    b->out += have;
+
+    if (ret == Z_STREAM_END) {
+      b->ended = 1;
+    } else if ((b->strm.data_type & 128) && !(b->strm.data_type & 64) &&
+               b->row >= b->next_point && b->row < b->height) {
+      if (builder_checkpoint(b) != 0) {
+        pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to record checkpoint");
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* One sequential pass over the file. IHDR and IDAT are CRC-checked since
+* their contents are read anyway; other chunks are skipped */
+static int builder_scan(builder_t *b, FILE *fp, U64 *source_size, pngcore_error_t *error) {
+  U8 sig[PNG_SIG_SIZE];
+  if (fread(sig, 1, PNG_SIG_SIZE, fp) != PNG_SIG_SIZE || !is_png(sig, PNG_SIG_SIZE)) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_PNG, "Not a PNG file");
+    return -1;
+  }
+
+  U8 *buf = pngcore_malloc(READ_SIZE);
+  if (!buf) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate read buffer");
+    return -1;
+  }
+
+  U64 offset = PNG_SIG_SIZE;
+  int rc = 0;
+  int seen_iend = 0;
+  while (rc == 0 && !seen_iend) {
+    U8 head[CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE];
+    U8 crc_be[CHUNK_CRC_SIZE];
+    if (fread(head, 1, sizeof(head), fp) != sizeof(head)) {
+      pngcore_error_set(error, PNGCORE_ERR, "Truncated PNG at offset %llu",
+                        (unsigned long long)offset);
+      rc = -1;
+      break;
+    }
+    U32 len = from_be_buffer(head);
+    const char *type = (const char *)head + CHUNK_LEN_SIZE;
+    int is_ihdr = memcmp(type, "IHDR", 4) == 0;
+    int is_idat = memcmp(type, "IDAT", 4) == 0;
+
+    if ((b->num_chunks == 0) != is_ihdr || (is_ihdr && len != DATA_IHDR_SIZE)) {
+      pngcore_error_set(error, PNGCORE_ERR_WRONG_CHUNK, "IHDR must be the first chunk");
+      rc = -1;
+      break;
+    }
+    if (grow((void **)&b->chunks, &b->cap_chunks, b->num_chunks + 1, sizeof(*b->chunks)) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to grow chunk table");
+      rc = -1;
+      break;
+    }
+    pngcore_index_chunk_t *chunk = &b->chunks[b->num_chunks++];
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->offset = offset;
+    chunk->length = len;
+    memcpy(chunk->type, type, 4);
+
+    unsigned long crc = pngcore_update_crc(0xffffffffL, head + CHUNK_LEN_SIZE, CHUNK_TYPE_SIZE);
+    if (is_ihdr || is_idat) {
+      for (U32 done = 0; rc == 0 && done < len; ) {
+        size_t n = len - done < READ_SIZE ? len - done : READ_SIZE;
+        if (fread(buf, 1, n, fp) != n) {
+          pngcore_error_set(error, PNGCORE_ERR, "Truncated %.4s chunk", type);
+          rc = -1;
+          break;
+        }
+        /* Timed per block since reading and inflating are interleaved */
+        U64 start = pngcore_stats_now();
+        crc = pngcore_update_crc(crc, buf, n);
+        pngcore_stats_since(PNGCORE_STAT_CRC_NS, start);
+        if (is_ihdr) {
+          rc = builder_setup(b, buf, error);
+        } else {
+          rc = builder_inflate(b, buf, n, error);
+        }
+        done += n;
+      }
+    } else if (fseeko(fp, len, SEEK_CUR) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR_IO, "Seek failed");
+      rc = -1;
+    }
+    if (rc != 0) break;
+
+    if (fread(crc_be, 1, CHUNK_CRC_SIZE, fp) != CHUNK_CRC_SIZE) {
+      pngcore_error_set(error, PNGCORE_ERR, "Truncated PNG at offset %llu",
+                        (unsigned long long)offset);
+      rc = -1;
+      break;
+    }
+    chunk->crc = from_be_buffer(crc_be);
+    if ((is_ihdr || is_idat) && chunk->crc != (U32)(crc ^ 0xffffffffL)) {
+      PNGCORE_PROBE3(crc_mismatch, type, chunk->crc, (U32)(crc ^ 0xffffffffL));
+      pngcore_error_set(error, PNGCORE_ERR_CRC_MISMATCH, "CRC mismatch in %.4s chunk", type);
+      rc = -1;
+      break;
+    }
+
+    offset += CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + (U64)len + CHUNK_CRC_SIZE;
+    seen_iend = memcmp(type, "IEND", 4) == 0;
+  }
+  free(buf);
+  if (rc != 0) return -1;
+
+  if (b->row < b->height || !b->ended || b->trailer_len < 4 ||
+      from_be_buffer(b->trailer) != (U32)b->adler) {
+    pngcore_error_set(error, PNGCORE_ERR, "Image data is incomplete or corrupt");
+    return -1;
+  }
+  *source_size = offset;
+  return 0;
+}
+
+static U64 align8(U64 n) {
+  return (n + 7) & ~(U64)7;
+}
+
+static int builder_write(const builder_t *b, U64 source_size, const char *index_path,
+                         pngcore_error_t *error) {
+  pngcore_index_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PNGCORE_INDEX_MAGIC, sizeof(header.magic));
+  header.byte_order = PNGCORE_INDEX_BYTE_ORDER;
+  header.version = PNGCORE_INDEX_VERSION;
+  header.source_size = source_size;
+  header.width = b->width;
+  header.height = b->height;
+  header.bit_depth = b->bit_depth;
+  header.color_type = b->color_type;
+  header.band_rows = b->band_rows;
+  header.num_chunks = b->num_chunks;
+  header.num_checkpoints = b->num_points;
+  header.num_bands = (b->height + b->band_rows - 1) / b->band_rows;
+  header.chunks_offset = align8(sizeof(header));
+  header.checkpoints_offset = header.chunks_offset + b->num_chunks * sizeof(*b->chunks);
+  header.hashes_offset = header.checkpoints_offset + b->num_points * sizeof(*b->points);
+  header.data_offset = header.hashes_offset + (U64)header.num_bands * sizeof(U64);
+  header.file_size = header.data_offset + b->data.len;
+
+  /* Readers may have the old index mapped, so never write over it */
+  char *tmp_path;
+  int fd = pngcore_open_temp(index_path, &tmp_path);
+  FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+  if (!fp) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to create a temporary file for %s",
+                      index_path);
+    if (fd >= 0) {
+      close(fd);
+      unlink(tmp_path);
+    }
+    free(tmp_path);
+    return -1;
+  }
+
+  int rc = 0;
+  rc |= pngcore_file_sink(fp, (const U8 *)&header, sizeof(header));
+  rc |= pngcore_file_sink(fp, (const U8 *)b->chunks, b->num_chunks * sizeof(*b->chunks));
+  rc |= pngcore_file_sink(fp, (const U8 *)b->points, b->num_points * sizeof(*b->points));
+  rc |= pngcore_file_sink(fp, (const U8 *)b->hashes, header.num_bands * sizeof(U64));
+  if (b->data.len > 0) {
+    rc |= pngcore_file_sink(fp, b->data.data, b->data.len);
+  }
+  if (fclose(fp) != 0) rc = -1;
+  if (rc == 0 && rename(tmp_path, index_path) != 0) rc = -1;
+  if (rc != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to write index %s", index_path);
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+  return rc;
+}
+
+int pngcore_index_build(const char *png_path, const char *index_path,
+                        uint32_t band_rows, pngcore_error_t *error) {
+  if (!png_path || !index_path) {
+    pngcore_error_set(error, PNGCORE_ERR, "Path is NULL");
+    return -1;
+  }
+
+  FILE *fp = fopen(png_path, "rb");
+  if (!fp) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to open file: %s", png_path);
+    return -1;
+  }
+
+  builder_t b;
+  memset(&b, 0, sizeof(b));
+  b.band_rows = band_rows ? band_rows : PNGCORE_INDEX_BAND_ROWS;
+
+  U64 source_size = 0;
+  int rc = builder_scan(&b, fp, &source_size, error);
+  fclose(fp);
+  if (rc == 0) {
+    rc = builder_write(&b, source_size, index_path, error);
+  }
+  builder_free(&b);
+  return rc;
+}
+
+typedef struct {
+  const char *png_path;
+  uint32_t band_rows;
+  int rc;
+  pngcore_error_t error;
+} build_job_t;
+
+static void build_task(void *arg) {
+  build_job_t *job = (build_job_t *)arg;
+  size_t len = strlen(job->png_path);
+  char *index_path = pngcore_malloc(len + sizeof(PNGCORE_INDEX_SUFFIX));
+  if (!index_path) {
+    pngcore_error_set(&job->error, PNGCORE_ERR_MEMORY, "Failed to allocate path");
+    job->rc = -1;
+    return;
+  }
+  memcpy(index_path, job->png_path, len);
+  memcpy(index_path + len, PNGCORE_INDEX_SUFFIX, sizeof(PNGCORE_INDEX_SUFFIX));
+  job->rc = pngcore_index_build(job->png_path, index_path, job->band_rows, &job->error);
+  free(index_path);
+}
+
+int pngcore_index_build_files(const char *const png_paths[], size_t n, uint32_t band_rows,
+                              int num_threads, pngcore_error_t *error) {
+  if (!png_paths) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid file list");
+    return -1;
+  }
+  if (n == 0) return 0;
+
+  build_job_t *jobs = pngcore_calloc(n, sizeof(*jobs));
+  pngcore_pool_t *pool = pngcore_pool_create(num_threads);
+  if (!jobs || !pool) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to start indexing");
+    free(jobs);
+    pngcore_pool_destroy(pool);
+    return -1;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    jobs[i].png_path = png_paths[i];
+    jobs[i].band_rows = band_rows;
+    if (!png_paths[i]) {
+      pngcore_error_set(&jobs[i].error, PNGCORE_ERR, "Path %zu is NULL", i);
+      jobs[i].rc = -1;
+    } else if (pngcore_pool_submit(pool, build_task, &jobs[i]) != 0) {
+      build_task(&jobs[i]);
+    }
+  }
+  pngcore_pool_wait(pool);
+  pngcore_pool_destroy(pool);
+
+  int rc = 0;
+  for (size_t i = 0; i < n && rc == 0; i++) {
+    if (jobs[i].rc != 0) {
+      if (error) *error = jobs[i].error;
+      rc = -1;
+    }
+  }
+  free(jobs);
+  return rc;
+}
+
+/******************************************************************************
+* READER
+*****************************************************************************/
+
+/* count elements of size at off lie inside the mapping */
+static int in_bounds(size_t map_size, U64 off, U64 count, size_t size) {
+  return off <= map_size && (off & 7) == 0 && count <= (map_size - off) / size;
+}
+
+static int index_validate(pngcore_index_t *index) {
+  const pngcore_index_header_t *h = index->header;
+  if (memcmp(h->magic, PNGCORE_INDEX_MAGIC, sizeof(h->magic)) != 0 ||
+      h->byte_order != PNGCORE_INDEX_BYTE_ORDER || h->version != PNGCORE_INDEX_VERSION ||
+      h->file_size != index->size) {
+    return -1;
+  }
+  if (h->width == 0 || h->height == 0 || h->interlace != 0 || h->band_rows == 0 ||
+      !pngcore_valid_format(h->bit_depth, h->color_type) ||
+      h->num_bands != (h->height + (U64)h->band_rows - 1) / h->band_rows ||
+      h->num_checkpoints == 0) {
+    return -1;
+  }
+  if (!in_bounds(index->size, h->chunks_offset, h->num_chunks, sizeof(pngcore_index_chunk_t)) ||
+      !in_bounds(index->size, h->checkpoints_offset, h->num_checkpoints,
+                 sizeof(pngcore_index_checkpoint_t)) ||
+      !in_bounds(index->size, h->hashes_offset, h->num_bands, sizeof(U64)) ||
+      h->data_offset > index->size) {
+    return -1;
+  }
+
+  index->chunks = (const pngcore_index_chunk_t *)(index->map + h->chunks_offset);
+  index->checkpoints = (const pngcore_index_checkpoint_t *)(index->map + h->checkpoints_offset);
+  index->hashes = (const U64 *)(index->map + h->hashes_offset);
+  index->row_bytes = pngcore_scanline_bytes(h->width, h->bit_depth, h->color_type);
+
+  /* Checked once so reads can trust every checkpoint */
+  U64 data_size = index->size - h->data_offset;
+  for (U32 i = 0; i < h->num_checkpoints; i++) {
+    const pngcore_index_checkpoint_t *p = &index->checkpoints[i];
+    U64 need = (U64)p->window_len + p->prefix_len + (p->row > 0 ? index->row_bytes : 0);
+    if (p->row >= h->height || p->window_len > PNGCORE_INDEX_WINDOW ||
+        p->prefix_len > index->row_bytes || p->bits > 7 || p->in < 2 ||
+        (i == 0 && (p->row != 0 || p->window_len != 0 || p->prefix_len != 0)) ||
+        (i > 0 && p->row < index->checkpoints[i - 1].row) ||
+        p->data > data_size || need > data_size - p->data) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+pngcore_index_t* pngcore_index_open(const char *index_path, pngcore_error_t *error) {
+  if (!index_path) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Filename is NULL");
+    return NULL;
+  }
+
+  int fd = open(index_path, O_RDONLY);
+  if (fd < 0) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to open file: %s", index_path);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(pngcore_index_header_t)) {
+    close(fd);
+    pngcore_error_set(error, PNGCORE_ERR, "Not a pngcore index: %s", index_path);
+    return NULL;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to map %s", index_path);
+    return NULL;
+  }
+
+  pngcore_index_t *index = pngcore_calloc(1, sizeof(pngcore_index_t));
+  if (!index) {
+    munmap(map, st.st_size);
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate index");
+    return NULL;
+  }
+  index->map = map;
+  index->size = st.st_size;
+  index->header = (const pngcore_index_header_t *)index->map;
+
+  if (index_validate(index) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid or incompatible index: %s", index_path);
+    pngcore_index_close(index);
+    return NULL;
+  }
+  return index;
+}
+
+void pngcore_index_close(pngcore_index_t *index) {
+  if (!index) return;
+  munmap(index->map, index->size);
+  free(index);
+}
+
+uint32_t pngcore_index_get_width(const pngcore_index_t *index) {
+  return index ? index->header->width : 0;
+}
+
+uint32_t pngcore_index_get_height(const pngcore_index_t *index) {
+  return index ? index->header->height : 0;
+}
+
+uint8_t pngcore_index_get_bit_depth(const pngcore_index_t *index) {
+  return index ? index->header->bit_depth : 0;
+}
+
+uint8_t pngcore_index_get_color_type(const pngcore_index_t *index) {
+  return index ? index->header->color_type : 0;
+}
+
+uint32_t pngcore_index_band_rows(const pngcore_index_t *index) {
+  return index ? index->header->band_rows : 0;
+}
+
+uint32_t pngcore_index_num_bands(const pngcore_index_t *index) {
+  return index ? index->header->num_bands : 0;
+}
+
+uint64_t pngcore_index_band_hash(const pngcore_index_t *index, uint32_t band) {
+  if (!index || band >= index->header->num_bands) return 0;
+  return index->hashes[band];
+}
+
+int pngcore_index_find_chunk(const pngcore_index_t *index, const char type[4],
+                             uint64_t *offset, uint32_t *length) {
+  if (!index || !type) return -1;
+  for (U32 i = 0; i < index->header->num_chunks; i++) {
+    if (memcmp(index->chunks[i].type, type, 4) == 0) {
+      if (offset) *offset = index->chunks[i].offset;
+      if (length) *length = index->chunks[i].length;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* Reads the zlib stream out of the IDAT chunks of the source file */
+typedef struct {
+  const pngcore_index_t *index;
+  int fd;
+  U32 chunk;            /* current IDAT in the chunk table */
+  U64 pos;              /* payload bytes of it already read */
+  int checked;          /* header of the current chunk verified */
+} idat_source_t;
+
+/* Position the source at byte `in` of the zlib stream */
+static int source_seek(idat_source_t *src, U64 in) {
+  U64 start = 0;
+  for (U32 i = 0; i < src->index->header->num_chunks; i++) {
+    const pngcore_index_chunk_t *c = &src->index->chunks[i];
+    if (memcmp(c->type, "IDAT", 4) != 0) continue;
+    if (in < start + c->length) {
+      src->chunk = i;
+      src->pos = in - start;
+      src->checked = 0;
+      return 0;
+    }
+    start += c->length;
+  }
+  return -1;
+}
+
+/* Returns bytes read, 0 at the end of the image data, -1 on error */
+static ssize_t source_read(idat_source_t *src, U8 *buf, size_t cap) {
+  const pngcore_index_header_t *h = src->index->header;
+  while (src->chunk < h->num_chunks) {
+    const pngcore_index_chunk_t *c = &src->index->chunks[src->chunk];
+    if (memcmp(c->type, "IDAT", 4) != 0 || src->pos >= c->length) {
+      src->chunk++;
+      src->pos = 0;
+      src->checked = 0;
+      continue;
+    }
+
+    /* The PNG must still be the one that was indexed */
+    if (!src->checked) {
+      U8 head[CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE];
+      if (pread(src->fd, head, sizeof(head), c->offset) != (ssize_t)sizeof(head) ||
+          from_be_buffer(head) != c->length || memcmp(head + CHUNK_LEN_SIZE, "IDAT", 4) != 0) {
+        return -1;
+      }
+      src->checked = 1;
+    }
+
+    size_t n = c->length - src->pos < cap ? c->length - src->pos : cap;
+    ssize_t got = pread(src->fd, buf, n, c->offset + CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + src->pos);
+    if (got <= 0) return -1;
+    src->pos += got;
+    return got;
+  }
+  return 0;
+}
+
+int pngcore_index_read_rows(const pngcore_index_t *index, const char *png_path,
+                            uint32_t y0, uint32_t y1, uint8_t *dst, size_t stride,
+                            pngcore_error_t *error) {
+  if (!index || !png_path || !dst || y0 >= y1 || y1 > index->header->height) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid index, path or row range");
+    return -1;
+  }
+  const pngcore_index_header_t *h = index->header;
+  size_t row_bytes = index->row_bytes;
+  size_t line_len = row_bytes + 1;
+  size_t bpp = pngcore_filter_bpp(h->bit_depth, h->color_type);
+  if (stride < row_bytes) {
+    pngcore_error_set(error, PNGCORE_ERR, "Stride too small");
+    return -1;
+  }
+
+  /* Last checkpoint at or above y0 */
+  U32 lo = 0, hi = h->num_checkpoints;
+  while (hi - lo > 1) {
+    U32 mid = lo + (hi - lo) / 2;
+    if (index->checkpoints[mid].row <= y0) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  const pngcore_index_checkpoint_t *p = &index->checkpoints[lo];
+  const U8 *data = index->map + h->data_offset + p->data;
+
+  idat_source_t src = { index, -1, 0, 0, 0 };
+  src.fd = open(png_path, O_RDONLY);
+  if (src.fd < 0) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to open file: %s", png_path);
+    return -1;
+  }
+
+  U8 *lines = pngcore_malloc(2 * line_len);
+  U8 *buf = pngcore_malloc(READ_SIZE);
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  int strm_open = 0;
+  int rc = -1;
+
+  if (!lines || !buf) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate scanline buffers");
+    goto done;
+  }
+  if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+    pngcore_error_set(error, PNGCORE_ERR, "inflateInit failed");
+    goto done;
+  }
+  strm_open = 1;
+
+  /* Restore the inflate state at the checkpoint */
+  if (source_seek(&src, p->in - (p->bits ? 1 : 0)) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Checkpoint outside the image data");
+    goto done;
+  }
+  if (p->bits) {
+    U8 byte;
+    if (source_read(&src, &byte, 1) != 1 ||
+        inflatePrime(&strm, p->bits, byte >> (8 - p->bits)) != Z_OK) {
+      pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to read %s", png_path);
+      goto done;
+    }
+  }
+  if (p->window_len > 0 && inflateSetDictionary(&strm, data, p->window_len) != Z_OK) {
+    pngcore_error_set(error, PNGCORE_ERR, "Failed to restore inflate window");
+    goto done;
+  }
+
+  U8 *cur = lines;
+  U8 *prev = lines + line_len;
+  memcpy(cur, data + p->window_len, p->prefix_len);
+  if (p->row > 0) {
+    memcpy(prev + 1, data + p->window_len + p->prefix_len, row_bytes);
+  }
+  size_t fill = p->prefix_len;
+  U32 row = p->row;
+
+  while (row < y1) {
+    if (strm.avail_in == 0) {
+      ssize_t n = source_read(&src, buf, READ_SIZE);
+      if (n <= 0) {
+        pngcore_error_set(error, n < 0 ? PNGCORE_ERR_IO : PNGCORE_ERR,
+                          n < 0 ? "PNG does not match its index" : "Image data ends early");
+        goto done;
+      }
+      strm.next_in = buf;
+      strm.avail_in = n;
+    }
+    strm.next_out = cur + fill;
+    strm.avail_out = line_len - fill;
+    U64 start = pngcore_stats_now();
+    U64 in_before = strm.avail_in;
+    PNGCORE_PROBE1(inflate_start, in_before);
+    int ret = inflate(&strm, Z_NO_FLUSH);
+    PNGCORE_PROBE3(inflate_done, in_before - strm.avail_in, line_len - fill - strm.avail_out, ret);
+    pngcore_stats_add(PNGCORE_STAT_BYTES_INFLATED, line_len - fill - strm.avail_out);
+    pngcore_stats_since(PNGCORE_STAT_INFLATE_NS, start);
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+      pngcore_error_set(error, PNGCORE_ERR, "Corrupt image data");
+      goto done;
+    }
+    fill = line_len - strm.avail_out;
+    if (fill < line_len) {
+      if (ret == Z_STREAM_END) {
+        pngcore_error_set(error, PNGCORE_ERR, "Image data ends early");
+        goto done;
+      }
+      continue;
+    }
+
+    if (pngcore_unfilter_row(cur[0], cur + 1, row > 0 ? prev + 1 : NULL, row_bytes, bpp) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR, "Invalid filter type in row %u", row);
+      goto done;
+    }
+    if (row >= y0) {
+      memcpy(dst + (size_t)(row - y0) * stride, cur + 1, row_bytes);
+    }
+    U8 *tmp = prev;
+    prev = cur;
+    cur = tmp;
+    fill = 0;
+    row++;
+  }
+  rc = 0;
+
+done:
+  if (strm_open) {
+    (void) inflateEnd(&strm);
+  }
+  free(lines);
+  free(buf);
+  close(src.fd);
+  return rc;
+}
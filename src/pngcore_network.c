@@ -6,6 +6,8 @@
 #include "pngcore.h"
 #include "pngcore/pngcore_network.h"
 #include "pngcore/pngcore_types.h"
+#include "pngcore/pngcore_stats.h"
+#include "pngcore/pngcore_probes.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -21,7 +23,7 @@ int pngcore_recv_buf_init(pngcore_recv_buf_t *ptr, size_t max_size) {
     return 1;
   }
   
-  p = malloc(max_size);
+  p = pngcore_malloc(max_size);
   if (p == NULL) {
     return 2;
   }
@@ -62,7 +64,7 @@ size_t pngcore_header_cb(char *p_recv, size_t size, size_t nmemb, void *userdata
   /* Store header data */
   if (header_buf->size + realsize + 1 > header_buf->max_size) {
     size_t new_size = header_buf->max_size + max(BUF_INC, realsize + 1);   
-    char *q = realloc(header_buf->buf, new_size);
+    char *q = pngcore_realloc(header_buf->buf, new_size);
     if (q == NULL) {
       perror("realloc");
       return -1;
@@ -94,7 +96,7 @@ size_t pngcore_write_cb(char *p_recv, size_t size, size_t nmemb, void *p_userdat
   
   if (p->size + realsize + 1 > p->max_size) {
     size_t new_size = p->max_size + max(BUF_INC, realsize + 1);   
-    char *q = realloc(p->buf, new_size);
+    char *q = pngcore_realloc(p->buf, new_size);
     if (q == NULL) {
       perror("realloc");
       return -1;
@@ -128,14 +130,14 @@ pngcore_http_response_t* pngcore_http_get(const char *url) {
   }
   
   /* Allocate response structure */
-  response = malloc(sizeof(pngcore_http_response_t));
+  response = pngcore_malloc(sizeof(pngcore_http_response_t));
   if (response == NULL) {
     fprintf(stderr, "pngcore_http_get: failed to allocate response structure\n");
     return NULL;
   }
   
   /* Allocate data buffer */
-  response->data = malloc(sizeof(pngcore_recv_buf_t));
+  response->data = pngcore_malloc(sizeof(pngcore_recv_buf_t));
   if (response->data == NULL) {
     fprintf(stderr, "pngcore_http_get: failed to allocate data buffer\n");
     free(response);
@@ -143,7 +145,7 @@ pngcore_http_response_t* pngcore_http_get(const char *url) {
   }
   
   /* Allocate header buffer */
-  response->header = malloc(sizeof(pngcore_recv_buf_t));
+  response->header = pngcore_malloc(sizeof(pngcore_recv_buf_t));
   if (response->header == NULL) {
     fprintf(stderr, "pngcore_http_get: failed to allocate header buffer\n");
     free(response->data);
@@ -196,7 +198,10 @@ pngcore_http_response_t* pngcore_http_get(const char *url) {
   curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "libpngcore/1.0");
   
   /* Perform request */
+  pngcore_stats_add(PNGCORE_STAT_HTTP_REQUESTS, 1);
+  PNGCORE_PROBE1(http_start, url);
   res = curl_easy_perform(curl_handle);
+  PNGCORE_PROBE3(http_done, url, (int)res, response->data->size);
   
   /* Clean up curl handle */
   curl_easy_cleanup(curl_handle);
@@ -0,0 +1,37 @@
+/**
+* @file pngcore_payload.c
+* @brief Reference-counted chunk payloads
+*/
+
+#include "pngcore/pngcore_payload.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+
+pngcore_payload_t* pngcore_payload_adopt(U8 *data, size_t size) {
+  pngcore_payload_t *payload = pngcore_malloc(sizeof(pngcore_payload_t));
+  if (!payload) return NULL;
+  atomic_init(&payload->refs, 1);
+  payload->size = size;
+  payload->data = data;
+  return payload;
+}
+
+pngcore_payload_t* pngcore_payload_retain(pngcore_payload_t *payload) {
+  if (payload) {
+    atomic_fetch_add_explicit(&payload->refs, 1, memory_order_relaxed);
+  }
+  return payload;
+}
+
+void pngcore_payload_release(pngcore_payload_t *payload) {
+  if (!payload) return;
+  /* The last holder must see every write made before the other releases */
+  if (atomic_fetch_sub_explicit(&payload->refs, 1, memory_order_acq_rel) == 1) {
+    free(payload->data);
+    free(payload);
+  }
+}
+
+int pngcore_payload_shared(const pngcore_payload_t *payload) {
+  return payload && atomic_load_explicit(&payload->refs, memory_order_acquire) > 1;
+}
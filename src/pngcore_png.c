@@ -6,42 +6,51 @@
 #include "pngcore/pngcore_png.h"
 #include "pngcore/pngcore_crc.h"
 #include "pngcore/pngcore_zutil.h"
+#include "pngcore/pngcore_bands.h"
+#include "pngcore/pngcore_stats.h"
+#include "pngcore/pngcore_probes.h"
 #include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
 /******************************************************************************
 * SIMPLE PNG OPERATIONS
 *****************************************************************************/
 
 pngcore_simple_png_t* pngcore_new_simple_png(void) {
-  pngcore_simple_png_t *png = (pngcore_simple_png_t *)malloc(sizeof(pngcore_simple_png_t));
+  pngcore_simple_png_t *png = (pngcore_simple_png_t *)pngcore_malloc(sizeof(pngcore_simple_png_t));
   if (!png) return NULL;
   
   png->ihdr = NULL;
   png->idat = NULL;
   png->iend = NULL;
+  png->extra = NULL;
   
-  png->ihdr = (pngcore_ihdr_t *)malloc(sizeof(pngcore_ihdr_t));
+  png->ihdr = (pngcore_ihdr_t *)pngcore_malloc(sizeof(pngcore_ihdr_t));
   if (!png->ihdr) {
     free(png);
     return NULL;
   }
-  png->ihdr->p_data = (pngcore_ihdr_data_t *)malloc(sizeof(pngcore_ihdr_data_t));
+  png->ihdr->p_data = (pngcore_ihdr_data_t *)pngcore_malloc(sizeof(pngcore_ihdr_data_t));
   if (!png->ihdr->p_data) {
     free(png->ihdr);
     free(png);
     return NULL;
   }
   
-  png->idat = (pngcore_idat_t *)malloc(sizeof(pngcore_idat_t));
+  png->idat = (pngcore_idat_t *)pngcore_malloc(sizeof(pngcore_idat_t));
   if (!png->idat) {
     free(png->ihdr->p_data);
     free(png->ihdr);
     free(png);
     return NULL;
   }
-  png->idat->p_data = (pngcore_idat_data_t *)malloc(sizeof(pngcore_idat_data_t));
+  png->idat->p_data = (pngcore_idat_data_t *)pngcore_malloc(sizeof(pngcore_idat_data_t));
   if (!png->idat->p_data) {
     free(png->idat);
     free(png->ihdr->p_data);
@@ -51,8 +60,11 @@ pngcore_simple_png_t* pngcore_new_simple_png(void) {
   }
   png->idat->p_data->data = NULL;
   png->idat->p_data->length = 0;
+  png->idat->p_data->payload = NULL;
+  png->idat->crc = pngcore_crc((U8 *)"IDAT", CHUNK_TYPE_SIZE);
+  png->idat->bands = NULL;
   
-  png->iend = (pngcore_iend_t *)malloc(sizeof(pngcore_iend_t));
+  png->iend = (pngcore_iend_t *)pngcore_malloc(sizeof(pngcore_iend_t));
   if (!png->iend) {
     free(png->idat->p_data);
     free(png->idat);
@@ -65,8 +77,38 @@ pngcore_simple_png_t* pngcore_new_simple_png(void) {
   return png;
 }
 
+/* Headers are copied; image data and raw chunks are shared */
+pngcore_simple_png_t* pngcore_clone_simple_png(const pngcore_simple_png_t *png) {
+  if (!png || !png->ihdr || !png->idat || !png->iend) return NULL;
+
+  pngcore_simple_png_t *copy = pngcore_new_simple_png();
+  if (!copy) return NULL;
+  const struct pngcore_idat_bands *bands = png->idat->bands;
+  if (bands) {
+    copy->idat->bands = pngcore_malloc(sizeof(*bands));
+    pngcore_band_t *table = pngcore_malloc(bands->count * sizeof(pngcore_band_t));
+    if (!copy->idat->bands || !table) {
+      free(table);
+      pngcore_free_simple_png(copy);
+      return NULL;
+    }
+    *copy->idat->bands = *bands;
+    copy->idat->bands->bands = memcpy(table, bands->bands, bands->count * sizeof(pngcore_band_t));
+  }
+
+  *copy->ihdr->p_data = *png->ihdr->p_data;
+  copy->ihdr->crc = png->ihdr->crc;
+  copy->idat->p_data->length = png->idat->p_data->length;
+  copy->idat->p_data->data = png->idat->p_data->data;
+  copy->idat->p_data->payload = pngcore_payload_retain(png->idat->p_data->payload);
+  copy->idat->crc = png->idat->crc;
+  copy->iend->crc = png->iend->crc;
+  copy->extra = pngcore_chunk_list_retain(png->extra);
+  return copy;
+}
+
 pngcore_simple_png_t* pngcore_parse_raw(pngcore_raw_png_t *raw_png, Error *error) {
-  pngcore_simple_png_t *png = (pngcore_simple_png_t *)malloc(sizeof(pngcore_simple_png_t));
+  pngcore_simple_png_t *png = (pngcore_simple_png_t *)pngcore_malloc(sizeof(pngcore_simple_png_t));
   if (!png) {
     if (error) {
       error->code = ERR;
@@ -80,6 +122,10 @@ pngcore_simple_png_t* pngcore_parse_raw(pngcore_raw_png_t *raw_png, Error *error
   png->idat = NULL;
   png->iend = NULL;
   
+  /* Other chunks stay raw until they are accessed */
+  png->extra = raw_png->extra;
+  raw_png->extra = NULL;
+  
   /* Parse IHDR */
   png->ihdr = pngcore_parse_ihdr(raw_png->chunks[0], error);
   if (png->ihdr == NULL || error->code != SUCCESS) {
@@ -116,6 +162,21 @@ pngcore_simple_png_t* pngcore_parse_raw(pngcore_raw_png_t *raw_png, Error *error
     }
   }
   
+  /* A saved band table comes back only while it matches the image data */
+  size_t index;
+  const pngcore_chunk_ref_t *ref = pngcore_chunk_list_find(png->extra, PNGCORE_BANDS_CHUNK, 0,
+                                                           &index);
+  if (ref) {
+    if (pngcore_chunk_ref_crc_ok(png->extra, ref)) {
+      png->idat->bands = pngcore_idat_bands_read(pngcore_chunk_ref_data(png->extra, ref),
+                                                 ref->length, png->idat->crc,
+                                                 png->idat->p_data->length,
+                                                 png->ihdr->p_data->height);
+    }
+    /* Saving writes a fresh one */
+    pngcore_chunk_list_remove(png->extra, index);
+  }
+  
   return png;
 }
 
@@ -141,7 +202,7 @@ pngcore_ihdr_t* pngcore_parse_ihdr(pngcore_raw_chunk_t *raw_chunk, Error *error)
     return NULL;
   }
   
-  pngcore_ihdr_t *ihdr = (pngcore_ihdr_t *)malloc(sizeof(pngcore_ihdr_t));
+  pngcore_ihdr_t *ihdr = (pngcore_ihdr_t *)pngcore_malloc(sizeof(pngcore_ihdr_t));
   if (!ihdr) {
     if (error) {
       error->code = ERR;
@@ -150,7 +211,7 @@ pngcore_ihdr_t* pngcore_parse_ihdr(pngcore_raw_chunk_t *raw_chunk, Error *error)
     return NULL;
   }
   
-  ihdr->p_data = (pngcore_ihdr_data_t *)malloc(sizeof(pngcore_ihdr_data_t));
+  ihdr->p_data = (pngcore_ihdr_data_t *)pngcore_malloc(sizeof(pngcore_ihdr_data_t));
   if (!ihdr->p_data) {
     free(ihdr);
     if (error) {
@@ -173,7 +234,7 @@ pngcore_ihdr_t* pngcore_parse_ihdr(pngcore_raw_chunk_t *raw_chunk, Error *error)
   
   /* Verify CRC */
   U32 total_len = 4 + raw_chunk->length;
-  U8 *crc_buf = (unsigned char *)malloc(total_len);
+  U8 *crc_buf = (unsigned char *)pngcore_malloc(total_len);
   if (crc_buf) {
     memcpy(crc_buf, raw_chunk->type, 4);
     memcpy(crc_buf + 4, raw_chunk->p_data, raw_chunk->length);
@@ -182,6 +243,7 @@ pngcore_ihdr_t* pngcore_parse_ihdr(pngcore_raw_chunk_t *raw_chunk, Error *error)
     free(crc_buf);
     
     if (computed_crc != ihdr->crc) {
+      PNGCORE_PROBE3(crc_mismatch, (const char *)raw_chunk->type, ihdr->crc, computed_crc);
       if (error) {
         error->code = ERR_CRC_MISMATCH;
         snprintf(error->message, sizeof(error->message),
@@ -212,7 +274,7 @@ pngcore_idat_t* pngcore_parse_idat(pngcore_raw_chunk_t *raw_chunk, Error *error)
     return NULL;
   }
   
-  pngcore_idat_t *idat = (pngcore_idat_t *)malloc(sizeof(pngcore_idat_t));
+  pngcore_idat_t *idat = (pngcore_idat_t *)pngcore_malloc(sizeof(pngcore_idat_t));
   if (!idat) {
     if (error) {
       error->code = ERR;
@@ -223,7 +285,7 @@ pngcore_idat_t* pngcore_parse_idat(pngcore_raw_chunk_t *raw_chunk, Error *error)
   
   /* Verify CRC first */
   U32 total_len = 4 + raw_chunk->length;
-  U8 *crc_buf = (unsigned char *)malloc(total_len);
+  U8 *crc_buf = (unsigned char *)pngcore_malloc(total_len);
   if (crc_buf) {
     memcpy(crc_buf, raw_chunk->type, 4);
     memcpy(crc_buf + 4, raw_chunk->p_data, raw_chunk->length);
@@ -232,6 +294,7 @@ pngcore_idat_t* pngcore_parse_idat(pngcore_raw_chunk_t *raw_chunk, Error *error)
     free(crc_buf);
     
     if (computed_crc != raw_chunk->crc) {
+      PNGCORE_PROBE3(crc_mismatch, (const char *)raw_chunk->type, raw_chunk->crc, computed_crc);
       if (error) {
         error->code = ERR_CRC_MISMATCH;
         snprintf(error->message, sizeof(error->message),
@@ -242,7 +305,7 @@ pngcore_idat_t* pngcore_parse_idat(pngcore_raw_chunk_t *raw_chunk, Error *error)
   }
   
   /* Copy data */
-  idat->p_data = (pngcore_idat_data_t *)malloc(sizeof(pngcore_idat_data_t));
+  idat->p_data = (pngcore_idat_data_t *)pngcore_malloc(sizeof(pngcore_idat_data_t));
   if (!idat->p_data) {
     free(idat);
     if (error) {
@@ -253,7 +316,7 @@ pngcore_idat_t* pngcore_parse_idat(pngcore_raw_chunk_t *raw_chunk, Error *error)
   }
   
   idat->p_data->length = raw_chunk->length;
-  idat->p_data->data = (U8 *)malloc(idat->p_data->length);
+  idat->p_data->data = (U8 *)pngcore_malloc(idat->p_data->length);
   if (!idat->p_data->data) {
     free(idat->p_data);
     free(idat);
@@ -265,7 +328,19 @@ pngcore_idat_t* pngcore_parse_idat(pngcore_raw_chunk_t *raw_chunk, Error *error)
   }
   
   memcpy(idat->p_data->data, raw_chunk->p_data, raw_chunk->length);
+  idat->p_data->payload = pngcore_payload_adopt(idat->p_data->data, idat->p_data->length);
+  if (!idat->p_data->payload) {
+    free(idat->p_data->data);
+    free(idat->p_data);
+    free(idat);
+    if (error) {
+      error->code = ERR;
+      snprintf(error->message, sizeof(error->message), "Failed to allocate IDAT buffer");
+    }
+    return NULL;
+  }
   idat->crc = raw_chunk->crc;
+  idat->bands = NULL;
   
   return idat;
 }
@@ -288,7 +363,7 @@ pngcore_iend_t* pngcore_parse_iend(pngcore_raw_chunk_t *raw_chunk, Error *error)
     return NULL;
   }
   
-  pngcore_iend_t *iend = (pngcore_iend_t *)malloc(sizeof(pngcore_iend_t));
+  pngcore_iend_t *iend = (pngcore_iend_t *)pngcore_malloc(sizeof(pngcore_iend_t));
   if (!iend) {
     if (error) {
       error->code = ERR;
@@ -307,13 +382,13 @@ pngcore_iend_t* pngcore_parse_iend(pngcore_raw_chunk_t *raw_chunk, Error *error)
 *****************************************************************************/
 
 pngcore_raw_chunk_t* pngcore_ihdr_to_raw(pngcore_ihdr_t *ihdr) {
-  pngcore_raw_chunk_t *raw_ch = (pngcore_raw_chunk_t *)malloc(sizeof(pngcore_raw_chunk_t));
+  pngcore_raw_chunk_t *raw_ch = (pngcore_raw_chunk_t *)pngcore_malloc(sizeof(pngcore_raw_chunk_t));
   if (!raw_ch) return NULL;
   
   raw_ch->length = DATA_IHDR_SIZE;
   memcpy(raw_ch->type, "IHDR", 4);
   
-  raw_ch->p_data = (U8 *)malloc(DATA_IHDR_SIZE);
+  raw_ch->p_data = (U8 *)pngcore_malloc(DATA_IHDR_SIZE);
   if (!raw_ch->p_data) {
     free(raw_ch);
     return NULL;
@@ -334,7 +409,7 @@ pngcore_raw_chunk_t* pngcore_ihdr_to_raw(pngcore_ihdr_t *ihdr) {
   
   /* Calculate CRC */
   U32 total_len = 4 + raw_ch->length;
-  U8 *crc_buf = (unsigned char *)malloc(total_len);
+  U8 *crc_buf = (unsigned char *)pngcore_malloc(total_len);
   if (crc_buf) {
     memcpy(crc_buf, raw_ch->type, 4);
     memcpy(crc_buf + 4, raw_ch->p_data, raw_ch->length);
@@ -346,13 +421,13 @@ pngcore_raw_chunk_t* pngcore_ihdr_to_raw(pngcore_ihdr_t *ihdr) {
 }
 
 pngcore_raw_chunk_t* pngcore_idat_to_raw(pngcore_idat_t *idat) {
-  pngcore_raw_chunk_t *raw_ch = (pngcore_raw_chunk_t *)malloc(sizeof(pngcore_raw_chunk_t));
+  pngcore_raw_chunk_t *raw_ch = (pngcore_raw_chunk_t *)pngcore_malloc(sizeof(pngcore_raw_chunk_t));
   if (!raw_ch) return NULL;
   
   raw_ch->length = idat->p_data->length;
   memcpy(raw_ch->type, "IDAT", 4);
   
-  raw_ch->p_data = (U8 *)malloc(idat->p_data->length);
+  raw_ch->p_data = (U8 *)pngcore_malloc(idat->p_data->length);
   if (!raw_ch->p_data) {
     free(raw_ch);
     return NULL;
@@ -360,21 +435,14 @@ pngcore_raw_chunk_t* pngcore_idat_to_raw(pngcore_idat_t *idat) {
   
   memcpy(raw_ch->p_data, idat->p_data->data, idat->p_data->length);
   
-  /* Calculate CRC */
-  U32 total_len = 4 + raw_ch->length;
-  U8 *crc_buf = (unsigned char *)malloc(total_len);
-  if (crc_buf) {
-    memcpy(crc_buf, raw_ch->type, 4);
-    memcpy(crc_buf + 4, raw_ch->p_data, raw_ch->length);
-    raw_ch->crc = pngcore_crc(crc_buf, total_len);
-    free(crc_buf);
-  }
+  /* The CRC is kept current whenever the data changes */
+  raw_ch->crc = idat->crc;
   
   return raw_ch;
 }
 
 pngcore_raw_chunk_t* pngcore_iend_to_raw(pngcore_iend_t *iend) {
-  pngcore_raw_chunk_t *raw_ch = (pngcore_raw_chunk_t *)malloc(sizeof(pngcore_raw_chunk_t));
+  pngcore_raw_chunk_t *raw_ch = (pngcore_raw_chunk_t *)pngcore_malloc(sizeof(pngcore_raw_chunk_t));
   if (!raw_ch) return NULL;
   
   raw_ch->length = 0;
@@ -396,7 +464,7 @@ pngcore_raw_png_t* pngcore_png_to_raw(pngcore_simple_png_t *png, Error *error) {
     return NULL;
   }
   
-  pngcore_raw_png_t *raw_png = (pngcore_raw_png_t *)malloc(sizeof(pngcore_raw_png_t));
+  pngcore_raw_png_t *raw_png = (pngcore_raw_png_t *)pngcore_malloc(sizeof(pngcore_raw_png_t));
   if (!raw_png) {
     if (error) {
       error->code = ERR;
@@ -408,6 +476,7 @@ pngcore_raw_png_t* pngcore_png_to_raw(pngcore_simple_png_t *png, Error *error) {
   raw_png->chunks[0] = pngcore_ihdr_to_raw(png->ihdr);
   raw_png->chunks[1] = pngcore_idat_to_raw(png->idat);
   raw_png->chunks[2] = pngcore_iend_to_raw(png->iend);
+  raw_png->extra = NULL;
   
   return raw_png;
 }
@@ -449,6 +518,16 @@ void pngcore_write_png_file(const char *filename, pngcore_simple_png_t *png, Err
   for (int i = 0; i < 3; i++) {
     pngcore_raw_chunk_t *chunk = raw_png->chunks[i];
     
+    /* The band table follows the image data it describes */
+    if (i == 2 && png->idat->bands) {
+      pngcore_idat_bands_write(png->idat->bands, png->idat->crc, fp);
+    }
+    
+    /* Other chunks go out byte for byte, before or after the image data */
+    if (i > 0) {
+      pngcore_chunk_list_write(png->extra, i == 2, fp);
+    }
+    
     /* Write length (big-endian) */
     U32 len_be = htonl(chunk->length);
     fwrite(&len_be, 1, 4, fp);
@@ -498,6 +577,77 @@ int pngcore_write_file(const char *path, const void *in, size_t len) {
   return fclose(fp);
 }
 
+int pngcore_open_temp(const char *path, char **tmp_path) {
+  static atomic_uint counter;
+  size_t len = strlen(path) + 32;
+  char *tmp = pngcore_malloc(len);
+  *tmp_path = NULL;
+  if (!tmp) return -1;
+
+  /* pid and counter keep names unique; O_EXCL skips ones left by dead processes */
+  for (int attempt = 0; attempt < 100; attempt++) {
+    snprintf(tmp, len, "%s.%ld.%u", path, (long)getpid(), atomic_fetch_add(&counter, 1));
+    int fd = open(tmp, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0666);
+    if (fd >= 0) {
+      *tmp_path = tmp;
+      return fd;
+    }
+    if (errno != EEXIST) break;
+  }
+  free(tmp);
+  return -1;
+}
+
+/******************************************************************************
+* IDAT PAYLOAD
+*****************************************************************************/
+
+int pngcore_idat_set_data(pngcore_idat_t *idat, U8 *data, U32 length) {
+  pngcore_payload_t *payload = pngcore_payload_adopt(data, length);
+  if (!payload) return -1;
+  pngcore_payload_release(idat->p_data->payload);
+  idat->p_data->payload = payload;
+  idat->p_data->data = data;
+  idat->p_data->length = length;
+  U64 start = pngcore_stats_now();
+  idat->crc = crc32(crc32(0, (U8 *)"IDAT", CHUNK_TYPE_SIZE), data, length);
+  pngcore_stats_add(PNGCORE_STAT_BYTES_CRC, CHUNK_TYPE_SIZE + (U64)length);
+  pngcore_stats_since(PNGCORE_STAT_CRC_NS, start);
+  pngcore_idat_bands_free(idat->bands);
+  idat->bands = NULL;
+  return 0;
+}
+
+U8* pngcore_idat_writable(pngcore_idat_t *idat, size_t size) {
+  pngcore_payload_t *payload = idat->p_data->payload;
+  if (payload && !pngcore_payload_shared(payload)) {
+    if (payload->size < size) {
+      U8 *grown = pngcore_realloc(payload->data, size);
+      if (!grown) return NULL;
+      payload->data = grown;
+      payload->size = size;
+      idat->p_data->data = grown;
+    }
+    return payload->data;
+  }
+
+  /* Copy on write: other holders keep the bytes they have */
+  size_t keep = idat->p_data->length < size ? idat->p_data->length : size;
+  U8 *copy = pngcore_malloc(size ? size : 1);
+  pngcore_payload_t *own = copy ? pngcore_payload_adopt(copy, size) : NULL;
+  if (!own) {
+    free(copy);
+    return NULL;
+  }
+  if (keep > 0) {
+    memcpy(copy, idat->p_data->data, keep);
+  }
+  pngcore_payload_release(payload);
+  idat->p_data->payload = own;
+  idat->p_data->data = copy;
+  return copy;
+}
+
 /******************************************************************************
 * COMPRESSION OPERATIONS
 *****************************************************************************/
@@ -517,8 +667,8 @@ ssize_t pngcore_inflate_idat(U8 *dest_buf, pngcore_raw_png_t *src_png) {
 }
 
 ssize_t pngcore_deflate_idat(U8 *src_buf, U64 src_len, pngcore_simple_png_t *dest_png) {
-  /* Compress data */
-  U8 *dest_buf = malloc(src_len);
+  /* Compress data; incompressible input can expand past src_len */
+  U8 *dest_buf = pngcore_malloc(compressBound(src_len));
   if (!dest_buf) {
     return -1;
   }
@@ -533,7 +683,7 @@ ssize_t pngcore_deflate_idat(U8 *src_buf, U64 src_len, pngcore_simple_png_t *des
   }
   
   /* Resize buffer to actual size */
-  U8 *tmp = realloc(dest_buf, dest_len);
+  U8 *tmp = pngcore_realloc(dest_buf, dest_len);
   if (!tmp && dest_len != 0) {
     free(dest_buf);
     return -1;
@@ -541,11 +691,10 @@ ssize_t pngcore_deflate_idat(U8 *src_buf, U64 src_len, pngcore_simple_png_t *des
   dest_buf = tmp;
   
   /* Set IDAT data */
-  if (dest_png->idat->p_data->data) {
-    free(dest_png->idat->p_data->data);
+  if (pngcore_idat_set_data(dest_png->idat, dest_buf, dest_len) != 0) {
+    free(dest_buf);
+    return -1;
   }
-  dest_png->idat->p_data->length = dest_len;
-  dest_png->idat->p_data->data = dest_buf;
   
   return dest_len;
 }
@@ -567,6 +716,7 @@ void pngcore_free_simple_png(pngcore_simple_png_t *png) {
   if (png->iend != NULL) {
     pngcore_free_iend(png->iend);
   }
+  pngcore_chunk_list_free(png->extra);
   free(png);
 }
 
@@ -585,11 +735,10 @@ void pngcore_free_idat(pngcore_idat_t *idat) {
     return;
   }
   if (idat->p_data != NULL) {
-    if (idat->p_data->data != NULL) {
-      free(idat->p_data->data);
-    }
+    pngcore_payload_release(idat->p_data->payload);
     free(idat->p_data);
   }
+  pngcore_idat_bands_free(idat->bands);
   free(idat);
 }
 
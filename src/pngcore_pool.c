@@ -0,0 +1,143 @@
+/**
+* @file pngcore_pool.c
+* @brief Worker thread pool used by the parallel image operations
+*/
+
+#include "pngcore/pngcore_pool.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static void* pool_worker(void *arg) {
+  pngcore_pool_t *pool = (pngcore_pool_t *)arg;
+
+  while (1) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->head == NULL && !pool->shutdown) {
+      pthread_cond_wait(&pool->work_cond, &pool->lock);
+    }
+    if (pool->head == NULL && pool->shutdown) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+
+    /* Dequeue in FIFO order */
+    pngcore_task_t *task = pool->head;
+    pool->head = task->next;
+    if (pool->head == NULL) {
+      pool->tail = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    task->fn(task->arg);
+    free(task);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending--;
+    if (pool->pending == 0) {
+      pthread_cond_broadcast(&pool->idle_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+int pngcore_pool_default_threads(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0) ? (int)n : 1;
+}
+
+pngcore_pool_t* pngcore_pool_create(int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = pngcore_pool_default_threads();
+  }
+
+  pngcore_pool_t *pool = pngcore_calloc(1, sizeof(pngcore_pool_t));
+  if (!pool) return NULL;
+
+  pool->threads = pngcore_calloc(num_threads, sizeof(pthread_t));
+  if (!pool->threads) {
+    free(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->idle_cond, NULL);
+
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0) {
+      perror("pthread_create");
+      break;
+    }
+    pool->num_threads++;
+  }
+
+  if (pool->num_threads == 0) {
+    pngcore_pool_destroy(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+int pngcore_pool_submit(pngcore_pool_t *pool, pngcore_task_fn fn, void *arg) {
+  if (!pool || !fn) return -1;
+
+  pngcore_task_t *task = pngcore_malloc(sizeof(pngcore_task_t));
+  if (!task) return -1;
+  task->fn = fn;
+  task->arg = arg;
+  task->next = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->tail) {
+    pool->tail->next = task;
+  } else {
+    pool->head = task;
+  }
+  pool->tail = task;
+  pool->pending++;
+  pthread_cond_signal(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  return 0;
+}
+
+void pngcore_pool_wait(pngcore_pool_t *pool) {
+  if (!pool) return;
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0) {
+    pthread_cond_wait(&pool->idle_cond, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void pngcore_pool_destroy(pngcore_pool_t *pool) {
+  if (!pool) return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->num_threads; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  /* Drop anything still queued */
+  while (pool->head) {
+    pngcore_task_t *next = pool->head->next;
+    free(pool->head);
+    pool->head = next;
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_cond_destroy(&pool->idle_cond);
+  free(pool->threads);
+  free(pool);
+}
@@ -4,9 +4,13 @@
 */
 
 #include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_crc.h"
+#include "pngcore/pngcore_stats.h"
+#include "pngcore/pngcore_probes.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <zlib.h>
 
 int pngcore_is_png_buf(U8 *buf, size_t buf_size, size_t offset) {
   if (buf == NULL || offset + PNG_SIG_SIZE > buf_size) {
@@ -15,6 +19,122 @@ int pngcore_is_png_buf(U8 *buf, size_t buf_size, size_t offset) {
   return is_png(buf + offset, PNG_SIG_SIZE);
 }
 
+/* CRC of the chunk type and data, computed without copying */
+static U32 chunk_crc(const pngcore_raw_chunk_t *chunk) {
+  return (U32)pngcore_chunk_crc(chunk->type, chunk->p_data, chunk->length);
+}
+
+/**
+* @brief Append every IDAT chunk following `offset` to `idat`
+*
+* Each part is CRC-checked as it is read and the CRC of the merged chunk is
+* built with crc32_combine, so the merged chunk validates like a single IDAT.
+* A mismatch in any part is carried into the merged CRC so that IDAT parsing
+* reports it. Returns the offset of the first chunk after the run, or 0 on
+* error.
+*/
+static size_t merge_idat_chunks(pngcore_raw_chunk_t *idat, U8 *buf, size_t buf_size,
+                                size_t offset, Error *error) {
+  if (offset + CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE > buf_size ||
+      memcmp(buf + offset + CHUNK_LEN_SIZE, "IDAT", 4) != 0) {
+    return offset;
+  }
+  
+  U32 merged_crc = chunk_crc(idat);
+  int crc_ok = (merged_crc == idat->crc);
+  
+  while (offset + CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE <= buf_size &&
+  memcmp(buf + offset + CHUNK_LEN_SIZE, "IDAT", 4) == 0) {
+    pngcore_raw_chunk_t *part = pngcore_load_raw_chunk(buf, buf_size, offset, error);
+    if (part == NULL) {
+      return 0;
+    }
+    
+    U64 start = pngcore_stats_now();
+    U32 data_crc = (U32)(pngcore_update_crc(0xffffffffL, part->p_data, part->length) ^
+                         0xffffffffL);
+    U32 type_crc = (U32)(pngcore_update_crc(0xffffffffL, part->type, CHUNK_TYPE_SIZE) ^
+                         0xffffffffL);
+    U32 part_crc = (U32)crc32_combine(type_crc, data_crc, part->length);
+    pngcore_stats_since(PNGCORE_STAT_CRC_NS, start);
+    if (part_crc != part->crc) {
+      PNGCORE_PROBE3(crc_mismatch, (const char *)part->type, part->crc, part_crc);
+      crc_ok = 0;
+    }
+    merged_crc = crc32_combine(merged_crc, data_crc, part->length);
+    
+    if (part->length > 0) {
+      U8 *grown = pngcore_realloc(idat->p_data, (size_t)idat->length + part->length);
+      if (grown == NULL) {
+        if (error) {
+          error->code = ERR;
+          snprintf(error->message, sizeof(error->message), "Failed to grow IDAT buffer");
+        }
+        pngcore_free_raw_chunk(part);
+        return 0;
+      }
+      memcpy(grown + idat->length, part->p_data, part->length);
+      idat->p_data = grown;
+      idat->length += part->length;
+    }
+    
+    offset += CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + part->length + CHUNK_CRC_SIZE;
+    pngcore_free_raw_chunk(part);
+  }
+  
+  idat->crc = crc_ok ? merged_crc : ~merged_crc;
+  return offset;
+}
+
+/**
+* @brief Walk the chunks before the next IDAT or IEND
+*
+* Animation chunks are left to the APNG decoder. PLTE and ancillary chunks
+* are copied into the chunk list as they are, without checking their CRC or
+* looking inside. Unknown critical chunks are an error. Returns the offset
+* of the next IDAT or IEND, or 0 on error.
+*/
+static size_t collect_chunks(U8 *buf, size_t buf_size, size_t offset,
+                             pngcore_raw_png_t *raw_png, U8 after_idat, Error *error) {
+  while (offset + CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE <= buf_size) {
+    const U8 *type = buf + offset + CHUNK_LEN_SIZE;
+    if (memcmp(type, "IDAT", 4) == 0 || memcmp(type, "IEND", 4) == 0) {
+      break;
+    }
+
+    size_t length = from_be_buffer(buf + offset);
+    if (length > buf_size - offset - CHUNK_LEN_SIZE - CHUNK_TYPE_SIZE ||
+        buf_size - offset - CHUNK_LEN_SIZE - CHUNK_TYPE_SIZE - length < CHUNK_CRC_SIZE) {
+      if (error) {
+        error->code = ERR;
+        snprintf(error->message, sizeof(error->message), "Buffer too small for chunk data and CRC");
+      }
+      return 0;
+    }
+
+    if (memcmp(type, "acTL", 4) == 0 || memcmp(type, "fcTL", 4) == 0 ||
+        memcmp(type, "fdAT", 4) == 0) {
+      /* skipped */
+    } else if ((type[0] & 0x20) || memcmp(type, "PLTE", 4) == 0) {
+      if (pngcore_chunk_list_add(&raw_png->extra, buf + offset, after_idat) != 0) {
+        if (error) {
+          error->code = ERR;
+          snprintf(error->message, sizeof(error->message), "Failed to record %.4s chunk", type);
+        }
+        return 0;
+      }
+    } else {
+      if (error) {
+        error->code = ERR_WRONG_CHUNK;
+        snprintf(error->message, sizeof(error->message), "Unsupported critical chunk %.4s", type);
+      }
+      return 0;
+    }
+    offset += CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + length + CHUNK_CRC_SIZE;
+  }
+  return offset;
+}
+
 pngcore_raw_png_t* pngcore_load_raw_png(U8 *buf, size_t buf_size, size_t offset, Error* error) {
   if (buf == NULL) {
     if (error) {
@@ -23,9 +143,10 @@ pngcore_raw_png_t* pngcore_load_raw_png(U8 *buf, size_t buf_size, size_t offset,
     }
     return NULL;
   }
+  U64 start = pngcore_stats_now();
   
   /* Allocate memory for raw_PNG struct */
-  pngcore_raw_png_t *raw_png = (pngcore_raw_png_t *)malloc(sizeof(pngcore_raw_png_t));
+  pngcore_raw_png_t *raw_png = (pngcore_raw_png_t *)pngcore_malloc(sizeof(pngcore_raw_png_t));
   if (!raw_png) {
     if (error) {
       error->code = ERR;
@@ -33,6 +154,7 @@ pngcore_raw_png_t* pngcore_load_raw_png(U8 *buf, size_t buf_size, size_t offset,
     }
     return NULL;
   }
+  raw_png->extra = NULL;
   
   if (offset + PNG_SIG_SIZE > buf_size) {
     if (error) {
@@ -55,7 +177,10 @@ pngcore_raw_png_t* pngcore_load_raw_png(U8 *buf, size_t buf_size, size_t offset,
   /* Load chunks starting after PNG signature */
   size_t i_offset = offset + PNG_SIG_SIZE;
   for (int i = 0; i < 3; i++) {
-    raw_png->chunks[i] = pngcore_load_raw_chunk(buf, buf_size, i_offset, error);
+    if (i > 0) {
+      i_offset = collect_chunks(buf, buf_size, i_offset, raw_png, i == 2, error);
+    }
+    raw_png->chunks[i] = i_offset ? pngcore_load_raw_chunk(buf, buf_size, i_offset, error) : NULL;
     if (raw_png->chunks[i] == NULL) {
       if (error && error->code == SUCCESS) {
         error->code = ERR;
@@ -65,6 +190,7 @@ pngcore_raw_png_t* pngcore_load_raw_png(U8 *buf, size_t buf_size, size_t offset,
       for (int j = 0; j < i; j++) {
         pngcore_free_raw_chunk(raw_png->chunks[j]);
       }
+      pngcore_chunk_list_free(raw_png->extra);
       free(raw_png);
       return NULL;
     }
@@ -73,8 +199,22 @@ pngcore_raw_png_t* pngcore_load_raw_png(U8 *buf, size_t buf_size, size_t offset,
     size_t chunk_size = CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + 
     raw_png->chunks[i]->length + CHUNK_CRC_SIZE;
     i_offset += chunk_size;
+    
+    /* Image data may be split across consecutive IDAT chunks */
+    if (i == 1 && memcmp(raw_png->chunks[1]->type, "IDAT", 4) == 0) {
+      i_offset = merge_idat_chunks(raw_png->chunks[1], buf, buf_size, i_offset, error);
+      if (i_offset == 0) {
+        pngcore_free_raw_chunk(raw_png->chunks[0]);
+        pngcore_free_raw_chunk(raw_png->chunks[1]);
+        pngcore_chunk_list_free(raw_png->extra);
+        free(raw_png);
+        return NULL;
+      }
+    }
   }
   
+  pngcore_stats_add(PNGCORE_STAT_BYTES_PARSED, i_offset - offset);
+  pngcore_stats_since(PNGCORE_STAT_PARSE_NS, start);
   return raw_png;
 }
 
@@ -96,7 +236,7 @@ pngcore_raw_chunk_t* pngcore_load_raw_chunk(U8 *buf, size_t buf_size, size_t off
     return NULL;
   }
   
-  pngcore_raw_chunk_t *raw_ch = (pngcore_raw_chunk_t *)malloc(sizeof(pngcore_raw_chunk_t));
+  pngcore_raw_chunk_t *raw_ch = (pngcore_raw_chunk_t *)pngcore_malloc(sizeof(pngcore_raw_chunk_t));
   if (raw_ch == NULL) {
     if (error) {
       error->code = ERR;
@@ -127,7 +267,7 @@ pngcore_raw_chunk_t* pngcore_load_raw_chunk(U8 *buf, size_t buf_size, size_t off
   
   /* Read data */
   if (raw_ch->length > 0) {
-    raw_ch->p_data = (U8 *)malloc(raw_ch->length);
+    raw_ch->p_data = (U8 *)pngcore_malloc(raw_ch->length);
     if (raw_ch->p_data == NULL) {
       if (error) {
         error->code = ERR;
@@ -145,6 +285,7 @@ pngcore_raw_chunk_t* pngcore_load_raw_chunk(U8 *buf, size_t buf_size, size_t off
   /* Read CRC (4 bytes, big-endian) */
   raw_ch->crc = from_be_buffer(buf + current_offset);
   
+  PNGCORE_PROBE3(chunk_parse, (const char *)raw_ch->type, raw_ch->length, offset);
   return raw_ch;
 }
 
@@ -157,6 +298,7 @@ void pngcore_free_raw_png(pngcore_raw_png_t *raw_png) {
       pngcore_free_raw_chunk(raw_png->chunks[i]);
     }
   }
+  pngcore_chunk_list_free(raw_png->extra);
   free(raw_png);
 }
 
@@ -0,0 +1,468 @@
+/**
+* @file pngcore_resize.c
+* @brief Streaming separable image resampling (box, bilinear, Lanczos)
+*/
+
+#include "pngcore/pngcore_resize.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_stream.h"
+#include "pngcore/pngcore_convert.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PNGCORE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/******************************************************************************
+* FILTER KERNELS
+*****************************************************************************/
+
+static double box_kernel(double x) {
+  return (x >= -0.5 && x < 0.5) ? 1.0 : 0.0;
+}
+
+static double bilinear_kernel(double x) {
+  if (x < 0.0) x = -x;
+  return (x < 1.0) ? 1.0 - x : 0.0;
+}
+
+static double sinc(double x) {
+  if (x == 0.0) return 1.0;
+  x *= M_PI;
+  return sin(x) / x;
+}
+
+static double lanczos3_kernel(double x) {
+  return (x > -3.0 && x < 3.0) ? sinc(x) * sinc(x / 3.0) : 0.0;
+}
+
+/******************************************************************************
+* COEFFICIENT TABLES
+*****************************************************************************/
+
+static void free_coeffs(pngcore_resize_coeffs_t *c) {
+  free(c->start);
+  free(c->count);
+  free(c->weights);
+  memset(c, 0, sizeof(*c));
+}
+
+/* Taps for mapping in_size samples onto out_size. When shrinking, the kernel
+* is stretched by the scale factor so every source sample contributes */
+static int build_coeffs(pngcore_resize_coeffs_t *c, U32 in_size, U32 out_size,
+                        pngcore_resize_filter_t filter) {
+  double (*kernel)(double);
+  double support;
+  switch (filter) {
+    case PNGCORE_RESIZE_BOX:      kernel = box_kernel;      support = 0.5; break;
+    case PNGCORE_RESIZE_BILINEAR: kernel = bilinear_kernel; support = 1.0; break;
+    case PNGCORE_RESIZE_LANCZOS3: kernel = lanczos3_kernel; support = 3.0; break;
+    default: return -1;
+  }
+
+  double scale = (double)in_size / out_size;
+  double filter_scale = scale > 1.0 ? scale : 1.0;
+  support *= filter_scale;
+
+  c->taps = (U32)ceil(support) * 2 + 1;
+  c->start = pngcore_malloc(out_size * sizeof(U32));
+  c->count = pngcore_malloc(out_size * sizeof(U32));
+  c->weights = pngcore_calloc((size_t)out_size * c->taps, sizeof(float));
+  if (!c->start || !c->count || !c->weights) {
+    free_coeffs(c);
+    return -1;
+  }
+
+  for (U32 i = 0; i < out_size; i++) {
+    double center = (i + 0.5) * scale;
+    long lo = (long)(center - support + 0.5);
+    long hi = (long)(center + support + 0.5);
+    if (lo < 0) lo = 0;
+    if (hi > (long)in_size) hi = in_size;
+    if (hi - lo > (long)c->taps) hi = lo + c->taps;
+
+    float *w = c->weights + (size_t)i * c->taps;
+    double sum = 0.0;
+    for (long x = lo; x < hi; x++) {
+      double v = kernel((x - center + 0.5) / filter_scale);
+      w[x - lo] = (float)v;
+      sum += v;
+    }
+
+    if (hi <= lo || sum == 0.0) {
+      /* Degenerate window: take the nearest sample */
+      lo = (long)center;
+      if (lo >= (long)in_size) lo = in_size - 1;
+      hi = lo + 1;
+      w[0] = 1.0f;
+      sum = 1.0;
+    }
+    for (long x = lo; x < hi; x++) {
+      w[x - lo] = (float)(w[x - lo] / sum);
+    }
+
+    c->start[i] = (U32)lo;
+    c->count[i] = (U32)(hi - lo);
+  }
+
+  return 0;
+}
+
+/******************************************************************************
+* RESAMPLING KERNELS
+*****************************************************************************/
+
+static void samples_to_float(const U8 *src, float *dst, size_t n, int sample_bytes) {
+  if (sample_bytes == 1) {
+    for (size_t i = 0; i < n; i++) dst[i] = src[i];
+  } else {
+    for (size_t i = 0; i < n; i++) dst[i] = (float)((src[2 * i] << 8) | src[2 * i + 1]);
+  }
+}
+
+static void float_to_samples(const float *src, U8 *dst, size_t n, int sample_bytes) {
+  float max = (sample_bytes == 1) ? 255.0f : 65535.0f;
+  for (size_t i = 0; i < n; i++) {
+    float v = src[i] + 0.5f;
+    if (v < 0.0f) v = 0.0f;
+    if (v > max) v = max;
+    U32 s = (U32)v;
+    if (sample_bytes == 1) {
+      dst[i] = (U8)s;
+    } else {
+      dst[2 * i] = (U8)(s >> 8);
+      dst[2 * i + 1] = (U8)s;
+    }
+  }
+}
+
+static void horizontal_scalar(const pngcore_resize_coeffs_t *hc, const float *in,
+                              float *out, U32 out_w, int channels) {
+  for (U32 x = 0; x < out_w; x++) {
+    const float *w = hc->weights + (size_t)x * hc->taps;
+    const float *p = in + (size_t)hc->start[x] * channels;
+    for (int c = 0; c < channels; c++) {
+      float acc = 0.0f;
+      for (U32 k = 0; k < hc->count[x]; k++) {
+        acc += w[k] * p[k * channels + c];
+      }
+      out[(size_t)x * channels + c] = acc;
+    }
+  }
+}
+
+static void vertical_scalar(const float *const *rows, const float *w, U32 count,
+                            float *out, size_t n) {
+  memset(out, 0, n * sizeof(float));
+  for (U32 k = 0; k < count; k++) {
+    const float *r = rows[k];
+    float wk = w[k];
+    for (size_t i = 0; i < n; i++) {
+      out[i] += wk * r[i];
+    }
+  }
+}
+
+#ifdef PNGCORE_X86_SIMD
+
+static int has_avx2_fma = -1;
+
+static int detect_avx2_fma(void) {
+  if (has_avx2_fma < 0) {
+    __builtin_cpu_init();
+    has_avx2_fma = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  }
+  return has_avx2_fma;
+}
+
+/* Four-channel pixels fit one SSE register: one multiply-add per tap */
+static void horizontal_sse4ch(const pngcore_resize_coeffs_t *hc, const float *in,
+                              float *out, U32 out_w) {
+  for (U32 x = 0; x < out_w; x++) {
+    const float *w = hc->weights + (size_t)x * hc->taps;
+    const float *p = in + (size_t)hc->start[x] * 4;
+    __m128 acc = _mm_setzero_ps();
+    for (U32 k = 0; k < hc->count[x]; k++) {
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(p + k * 4)));
+    }
+    _mm_storeu_ps(out + (size_t)x * 4, acc);
+  }
+}
+
+/* Vertical taps are contiguous rows: eight lanes per fused multiply-add */
+__attribute__((target("avx2,fma")))
+static void vertical_avx2(const float *const *rows, const float *w, U32 count,
+                          float *out, size_t n) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256 a0 = _mm256_setzero_ps();
+    __m256 a1 = _mm256_setzero_ps();
+    __m256 a2 = _mm256_setzero_ps();
+    __m256 a3 = _mm256_setzero_ps();
+    for (U32 k = 0; k < count; k++) {
+      __m256 wk = _mm256_set1_ps(w[k]);
+      const float *r = rows[k] + i;
+      a0 = _mm256_fmadd_ps(wk, _mm256_loadu_ps(r), a0);
+      a1 = _mm256_fmadd_ps(wk, _mm256_loadu_ps(r + 8), a1);
+      a2 = _mm256_fmadd_ps(wk, _mm256_loadu_ps(r + 16), a2);
+      a3 = _mm256_fmadd_ps(wk, _mm256_loadu_ps(r + 24), a3);
+    }
+    _mm256_storeu_ps(out + i, a0);
+    _mm256_storeu_ps(out + i + 8, a1);
+    _mm256_storeu_ps(out + i + 16, a2);
+    _mm256_storeu_ps(out + i + 24, a3);
+  }
+  for (; i + 8 <= n; i += 8) {
+    __m256 acc = _mm256_setzero_ps();
+    for (U32 k = 0; k < count; k++) {
+      acc = _mm256_fmadd_ps(_mm256_set1_ps(w[k]), _mm256_loadu_ps(rows[k] + i), acc);
+    }
+    _mm256_storeu_ps(out + i, acc);
+  }
+  for (; i < n; i++) {
+    float acc = 0.0f;
+    for (U32 k = 0; k < count; k++) {
+      acc += w[k] * rows[k][i];
+    }
+    out[i] = acc;
+  }
+}
+
+#endif /* PNGCORE_X86_SIMD */
+
+/******************************************************************************
+* PARALLEL PASSES
+*****************************************************************************/
+
+/* Resample batch rows [begin, end) horizontally into the ring */
+static void horizontal_task(void *arg) {
+  pngcore_resize_task_t *task = (pngcore_resize_task_t *)arg;
+  pngcore_resize_t *ctx = task->ctx;
+  float *in = ctx->scratch[task->index];
+
+  for (U32 r = task->begin; r < task->end; r++) {
+    U32 src_y = ctx->batch_first + r;
+    float *out = ctx->ring + (size_t)(src_y % ctx->ring_rows) * ctx->ring_stride;
+    samples_to_float(ctx->batch + (size_t)r * ctx->in_row_bytes, in,
+                     (size_t)ctx->in_w * ctx->channels, ctx->sample_bytes);
+#ifdef PNGCORE_X86_SIMD
+    if (ctx->channels == 4) {
+      horizontal_sse4ch(&ctx->hc, in, out, ctx->out_w);
+      continue;
+    }
+#endif
+    horizontal_scalar(&ctx->hc, in, out, ctx->out_w, ctx->channels);
+  }
+}
+
+/* Resample band rows [begin, end) vertically from the ring */
+static void vertical_task(void *arg) {
+  pngcore_resize_task_t *task = (pngcore_resize_task_t *)arg;
+  pngcore_resize_t *ctx = task->ctx;
+  float *acc = ctx->scratch[task->index];
+  const float *rows[ctx->vc.taps];
+
+  for (U32 r = task->begin; r < task->end; r++) {
+    U32 y = ctx->band_first + r;
+    U32 start = ctx->vc.start[y];
+    U32 count = ctx->vc.count[y];
+    const float *w = ctx->vc.weights + (size_t)y * ctx->vc.taps;
+    for (U32 k = 0; k < count; k++) {
+      rows[k] = ctx->ring + (size_t)((start + k) % ctx->ring_rows) * ctx->ring_stride;
+    }
+
+#ifdef PNGCORE_X86_SIMD
+    if (detect_avx2_fma()) {
+      vertical_avx2(rows, w, count, acc, ctx->ring_stride);
+    } else
+#endif
+    vertical_scalar(rows, w, count, acc, ctx->ring_stride);
+
+    float_to_samples(acc, ctx->band + (size_t)r * ctx->out_row_bytes,
+                     ctx->ring_stride, ctx->sample_bytes);
+  }
+}
+
+/* Split [0, n) across the pool and wait */
+static void run_parallel(pngcore_resize_t *ctx, pngcore_task_fn fn, U32 n) {
+  int tasks = ctx->pool->num_threads;
+  pngcore_resize_task_t slices[tasks];
+  U32 per = (n + tasks - 1) / tasks;
+
+  for (int t = 0; t < tasks; t++) {
+    slices[t].ctx = ctx;
+    slices[t].index = t;
+    slices[t].begin = t * per < n ? t * per : n;
+    slices[t].end = (t + 1) * per < n ? (t + 1) * per : n;
+    if (slices[t].begin == slices[t].end) continue;
+    if (pngcore_pool_submit(ctx->pool, fn, &slices[t]) != 0) {
+      fn(&slices[t]);
+    }
+  }
+  pngcore_pool_wait(ctx->pool);
+}
+
+/******************************************************************************
+* PUBLIC API
+*****************************************************************************/
+
+static void resize_cleanup(pngcore_resize_t *ctx) {
+  free_coeffs(&ctx->hc);
+  free_coeffs(&ctx->vc);
+  free(ctx->batch);
+  free(ctx->ring);
+  free(ctx->band);
+  if (ctx->scratch) {
+    for (int t = 0; ctx->pool && t < ctx->pool->num_threads; t++) {
+      free(ctx->scratch[t]);
+    }
+    free(ctx->scratch);
+  }
+  pngcore_pool_destroy(ctx->pool);
+}
+
+int pngcore_resize(const pngcore_png_t *png, uint32_t out_w, uint32_t out_h,
+                   pngcore_resize_filter_t filter, const char *filename,
+                   pngcore_error_t *error) {
+  if (!png || !png->internal || !png->internal->ihdr || !filename ||
+      out_w == 0 || out_h == 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid PNG, size or filename");
+    return -1;
+  }
+
+  pngcore_ihdr_data_t *ihdr = png->internal->ihdr->p_data;
+
+  /* A gray key cannot follow sub-byte gray to 8 bits, so it becomes alpha */
+  U8 out_depth = ihdr->bit_depth < 8 ? 8 : ihdr->bit_depth;
+  U8 out_type = ihdr->color_type;
+  int key_to_alpha = out_depth != ihdr->bit_depth &&
+                     pngcore_chunk_list_find(png->internal->extra, "tRNS", 0, NULL) != NULL;
+  if (key_to_alpha && out_type == PNGCORE_COLOR_GRAYSCALE) {
+    out_type = PNGCORE_COLOR_GRAYSCALE_ALPHA;
+  }
+
+  /* Alpha is resampled premultiplied so transparent pixels don't bleed */
+  pngcore_pixel_format_t work_fmt;
+  if (ihdr->color_type == PNGCORE_COLOR_INDEXED ||
+      pngcore_format_from_png(out_depth, out_type, &work_fmt) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED,
+    "Resizing depth %u type %u is not supported", ihdr->bit_depth, ihdr->color_type);
+    return -1;
+  }
+  if (work_fmt == PNGCORE_FMT_RGBA8) work_fmt = PNGCORE_FMT_RGBA8_PREMUL;
+  if (work_fmt == PNGCORE_FMT_RGBA16) work_fmt = PNGCORE_FMT_RGBA16_PREMUL;
+  if (work_fmt == PNGCORE_FMT_GRAY_ALPHA8) work_fmt = PNGCORE_FMT_GRAY_ALPHA8_PREMUL;
+  if (work_fmt == PNGCORE_FMT_GRAY_ALPHA16) work_fmt = PNGCORE_FMT_GRAY_ALPHA16_PREMUL;
+
+  pngcore_resize_t ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.in_w = ihdr->width;
+  ctx.in_h = ihdr->height;
+  ctx.out_w = out_w;
+  ctx.out_h = out_h;
+  ctx.channels = pngcore_format_desc(work_fmt)->channels;
+  ctx.sample_bytes = pngcore_format_desc(work_fmt)->sample_bytes;
+
+  pngcore_row_reader_t *reader = NULL;
+  pngcore_row_writer_t *writer = NULL;
+  int rc = -1;
+
+  if (build_coeffs(&ctx.hc, ctx.in_w, out_w, filter) != 0 ||
+      build_coeffs(&ctx.vc, ctx.in_h, out_h, filter) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid filter or out of memory");
+    goto cleanup;
+  }
+
+  reader = pngcore_row_reader_create(png, error);
+  if (!reader) goto cleanup;
+  writer = pngcore_row_writer_create(filename, out_w, out_h, out_depth, out_type, error);
+  if (!writer) goto cleanup;
+  if (key_to_alpha ? pngcore_row_reader_load_palette(reader, png, error) != 0
+                   : pngcore_row_writer_copy_palette(writer, png, error) != 0) {
+    goto cleanup;
+  }
+  if (pngcore_row_reader_set_format(reader, work_fmt) != 0 ||
+      pngcore_row_writer_set_format(writer, work_fmt) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Failed to set working pixel format");
+    goto cleanup;
+  }
+
+  ctx.pool = pngcore_pool_create(0);
+  if (!ctx.pool) {
+    pngcore_error_set(error, PNGCORE_ERR, "Failed to start resize threads");
+    goto cleanup;
+  }
+
+  /* The ring holds one batch plus the widest vertical window */
+  ctx.in_row_bytes = pngcore_row_reader_row_bytes(reader);
+  ctx.out_row_bytes = (size_t)out_w * ctx.channels * ctx.sample_bytes;
+  ctx.ring_rows = PNGCORE_RESIZE_BATCH_ROWS + ctx.vc.taps;
+  ctx.ring_stride = (size_t)out_w * ctx.channels;
+  size_t scratch_len = (size_t)(ctx.in_w > out_w ? ctx.in_w : out_w) * ctx.channels;
+
+  ctx.batch = pngcore_malloc(ctx.in_row_bytes * PNGCORE_RESIZE_BATCH_ROWS);
+  ctx.ring = pngcore_malloc(ctx.ring_rows * ctx.ring_stride * sizeof(float));
+  ctx.band = pngcore_malloc(ctx.out_row_bytes * PNGCORE_RESIZE_BAND_ROWS);
+  ctx.scratch = pngcore_calloc(ctx.pool->num_threads, sizeof(float *));
+  int scratch_ok = (ctx.scratch != NULL);
+  for (int t = 0; scratch_ok && t < ctx.pool->num_threads; t++) {
+    ctx.scratch[t] = pngcore_malloc(scratch_len * sizeof(float));
+    scratch_ok = (ctx.scratch[t] != NULL);
+  }
+  if (!ctx.batch || !ctx.ring || !ctx.band || !scratch_ok) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate resize buffers");
+    goto cleanup;
+  }
+
+  U32 next_in = 0;
+  U32 next_out = 0;
+  while (next_out < out_h) {
+    /* Decode a batch, then resample it horizontally in parallel */
+    if (next_in < ctx.in_h) {
+      U32 n = ctx.in_h - next_in;
+      if (n > PNGCORE_RESIZE_BATCH_ROWS) n = PNGCORE_RESIZE_BATCH_ROWS;
+      for (U32 r = 0; r < n; r++) {
+        const uint8_t *row = NULL;
+        if (pngcore_row_reader_next(reader, &row) != 1) {
+          pngcore_error_set(error, PNGCORE_ERR, "Failed to decode row %u", next_in + r);
+          goto cleanup;
+        }
+        memcpy(ctx.batch + (size_t)r * ctx.in_row_bytes, row, ctx.in_row_bytes);
+      }
+      ctx.batch_first = next_in;
+      run_parallel(&ctx, horizontal_task, n);
+      next_in += n;
+    }
+
+    /* Emit every output row whose vertical window is now complete */
+    while (next_out < out_h &&
+           ctx.vc.start[next_out] + ctx.vc.count[next_out] <= next_in) {
+      U32 n = 0;
+      while (n < PNGCORE_RESIZE_BAND_ROWS && next_out + n < out_h &&
+             ctx.vc.start[next_out + n] + ctx.vc.count[next_out + n] <= next_in) {
+        n++;
+      }
+      ctx.band_first = next_out;
+      run_parallel(&ctx, vertical_task, n);
+      for (U32 r = 0; r < n; r++) {
+        if (pngcore_row_writer_write(writer, ctx.band + (size_t)r * ctx.out_row_bytes) != 0) {
+          pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to encode row %u", next_out + r);
+          goto cleanup;
+        }
+      }
+      next_out += n;
+    }
+  }
+
+  rc = pngcore_row_writer_finish(writer, error);
+
+cleanup:
+  pngcore_row_writer_destroy(writer);
+  pngcore_row_reader_destroy(reader);
+  resize_cleanup(&ctx);
+  return rc;
+}
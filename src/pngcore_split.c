@@ -0,0 +1,186 @@
+/**
+* @file pngcore_split.c
+* @brief Split one PNG into strips or tiles encoded in parallel
+*/
+
+#include "pngcore/pngcore_split.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_filter.h"
+#include "pngcore/pngcore_pool.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/******************************************************************************
+* TILE ENCODING
+*****************************************************************************/
+
+static void tile_task(void *arg) {
+  pngcore_split_tile_t *tile = (pngcore_split_tile_t *)arg;
+  tile->rc = -1;
+
+  pngcore_row_writer_t *writer = pngcore_row_writer_open(pngcore_mem_sink, &tile->out,
+                                                         tile->width, tile->height,
+                                                         tile->bit_depth, tile->color_type,
+                                                         Z_DEFAULT_COMPRESSION, &tile->error);
+  if (!writer) return;
+  if (pngcore_row_writer_copy_palette(writer, tile->src, &tile->error) != 0) {
+    pngcore_row_writer_destroy(writer);
+    return;
+  }
+
+  /* Sub-byte pixels off a byte boundary are shifted into a scratch row */
+  size_t pixel_bits = pngcore_pixel_bits(tile->bit_depth, tile->color_type);
+  U8 *out_row = NULL;
+  if (((size_t)tile->x * pixel_bits) % 8 != 0) {
+    out_row = pngcore_malloc(writer->row_bytes);
+    if (!out_row) {
+      pngcore_error_set(&tile->error, PNGCORE_ERR_MEMORY, "Failed to allocate tile scanline");
+      pngcore_row_writer_destroy(writer);
+      return;
+    }
+  }
+
+  int rc = 0;
+  for (U32 r = 0; r < tile->height; r++) {
+    const U8 *row = tile->band + (size_t)r * tile->band_stride;
+    if (out_row) {
+      pngcore_copy_pixels(out_row, 0, row, tile->x, tile->width, pixel_bits);
+      row = out_row;
+    } else {
+      row += (size_t)tile->x * pixel_bits / 8;
+    }
+    if (pngcore_row_writer_write(writer, row) != 0) {
+      pngcore_error_set(&tile->error, PNGCORE_ERR_IO, "Failed to encode tile row %u", r);
+      rc = -1;
+      break;
+    }
+  }
+
+  if (rc == 0) {
+    rc = pngcore_row_writer_finish(writer, &tile->error);
+  }
+  tile->rc = rc;
+
+  free(out_row);
+  pngcore_row_writer_destroy(writer);
+}
+
+/******************************************************************************
+* PUBLIC API
+*****************************************************************************/
+
+int pngcore_split(const pngcore_png_t *png, const pngcore_split_grid_t *grid,
+                  pngcore_split_fn callback, void *ctx, pngcore_error_t *error) {
+  if (!png || !png->internal || !png->internal->ihdr || !grid || !callback) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid PNG, grid or callback");
+    return -1;
+  }
+
+  pngcore_ihdr_data_t *ihdr = png->internal->ihdr->p_data;
+  U32 tw = (grid->tile_width && grid->tile_width < ihdr->width) ? grid->tile_width : ihdr->width;
+  U32 th = (grid->tile_height && grid->tile_height < ihdr->height) ? grid->tile_height : ihdr->height;
+  U32 cols = (ihdr->width + tw - 1) / tw;
+  U32 rows = (ihdr->height + th - 1) / th;
+
+  pngcore_row_reader_t *reader = pngcore_row_reader_create(png, error);
+  if (!reader) return -1;
+
+  size_t row_bytes = pngcore_row_reader_row_bytes(reader);
+  pngcore_pool_t *pool = pngcore_pool_create(0);
+  U8 *bands[2] = { pngcore_malloc(row_bytes * th), pngcore_malloc(row_bytes * th) };
+  pngcore_split_tile_t *tiles = pngcore_calloc(cols, sizeof(*tiles));
+  int rc = 0;
+
+  if (!pool || !bands[0] || !bands[1] || !tiles) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate split buffers");
+    rc = -1;
+  }
+
+  /* Band b is decoded while the tiles of band b - 1 are being encoded */
+  for (U32 b = 0; rc == 0 && b <= rows; b++) {
+    U8 *band = bands[b % 2];
+    U32 band_h = 0;
+    if (b < rows) {
+      band_h = ihdr->height - b * th < th ? ihdr->height - b * th : th;
+      for (U32 r = 0; r < band_h; r++) {
+        const uint8_t *row = NULL;
+        if (pngcore_row_reader_next(reader, &row) != 1) {
+          pngcore_error_set(error, PNGCORE_ERR, "Failed to decode row %u", b * th + r);
+          rc = -1;
+          break;
+        }
+        memcpy(band + (size_t)r * row_bytes, row, row_bytes);
+      }
+    }
+
+    if (b > 0) {
+      pngcore_pool_wait(pool);
+      for (U32 c = 0; c < cols; c++) {
+        pngcore_split_tile_t *tile = &tiles[c];
+        if (rc == 0 && tile->rc != 0) {
+          if (error) *error = tile->error;
+          rc = -1;
+        }
+        if (rc == 0 && callback(ctx, (b - 1) * cols + c, c, b - 1,
+                                tile->out.data, tile->out.len) != 0) {
+          pngcore_error_set(error, PNGCORE_ERR, "Split callback failed on tile %u",
+          (b - 1) * cols + c);
+          rc = -1;
+        }
+        free(tile->out.data);
+        memset(&tile->out, 0, sizeof(tile->out));
+      }
+    }
+
+    if (rc != 0 || b == rows) break;
+
+    for (U32 c = 0; c < cols; c++) {
+      pngcore_split_tile_t *tile = &tiles[c];
+      tile->src = png;
+      tile->band = band;
+      tile->band_stride = row_bytes;
+      tile->x = c * tw;
+      tile->width = ihdr->width - tile->x < tw ? ihdr->width - tile->x : tw;
+      tile->height = band_h;
+      tile->bit_depth = ihdr->bit_depth;
+      tile->color_type = ihdr->color_type;
+      if (pngcore_pool_submit(pool, tile_task, tile) != 0) {
+        tile_task(tile);
+      }
+    }
+  }
+
+  /* Running tiles finish before their buffers are released */
+  pngcore_pool_destroy(pool);
+  if (tiles) {
+    for (U32 c = 0; c < cols; c++) {
+      free(tiles[c].out.data);
+    }
+  }
+  free(tiles);
+  free(bands[0]);
+  free(bands[1]);
+  pngcore_row_reader_destroy(reader);
+  return rc;
+}
+
+static int dir_sink(void *ctx, uint32_t index, uint32_t col, uint32_t row,
+                    const uint8_t *data, size_t size) {
+  (void) col;
+  (void) row;
+  char path[4096];
+  int n = snprintf(path, sizeof(path), "%s/%u.png", (const char *)ctx, index);
+  if (n < 0 || (size_t)n >= sizeof(path)) return -1;
+  return pngcore_write_file(path, data, size);
+}
+
+int pngcore_split_to_dir(const pngcore_png_t *png, const pngcore_split_grid_t *grid,
+                         const char *dir, pngcore_error_t *error) {
+  if (!dir) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid output directory");
+    return -1;
+  }
+  return pngcore_split(png, grid, dir_sink, (void *)dir, error);
+}
@@ -0,0 +1,252 @@
+/**
+* @file pngcore_stats.c
+* @brief Library-wide performance counters and Prometheus export
+*/
+
+#include "pngcore.h"
+#include "pngcore/pngcore_stats.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+_Static_assert(sizeof(pngcore_stats_t) == PNGCORE_STAT_COUNT * sizeof(uint64_t),
+               "pngcore_stats_t must mirror pngcore_stat_t");
+
+typedef struct {
+  pthread_mutex_t lock;                       /* orders retiring against summing */
+  atomic_int used[PNGCORE_STATS_MAX_BLOCKS];
+  atomic_ullong retired[PNGCORE_STAT_COUNT];  /* exited workers and overflow */
+  U64 baseline[PNGCORE_STAT_COUNT];           /* totals at the last reset */
+  pngcore_stats_block_t blocks[PNGCORE_STATS_MAX_BLOCKS];
+} stats_shared_t;
+
+__thread pngcore_stats_block_t *pngcore_stats_local;
+
+static __thread int local_full;
+static stats_shared_t *shared;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+
+/* The lock lives in the shared mapping; one left by a dead worker is taken over */
+static void lock_shared(void) {
+  if (pthread_mutex_lock(&shared->lock) == EOWNERDEAD) {
+    pthread_mutex_consistent(&shared->lock);
+  }
+}
+
+/* Fold a block into the common total and give it back. Done under the lock
+* so sum() never sees the counts both folded and still in the block */
+static void retire(pngcore_stats_block_t *block) {
+  if (!block || !shared) return;
+  lock_shared();
+  for (int i = 0; i < PNGCORE_STAT_COUNT; i++) {
+    atomic_fetch_add_explicit(&shared->retired[i], block->v[i], memory_order_relaxed);
+    block->v[i] = 0;
+  }
+  pthread_mutex_unlock(&shared->lock);
+  atomic_store(&shared->used[block - shared->blocks], 0);
+  pngcore_stats_local = NULL;
+}
+
+/* The argument is ignored: in a forked child it would be the parent's block */
+static void retire_thread(void *block) {
+  (void)block;
+  retire(pngcore_stats_local);
+}
+
+static void retire_process(void) {
+  retire(pngcore_stats_local);
+}
+
+static void forget_block(void) {
+  pngcore_stats_local = NULL;
+  local_full = 0;
+}
+
+static void init(void) {
+  stats_shared_t *map = mmap(NULL, sizeof(stats_shared_t), PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) return;
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&map->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  pthread_key_create(&thread_key, retire_thread);
+  pthread_atfork(NULL, NULL, forget_block);
+  atexit(retire_process);
+  shared = map;
+}
+
+void pngcore_stats_init(void) {
+  pthread_once(&init_once, init);
+}
+
+static pngcore_stats_block_t* claim(void) {
+  pngcore_stats_init();
+  if (!shared) return NULL;
+  for (int i = 0; i < PNGCORE_STATS_MAX_BLOCKS; i++) {
+    int expected = 0;
+    if (atomic_load_explicit(&shared->used[i], memory_order_relaxed) == 0 &&
+        atomic_compare_exchange_strong(&shared->used[i], &expected, 1)) {
+      pngcore_stats_block_t *block = &shared->blocks[i];
+      memset(block, 0, sizeof(*block));
+      pthread_setspecific(thread_key, block);
+      pngcore_stats_local = block;
+      return block;
+    }
+  }
+  return NULL;
+}
+
+void pngcore_stats_add_slow(pngcore_stat_t stat, U64 n) {
+  if (!local_full) {
+    pngcore_stats_block_t *block = claim();
+    if (block) {
+      block->v[stat] += n;
+      return;
+    }
+    local_full = 1;
+  }
+  if (shared) {
+    atomic_fetch_add_explicit(&shared->retired[stat], n, memory_order_relaxed);
+  }
+}
+
+static void sum(U64 totals[PNGCORE_STAT_COUNT]) {
+  lock_shared();
+  for (int i = 0; i < PNGCORE_STAT_COUNT; i++) {
+    totals[i] = atomic_load_explicit(&shared->retired[i], memory_order_relaxed);
+  }
+  /* Free blocks are zero, so every block can be added */
+  for (int b = 0; b < PNGCORE_STATS_MAX_BLOCKS; b++) {
+    for (int i = 0; i < PNGCORE_STAT_COUNT; i++) {
+      totals[i] += __atomic_load_n(&shared->blocks[b].v[i], __ATOMIC_RELAXED);
+    }
+  }
+  pthread_mutex_unlock(&shared->lock);
+}
+
+/******************************************************************************
+* ALLOCATION
+*****************************************************************************/
+
+void* pngcore_malloc(size_t size) {
+  pngcore_stats_add(PNGCORE_STAT_ALLOCATIONS, 1);
+  pngcore_stats_add(PNGCORE_STAT_BYTES_ALLOCATED, size);
+  return malloc(size);
+}
+
+void* pngcore_calloc(size_t count, size_t size) {
+  pngcore_stats_add(PNGCORE_STAT_ALLOCATIONS, 1);
+  pngcore_stats_add(PNGCORE_STAT_BYTES_ALLOCATED, count * size);
+  return calloc(count, size);
+}
+
+void* pngcore_realloc(void *ptr, size_t size) {
+  pngcore_stats_add(PNGCORE_STAT_ALLOCATIONS, 1);
+  pngcore_stats_add(PNGCORE_STAT_BYTES_ALLOCATED, size);
+  return realloc(ptr, size);
+}
+
+/******************************************************************************
+* PUBLIC API
+*****************************************************************************/
+
+void pngcore_stats_get(pngcore_stats_t *stats) {
+  if (!stats) return;
+  memset(stats, 0, sizeof(*stats));
+  pngcore_stats_init();
+  if (!shared) return;
+
+  U64 totals[PNGCORE_STAT_COUNT];
+  uint64_t *out = (uint64_t *)stats;
+  sum(totals);
+  for (int i = 0; i < PNGCORE_STAT_COUNT; i++) {
+    out[i] = totals[i] > shared->baseline[i] ? totals[i] - shared->baseline[i] : 0;
+  }
+}
+
+void pngcore_stats_reset(void) {
+  pngcore_stats_init();
+  if (shared) {
+    sum(shared->baseline);
+  }
+}
+
+static const struct {
+  const char *name;
+  const char *help;
+  const char *phase;
+  pngcore_stat_t stat;
+} metrics[] = {
+  {"pngcore_processed_bytes_total", "Bytes handled by each codec phase.", "parse",
+   PNGCORE_STAT_BYTES_PARSED},
+  {"pngcore_processed_bytes_total", NULL, "crc", PNGCORE_STAT_BYTES_CRC},
+  {"pngcore_processed_bytes_total", NULL, "inflate", PNGCORE_STAT_BYTES_INFLATED},
+  {"pngcore_processed_bytes_total", NULL, "deflate", PNGCORE_STAT_BYTES_DEFLATED},
+  {"pngcore_phase_seconds_total", "Time spent in each codec phase.", "parse",
+   PNGCORE_STAT_PARSE_NS},
+  {"pngcore_phase_seconds_total", NULL, "crc", PNGCORE_STAT_CRC_NS},
+  {"pngcore_phase_seconds_total", NULL, "inflate", PNGCORE_STAT_INFLATE_NS},
+  {"pngcore_phase_seconds_total", NULL, "deflate", PNGCORE_STAT_DEFLATE_NS},
+  {"pngcore_allocations_total", "Allocations made by the library.", NULL,
+   PNGCORE_STAT_ALLOCATIONS},
+  {"pngcore_allocated_bytes_total", "Bytes requested by library allocations.", NULL,
+   PNGCORE_STAT_BYTES_ALLOCATED},
+  {"pngcore_http_requests_total", "HTTP requests performed.", NULL,
+   PNGCORE_STAT_HTTP_REQUESTS},
+  {"pngcore_http_retries_total", "Fragment fetches retried after a failure.", NULL,
+   PNGCORE_STAT_HTTP_RETRIES},
+};
+
+int pngcore_stats_write_prometheus(const char *path, pngcore_error_t *error) {
+  if (!path) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid path");
+    return -1;
+  }
+
+  /* Written aside and renamed so a scraper never reads half a file */
+  char tmp[4096];
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+    pngcore_error_set(error, PNGCORE_ERR, "Path too long: %s", path);
+    return -1;
+  }
+  FILE *fp = fopen(tmp, "w");
+  if (!fp) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to open %s", tmp);
+    return -1;
+  }
+
+  pngcore_stats_t stats;
+  const uint64_t *values = (const uint64_t *)&stats;
+  pngcore_stats_get(&stats);
+  for (size_t m = 0; m < sizeof(metrics) / sizeof(metrics[0]); m++) {
+    int seconds = strstr(metrics[m].name, "_seconds_") != NULL;
+    if (metrics[m].help) {
+      fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n", metrics[m].name, metrics[m].help,
+              metrics[m].name);
+    }
+    fprintf(fp, "%s", metrics[m].name);
+    if (metrics[m].phase) {
+      fprintf(fp, "{phase=\"%s\"}", metrics[m].phase);
+    }
+    if (seconds) {
+      fprintf(fp, " %.9f\n", values[metrics[m].stat] / 1e9);
+    } else {
+      fprintf(fp, " %llu\n", (unsigned long long)values[metrics[m].stat]);
+    }
+  }
+
+  if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+    remove(tmp);
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to write %s", path);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,679 @@
+/**
+* @file pngcore_stream.c
+* @brief Streaming scanline decoder and encoder
+*/
+
+#include "pngcore/pngcore_stream.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_filter.h"
+#include "pngcore/pngcore_crc.h"
+#include "pngcore/pngcore_stats.h"
+#include "pngcore/pngcore_probes.h"
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/******************************************************************************
+* CHUNK OUTPUT
+*****************************************************************************/
+
+int pngcore_file_sink(void *ctx, const U8 *buf, size_t len) {
+  return (fwrite(buf, 1, len, (FILE *)ctx) == len) ? 0 : -1;
+}
+
+int pngcore_mem_sink(void *ctx, const U8 *buf, size_t len) {
+  pngcore_mem_buffer_t *mem = (pngcore_mem_buffer_t *)ctx;
+  if (len > mem->cap - mem->len) {
+    size_t cap = mem->cap ? mem->cap : 4096;
+    while (cap - mem->len < len) {
+      cap *= 2;
+    }
+    U8 *data = pngcore_realloc(mem->data, cap);
+    if (!data) return -1;
+    mem->data = data;
+    mem->cap = cap;
+  }
+  memcpy(mem->data + mem->len, buf, len);
+  mem->len += len;
+  return 0;
+}
+
+int pngcore_write_chunk(pngcore_sink_fn sink, void *ctx, const char type[4],
+                        const U8 *data, U32 len) {
+  U8 header[CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE];
+  U32 len_be = htonl(len);
+  memcpy(header, &len_be, CHUNK_LEN_SIZE);
+  memcpy(header + CHUNK_LEN_SIZE, type, CHUNK_TYPE_SIZE);
+
+  /* CRC covers type and data */
+  U32 crc_be = htonl((U32)pngcore_chunk_crc((const U8 *)type, data, len));
+
+  if (sink(ctx, header, sizeof(header)) != 0) return -1;
+  if (len > 0 && sink(ctx, data, len) != 0) return -1;
+  return sink(ctx, (U8 *)&crc_be, CHUNK_CRC_SIZE);
+}
+
+/******************************************************************************
+* ROW READER
+*****************************************************************************/
+
+pngcore_row_reader_t* pngcore_row_reader_open(const U8 *zdata, size_t zlen,
+                                              U32 width, U32 height,
+                                              U8 bit_depth, U8 color_type,
+                                              pngcore_error_t *error) {
+  if (!zdata || zlen == 0 || width == 0 || height == 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid image data or dimensions");
+    return NULL;
+  }
+  if (!pngcore_valid_format(bit_depth, color_type)) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED,
+    "Unsupported bit depth %u for color type %u", bit_depth, color_type);
+    return NULL;
+  }
+
+  pngcore_row_reader_t *reader = pngcore_calloc(1, sizeof(pngcore_row_reader_t));
+  if (!reader) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate row reader");
+    return NULL;
+  }
+
+  reader->width = width;
+  reader->height = height;
+  reader->bit_depth = bit_depth;
+  reader->color_type = color_type;
+  reader->row_bytes = pngcore_scanline_bytes(width, bit_depth, color_type);
+  reader->bpp = pngcore_filter_bpp(bit_depth, color_type);
+
+  reader->lines = pngcore_malloc(2 * (reader->row_bytes + 1));
+  if (!reader->lines) {
+    free(reader);
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate scanline buffers");
+    return NULL;
+  }
+  reader->cur = reader->lines;
+  reader->prev = reader->lines + reader->row_bytes + 1;
+
+  reader->strm.zalloc = Z_NULL;
+  reader->strm.zfree = Z_NULL;
+  reader->strm.opaque = Z_NULL;
+  reader->strm.next_in = (U8 *)zdata;
+  reader->strm.avail_in = zlen;
+  if (inflateInit(&reader->strm) != Z_OK) {
+    free(reader->lines);
+    free(reader);
+    pngcore_error_set(error, PNGCORE_ERR, "inflateInit failed");
+    return NULL;
+  }
+  reader->strm_open = 1;
+
+  return reader;
+}
+
+pngcore_row_reader_t* pngcore_row_reader_create(const pngcore_png_t *png, pngcore_error_t *error) {
+  if (!png || !png->internal || !png->internal->ihdr || !png->internal->idat) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid PNG");
+    return NULL;
+  }
+
+  pngcore_ihdr_data_t *ihdr = png->internal->ihdr->p_data;
+  if (ihdr->interlace != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED,
+    "Streaming decode of interlaced images is not supported");
+    return NULL;
+  }
+
+  return pngcore_row_reader_open(png->internal->idat->p_data->data,
+                                 png->internal->idat->p_data->length,
+                                 ihdr->width, ihdr->height,
+                                 ihdr->bit_depth, ihdr->color_type, error);
+}
+
+/* Sample i of a native row, for any bit depth */
+static uint16_t native_sample(const U8 *row, size_t i, U8 depth) {
+  if (depth == 16) return (uint16_t)((row[2 * i] << 8) | row[2 * i + 1]);
+  if (depth == 8) return row[i];
+  size_t bit = i * depth;
+  return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1u << depth) - 1);
+}
+
+static void expand_palette(pngcore_row_reader_t *reader, const U8 *src) {
+  U8 *dst = reader->unpacked;
+  for (U32 x = 0; x < reader->width; x++) {
+    memcpy(dst + 4 * (size_t)x, reader->palette + 4 * native_sample(src, x, reader->bit_depth), 4);
+  }
+}
+
+/* Clear alpha of converted pixels whose native samples equal the key;
+* premultiplied pixels become all zero */
+static void apply_key(pngcore_row_reader_t *reader, const U8 *src) {
+  const pngcore_format_desc_t *desc = pngcore_format_desc(reader->plan.dst);
+  if (desc->a < 0) return;
+  size_t channels = reader->color_type == PNGCORE_COLOR_RGB ? 3 : 1;
+  size_t pixel_bytes = reader->plan.dst_bytes;
+  for (U32 x = 0; x < reader->width; x++) {
+    size_t c = 0;
+    while (c < channels && native_sample(src, x * channels + c, reader->bit_depth) == reader->key[c]) {
+      c++;
+    }
+    if (c < channels) continue;
+    U8 *px = reader->converted + x * pixel_bytes;
+    if (desc->premul) {
+      memset(px, 0, pixel_bytes);
+    } else {
+      memset(px + desc->a * desc->sample_bytes, 0, desc->sample_bytes);
+    }
+  }
+}
+
+int pngcore_row_reader_next(pngcore_row_reader_t *reader, const uint8_t **row) {
+  if (!reader || reader->failed) return -1;
+  if (reader->y >= reader->height) return 0;
+
+  /* Inflate exactly one filtered scanline */
+  size_t line_len = reader->row_bytes + 1;
+  reader->strm.next_out = reader->cur;
+  reader->strm.avail_out = line_len;
+
+  U64 start = pngcore_stats_now();
+  U64 in_before = reader->strm.avail_in;
+  PNGCORE_PROBE1(inflate_start, in_before);
+  int ret = Z_OK;
+  while (reader->strm.avail_out > 0 && ret == Z_OK) {
+    ret = inflate(&reader->strm, Z_NO_FLUSH);
+  }
+  PNGCORE_PROBE3(inflate_done, in_before - reader->strm.avail_in,
+                 line_len - reader->strm.avail_out, ret);
+  pngcore_stats_add(PNGCORE_STAT_BYTES_INFLATED, line_len - reader->strm.avail_out);
+  pngcore_stats_since(PNGCORE_STAT_INFLATE_NS, start);
+  if (ret != Z_OK && ret != Z_STREAM_END) {
+    reader->failed = 1;
+    return -1;
+  }
+  if (reader->strm.avail_out > 0) {
+    /* Stream ended before the last row */
+    reader->failed = 1;
+    return -1;
+  }
+
+  const U8 *prev = (reader->y > 0) ? reader->prev + 1 : NULL;
+  if (pngcore_unfilter_row(reader->cur[0], reader->cur + 1, prev,
+                           reader->row_bytes, reader->bpp) != 0) {
+    reader->failed = 1;
+    return -1;
+  }
+
+  if (row) {
+    *row = reader->cur + 1;
+  }
+
+  if (reader->stats_acc) {
+    pngcore_image_stats_acc_row(reader->stats_acc, reader->cur + 1);
+    if (reader->y + 1 == reader->height) {
+      pngcore_image_stats_acc_finish(reader->stats_acc, reader->stats);
+    }
+  }
+
+  if (reader->convert) {
+    const U8 *src = reader->cur + 1;
+    if (reader->palette) {
+      expand_palette(reader, src);
+      src = reader->unpacked;
+    } else if (reader->unpacked) {
+      pngcore_unpack_gray(src, reader->unpacked, reader->width, reader->bit_depth);
+      src = reader->unpacked;
+    }
+    pngcore_convert_plan_run(&reader->plan, src, reader->converted, reader->width);
+    if (reader->has_key) {
+      apply_key(reader, reader->cur + 1);
+    }
+    if (row) {
+      *row = reader->converted;
+    }
+  }
+
+  /* The current line becomes the reference for the next one */
+  U8 *tmp = reader->prev;
+  reader->prev = reader->cur;
+  reader->cur = tmp;
+  reader->y++;
+
+  return 1;
+}
+
+size_t pngcore_row_reader_row_bytes(const pngcore_row_reader_t *reader) {
+  if (!reader) return 0;
+  return reader->convert ? reader->out_row_bytes : reader->row_bytes;
+}
+
+int pngcore_row_reader_set_format(pngcore_row_reader_t *reader, pngcore_pixel_format_t fmt) {
+  if (!reader || reader->y > 0 || !pngcore_format_desc(fmt)) return -1;
+
+  /* Indices are expanded to RGBA8 and sub-byte gray to 8 bits before conversion */
+  pngcore_pixel_format_t src_fmt;
+  size_t unpack = 0;
+  if (reader->palette) {
+    src_fmt = PNGCORE_FMT_RGBA8;
+    unpack = (size_t)reader->width * 4;
+  } else if (reader->color_type == PNGCORE_COLOR_GRAYSCALE && reader->bit_depth < 8) {
+    src_fmt = PNGCORE_FMT_GRAY8;
+    unpack = reader->width;
+  } else if (pngcore_format_from_png(reader->bit_depth, reader->color_type, &src_fmt) != 0) {
+    return -1;
+  }
+
+  pngcore_convert_plan_t plan;
+  if (pngcore_convert_plan_init(&plan, src_fmt, fmt) != 0) return -1;
+
+  size_t out_row_bytes = (size_t)reader->width * pngcore_format_pixel_bytes(fmt);
+  U8 *converted = pngcore_malloc(out_row_bytes);
+  U8 *unpacked = unpack ? pngcore_malloc(unpack) : NULL;
+  if (!converted || (unpack && !unpacked)) {
+    free(converted);
+    free(unpacked);
+    return -1;
+  }
+
+  free(reader->converted);
+  free(reader->unpacked);
+  reader->plan = plan;
+  reader->converted = converted;
+  reader->unpacked = unpacked;
+  reader->out_row_bytes = out_row_bytes;
+  reader->convert = 1;
+  return 0;
+}
+
+int pngcore_row_reader_load_palette(pngcore_row_reader_t *reader, const pngcore_png_t *src,
+                                    pngcore_error_t *error) {
+  if (!reader || reader->y > 0 || reader->convert || !src || !src->internal) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid reader or source");
+    return -1;
+  }
+  const pngcore_chunk_list_t *extra = src->internal->extra;
+  const pngcore_chunk_ref_t *plte = pngcore_chunk_list_find(extra, "PLTE", 0, NULL);
+  const pngcore_chunk_ref_t *trns = pngcore_chunk_list_find(extra, "tRNS", 0, NULL);
+  U8 ct = reader->color_type;
+  if (ct != PNGCORE_COLOR_INDEXED) plte = NULL;
+  if (ct != PNGCORE_COLOR_INDEXED && ct != PNGCORE_COLOR_GRAYSCALE && ct != PNGCORE_COLOR_RGB) {
+    trns = NULL;
+  }
+
+  if (ct == PNGCORE_COLOR_INDEXED &&
+      (!plte || plte->length == 0 || plte->length % 3 != 0 || plte->length > 3 * 256)) {
+    pngcore_error_set(error, PNGCORE_ERR, "Indexed image has no valid PLTE chunk");
+    return -1;
+  }
+  if ((plte && !pngcore_chunk_ref_crc_ok(extra, plte)) ||
+      (trns && !pngcore_chunk_ref_crc_ok(extra, trns))) {
+    pngcore_error_set(error, PNGCORE_ERR_CRC_MISMATCH, "PLTE or tRNS CRC mismatch");
+    return -1;
+  }
+  const U8 *trns_data = trns ? pngcore_chunk_ref_data(extra, trns) : NULL;
+
+  if (plte) {
+    /* Indices past the end of PLTE decode as opaque black */
+    U8 *palette = pngcore_calloc(256, 4);
+    if (!palette) {
+      pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate palette");
+      return -1;
+    }
+    const U8 *entries = pngcore_chunk_ref_data(extra, plte);
+    for (U32 i = 0; i < 256; i++) {
+      if (i < plte->length / 3) {
+        memcpy(palette + 4 * i, entries + 3 * i, 3);
+      }
+      palette[4 * i + 3] = (trns && i < trns->length) ? trns_data[i] : 0xff;
+    }
+    free(reader->palette);
+    reader->palette = palette;
+    return 0;
+  }
+
+  size_t channels = ct == PNGCORE_COLOR_RGB ? 3 : 1;
+  if (trns) {
+    if (trns->length != 2 * channels) {
+      pngcore_error_set(error, PNGCORE_ERR, "Invalid tRNS length %u", trns->length);
+      return -1;
+    }
+    for (size_t c = 0; c < channels; c++) {
+      reader->key[c] = (uint16_t)((trns_data[2 * c] << 8) | trns_data[2 * c + 1]);
+    }
+    reader->has_key = 1;
+  }
+  return 0;
+}
+
+void pngcore_row_reader_destroy(pngcore_row_reader_t *reader) {
+  if (!reader) return;
+  if (reader->strm_open) {
+    (void) inflateEnd(&reader->strm);
+  }
+  free(reader->stats_acc);
+  free(reader->converted);
+  free(reader->unpacked);
+  free(reader->palette);
+  free(reader->lines);
+  free(reader);
+}
+
+/******************************************************************************
+* ROW WRITER
+*****************************************************************************/
+
+/* Move the staged IDAT payload to the sink */
+static int writer_flush_idat(pngcore_row_writer_t *writer) {
+  size_t have = PNGCORE_STREAM_IDAT_SIZE - writer->strm.avail_out;
+  if (have > 0) {
+    if (pngcore_write_chunk(writer->sink, writer->sink_ctx, "IDAT",
+                            writer->zbuf, have) != 0) {
+      return -1;
+    }
+  }
+  writer->strm.next_out = writer->zbuf;
+  writer->strm.avail_out = PNGCORE_STREAM_IDAT_SIZE;
+  return 0;
+}
+
+pngcore_row_writer_t* pngcore_row_writer_open(pngcore_sink_fn sink, void *ctx,
+                                              U32 width, U32 height,
+                                              U8 bit_depth, U8 color_type,
+                                              int level, pngcore_error_t *error) {
+  if (!sink || width == 0 || height == 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid sink or dimensions");
+    return NULL;
+  }
+  if (!pngcore_valid_format(bit_depth, color_type)) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED,
+    "Unsupported bit depth %u for color type %u", bit_depth, color_type);
+    return NULL;
+  }
+
+  pngcore_row_writer_t *writer = pngcore_calloc(1, sizeof(pngcore_row_writer_t));
+  if (!writer) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate row writer");
+    return NULL;
+  }
+
+  writer->sink = sink;
+  writer->sink_ctx = ctx;
+  writer->width = width;
+  writer->height = height;
+  writer->bit_depth = bit_depth;
+  writer->color_type = color_type;
+  writer->row_bytes = pngcore_scanline_bytes(width, bit_depth, color_type);
+  writer->bpp = pngcore_filter_bpp(bit_depth, color_type);
+
+  writer->prev = pngcore_malloc(writer->row_bytes);
+  writer->filtered = pngcore_malloc(writer->row_bytes + 1);
+  writer->scratch = pngcore_malloc(writer->row_bytes + 1);
+  writer->zbuf = pngcore_malloc(PNGCORE_STREAM_IDAT_SIZE);
+  if (!writer->prev || !writer->filtered || !writer->scratch || !writer->zbuf) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate scanline buffers");
+    pngcore_row_writer_destroy(writer);
+    return NULL;
+  }
+
+  writer->strm.zalloc = Z_NULL;
+  writer->strm.zfree = Z_NULL;
+  writer->strm.opaque = Z_NULL;
+  if (deflateInit(&writer->strm, level) != Z_OK) {
+    pngcore_error_set(error, PNGCORE_ERR, "deflateInit failed");
+    pngcore_row_writer_destroy(writer);
+    return NULL;
+  }
+  writer->strm_open = 1;
+  writer->strm.next_out = writer->zbuf;
+  writer->strm.avail_out = PNGCORE_STREAM_IDAT_SIZE;
+
+  /* Signature and IHDR go out immediately */
+  U8 png_sig[PNG_SIG_SIZE] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+  U8 ihdr[DATA_IHDR_SIZE];
+  U32 width_be = htonl(width);
+  U32 height_be = htonl(height);
+  memcpy(ihdr, &width_be, 4);
+  memcpy(ihdr + 4, &height_be, 4);
+  ihdr[8] = bit_depth;
+  ihdr[9] = color_type;
+  ihdr[10] = 0;
+  ihdr[11] = 0;
+  ihdr[12] = 0;
+
+  if (sink(ctx, png_sig, sizeof(png_sig)) != 0 ||
+      pngcore_write_chunk(sink, ctx, "IHDR", ihdr, DATA_IHDR_SIZE) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to write PNG header");
+    pngcore_row_writer_destroy(writer);
+    return NULL;
+  }
+
+  return writer;
+}
+
+pngcore_row_writer_t* pngcore_row_writer_create(const char *filename,
+                                                uint32_t width, uint32_t height,
+                                                uint8_t bit_depth, uint8_t color_type,
+                                                pngcore_error_t *error) {
+  if (!filename) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Filename is NULL");
+    return NULL;
+  }
+
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to open file: %s", filename);
+    return NULL;
+  }
+
+  pngcore_row_writer_t *writer = pngcore_row_writer_open(pngcore_file_sink, fp,
+                                                         width, height, bit_depth,
+                                                         color_type, Z_DEFAULT_COMPRESSION,
+                                                         error);
+  if (!writer) {
+    fclose(fp);
+    return NULL;
+  }
+  writer->fp = fp;
+  return writer;
+}
+
+int pngcore_row_writer_write(pngcore_row_writer_t *writer, const uint8_t *row) {
+  if (!writer || !row || writer->failed || writer->finished) return -1;
+  if (writer->y >= writer->height) return -1;
+  if (writer->color_type == PNGCORE_COLOR_INDEXED && !writer->has_palette) return -1;
+
+  if (writer->convert) {
+    pngcore_convert_plan_run(&writer->plan, row, writer->converted, writer->width);
+    row = writer->converted;
+  }
+
+  pngcore_filter_row(writer->filtered, writer->scratch, row,
+                     writer->y > 0 ? writer->prev : NULL,
+                     writer->row_bytes, writer->bpp);
+  memcpy(writer->prev, row, writer->row_bytes);
+
+  U64 start = pngcore_stats_now();
+  writer->strm.next_in = writer->filtered;
+  writer->strm.avail_in = writer->row_bytes + 1;
+  while (writer->strm.avail_in > 0) {
+    if (deflate(&writer->strm, Z_NO_FLUSH) == Z_STREAM_ERROR ||
+        (writer->strm.avail_out == 0 && writer_flush_idat(writer) != 0)) {
+      writer->failed = 1;
+      return -1;
+    }
+  }
+  pngcore_stats_add(PNGCORE_STAT_BYTES_DEFLATED, writer->row_bytes + 1);
+  pngcore_stats_since(PNGCORE_STAT_DEFLATE_NS, start);
+
+  writer->y++;
+  return 0;
+}
+
+int pngcore_row_writer_set_format(pngcore_row_writer_t *writer, pngcore_pixel_format_t fmt) {
+  if (!writer || writer->y > 0) return -1;
+
+  pngcore_pixel_format_t png_fmt;
+  pngcore_convert_plan_t plan;
+  if (pngcore_format_from_png(writer->bit_depth, writer->color_type, &png_fmt) != 0 ||
+      pngcore_convert_plan_init(&plan, fmt, png_fmt) != 0) {
+    return -1;
+  }
+
+  U8 *converted = pngcore_malloc(writer->row_bytes);
+  if (!converted) return -1;
+
+  free(writer->converted);
+  writer->plan = plan;
+  writer->converted = converted;
+  writer->convert = 1;
+  return 0;
+}
+
+int pngcore_row_writer_set_palette(pngcore_row_writer_t *writer,
+                                   const uint8_t *plte, size_t plte_len,
+                                   const uint8_t *trns, size_t trns_len) {
+  if (!writer || writer->y > 0 || writer->failed || writer->has_palette) return -1;
+
+  /* PLTE is not allowed for gray, tRNS not with an alpha channel */
+  U8 ct = writer->color_type;
+  size_t entries = plte_len / 3;
+  if (!plte || plte_len == 0 || plte_len % 3 != 0 || entries > 256 ||
+      ct == PNGCORE_COLOR_GRAYSCALE || ct == PNGCORE_COLOR_GRAYSCALE_ALPHA) {
+    return -1;
+  }
+  if (ct == PNGCORE_COLOR_INDEXED && entries > (1u << writer->bit_depth)) return -1;
+  if (trns && trns_len > 0 &&
+      (ct == PNGCORE_COLOR_RGBA ||
+       (ct == PNGCORE_COLOR_INDEXED && trns_len > entries) ||
+       (ct == PNGCORE_COLOR_RGB && trns_len != 6))) {
+    return -1;
+  }
+
+  /* No IDAT has been flushed before the first row */
+  if (pngcore_write_chunk(writer->sink, writer->sink_ctx, "PLTE", plte, (U32)plte_len) != 0 ||
+      (trns && trns_len > 0 &&
+       pngcore_write_chunk(writer->sink, writer->sink_ctx, "tRNS", trns, (U32)trns_len) != 0)) {
+    writer->failed = 1;
+    return -1;
+  }
+  writer->has_palette = 1;
+  return 0;
+}
+
+int pngcore_row_writer_copy_palette(pngcore_row_writer_t *writer, const pngcore_png_t *src,
+                                    pngcore_error_t *error) {
+  const pngcore_chunk_list_t *extra = src->internal->extra;
+  const pngcore_chunk_ref_t *plte = pngcore_chunk_list_find(extra, "PLTE", 0, NULL);
+  const pngcore_chunk_ref_t *trns = pngcore_chunk_list_find(extra, "tRNS", 0, NULL);
+
+  if (!plte) {
+    if (writer->color_type == PNGCORE_COLOR_INDEXED) {
+      pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED,
+      "Indexed source has no PLTE chunk");
+      return -1;
+    }
+    /* A gray or color key tRNS needs no palette */
+    if (trns && writer->color_type != PNGCORE_COLOR_RGBA &&
+        writer->color_type != PNGCORE_COLOR_GRAYSCALE_ALPHA) {
+      if (!pngcore_chunk_ref_crc_ok(extra, trns) ||
+          pngcore_write_chunk(writer->sink, writer->sink_ctx, "tRNS",
+                              pngcore_chunk_ref_data(extra, trns), trns->length) != 0) {
+        pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to copy tRNS chunk");
+        return -1;
+      }
+    }
+    return 0;
+  }
+
+  if (!pngcore_chunk_ref_crc_ok(extra, plte) || (trns && !pngcore_chunk_ref_crc_ok(extra, trns))) {
+    pngcore_error_set(error, PNGCORE_ERR_CRC_MISMATCH, "PLTE or tRNS CRC mismatch");
+    return -1;
+  }
+  if (pngcore_row_writer_set_palette(writer, pngcore_chunk_ref_data(extra, plte), plte->length,
+                                     trns ? pngcore_chunk_ref_data(extra, trns) : NULL,
+                                     trns ? trns->length : 0) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR, "Failed to write PLTE/tRNS");
+    return -1;
+  }
+  return 0;
+}
+
+static int same_chunk(const pngcore_png_t *a, const pngcore_png_t *b, const char type[4]) {
+  const pngcore_chunk_list_t *la = a->internal->extra;
+  const pngcore_chunk_list_t *lb = b->internal->extra;
+  const pngcore_chunk_ref_t *ra = pngcore_chunk_list_find(la, type, 0, NULL);
+  const pngcore_chunk_ref_t *rb = pngcore_chunk_list_find(lb, type, 0, NULL);
+  if (!ra || !rb) return !ra && !rb;
+  return ra->length == rb->length &&
+         memcmp(pngcore_chunk_ref_data(la, ra), pngcore_chunk_ref_data(lb, rb), ra->length) == 0;
+}
+
+int pngcore_same_palette(const pngcore_png_t *a, const pngcore_png_t *b) {
+  return same_chunk(a, b, "PLTE") && same_chunk(a, b, "tRNS");
+}
+
+int pngcore_row_writer_finish(pngcore_row_writer_t *writer, pngcore_error_t *error) {
+  if (!writer || writer->finished) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid or finished writer");
+    return -1;
+  }
+  if (writer->color_type == PNGCORE_COLOR_INDEXED && !writer->has_palette) {
+    pngcore_error_set(error, PNGCORE_ERR_NOT_IMPLEMENTED, "Indexed image written without PLTE");
+    return -1;
+  }
+  if (writer->failed) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Writer failed while encoding rows");
+    return -1;
+  }
+  if (writer->y != writer->height) {
+    pngcore_error_set(error, PNGCORE_ERR, "Only %u of %u rows were written",
+    writer->y, writer->height);
+    return -1;
+  }
+
+  /* Drain the compressor */
+  U64 start = pngcore_stats_now();
+  int ret;
+  do {
+    ret = deflate(&writer->strm, Z_FINISH);
+    if (ret == Z_STREAM_ERROR || writer_flush_idat(writer) != 0) {
+      writer->failed = 1;
+      pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to write IDAT");
+      return -1;
+    }
+  } while (ret != Z_STREAM_END);
+  pngcore_stats_since(PNGCORE_STAT_DEFLATE_NS, start);
+
+  if (pngcore_write_chunk(writer->sink, writer->sink_ctx, "IEND", NULL, 0) != 0) {
+    writer->failed = 1;
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to write IEND");
+    return -1;
+  }
+
+  writer->finished = 1;
+
+  if (writer->fp) {
+    int rc = fclose(writer->fp);
+    writer->fp = NULL;
+    if (rc != 0) {
+      pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to close output file");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+void pngcore_row_writer_destroy(pngcore_row_writer_t *writer) {
+  if (!writer) return;
+  if (writer->strm_open) {
+    (void) deflateEnd(&writer->strm);
+  }
+  if (writer->fp) {
+    fclose(writer->fp);
+  }
+  free(writer->prev);
+  free(writer->filtered);
+  free(writer->scratch);
+  free(writer->zbuf);
+  free(writer->converted);
+  free(writer);
+}
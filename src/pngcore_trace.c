@@ -0,0 +1,212 @@
+/**
+* @file pngcore_trace.c
+* @brief Pipeline stage tracing and Chrome trace export
+*/
+
+#define _GNU_SOURCE
+#include "pngcore.h"
+#include "pngcore/pngcore_trace.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define TRACE_DEFAULT_EVENTS 16384
+#define TRACE_HEADER_SIZE    64
+
+pngcore_trace_shared_t *pngcore_trace_shared = NULL;
+
+static const char *stage_names[PNGCORE_TRACE_STAGE_COUNT] = {
+  "fetch", "enqueue", "dequeue", "parse", "crc", "inflate", "place", "deflate"
+};
+
+/* The calling worker's ring, valid only in the generation it was claimed
+* in; a forked child starts without one */
+static __thread pngcore_trace_ring_t *local_ring;
+static __thread int local_full;
+static __thread unsigned local_generation;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+/* Process-wide, so a new mapping never reuses an old generation */
+static atomic_uint generations;
+
+static void forget_ring(void) {
+  local_ring = NULL;
+  local_full = 0;
+  local_generation = 0;
+}
+
+static void register_atfork(void) {
+  pthread_atfork(NULL, NULL, forget_ring);
+}
+
+static size_t ring_size(U64 capacity) {
+  return sizeof(pngcore_trace_ring_t) + capacity * sizeof(pngcore_trace_event_t);
+}
+
+static pngcore_trace_ring_t* ring_at(pngcore_trace_shared_t *shared, unsigned index) {
+  return (pngcore_trace_ring_t *)((U8 *)shared + TRACE_HEADER_SIZE +
+                                  index * ring_size(shared->capacity));
+}
+
+static pngcore_trace_event_t* ring_events(pngcore_trace_ring_t *ring) {
+  return (pngcore_trace_event_t *)(ring + 1);
+}
+
+U64 pngcore_trace_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (U64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static pngcore_trace_ring_t* claim_ring(pngcore_trace_shared_t *shared) {
+  unsigned generation = atomic_load_explicit(&shared->generation, memory_order_acquire);
+  if (local_generation == generation && (local_ring || local_full)) return local_ring;
+  /* Rings of an earlier enable were handed out again or unmapped */
+  local_ring = NULL;
+  local_full = 0;
+  local_generation = generation;
+  unsigned index = atomic_fetch_add(&shared->workers, 1);
+  if (index >= PNGCORE_TRACE_MAX_WORKERS) {
+    local_full = 1;
+    return NULL;
+  }
+  pngcore_trace_ring_t *ring = ring_at(shared, index);
+  ring->head = 0;
+  ring->pid = getpid();
+  ring->tid = (int)syscall(SYS_gettid);
+  ring->name[0] = '\0';
+  local_ring = ring;
+  return ring;
+}
+
+void pngcore_trace_record(pngcore_trace_stage_t stage, U64 start, int seq, U64 bytes) {
+  pngcore_trace_shared_t *shared = pngcore_trace_shared;
+  if (!shared) return;
+  U64 end = pngcore_trace_now();
+  pngcore_trace_ring_t *ring = claim_ring(shared);
+  if (!ring) {
+    atomic_fetch_add_explicit(&shared->dropped, 1, memory_order_relaxed);
+    return;
+  }
+  pngcore_trace_event_t *event = &ring_events(ring)[ring->head % shared->capacity];
+  event->start = start > shared->origin ? start - shared->origin : 0;
+  event->duration = end - start;
+  event->bytes = bytes;
+  event->stage = stage;
+  event->seq = seq;
+  ring->head++;
+}
+
+void pngcore_trace_name(const char *fmt, ...) {
+  pngcore_trace_shared_t *shared = pngcore_trace_shared;
+  if (!shared || !atomic_load(&shared->on)) return;
+  pngcore_trace_ring_t *ring = claim_ring(shared);
+  if (!ring) return;
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(ring->name, sizeof(ring->name), fmt, ap);
+  va_end(ap);
+}
+
+/******************************************************************************
+* PUBLIC API
+*****************************************************************************/
+
+int pngcore_trace_enable(size_t events_per_worker, pngcore_error_t *error) {
+  U64 capacity = events_per_worker ? events_per_worker : TRACE_DEFAULT_EVENTS;
+  pngcore_trace_shared_t *shared = pngcore_trace_shared;
+
+  pthread_once(&atfork_once, register_atfork);
+  if (!shared || shared->capacity != capacity) {
+    pngcore_trace_free();
+    size_t size = TRACE_HEADER_SIZE + PNGCORE_TRACE_MAX_WORKERS * ring_size(capacity);
+    shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+      pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to map %zu bytes of trace buffers",
+                        size);
+      return -1;
+    }
+    shared->capacity = capacity;
+    shared->map_size = size;
+  }
+
+  /* Start over; rings are claimed again by the next event of each worker */
+  atomic_store(&shared->workers, 0);
+  atomic_store(&shared->dropped, 0);
+  shared->origin = pngcore_trace_now();
+  atomic_store(&shared->generation, atomic_fetch_add(&generations, 1) + 1);
+  pngcore_trace_shared = shared;
+  atomic_store(&shared->on, 1);
+  return 0;
+}
+
+void pngcore_trace_disable(void) {
+  if (pngcore_trace_shared) {
+    atomic_store(&pngcore_trace_shared->on, 0);
+  }
+}
+
+void pngcore_trace_free(void) {
+  pngcore_trace_shared_t *shared = pngcore_trace_shared;
+  if (!shared) return;
+  pngcore_trace_shared = NULL;
+  forget_ring();
+  munmap(shared, shared->map_size);
+}
+
+int pngcore_trace_write(const char *path, pngcore_error_t *error) {
+  pngcore_trace_shared_t *shared = pngcore_trace_shared;
+  if (!shared) {
+    pngcore_error_set(error, PNGCORE_ERR, "Tracing was never enabled");
+    return -1;
+  }
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to open %s", path);
+    return -1;
+  }
+
+  unsigned workers = atomic_load(&shared->workers);
+  if (workers > PNGCORE_TRACE_MAX_WORKERS) workers = PNGCORE_TRACE_MAX_WORKERS;
+  U64 overwritten = 0;
+  int first = 1;
+
+  fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+  for (unsigned w = 0; w < workers; w++) {
+    pngcore_trace_ring_t *ring = ring_at(shared, w);
+    if (ring->name[0]) {
+      fprintf(fp, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                  "\"args\": {\"name\": \"%s\"}}",
+              first ? "" : ",", ring->pid, ring->tid, ring->name);
+      first = 0;
+    }
+    U64 head = ring->head;
+    U64 begin = head > shared->capacity ? head - shared->capacity : 0;
+    overwritten += begin;
+    for (U64 i = begin; i < head; i++) {
+      const pngcore_trace_event_t *e = &ring_events(ring)[i % shared->capacity];
+      /* Chrome wants microseconds */
+      fprintf(fp, "%s\n{\"name\": \"%s\", \"cat\": \"pngcore\", \"ph\": \"X\", "
+                  "\"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d, "
+                  "\"args\": {\"seq\": %d, \"bytes\": %llu}}",
+              first ? "" : ",", e->stage < PNGCORE_TRACE_STAGE_COUNT ? stage_names[e->stage] : "?",
+              e->start / 1e3, e->duration / 1e3, ring->pid, ring->tid, e->seq,
+              (unsigned long long)e->bytes);
+      first = 0;
+    }
+  }
+  fprintf(fp, "\n], \"otherData\": {\"workers\": %u, \"overwritten_events\": %llu, "
+              "\"dropped_events\": %lu}}\n",
+          workers, (unsigned long long)overwritten, atomic_load(&shared->dropped));
+
+  if (fclose(fp) != 0) {
+    pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to write %s", path);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,437 @@
+/**
+* @file pngcore_transform.c
+* @brief Geometric transforms (crop, rotate, flip, transpose)
+*/
+
+#include "pngcore.h"
+#include "pngcore/pngcore_transform.h"
+#include "pngcore/pngcore_png.h"
+#include "pngcore/pngcore_stream.h"
+#include "pngcore/pngcore_filter.h"
+#include "pngcore/pngcore_convert.h"
+#include "pngcore/pngcore_pool.h"
+#include "pngcore/pngcore_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PNGCORE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/******************************************************************************
+* CROP
+*****************************************************************************/
+
+int pngcore_crop(const pngcore_png_t *png, uint32_t x, uint32_t y,
+                 uint32_t w, uint32_t h, const char *filename,
+                 pngcore_error_t *error) {
+  if (!png || !png->internal || !png->internal->ihdr || !filename) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid PNG or filename");
+    return -1;
+  }
+
+  pngcore_ihdr_data_t *ihdr = png->internal->ihdr->p_data;
+  if (w == 0 || h == 0 || x >= ihdr->width || y >= ihdr->height ||
+      w > ihdr->width - x || h > ihdr->height - y) {
+    pngcore_error_set(error, PNGCORE_ERR,
+    "Crop %ux%u+%u+%u is outside the %ux%u image", w, h, x, y,
+    ihdr->width, ihdr->height);
+    return -1;
+  }
+
+  pngcore_row_reader_t *reader = pngcore_row_reader_create(png, error);
+  if (!reader) return -1;
+
+  pngcore_row_writer_t *writer = pngcore_row_writer_create(filename, w, h,
+                                                           ihdr->bit_depth,
+                                                           ihdr->color_type, error);
+  if (!writer || pngcore_row_writer_copy_palette(writer, png, error) != 0) {
+    pngcore_row_writer_destroy(writer);
+    pngcore_row_reader_destroy(reader);
+    return -1;
+  }
+
+  /* Byte-aligned pixels are fed straight from the decoder's scanline */
+  size_t pixel_bits = pngcore_pixel_bits(ihdr->bit_depth, ihdr->color_type);
+  U8 *out_row = NULL;
+  if (pixel_bits % 8 != 0) {
+    out_row = pngcore_malloc(writer->row_bytes);
+    if (!out_row) {
+      pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate crop scanline");
+      pngcore_row_writer_destroy(writer);
+      pngcore_row_reader_destroy(reader);
+      return -1;
+    }
+  }
+
+  /* Rows above the crop must still be unfiltered since each row may predict
+  * from the one before it; inflation stops after the last cropped row */
+  int rc = 0;
+  for (U32 row_y = 0; row_y < y + h; row_y++) {
+    const uint8_t *row = NULL;
+    if (pngcore_row_reader_next(reader, &row) != 1) {
+      pngcore_error_set(error, PNGCORE_ERR, "Failed to decode row %u", row_y);
+      rc = -1;
+      break;
+    }
+    if (row_y < y) continue;
+
+    const U8 *src;
+    if (out_row) {
+      pngcore_copy_pixels(out_row, 0, row, x, w, pixel_bits);
+      src = out_row;
+    } else {
+      src = row + (size_t)x * (pixel_bits / 8);
+    }
+    if (pngcore_row_writer_write(writer, src) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to encode row %u", row_y - y);
+      rc = -1;
+      break;
+    }
+  }
+
+  if (rc == 0) {
+    rc = pngcore_row_writer_finish(writer, error);
+  }
+
+  free(out_row);
+  pngcore_row_writer_destroy(writer);
+  pngcore_row_reader_destroy(reader);
+  return rc;
+}
+
+/******************************************************************************
+* ORIENTATION KERNELS
+*****************************************************************************/
+
+static inline void put_pixel(U8 *dst, const U8 *src, size_t pixel_bytes) {
+  switch (pixel_bytes) {
+    case 1: dst[0] = src[0]; break;
+    case 2: memcpy(dst, src, 2); break;
+    case 3: memcpy(dst, src, 3); break;
+    case 4: memcpy(dst, src, 4); break;
+    case 6: memcpy(dst, src, 6); break;
+    case 8: memcpy(dst, src, 8); break;
+    default: memcpy(dst, src, pixel_bytes); break;
+  }
+}
+
+/* Output block [bx, bx + bw) x [by, by + bh) of a transposing view */
+static void transpose_block_scalar(const pngcore_orient_task_t *t, U32 bx, U32 by,
+                                   U32 bw, U32 bh) {
+  for (U32 y = by; y < by + bh; y++) {
+    const U8 *src = t->base + (ptrdiff_t)y * t->col_step + (ptrdiff_t)bx * t->row_step;
+    U8 *dst = t->dst + (size_t)y * t->dst_stride + (size_t)bx * t->pixel_bytes;
+    for (U32 x = 0; x < bw; x++) {
+      put_pixel(dst + x * t->pixel_bytes, src, t->pixel_bytes);
+      src += t->row_step;
+    }
+  }
+}
+
+#ifdef PNGCORE_X86_SIMD
+
+static int has_avx2 = -1;
+
+static int detect_avx2(void) {
+  if (has_avx2 < 0) {
+    __builtin_cpu_init();
+    has_avx2 = __builtin_cpu_supports("avx2");
+  }
+  return has_avx2;
+}
+
+/* Load the eight 32-bit pixels of source row x feeding outputs by..by+7 */
+__attribute__((target("avx2")))
+static inline __m256i load_row8(const pngcore_orient_task_t *t, U32 x, U32 by) {
+  const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  const U8 *row = t->base + (ptrdiff_t)x * t->row_step;
+  if (t->col_step > 0) {
+    return _mm256_loadu_si256((const __m256i *)(row + (ptrdiff_t)by * t->col_step));
+  }
+  __m256i v = _mm256_loadu_si256((const __m256i *)(row + (ptrdiff_t)(by + 7) * t->col_step));
+  return _mm256_permutevar8x32_epi32(v, reverse);
+}
+
+/* 8x8 transpose of 32-bit pixels: interleave 32-bit pairs, then 64-bit
+* pairs, then swap 128-bit halves */
+__attribute__((target("avx2")))
+static void transpose_block_avx2(const pngcore_orient_task_t *t, U32 bx, U32 by) {
+  __m256i r0 = load_row8(t, bx + 0, by);
+  __m256i r1 = load_row8(t, bx + 1, by);
+  __m256i r2 = load_row8(t, bx + 2, by);
+  __m256i r3 = load_row8(t, bx + 3, by);
+  __m256i r4 = load_row8(t, bx + 4, by);
+  __m256i r5 = load_row8(t, bx + 5, by);
+  __m256i r6 = load_row8(t, bx + 6, by);
+  __m256i r7 = load_row8(t, bx + 7, by);
+
+  __m256i t0 = _mm256_unpacklo_epi32(r0, r1);
+  __m256i t1 = _mm256_unpackhi_epi32(r0, r1);
+  __m256i t2 = _mm256_unpacklo_epi32(r2, r3);
+  __m256i t3 = _mm256_unpackhi_epi32(r2, r3);
+  __m256i t4 = _mm256_unpacklo_epi32(r4, r5);
+  __m256i t5 = _mm256_unpackhi_epi32(r4, r5);
+  __m256i t6 = _mm256_unpacklo_epi32(r6, r7);
+  __m256i t7 = _mm256_unpackhi_epi32(r6, r7);
+
+  __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+  __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+  __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+  __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+  __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+  __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+  __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+  __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+  __m256i out[8];
+  out[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+  out[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+  out[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+  out[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+  out[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+  out[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+  out[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+  out[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+
+  for (int k = 0; k < 8; k++) {
+    U8 *dst = t->dst + (size_t)(by + k) * t->dst_stride + (size_t)bx * 4;
+    _mm256_storeu_si256((__m256i *)dst, out[k]);
+  }
+}
+
+/* Reverse a row of 32-bit pixels eight at a time; returns pixels done */
+__attribute__((target("avx2")))
+static size_t reverse_row_avx2(U8 *dst, const U8 *src_last, size_t width) {
+  const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  size_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(src_last - (x + 7) * 4));
+    _mm256_storeu_si256((__m256i *)(dst + x * 4), _mm256_permutevar8x32_epi32(v, reverse));
+  }
+  return x;
+}
+
+#endif /* PNGCORE_X86_SIMD */
+
+/* Walk output rows in tiles so both the reads down source columns and the
+* writes along output rows stay within cache */
+static void transpose_rows(const pngcore_orient_task_t *t) {
+  const U32 tile = PNGCORE_TRANSFORM_TILE;
+#ifdef PNGCORE_X86_SIMD
+  int simd = (t->pixel_bytes == 4) && detect_avx2();
+#endif
+
+  for (U32 ty = t->y_begin; ty < t->y_end; ty += tile) {
+    U32 th = t->y_end - ty < tile ? t->y_end - ty : tile;
+    for (U32 tx = 0; tx < t->out_w; tx += tile) {
+      U32 tw = t->out_w - tx < tile ? t->out_w - tx : tile;
+      for (U32 by = ty; by < ty + th; by += 8) {
+        U32 bh = ty + th - by < 8 ? ty + th - by : 8;
+        for (U32 bx = tx; bx < tx + tw; bx += 8) {
+          U32 bw = tx + tw - bx < 8 ? tx + tw - bx : 8;
+#ifdef PNGCORE_X86_SIMD
+          if (simd && bw == 8 && bh == 8) {
+            transpose_block_avx2(t, bx, by);
+            continue;
+          }
+#endif
+          transpose_block_scalar(t, bx, by, bw, bh);
+        }
+      }
+    }
+  }
+}
+
+/* Flips copy whole rows, reversing pixel order for mirrored columns */
+static void flip_rows(const pngcore_orient_task_t *t) {
+  size_t pb = t->pixel_bytes;
+  for (U32 y = t->y_begin; y < t->y_end; y++) {
+    const U8 *src = t->base + (ptrdiff_t)y * t->row_step;
+    U8 *dst = t->dst + (size_t)y * t->dst_stride;
+    if (t->col_step > 0) {
+      memcpy(dst, src, (size_t)t->out_w * pb);
+      continue;
+    }
+    size_t x = 0;
+#ifdef PNGCORE_X86_SIMD
+    if (pb == 4 && detect_avx2()) {
+      x = reverse_row_avx2(dst, src, t->out_w);
+    }
+#endif
+    for (; x < t->out_w; x++) {
+      put_pixel(dst + x * pb, src - (ptrdiff_t)(x * pb), pb);
+    }
+  }
+}
+
+static void orient_task(void *arg) {
+  pngcore_orient_task_t *t = (pngcore_orient_task_t *)arg;
+  if (t->transpose) {
+    transpose_rows(t);
+  } else {
+    flip_rows(t);
+  }
+}
+
+/******************************************************************************
+* ORIENTATION
+*****************************************************************************/
+
+static int orient_transposes(pngcore_orientation_t op) {
+  return op == PNGCORE_ORIENT_ROTATE_90 || op == PNGCORE_ORIENT_ROTATE_270 ||
+         op == PNGCORE_ORIENT_TRANSPOSE || op == PNGCORE_ORIENT_TRANSVERSE;
+}
+
+int pngcore_reorient_pixels(const uint8_t *src, size_t src_stride,
+                            uint8_t *dst, size_t dst_stride,
+                            uint32_t width, uint32_t height, size_t pixel_bytes,
+                            pngcore_orientation_t op) {
+  if (!src || !dst || width == 0 || height == 0 || pixel_bytes == 0 ||
+      op < PNGCORE_ORIENT_ROTATE_90 || op > PNGCORE_ORIENT_TRANSVERSE) {
+    return -1;
+  }
+
+  /* Mirror the source axes each orientation reverses */
+  int flip_rows_axis = (op == PNGCORE_ORIENT_ROTATE_90 || op == PNGCORE_ORIENT_ROTATE_180 ||
+                        op == PNGCORE_ORIENT_FLIP_V || op == PNGCORE_ORIENT_TRANSVERSE);
+  int flip_cols_axis = (op == PNGCORE_ORIENT_ROTATE_270 || op == PNGCORE_ORIENT_ROTATE_180 ||
+                        op == PNGCORE_ORIENT_FLIP_H || op == PNGCORE_ORIENT_TRANSVERSE);
+
+  pngcore_orient_task_t view;
+  memset(&view, 0, sizeof(view));
+  view.base = src;
+  view.row_step = (ptrdiff_t)src_stride;
+  view.col_step = (ptrdiff_t)pixel_bytes;
+  if (flip_rows_axis) {
+    view.base += (size_t)(height - 1) * src_stride;
+    view.row_step = -view.row_step;
+  }
+  if (flip_cols_axis) {
+    view.base += (size_t)(width - 1) * pixel_bytes;
+    view.col_step = -view.col_step;
+  }
+  view.transpose = orient_transposes(op);
+  view.dst = dst;
+  view.dst_stride = dst_stride;
+  view.out_w = view.transpose ? height : width;
+  view.pixel_bytes = pixel_bytes;
+  U32 out_h = view.transpose ? width : height;
+
+  pngcore_pool_t *pool = NULL;
+  if ((U64)width * height >= PNGCORE_TRANSFORM_MIN_PARALLEL) {
+    pool = pngcore_pool_create(0);
+  }
+  if (!pool) {
+    view.y_begin = 0;
+    view.y_end = out_h;
+    orient_task(&view);
+    return 0;
+  }
+
+  /* Bands of whole tiles, a few per thread to even out the load */
+  int tasks = pool->num_threads * 4;
+  U32 tile = PNGCORE_TRANSFORM_TILE;
+  U32 band = ((out_h + tasks - 1) / tasks + tile - 1) / tile * tile;
+  pngcore_orient_task_t *jobs = pngcore_malloc(tasks * sizeof(*jobs));
+  if (!jobs) {
+    pngcore_pool_destroy(pool);
+    view.y_begin = 0;
+    view.y_end = out_h;
+    orient_task(&view);
+    return 0;
+  }
+
+  for (int i = 0; i < tasks; i++) {
+    jobs[i] = view;
+    jobs[i].y_begin = (U64)i * band < out_h ? i * band : out_h;
+    jobs[i].y_end = (U64)(i + 1) * band < out_h ? (i + 1) * band : out_h;
+    if (jobs[i].y_begin == jobs[i].y_end) continue;
+    if (pngcore_pool_submit(pool, orient_task, &jobs[i]) != 0) {
+      orient_task(&jobs[i]);
+    }
+  }
+  pngcore_pool_wait(pool);
+  pngcore_pool_destroy(pool);
+  free(jobs);
+  return 0;
+}
+
+int pngcore_reorient(const pngcore_png_t *png, pngcore_orientation_t op,
+                     const char *filename, pngcore_error_t *error) {
+  if (!png || !png->internal || !png->internal->ihdr || !filename ||
+      op < PNGCORE_ORIENT_ROTATE_90 || op > PNGCORE_ORIENT_TRANSVERSE) {
+    pngcore_error_set(error, PNGCORE_ERR, "Invalid PNG, orientation or filename");
+    return -1;
+  }
+
+  pngcore_ihdr_data_t *ihdr = png->internal->ihdr->p_data;
+  U32 w = ihdr->width;
+  U32 h = ihdr->height;
+  U32 out_w = orient_transposes(op) ? h : w;
+  U32 out_h = orient_transposes(op) ? w : h;
+
+  /* Sub-byte samples are expanded to one byte per pixel and packed again */
+  size_t pixel_bits = pngcore_pixel_bits(ihdr->bit_depth, ihdr->color_type);
+  int packed = pixel_bits < 8;
+  size_t pb = packed ? 1 : pixel_bits / 8;
+
+  pngcore_row_reader_t *reader = pngcore_row_reader_create(png, error);
+  if (!reader) return -1;
+  pngcore_row_writer_t *writer = pngcore_row_writer_create(filename, out_w, out_h,
+                                                           ihdr->bit_depth,
+                                                           ihdr->color_type, error);
+  if (!writer || pngcore_row_writer_copy_palette(writer, png, error) != 0) {
+    pngcore_row_writer_destroy(writer);
+    pngcore_row_reader_destroy(reader);
+    return -1;
+  }
+
+  int rc = -1;
+  U8 *src = pngcore_malloc((size_t)w * h * pb);
+  U8 *dst = pngcore_malloc((size_t)out_w * out_h * pb);
+  U8 *out_row = packed ? pngcore_malloc(writer->row_bytes) : NULL;
+  if (!src || !dst || (packed && !out_row)) {
+    pngcore_error_set(error, PNGCORE_ERR_MEMORY, "Failed to allocate image buffers");
+    goto cleanup;
+  }
+
+  for (U32 y = 0; y < h; y++) {
+    const uint8_t *row = NULL;
+    if (pngcore_row_reader_next(reader, &row) != 1) {
+      pngcore_error_set(error, PNGCORE_ERR, "Failed to decode row %u", y);
+      goto cleanup;
+    }
+    if (packed) {
+      pngcore_unpack_gray(row, src + (size_t)y * w, w, ihdr->bit_depth);
+    } else {
+      memcpy(src + (size_t)y * w * pb, row, (size_t)w * pb);
+    }
+  }
+
+  pngcore_reorient_pixels(src, (size_t)w * pb, dst, (size_t)out_w * pb, w, h, pb, op);
+
+  for (U32 y = 0; y < out_h; y++) {
+    const U8 *row = dst + (size_t)y * out_w * pb;
+    if (packed) {
+      pngcore_pack_gray(row, out_row, out_w, ihdr->bit_depth);
+      row = out_row;
+    }
+    if (pngcore_row_writer_write(writer, row) != 0) {
+      pngcore_error_set(error, PNGCORE_ERR_IO, "Failed to encode row %u", y);
+      goto cleanup;
+    }
+  }
+
+  rc = pngcore_row_writer_finish(writer, error);
+
+cleanup:
+  free(src);
+  free(dst);
+  free(out_row);
+  pngcore_row_writer_destroy(writer);
+  pngcore_row_reader_destroy(reader);
+  return rc;
+}
@@ -5,6 +5,8 @@
 */
 
 #include "pngcore/pngcore_zutil.h"
+#include "pngcore/pngcore_stats.h"
+#include "pngcore/pngcore_probes.h"
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -19,6 +21,7 @@ int pngcore_mem_deflate(U8 *dest, U64 *dest_len, U8 *source, U64 source_len, int
   int have = 0;               /* amount of data returned from deflate() */
   int def_len = 0;            /* accumulated deflated data length */
   U8 *p_dest = dest;          /* current position in dest buffer */
+  U64 start = pngcore_stats_now();
   
   /* Initialize deflate */
   strm.zalloc = Z_NULL;
@@ -52,6 +55,8 @@ int pngcore_mem_deflate(U8 *dest, U64 *dest_len, U8 *source, U64 source_len, int
   /* Clean up and return */
   (void) deflateEnd(&strm);
   *dest_len = def_len;
+  pngcore_stats_add(PNGCORE_STAT_BYTES_DEFLATED, source_len);
+  pngcore_stats_since(PNGCORE_STAT_DEFLATE_NS, start);
   return Z_OK;
 }
 
@@ -65,6 +70,7 @@ int pngcore_mem_inflate(U8 *dest, U64 *dest_len, U8 *source, U64 source_len) {
   int have = 0;               /* amount of data returned from inflate() */
   int inf_len = 0;            /* accumulated inflated data length */
   U8 *p_dest = dest;          /* current position in dest buffer */
+  U64 start = pngcore_stats_now();
   
   /* Initialize inflate */
   strm.zalloc = Z_NULL;
@@ -80,6 +86,7 @@ int pngcore_mem_inflate(U8 *dest, U64 *dest_len, U8 *source, U64 source_len) {
   /* Set input data stream */
   strm.avail_in = source_len;
   strm.next_in = source;
+  PNGCORE_PROBE1(inflate_start, source_len);
   
   /* Run inflate() on input until output buffer not full */
   do {
@@ -95,6 +102,7 @@ int pngcore_mem_inflate(U8 *dest, U64 *dest_len, U8 *source, U64 source_len) {
       case Z_DATA_ERROR:
       case Z_MEM_ERROR:
       (void) inflateEnd(&strm);
+      PNGCORE_PROBE3(inflate_done, source_len, inf_len, ret);
       return ret;
     }
     have = PNGCORE_ZLIB_CHUNK - strm.avail_out;
@@ -106,8 +114,12 @@ int pngcore_mem_inflate(U8 *dest, U64 *dest_len, U8 *source, U64 source_len) {
   /* Clean up and return */
   (void) inflateEnd(&strm);
   *dest_len = inf_len;
+  pngcore_stats_add(PNGCORE_STAT_BYTES_INFLATED, inf_len);
+  pngcore_stats_since(PNGCORE_STAT_INFLATE_NS, start);
   
-  return (ret == Z_STREAM_END) ? Z_OK : Z_DATA_ERROR;
+  ret = (ret == Z_STREAM_END) ? Z_OK : Z_DATA_ERROR;
+  PNGCORE_PROBE3(inflate_done, source_len, inf_len, ret);
+  return ret;
 }
 
 /* Report a zlib or i/o error */